@@ -18,29 +18,176 @@
 #ifndef __COMPUTER_H__
 #define __COMPUTER_H__
 
+#include <stdio.h>
+
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
+#include "freertos/semphr.h"
 
 #include "esp_err.h"
+#include "ring.h"
 #include "display.h"
 #include "memory.h"
 #include "cpu.h"
 #include "keyboard.h"
+#ifdef CONFIG_ORION_SOUND
+#include "sound.h"
+#endif
+#ifdef CONFIG_ORION_TAPE
+#include "tape.h"
+#endif
+#ifdef CONFIG_ORION_IDLE_DETECT
+#include "idle.h"
+#endif
+#ifdef CONFIG_ORION_VIDEO_RECORDER
+#include "recorder.h"
+#endif
+#ifdef CONFIG_ORION_PERF_COUNTERS
+#include "perf.h"
+#endif
+#ifdef CONFIG_ORION_DEBUGGER
+#include "debugger.h"
+#endif
+
+#define COMPUTER_RUN_BATCH 256
+// 50 Hz of the 2.5 MHz clock, RST 7 as the floating data bus gives it
+#define COMPUTER_FRAME_CYCLES 50000
+#define COMPUTER_FRAME_US 20000
+#define COMPUTER_FRAME_RST 7
+// frames of the emulated time the speed is averaged over
+#define COMPUTER_STATS_FRAMES 50
+
+typedef enum {
+    COMPUTER_STOPPED = 0,
+    COMPUTER_RUNNING,
+    COMPUTER_PAUSE_REQUEST,
+    COMPUTER_PAUSED
+} computer_state_t;
+
+// Read by other tasks, the numbers are only as consistent as statistics
+// need to be.
+typedef struct computer_stats {
+    uint64_t cycles;
+    // emulated clock in kHz over the last COMPUTER_STATS_FRAMES frames,
+    // the skipped idle time included
+    uint32_t speed;
+    // host time of a 20 ms frame of the emulated time, on average and at
+    // most over the same frames
+    uint32_t frame_us;
+    uint32_t max_frame_us;
+    // items waiting in the queues of the other tasks and the queue sizes
+    uint32_t video_queue;
+    uint32_t video_queue_size;
+    uint32_t key_queue;
+    uint32_t key_queue_size;
+    uint32_t sound_queue;
+    uint32_t sound_queue_size;
+} computer_stats_t;
+
+#ifdef CONFIG_ORION_PERF_COUNTERS
+// Counters of the emulation and the video tasks, the memory keeps its own.
+// Each one is written by one task only, see perf.h.
+typedef struct computer_perf {
+    // emulation task
+    perf_counter_t steps;
+    perf_counter_t cycles;
+    perf_range_t frame_us;
+    // queue depths once per frame of the emulated time and the overflows
+    perf_range_t video_queue;
+    perf_counter_t video_dropped;
+#ifdef CONFIG_ORION_SOUND
+    perf_range_t sound_queue;
+    perf_counter_t sound_dropped;
+#endif
+    // video task: addresses written by the CPU, LCD windows and their
+    // pixels and bytes, the time to fill a window and to send it
+    perf_counter_t video_dirty;
+    perf_counter_t video_windows;
+    perf_counter_t video_pixels;
+    perf_counter_t video_bytes;
+    perf_range_t video_convert_us;
+    perf_range_t video_transfer_us;
+} computer_perf_t;
+#endif
 
 typedef struct computer {
     cpu_t *cpu;
     memory_t *mem;
     display_t *display;
     keyboard_t *kbd;
+#ifdef CONFIG_ORION_SOUND
+    sound_t *snd;
+#endif
+#ifdef CONFIG_ORION_TAPE
+    tape_t *tape;
+#endif
+#ifdef CONFIG_ORION_IDLE_DETECT
+    idle_t *idle;
+#endif
     TaskHandle_t video_task;
-    QueueHandle_t video_queue;
+    ring_t *video_ring;
+    struct video_scale *video_scale;
+#ifdef CONFIG_ORION_VIDEO_SHADOW
+    // page 0 and page 1 bytes of the picture on the LCD, column by column
+    uint8_t *video_shadow;
+    // palette of the picture on the LCD, VIDEO_SHADOW_INVALID when unknown
+    uint8_t video_shadow_palette;
+#endif
+#ifdef CONFIG_ORION_VIDEO_RECORDER
+    recorder_t *recorder;
+#endif
+    TaskHandle_t task;
+    volatile computer_state_t state;
+    // the app and the server pause the machine independently, it runs
+    // when nobody holds a pause
+    SemaphoreHandle_t pause_mutex;
+    uint32_t pauses;
+#ifdef CONFIG_ORION_FRAME_INTERRUPT
+    // cycle counter value of the next frame interrupt
+    uint64_t frame_cycles;
+    // esp_timer time the next frame interrupt is due at
+    int64_t frame_time;
+#endif
+#ifdef CPU_CYCLES_ENABLE
+    // cycle counter value of the next frame of the statistics
+    uint64_t stats_cycles;
+    uint64_t stats_start_cycles;
+    int64_t stats_start_time;
+    int64_t stats_frame_time;
+    uint32_t stats_frames;
+    uint32_t stats_max_frame_us;
+    computer_stats_t stats;
+#endif
+#ifdef CONFIG_ORION_PERF_COUNTERS
+    perf_t *perf;
+    computer_perf_t counters;
+#endif
+#ifdef CONFIG_ORION_DEBUGGER
+    debugger_t *debugger;
+#endif
 } computer_t;
 
 esp_err_t computer_create(computer_t **cmp);
 esp_err_t computer_init(computer_t *cmp);
 esp_err_t computer_step(computer_t *cmp);
+esp_err_t computer_reset(computer_t *cmp);
 esp_err_t computer_done(computer_t *cmp);
 
+esp_err_t computer_start(computer_t *cmp);
+// Nested, the machine runs again after the last resume. Works before the
+// start and after the stop too, the machine isn't running then.
+esp_err_t computer_pause(computer_t *cmp);
+esp_err_t computer_resume(computer_t *cmp);
+// Called between the steps by the thread running the machine without
+// computer_start: parks it while the machine is paused.
+esp_err_t computer_yield(computer_t *cmp);
+// The thread running the machine without computer_start leaves it.
+esp_err_t computer_stop(computer_t *cmp);
+
+esp_err_t computer_get_stats(computer_t *cmp, computer_stats_t *stats);
+
+esp_err_t computer_save(computer_t *cmp, FILE *f);
+esp_err_t computer_load(computer_t *cmp, FILE *f);
+
 
 #endif // __COMPUTER_H__
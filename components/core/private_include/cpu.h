@@ -30,6 +30,38 @@
 #define CPU_CYCLES_ENABLE
 #endif
 
+#ifdef CONFIG_CPU_Z80_ENABLE
+#define CPU_Z80_ENABLE
+#endif
+
+#define CPU_FILE_B 1
+#define CPU_FILE_C 0
+#define CPU_FILE_D 3
+#define CPU_FILE_E 2
+#define CPU_FILE_H 5
+#define CPU_FILE_L 4
+#define CPU_FLAGS  6
+#define CPU_FILE_A 7
+#define CPU_REG_FILE_SIZE 8
+
+#define CPU_IRQ_PENDING 0x80
+
+#define CPU_FILE_BC 0
+#define CPU_FILE_DE 2
+#define CPU_FILE_HL 4
+#define CPU_FILE_PSW 6
+
+#define CPU_HL_VAL(cpu)  (*((uint16_t *)&cpu->reg_file[CPU_FILE_L]))
+#define CPU_PSW_VAL(cpu) (*((uint16_t *)&cpu->reg_file[CPU_FILE_A]))
+#define CPU_A_VAL(cpu)   (cpu->reg_file[CPU_FILE_A])
+#define CPU_BC_VAL(cpu)  (*((uint16_t *)&cpu->reg_file[CPU_FILE_BC]))
+#define CPU_DE_VAL(cpu)  (*((uint16_t *)&cpu->reg_file[CPU_FILE_DE]))
+
+typedef enum cpu_type {
+    CPU_TYPE_8080 = 0,
+    CPU_TYPE_Z80
+} cpu_type_t;
+
 typedef const uint8_t * (*cpu_rd_pointer_cb_t)(uint16_t addr, void *arg);
 typedef uint8_t * (*cpu_wr_pointer_cb_t)(uint16_t addr, void *arg);
 
@@ -38,8 +70,16 @@ typedef struct cpu {
     uint16_t sp;
     uint8_t is_word;
     uint8_t cmd;
+    // INTE flip-flop of the 8080, IFF1 of the Z80
+    uint8_t inte;
+    // HLT was executed, the CPU waits for an interrupt
+    uint8_t halted;
+    // CPU_IRQ_PENDING | RST number, cleared when the interrupt is taken
+    volatile uint8_t irq;
 #ifdef CPU_CYCLES_ENABLE
-    uint32_t cycles;
+    // total number of cycles since reset
+    uint64_t cycles;
+    uint64_t speed_cycles;
     uint32_t us_timer;
     uint32_t speed;
     uint32_t steps;
@@ -48,6 +88,23 @@ typedef struct cpu {
     uint16_t save_pc;
     uint8_t invalid_op;
 #endif
+#ifdef CPU_Z80_ENABLE
+    // selected before cpu_init, the Z80 core keeps the 8080 registers
+    // in reg_file and adds its own ones
+    cpu_type_t type;
+    uint8_t prefix;
+    uint8_t i;
+    uint8_t r;
+    uint8_t iff2;
+    uint8_t im;
+    uint16_t ix;
+    uint16_t iy;
+    // internal MEMPTR register, leaks into the undocumented flags
+    uint16_t wz;
+    // HL, IX or IY depending on the prefix of the current instruction
+    uint16_t *hl;
+    uint8_t alt_file[CPU_REG_FILE_SIZE];
+#endif
 
     // CPU_REG_FILE_SIZE = 8
     uint8_t *reg_file;
@@ -69,5 +126,6 @@ esp_err_t cpu_init(cpu_t *cpu);
 esp_err_t cpu_done(cpu_t *cpu);
 esp_err_t cpu_reset(cpu_t *cpu);
 esp_err_t cpu_step(cpu_t *cpu);
+esp_err_t cpu_interrupt(cpu_t *cpu, uint8_t rst);
 
 #endif // __CPU_H__
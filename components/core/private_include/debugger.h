@@ -0,0 +1,169 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#ifndef __DEBUGGER_H__
+#define __DEBUGGER_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "cpu.h"
+
+#ifdef CONFIG_ORION_DEBUGGER
+
+#define DEBUGGER_BREAKPOINTS_MAX 8
+#define DEBUGGER_WATCHPOINTS_MAX 8
+// memory accesses of one instruction remembered for the watchpoints
+#define DEBUGGER_ACCESSES_MAX 8
+#define DEBUGGER_LINE_SIZE 80
+#define DEBUGGER_DUMP_SIZE 0x80
+
+// bits of debugger_t pages, a flagged page takes the slow path
+#define DEBUGGER_PAGE_EXEC  0x01
+#define DEBUGGER_PAGE_READ  0x02
+#define DEBUGGER_PAGE_WRITE 0x04
+
+typedef enum {
+    DEBUGGER_RUNNING = 0,
+    // F5 or the machine was paused for the console
+    DEBUGGER_STOP_BREAK,
+    DEBUGGER_STOP_BREAKPOINT,
+    DEBUGGER_STOP_WATCHPOINT,
+    DEBUGGER_STOP_STEP
+} debugger_stop_t;
+
+typedef enum {
+    DEBUGGER_COND_NONE = 0,
+    DEBUGGER_COND_EQ,
+    DEBUGGER_COND_NE,
+    DEBUGGER_COND_LT,
+    DEBUGGER_COND_GT
+} debugger_cond_op_t;
+
+// "A==3e", "HL!=c000", "[f400]<80": a register or a memory byte against
+// a hex number
+typedef struct debugger_cond {
+    debugger_cond_op_t op;
+    // index of debugger_regs, DEBUGGER_COND_MEMORY for a memory byte
+    uint8_t reg;
+    uint16_t addr;
+    uint16_t value;
+} debugger_cond_t;
+
+#define DEBUGGER_COND_MEMORY 0xff
+
+typedef struct debugger_breakpoint {
+    uint16_t addr;
+    debugger_cond_t cond;
+    uint32_t hits;
+} debugger_breakpoint_t;
+
+typedef struct debugger_watchpoint {
+    uint16_t start;
+    uint16_t end;
+    // DEBUGGER_PAGE_READ and/or DEBUGGER_PAGE_WRITE
+    uint8_t type;
+    debugger_cond_t cond;
+    uint32_t hits;
+} debugger_watchpoint_t;
+
+typedef struct debugger_access {
+    uint16_t addr;
+    uint8_t type;
+} debugger_access_t;
+
+struct computer;
+
+// Breakpoints on the PC and watchpoints on memory ranges, both with an
+// optional condition. The memory callbacks of the CPU are replaced only
+// while there are watchpoints, then only the flagged 256 byte pages go
+// through the slow path. Without breakpoints and watchpoints the machine
+// runs computer_step() as it is, is_active is checked per batch.
+typedef struct debugger {
+    cpu_t *cpu;
+    // the memory callbacks the watchpoints wrap
+    cpu_rd_pointer_cb_t reader;
+    cpu_wr_pointer_cb_t writer;
+    void *memory;
+    debugger_breakpoint_t breakpoints[DEBUGGER_BREAKPOINTS_MAX];
+    debugger_watchpoint_t watchpoints[DEBUGGER_WATCHPOINTS_MAX];
+    size_t breakpoints_count;
+    size_t watchpoints_count;
+    uint8_t pages[256];
+    debugger_access_t accesses[DEBUGGER_ACCESSES_MAX];
+    size_t accesses_count;
+    // the breakpoint at this address is passed once, the machine goes on
+    // from the place it stopped at
+    int32_t pass_addr;
+    // where "m" without an address goes on
+    uint16_t dump_addr;
+    volatile bool is_active;
+#ifdef CONFIG_ORION_GDB_STUB
+    // "gdb" was typed, the console goes on with the GDB stub
+    bool is_remote;
+#endif
+    volatile debugger_stop_t stop;
+    // the breakpoint or watchpoint index and the address of the stop
+    size_t stop_index;
+    uint16_t stop_addr;
+} debugger_t;
+
+esp_err_t debugger_create(debugger_t **pdbg);
+// Takes the memory callbacks of the initialized CPU
+esp_err_t debugger_init(debugger_t *dbg, cpu_t *cpu);
+esp_err_t debugger_done(debugger_t *dbg);
+
+// computer_step() with the checks, does nothing while stopped
+esp_err_t debugger_step(debugger_t *dbg, struct computer *cmp);
+// Stops at the next debugger_step(), or right away with the machine paused
+esp_err_t debugger_break(debugger_t *dbg);
+esp_err_t debugger_continue(debugger_t *dbg);
+// Runs count instructions with the machine paused, stops with
+// DEBUGGER_STOP_STEP unless a breakpoint or a watchpoint comes first
+esp_err_t debugger_single_step(debugger_t *dbg, struct computer *cmp, uint32_t count);
+
+// cond may be NULL, ESP_ERR_NO_MEM when all the slots are taken and
+// ESP_ERR_NOT_FOUND when there is nothing to remove
+esp_err_t debugger_add_breakpoint(debugger_t *dbg, uint16_t addr, const debugger_cond_t *cond);
+esp_err_t debugger_remove_breakpoint(debugger_t *dbg, uint16_t addr);
+esp_err_t debugger_add_watchpoint(debugger_t *dbg, uint16_t start, uint16_t end, uint8_t type, const debugger_cond_t *cond);
+esp_err_t debugger_remove_watchpoint(debugger_t *dbg, uint16_t start, uint16_t end, uint8_t type);
+
+// memory access past the watchpoints
+static inline uint8_t debugger_peek(debugger_t *dbg, uint16_t addr)
+{
+    return *dbg->reader(addr, dbg->memory);
+}
+
+static inline void debugger_poke(debugger_t *dbg, uint16_t addr, uint8_t value)
+{
+    *dbg->writer(addr, dbg->memory) = value;
+}
+
+// The commands change the breakpoints and the memory callbacks, call them
+// with the machine paused. "h" lists them.
+esp_err_t debugger_command(debugger_t *dbg, struct computer *cmp, const char *line, FILE *out);
+esp_err_t debugger_report(debugger_t *dbg, FILE *out);
+esp_err_t debugger_print_regs(debugger_t *dbg, FILE *out);
+// Reads the commands from the key ring in raw mode until "c", or "gdb"
+// that leaves the machine stopped and sets is_remote
+esp_err_t debugger_console(debugger_t *dbg, struct computer *cmp, FILE *out);
+
+#endif
+
+#endif // __DEBUGGER_H__
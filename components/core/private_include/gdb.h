@@ -0,0 +1,94 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#ifndef __GDB_H__
+#define __GDB_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "debugger.h"
+
+#ifdef CONFIG_ORION_GDB_STUB
+
+// 0x200 bytes, reported to GDB with qSupported, a memory read takes
+// up to 0xff bytes per packet
+#define GDB_PACKET_SIZE 0x200
+
+// results of gdb_read_cb_t besides the byte
+#define GDB_READ_NONE (-1)
+#define GDB_READ_CLOSED (-2)
+
+// The transport: the serial console on the device, a socket on the host.
+// The read callback doesn't block.
+typedef int (*gdb_read_cb_t)(void *arg);
+typedef esp_err_t (*gdb_write_cb_t)(void *arg, const void *data, size_t size);
+
+typedef enum {
+    GDB_WAIT = 0,
+    GDB_PACKET,
+    GDB_CHECKSUM_HIGH,
+    GDB_CHECKSUM_LOW
+} gdb_state_t;
+
+struct computer;
+
+// GDB remote serial protocol stub on top of the debugger. The registers
+// are the ones of the GDB z80 target: AF, BC, DE, HL, SP, PC, IX, IY,
+// AF', BC', DE', HL' and IR, the 8080 has zeros in the Z80 ones. The
+// machine runs without the stub until a break, the owner polls the
+// transport between the batches with gdb_poll() and gives the stopped
+// machine to gdb_serve().
+typedef struct gdb {
+    struct computer *cmp;
+    debugger_t *dbg;
+    gdb_read_cb_t read;
+    gdb_write_cb_t write;
+    void *arg;
+    gdb_state_t state;
+    char packet[GDB_PACKET_SIZE];
+    char reply[GDB_PACKET_SIZE];
+    size_t length;
+    uint8_t sum;
+    uint8_t checksum;
+    bool is_overflow;
+    // a whole packet came while running, gdb_serve() takes it
+    bool is_pending;
+    bool is_no_ack;
+    // GDB waits for the stop reply of "c", "s" or Ctrl-C
+    bool is_waiting;
+    bool is_interrupted;
+    bool is_attached;
+} gdb_t;
+
+esp_err_t gdb_create(gdb_t **pgdb);
+// Attaches to the transport, the machine should be stopped with
+// debugger_break() to let GDB in
+esp_err_t gdb_init(gdb_t *gdb, struct computer *cmp, gdb_read_cb_t read, gdb_write_cb_t write, void *arg);
+// Doesn't block: Ctrl-C or a packet from GDB stop the machine at the next
+// debugger_step()
+esp_err_t gdb_poll(gdb_t *gdb);
+// Serves GDB with the machine stopped and paused until "c", a detach or
+// the end of the connection that clear is_attached, then lets the machine
+// go on with debugger_continue(). A detach removes all the breakpoints.
+esp_err_t gdb_serve(gdb_t *gdb);
+esp_err_t gdb_done(gdb_t *gdb);
+
+#endif
+
+#endif // __GDB_H__
@@ -0,0 +1,68 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#ifndef __IDLE_H__
+#define __IDLE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "cpu.h"
+#include "memory.h"
+#include "keyboard.h"
+
+#ifdef CONFIG_ORION_IDLE_DETECT
+
+// CPU states seen at the keyboard port B reads, a scan of the 8 matrix
+// columns and the modifiers fits
+#define IDLE_HISTORY_SIZE 16
+// repeated states before the loop counts as idle, a few full scans
+#define IDLE_MATCHES 48
+// emulated time skipped on every detection, one frame
+#define IDLE_SKIP_CYCLES 50000
+// the longest sleep of the emulation task waiting for a key
+#define IDLE_WAIT_MS 20
+
+typedef struct idle_state {
+    uint16_t pc;
+    uint16_t sp;
+    uint8_t reg_file[CPU_REG_FILE_SIZE];
+} idle_state_t;
+
+// A program waiting for a key reads port B over and over and the CPU comes
+// to every read in the same state, with no video, port or sound writes in
+// between. Such a loop is skipped forward, the emulation task may sleep.
+typedef struct idle {
+    idle_state_t history[IDLE_HISTORY_SIZE];
+    uint32_t history_pos;
+    uint32_t matches;
+    bool is_idle;
+    // statistics
+    uint32_t detections;
+    uint64_t skipped_cycles;
+} idle_t;
+
+esp_err_t idle_create(idle_t **pidle);
+esp_err_t idle_init(idle_t *idle);
+esp_err_t idle_done(idle_t *idle);
+esp_err_t idle_step(idle_t *idle, cpu_t *cpu, memory_t *mem, keyboard_t *kbd);
+// sleep while the CPU is idle and no key is waiting in the key ring
+esp_err_t idle_wait(idle_t *idle, keyboard_t *kbd);
+
+#endif
+
+#endif // __IDLE_H__
@@ -17,27 +17,154 @@
  */#ifndef __KEYBOARD_H__
 #define __KEYBOARD_H__
 
+#include <stdio.h>
+
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
 
+#include "ring.h"
 #include "memory.h"
 
 #define KEYBOARD_FIELDS_NUM 8
 
+#define KEYBOARD_COMMAND_NONE 0
+#define KEYBOARD_COMMAND_SAVE 1
+#define KEYBOARD_COMMAND_LOAD 2
+#define KEYBOARD_COMMAND_TAPE_PLAY 3
+#define KEYBOARD_COMMAND_TAPE_RECORD 4
+#define KEYBOARD_COMMAND_MENU 5
+#define KEYBOARD_COMMAND_VIDEO_RECORD 6
+#define KEYBOARD_COMMAND_INPUT_RECORD 7
+#define KEYBOARD_COMMAND_INPUT_REPLAY 8
+#define KEYBOARD_COMMAND_PERF 9
+#define KEYBOARD_COMMAND_DEBUG 10
+
+// Text file of the recorded keys, a line per key: the cycle counter since
+// the start of the record and the matrix code in hex, '#' starts a comment.
+#define KEYBOARD_INPUT_HEADER "# orion128 keys: cycles key\n"
+#define KEYBOARD_INPUT_END UINT64_MAX
+
+// Matrix codes of the keys in the key ring: row in bits 3-5, column in
+// bits 0-2, bit 6 marks the modifier keys of port C.
+#define KBD_KEY_HOME      0x00
+#define KBD_KEY_CLEAR     0x01
+#define KBD_KEY_ESC       0x02
+#define KBD_KEY_F1        0x03
+#define KBD_KEY_F2        0x04
+#define KBD_KEY_F3        0x05
+#define KBD_KEY_F4        0x06
+#define KBD_KEY_F5        0x07
+#define KBD_KEY_TAB       0x08
+#define KBD_KEY_LINEFEED  0x09
+#define KBD_KEY_ENTER     0x0a
+#define KBD_KEY_BACKSPACE 0x0b
+#define KBD_KEY_LEFT      0x0c
+#define KBD_KEY_UP        0x0d
+#define KBD_KEY_RIGHT     0x0e
+#define KBD_KEY_DOWN      0x0f
+#define KBD_KEY_0         0x10
+#define KBD_KEY_1         0x11
+#define KBD_KEY_2         0x12
+#define KBD_KEY_3         0x13
+#define KBD_KEY_4         0x14
+#define KBD_KEY_5         0x15
+#define KBD_KEY_6         0x16
+#define KBD_KEY_7         0x17
+#define KBD_KEY_8         0x18
+#define KBD_KEY_9         0x19
+#define KBD_KEY_COLON     0x1a
+#define KBD_KEY_SEMICOLON 0x1b
+#define KBD_KEY_COMMA     0x1c
+#define KBD_KEY_MINUS     0x1d
+#define KBD_KEY_POINT     0x1e
+#define KBD_KEY_SLASH     0x1f
+#define KBD_KEY_AT        0x20
+#define KBD_KEY_A         0x21
+#define KBD_KEY_B         0x22
+#define KBD_KEY_C         0x23
+#define KBD_KEY_D         0x24
+#define KBD_KEY_E         0x25
+#define KBD_KEY_F         0x26
+#define KBD_KEY_G         0x27
+#define KBD_KEY_H         0x28
+#define KBD_KEY_I         0x29
+#define KBD_KEY_J         0x2a
+#define KBD_KEY_K         0x2b
+#define KBD_KEY_L         0x2c
+#define KBD_KEY_M         0x2d
+#define KBD_KEY_N         0x2e
+#define KBD_KEY_O         0x2f
+#define KBD_KEY_P         0x30
+#define KBD_KEY_Q         0x31
+#define KBD_KEY_R         0x32
+#define KBD_KEY_S         0x33
+#define KBD_KEY_T         0x34
+#define KBD_KEY_U         0x35
+#define KBD_KEY_V         0x36
+#define KBD_KEY_W         0x37
+#define KBD_KEY_X         0x38
+#define KBD_KEY_Y         0x39
+#define KBD_KEY_Z         0x3a
+#define KBD_KEY_SQ_LEFT   0x3b
+#define KBD_KEY_BACKSLASH 0x3c
+#define KBD_KEY_SQ_RIGHT  0x3d
+#define KBD_KEY_AND       0x3e
+#define KBD_KEY_SPACE     0x3f
+#define KBD_KEY_US        0x42
+#define KBD_KEY_SS        0x44
+#define KBD_KEY_RUS       0x48
+
 typedef struct keyboard {
     uint8_t fields[KEYBOARD_FIELDS_NUM];
     uint8_t flags;
     uint32_t count;
     uint8_t tracing;
-    QueueHandle_t queue;
+    uint8_t command;
+    // bytes of the escape sequence so far, the first one highest, up to
+    // KBD_ESC_MAX_LENGTH of them
+    uint64_t esc_key;
+    uint8_t esc_length;
+    bool esc_ss3;
+    ring_t *ring;
     TaskHandle_t task;
+    // the console bytes go to the ring as they are, see keyboard_set_raw()
+    volatile bool is_raw;
+#ifdef CONFIG_ORION_INPUT_REPLAY
+    // the keys the machine takes are written to record, the keys of replay
+    // are taken instead of the key ring, both timed by the cycle counter
+    FILE *record;
+    FILE *replay;
+    uint64_t input_start;
+    // the next key of replay, KEYBOARD_INPUT_END after the last one
+    uint64_t replay_cycles;
+    uint8_t replay_key;
+    uint32_t input_keys;
+#endif
 } keyboard_t;
 
 
 esp_err_t keyboard_create(keyboard_t **pkbd);
 esp_err_t keyboard_init(keyboard_t *kbd);
-esp_err_t keyboard_step(keyboard_t *kbd, memory_t *mem);
+// The cycle counter times the recorded and replayed keys only.
+esp_err_t keyboard_step(keyboard_t *kbd, memory_t *mem, uint64_t cycles);
+// Releases all keys, like the machine reset.
+esp_err_t keyboard_reset(keyboard_t *kbd);
+// The key ring has a single producer: don't call it while the console
+// task is running on the same keyboard. ESP_ERR_NO_MEM means the ring is full.
+esp_err_t keyboard_put_key(keyboard_t *kbd, uint32_t key);
+// The console bytes go to the key ring untranslated, the escape sequences
+// are dropped. The ring is emptied on both switches, the machine must not
+// take keys meanwhile.
+esp_err_t keyboard_set_raw(keyboard_t *kbd, bool is_raw);
 esp_err_t keyboard_done(keyboard_t *kbd);
 
+#ifdef CONFIG_ORION_INPUT_REPLAY
+// The same machine state and the same keys at the same cycles run the same
+// instructions, the record starts at the given cycle counter. The caller
+// closes the file after keyboard_input_stop().
+esp_err_t keyboard_record(keyboard_t *kbd, FILE *f, uint64_t cycles);
+esp_err_t keyboard_replay(keyboard_t *kbd, FILE *f, uint64_t cycles);
+esp_err_t keyboard_input_stop(keyboard_t *kbd);
+#endif
+
 #endif // __KEYBOARD_H__
@@ -17,10 +17,21 @@
  */#ifndef __MEMORY_H__
 #define __MEMORY_H__
 
+#include "sdkconfig.h"
 #include "esp_err.h"
+#include "romdisk.h"
+#include "ordos.h"
+#ifdef CONFIG_ORION_PERF_COUNTERS
+#include "perf.h"
+#endif
 
 #define MEMORY_RAM_PAGE0_SIZE 0xf400
 #define MEMORY_RAM_PAGE1_SIZE 0xf000
+#define MEMORY_RAM_PAGE_SIZE  0xf000
+#define MEMORY_RAM_PAGES      CONFIG_ORION_RAM_PAGES
+#define MEMORY_RAM_PAGES_MAX  8
+// ORDOS disk B
+#define MEMORY_RAM_DISK_PAGE  1
 
 typedef union memory_port {
     uint8_t p;
@@ -48,13 +59,15 @@ typedef union memory_ports {
 
 
 typedef struct memory {
-    uint8_t *ram_page0;
-    uint8_t *ram_page1;
+    uint8_t *ram_page[MEMORY_RAM_PAGES];
+    uint8_t *ram;
     const uint8_t *rom;
-    const uint8_t *rom_disk;
+    romdisk_t *rom_disk;
+    ordos_t *ram_disk;
     bool rom_init;
     memory_ports_t port_f4r;
     memory_ports_t port_f4w;
+    uint8_t port_f4_mode;
     memory_ports_t port_f5;
     memory_ports_t port_f6;
     memory_ports_t port_f7;
@@ -63,13 +76,25 @@ typedef struct memory {
     uint16_t port_fa;
     uint16_t port_fb;
     bool set_keyboard;
+    bool set_keyboard_ctrl;
+    bool set_sound;
     bool set_video_mode;
     bool set_ram_page;
     bool set_video_buf;
+    bool set_video_refresh;
+    // the LCD was drawn over, redraw the whole screen unconditionally
+    bool set_video_invalidate;
     bool set_rom_disk;
+    // port B was read, the idle detector looks at it
+    bool get_keyboard;
     uint16_t video_addr;
     uint32_t default_read;
     uint32_t default_write;
+#ifdef CONFIG_ORION_PERF_COUNTERS
+    // accesses to the ports 0xF400-0xFBFF, the flags of memory_step
+    perf_counter_t port_reads;
+    perf_counter_t port_writes;
+#endif
 } memory_t;
 
 const uint8_t *memory_reader_cb(uint16_t addr, void *arg);
@@ -79,5 +104,8 @@ esp_err_t memory_create(memory_t **pmem);
 esp_err_t memory_init(memory_t *mem);
 esp_err_t memory_step(memory_t *mem);
 esp_err_t memory_done(memory_t *mem);
+// Prints the access time of every RAM page, CONFIG_ORION_MEMORY_BENCHMARK
+// runs it on start, orion128-bench -M on the host.
+esp_err_t memory_benchmark(memory_t *mem);
 
 #endif //__CORE_H__
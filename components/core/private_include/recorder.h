@@ -0,0 +1,112 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_err.h"
+#include "ring.h"
+#include "memory.h"
+
+#ifdef CONFIG_ORION_VIDEO_RECORDER
+
+// The record starts with a header, the frames follow.
+//
+// header:  "ORV1", columns (uint16), rows (uint16), cycles per frame (uint32)
+// frame:   frames since the previous one (uint16), port 0xF8, port 0xFA,
+//          runs, RECORDER_END (uint16)
+// run:     position (uint16), length - 1 (uint8), then the bytes or, for a
+//          fill run, one byte repeated
+//
+// The position is the row in bits 0-7, the byte column in bits 8-13, page 1
+// in bit 14 and a fill run in bit 15. All numbers are little endian. A
+// frame holds the runs of the visible buffer that differ from the previous
+// frame, the first frame and the one after a drop hold the whole screen.
+#define RECORDER_MAGIC "ORV1"
+#define RECORDER_HEADER_SIZE 12
+#define RECORDER_FRAME_HEADER_SIZE 4
+#define RECORDER_RUN_HEADER_SIZE 3
+#define RECORDER_PAGE1 0x4000
+#define RECORDER_FILL 0x8000
+#define RECORDER_END 0xffff
+#define RECORDER_COLUMNS 48
+#define RECORDER_ROWS 256
+#define RECORDER_PAGE_SIZE (RECORDER_COLUMNS * RECORDER_ROWS)
+#define RECORDER_FRAME_CYCLES 50000
+// repeated bytes worth a fill run
+#define RECORDER_MIN_FILL 4
+// equal bytes between two changed runs cheaper to store than a new run
+#define RECORDER_GAP 3
+// The largest column alternates a changed byte with RECORDER_MIN_FILL
+// equal ones: a literal run of one byte and a fill run, 8 bytes per 5 rows,
+// and a literal run at the end. The spans of a delta frame are at least
+// RECORDER_GAP rows apart, the rows between them pay for the extra headers.
+#define RECORDER_MAX_COLUMN_SIZE \
+    ((RECORDER_ROWS * 2 * (RECORDER_RUN_HEADER_SIZE + 1) + RECORDER_MIN_FILL) / (RECORDER_MIN_FILL + 1) + \
+    RECORDER_RUN_HEADER_SIZE + 1)
+#define RECORDER_MAX_FRAME_SIZE (RECORDER_FRAME_HEADER_SIZE + 2 + 2 * RECORDER_COLUMNS * RECORDER_MAX_COLUMN_SIZE)
+// encoded frames waiting for the writer task, a key frame after a drop
+// needs the room of the largest frame, a power of 2
+#define RECORDER_RING_SIZE 0x10000
+#define RECORDER_WRITE_BATCH 512
+
+#if RECORDER_RING_SIZE < RECORDER_MAX_FRAME_SIZE
+#error "RECORDER_RING_SIZE doesn't hold the largest frame"
+#endif
+
+// Records the video memory shown on the screen once per frame of the
+// emulated time. The emulation task encodes the frames, a task of its own
+// writes them to the file, any stream opened as FILE works, a socket too.
+typedef struct recorder {
+    FILE *f;
+    ring_t *ring;
+    TaskHandle_t task;
+    volatile bool is_recording;
+    // the previous frame, page 0 and page 1 bytes of the visible buffer
+    uint8_t *frame;
+    uint8_t *buffer;
+    uint8_t port_f8;
+    uint8_t port_fa;
+    bool is_key;
+    uint64_t next_cycles;
+    uint32_t skipped;
+    // bytes passed to the writer task and written by it
+    uint64_t pushed;
+    volatile uint64_t written;
+    // statistics
+    uint32_t frames;
+    uint32_t dropped;
+} recorder_t;
+
+esp_err_t recorder_create(recorder_t **prec);
+esp_err_t recorder_done(recorder_t *rec);
+
+// Starts recording to the stream, the caller closes it after the stop.
+esp_err_t recorder_start(recorder_t *rec, FILE *f, uint64_t cycles);
+// Stops recording and waits for the pending frames to be written.
+esp_err_t recorder_stop(recorder_t *rec);
+esp_err_t recorder_step(recorder_t *rec, const memory_t *mem, uint64_t cycles);
+
+#endif
+
+#endif // __RECORDER_H__
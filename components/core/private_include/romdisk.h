@@ -0,0 +1,92 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#ifndef __ROMDISK_H__
+#define __ROMDISK_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#define ROMDISK_PARTITION_SUBTYPE 0x40
+#define ROMDISK_DIR_MAGIC "ORDSKDIR"
+#define ROMDISK_DIR_SIZE 0x1000
+#define ROMDISK_NAME_SIZE 16
+// ports B and C of the F5 PPI are the whole address, there is no bank
+// register, the longer images are cut
+#define ROMDISK_IMAGE_MAX_SIZE 0x10000
+
+#define ROMDISK_CACHE_LINE_SIZE 512
+#define ROMDISK_CACHE_LINES 8
+#define ROMDISK_CACHE_PREFETCH 4
+#define ROMDISK_NO_TAG 0xffffffff
+
+// Partition layout: one ROMDISK_DIR_SIZE sector with the directory header
+// followed by the entries, images start at ROMDISK_DIR_SIZE aligned offsets.
+typedef struct romdisk_dir_header {
+    char magic[8];
+    uint32_t count;
+    uint32_t reserved;
+} romdisk_dir_header_t;
+
+typedef struct romdisk_dir_entry {
+    char name[ROMDISK_NAME_SIZE];
+    uint32_t offset;
+    uint32_t size;
+} romdisk_dir_entry_t;
+
+#define ROMDISK_DIR_ENTRIES ((ROMDISK_DIR_SIZE - sizeof(romdisk_dir_header_t)) / sizeof(romdisk_dir_entry_t))
+
+typedef struct romdisk {
+    const uint8_t *data;
+    const esp_partition_t *partition;
+    romdisk_dir_entry_t *dir;
+    uint32_t dir_count;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t tags[ROMDISK_CACHE_LINES];
+    uint8_t *cache;
+    uint32_t hits;
+    uint32_t misses;
+} romdisk_t;
+
+esp_err_t romdisk_create(romdisk_t **pdisk);
+esp_err_t romdisk_set_image(romdisk_t *disk, const uint8_t *data, size_t size);
+esp_err_t romdisk_open_partition(romdisk_t *disk, const char *label);
+esp_err_t romdisk_select(romdisk_t *disk, uint32_t index);
+const char *romdisk_get_name(const romdisk_t *disk, uint32_t index);
+esp_err_t romdisk_copy(romdisk_t *disk, uint8_t *dst, uint32_t addr, size_t size);
+esp_err_t romdisk_done(romdisk_t *disk);
+
+void romdisk_fill(romdisk_t *disk, uint32_t tag);
+
+static inline uint8_t romdisk_read(romdisk_t *disk, uint32_t addr) {
+    if (addr >= disk->size)
+        return 0xff;
+    if (disk->data)
+        return disk->data[addr];
+    uint32_t tag = addr / ROMDISK_CACHE_LINE_SIZE;
+    uint32_t line = tag % ROMDISK_CACHE_LINES;
+    if (disk->tags[line] != tag)
+        romdisk_fill(disk, tag);
+    else
+        ++disk->hits;
+    return disk->cache[line * ROMDISK_CACHE_LINE_SIZE + addr % ROMDISK_CACHE_LINE_SIZE];
+}
+
+#endif // __ROMDISK_H__
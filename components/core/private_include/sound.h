@@ -0,0 +1,86 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#ifndef __SOUND_H__
+#define __SOUND_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ring.h"
+#include "memory.h"
+
+#define SOUND_CPU_FREQUENCY 2500000
+#define SOUND_SAMPLE_RATE CONFIG_ORION_SOUND_SAMPLE_RATE
+#define SOUND_BLOCK_SAMPLES 256
+#define SOUND_RING_SIZE 0x1000
+#define SOUND_EVENT_BATCH 64
+#define SOUND_AMPLITUDE 0x2000
+
+#if defined(CONFIG_ORION_SOUND_OUTPUT_DAC) || defined(CONFIG_ORION_SOUND_OUTPUT_I2S)
+#define SOUND_OUTPUT_ENABLE
+#endif
+
+// Speaker level change, stamped with the low 32 bits of the CPU cycle
+// counter. At 2.5 MHz it wraps every half an hour, only the differences
+// are used.
+typedef struct sound_event {
+    uint32_t cycles;
+    uint32_t level;
+} sound_event_t;
+
+typedef struct sound {
+    ring_t *ring;
+    // producer (emulation task) side
+    uint8_t level;
+    // consumer (renderer) side
+    bool is_synced;
+    uint8_t render_level;
+    uint32_t time;
+    uint32_t time_frac;
+    uint32_t step;
+    uint32_t step_frac;
+    int32_t dc_x;
+    int32_t dc_y;
+    sound_event_t events[SOUND_EVENT_BATCH];
+    size_t event_count;
+    size_t event_index;
+    TaskHandle_t task;
+} sound_t;
+
+esp_err_t sound_create(sound_t **psnd);
+esp_err_t sound_init(sound_t *snd);
+// Records the speaker level after a write to port 0xF402 or 0xF403,
+// the caller checks and clears mem->set_sound first.
+esp_err_t sound_step(sound_t *snd, memory_t *mem, uint64_t cycles);
+esp_err_t sound_done(sound_t *snd);
+
+// Consumer side: start rendering at the given CPU cycle.
+esp_err_t sound_sync(sound_t *snd, uint32_t cycles);
+// Consumer side: render count samples of the recorded speaker transitions,
+// every sample covers SOUND_CPU_FREQUENCY / SOUND_SAMPLE_RATE cycles.
+esp_err_t sound_render(sound_t *snd, int16_t *samples, size_t count);
+
+#ifdef SOUND_OUTPUT_ENABLE
+esp_err_t sound_output_start(sound_t *snd);
+esp_err_t sound_output_stop(sound_t *snd);
+#endif
+
+#endif // __SOUND_H__
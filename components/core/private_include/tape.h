@@ -0,0 +1,93 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#ifndef __TAPE_H__
+#define __TAPE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "cpu.h"
+#include "memory.h"
+
+// The monitors write a bit as two halves, the second half is the bit value,
+// the first one its inverse. Monitor 2 writes a half in about 1050 cycles.
+#define TAPE_HALF_BIT_CYCLES 1050
+// the first half of every byte is longer, the reader needs the time to store the byte
+#define TAPE_BYTE_GAP_CYCLES 1000
+#define TAPE_PILOT_SIZE 256
+#define TAPE_SYNC_BYTE 0xe6
+// the ORDOS tape record header: name, pilot, sync
+#define TAPE_ORD_NAME_SIZE 8
+#define TAPE_ORD_GAP_SIZE 64
+#define TAPE_ORD_HEADER_SIZE 16
+
+// monitor entry points
+#define TAPE_READ_ENTRY 0xf806
+#define TAPE_WRITE_ENTRY 0xf80c
+
+typedef enum {
+    TAPE_STOPPED = 0,
+    TAPE_PLAYING,
+    TAPE_RECORDING
+} tape_state_t;
+
+// The tape image is the byte stream the monitor reads with 0xF806 and
+// writes with 0xF80C, pilot and sync bytes included.
+typedef struct tape {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    size_t pos;
+    tape_state_t state;
+    bool is_fast;
+    // bit stream playback
+    uint8_t level;
+    uint8_t half;
+    uint64_t next_edge;
+    // bit stream capture
+    uint8_t out_level;
+    bool is_synced;
+    uint8_t shift;
+    uint8_t bits;
+    uint32_t half_cycles;
+    uint64_t last_edge;
+    uint64_t last_mid;
+} tape_t;
+
+esp_err_t tape_create(tape_t **ptape);
+esp_err_t tape_done(tape_t *tape);
+
+// Reads a tape image, an ORDOS file (16 byte header) is converted to the
+// record the ORDOS tape utility reads.
+esp_err_t tape_load(tape_t *tape, FILE *f, bool is_ord);
+// Writes the recorded tape image.
+esp_err_t tape_save(tape_t *tape, FILE *f);
+
+// Fast mode traps the monitor entry points and moves whole bytes,
+// otherwise the tape is a bit stream on port 0xF402 bits 4 (in) and 0 (out).
+esp_err_t tape_play(tape_t *tape, bool is_fast, uint64_t cycles);
+esp_err_t tape_record(tape_t *tape, bool is_fast);
+esp_err_t tape_stop(tape_t *tape);
+
+// Called before every CPU step while the tape is not stopped.
+esp_err_t tape_step(tape_t *tape, cpu_t *cpu, memory_t *mem);
+// Called after a port C write while recording.
+esp_err_t tape_output(tape_t *tape, memory_t *mem, uint64_t cycles);
+
+#endif // __TAPE_H__
@@ -0,0 +1,45 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#ifndef __TRAP_H__
+#define __TRAP_H__
+
+#include "esp_err.h"
+#include "computer.h"
+
+#define TRAP_CODE_SEGMENTS 3
+
+typedef struct trap_code {
+    uint16_t addr;
+    uint16_t size;
+    const uint8_t *data;
+} trap_code_t;
+
+typedef struct trap trap_t;
+typedef bool (*trap_handler_t)(const trap_t *trap, cpu_t *cpu, memory_t *mem);
+
+// A trap fires when the CPU reaches pc and every code segment matches
+// the memory contents, so relocated or patched loaders are left alone.
+struct trap {
+    const char *name;
+    uint16_t pc;
+    trap_code_t code[TRAP_CODE_SEGMENTS];
+    trap_handler_t handler;
+};
+
+esp_err_t trap_step(computer_t *cmp);
+
+#endif // __TRAP_H__
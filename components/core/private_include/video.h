@@ -22,6 +22,11 @@
 
 #define VIDEO_DISPLAY_WIDTH 384
 #define VIDEO_DISPLAY_HEIGHT 256
+// 8 pixel wide byte columns of the screen
+#define VIDEO_COLUMNS (VIDEO_DISPLAY_WIDTH >> 3)
+#define VIDEO_SHADOW_PAGE_SIZE (VIDEO_COLUMNS * VIDEO_DISPLAY_HEIGHT)
+#define VIDEO_SHADOW_INVALID 0xff
+#define VIDEO_PALETTE_SIZE 16
 
 typedef enum {
     VIDEO_COLOR_BLACK    = 0,
@@ -42,8 +47,116 @@ typedef enum {
     VIDEO_COLOR_WHITE    = 15
 } video_color_t;
 
+// How the Orion screen is fitted to the LCD
+typedef enum {
+    // pixel to pixel in the middle of the LCD
+    VIDEO_SCALE_NONE = 0,
+    // stretched over the whole LCD
+    VIDEO_SCALE_FILL,
+    // the biggest 4:3 rectangle in the middle
+    VIDEO_SCALE_ASPECT
+} video_scale_mode_t;
+
+#if defined(CONFIG_ORION_VIDEO_SCALE_ASPECT)
+#define VIDEO_SCALE_DEFAULT VIDEO_SCALE_ASPECT
+#elif defined(CONFIG_ORION_VIDEO_SCALE_FILL)
+#define VIDEO_SCALE_DEFAULT VIDEO_SCALE_FILL
+#else
+#define VIDEO_SCALE_DEFAULT VIDEO_SCALE_NONE
+#endif
+
+// Nearest neighbour scaling of the Orion screen to the LCD. The maps are
+// built once, the converter only looks them up.
+typedef struct video_scale {
+    // LCD rectangle the Orion screen is drawn to
+    display_rectangle_t bounds;
+    // Orion pixel of every column and row of the rectangle
+    uint16_t *x_map;
+    uint16_t *y_map;
+    // first column and row of the rectangle showing every Orion pixel,
+    // the last entries are the rectangle size
+    uint16_t x_first[VIDEO_DISPLAY_WIDTH + 1];
+    uint16_t y_first[VIDEO_DISPLAY_HEIGHT + 1];
+    // palette indices of the Orion row being converted
+    uint8_t line[VIDEO_DISPLAY_WIDTH];
+} video_scale_t;
+
+
+// Palette indices of the 8 pixels of a byte column, the first pixel in
+// the lowest nibble
+static inline uint32_t video_get_colors(uint8_t page0, uint8_t page1, uint8_t port) {
+    size_t i;
+    uint32_t colors = 0;
+    switch (port & 7) {
+        case 0:
+            for (i = 0; i < 8; ++i) {
+                colors <<= 4;
+                colors |= (page0 & 1) ? VIDEO_COLOR_GREEN : VIDEO_COLOR_BLACK;
+                page0 >>= 1;
+            }
+            break;
+        case 1:
+            for (i = 0; i < 8; ++i) {
+                colors <<= 4;
+                colors |= (page0 & 1) ? VIDEO_COLOR_LCYAN : VIDEO_COLOR_LBLUE;
+                page0 >>= 1;
+            }
+            break;
+        case 2:
+        case 3:
+            for (i = 0; i < 8; ++i) {
+                colors <<= 4;
+                colors |= VIDEO_COLOR_BLACK;
+            }
+            break;
+        case 4:
+            for (i = 0; i < 8; ++i) {
+                colors <<= 4;
+                if (page1 & 1)
+                    colors |= (page0 & 1) ? VIDEO_COLOR_BLUE : VIDEO_COLOR_RED;
+                else
+                    colors |= (page0 & 1) ? VIDEO_COLOR_GREEN : VIDEO_COLOR_BLACK;
+                page0 >>= 1;
+                page1 >>= 1;
+            }
+            break;
+        case 5:
+            for (i = 0; i < 8; ++i) {
+                colors <<= 4;
+                if (page1 & 1)
+                    colors |= (page0 & 1) ? VIDEO_COLOR_BLUE : VIDEO_COLOR_RED;
+                else
+                    colors |= (page0 & 1) ? VIDEO_COLOR_GREEN : VIDEO_COLOR_BLACK;
+                page0 >>= 1;
+                page1 >>= 1;
+            }
+            break;
+        case 6:
+        case 7: {
+            uint32_t lo = page1 & 0x0f;
+            uint32_t hi = (page1>>4) & 0x0f;
+            for (i = 0; i < 8; ++i) {
+                colors <<= 4;
+                colors |= (page0 & 1) ? lo : hi;
+                page0 >>= 1;
+            }
+            break;
+        }
+    }
+    return colors;
+}
+
+esp_err_t video_scale_create(video_scale_t **pscale, const display_t *display, video_scale_mode_t mode);
+esp_err_t video_scale_done(video_scale_t *scale);
 
 esp_err_t video_init(computer_t *cmp);
 esp_err_t video_step(computer_t *cmp);
+esp_err_t video_done(computer_t *cmp);
+
+// Draw in the calling task while the refresh task doesn't, e.g. in the
+// host checks: an Orion rectangle, or the whole screen the way the task
+// redraws it, force ignores the shadow.
+esp_err_t video_draw(computer_t *cmp, uint32_t left, uint32_t top, uint32_t width, uint32_t height);
+esp_err_t video_redraw(computer_t *cmp, bool force);
 
 #endif // __VIDEO_H__
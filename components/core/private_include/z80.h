@@ -0,0 +1,32 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#ifndef __Z80_H__
+#define __Z80_H__
+
+#include "esp_err.h"
+#include "cpu.h"
+
+#ifdef CPU_Z80_ENABLE
+
+// Z80 core, called by cpu_reset and cpu_step when cpu->type is CPU_TYPE_Z80
+esp_err_t z80_reset(cpu_t *cpu);
+esp_err_t z80_step(cpu_t *cpu);
+esp_err_t z80_interrupt(cpu_t *cpu, uint8_t rst);
+
+#endif
+
+#endif // __Z80_H__
@@ -0,0 +1,52 @@
+#
+# This file is part of the orion128-core distribution
+# (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+# Copyright (c) 2022 Dmitry Romanchenko.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, version 3.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/>.
+#
+# Packs ROM disk images into the "romdisk" partition image:
+#   ruby romdisk_pack.rb romdisk.bin romdisk1.rom romdisk2.rom ...
+# and flash it with
+#   parttool.py write_partition --partition-name=romdisk --input=romdisk.bin
+
+MAGIC = "ORDSKDIR"
+DIR_SIZE = 0x1000
+NAME_SIZE = 16
+# ports B and C of the F5 PPI address 64 KB, there is no bank register
+IMAGE_SIZE = 0x10000
+ENTRY_SIZE = NAME_SIZE + 8
+PARTITION_SIZE = 0x180000
+
+abort "usage: #{$0} <output> <image>..." if ARGV.size < 2
+
+output, *images = ARGV
+abort "too many images" if 16 + images.size * ENTRY_SIZE > DIR_SIZE
+
+dir = [MAGIC, images.size, 0].pack("a8VV")
+data = "".b
+images.each do |name|
+  image = File.binread(name)
+  abort "#{name}: #{image.size} bytes, the ROM disk addresses #{IMAGE_SIZE}" if image.size > IMAGE_SIZE
+  offset = DIR_SIZE + data.size
+  dir << [File.basename(name, ".*")[0, NAME_SIZE - 1], offset, image.size].pack("a#{NAME_SIZE}VV")
+  data << image
+  data << "\xff".b * (-data.size % DIR_SIZE)
+end
+
+abort "images do not fit the partition" if DIR_SIZE + data.size > PARTITION_SIZE
+
+File.open(output, "wb") do |fo|
+  fo.write dir.ljust(DIR_SIZE, "\xff".b)
+  fo.write data
+end
@@ -17,8 +17,56 @@
  */#include <string.h>
 #include "computer.h"
 #include "video.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#ifdef CONFIG_ORION_ROMDISK_TRAP
+#include "trap.h"
+#endif
 
 
+static const char __attribute__((unused)) *TAG = "computer";
+
+#ifdef CONFIG_ORION_PERF_COUNTERS
+static void computer_perf_create(computer_t *cmp)
+{
+    ESP_ERROR_CHECK(perf_create(&cmp->perf));
+    perf_t *perf = cmp->perf;
+    computer_perf_t *c = &cmp->counters;
+    ESP_ERROR_CHECK(perf_add_counter(perf, "cpu.steps", &c->steps));
+    ESP_ERROR_CHECK(perf_add_counter(perf, "cpu.cycles", &c->cycles));
+    ESP_ERROR_CHECK(perf_add_range(perf, "cpu.frame_us", &c->frame_us));
+    ESP_ERROR_CHECK(perf_add_counter(perf, "mem.port_reads", &cmp->mem->port_reads));
+    ESP_ERROR_CHECK(perf_add_counter(perf, "mem.port_writes", &cmp->mem->port_writes));
+    ESP_ERROR_CHECK(perf_add_range(perf, "video.queue", &c->video_queue));
+    ESP_ERROR_CHECK(perf_add_counter(perf, "video.dropped", &c->video_dropped));
+    ESP_ERROR_CHECK(perf_add_counter(perf, "video.dirty", &c->video_dirty));
+    ESP_ERROR_CHECK(perf_add_counter(perf, "video.windows", &c->video_windows));
+    ESP_ERROR_CHECK(perf_add_counter(perf, "video.pixels", &c->video_pixels));
+    ESP_ERROR_CHECK(perf_add_counter(perf, "video.bytes", &c->video_bytes));
+    ESP_ERROR_CHECK(perf_add_range(perf, "video.convert_us", &c->video_convert_us));
+    ESP_ERROR_CHECK(perf_add_range(perf, "video.transfer_us", &c->video_transfer_us));
+#ifdef CONFIG_ORION_SOUND
+    ESP_ERROR_CHECK(perf_add_range(perf, "sound.queue", &c->sound_queue));
+    ESP_ERROR_CHECK(perf_add_counter(perf, "sound.dropped", &c->sound_dropped));
+#endif
+}
+
+// The emulation task writes these once per frame of the emulated time
+static void computer_perf_frame(computer_t *cmp, uint32_t frame_us, int64_t now)
+{
+    computer_perf_t *c = &cmp->counters;
+    perf_set(&c->cycles, (uint32_t)cmp->cpu->cycles);
+    perf_sample(&c->frame_us, frame_us);
+    perf_sample(&c->video_queue, ring_count(cmp->video_ring));
+    perf_set(&c->video_dropped, ring_get_dropped(cmp->video_ring));
+#ifdef CONFIG_ORION_SOUND
+    perf_sample(&c->sound_queue, ring_count(cmp->snd->ring));
+    perf_set(&c->sound_dropped, ring_get_dropped(cmp->snd->ring));
+#endif
+    ESP_ERROR_CHECK(perf_step(cmp->perf, now));
+}
+#endif
+
 esp_err_t computer_create(computer_t **pcmp)
 {
     esp_err_t r = ESP_OK;
@@ -27,46 +75,385 @@ esp_err_t computer_create(computer_t **pcmp)
     ESP_ERROR_CHECK(cmp ? ESP_OK : ESP_ERR_NO_MEM);
     bzero(cmp, sizeof(computer_t));
 
+    cmp->pause_mutex = xSemaphoreCreateMutex();
+    ESP_ERROR_CHECK(cmp->pause_mutex ? ESP_OK : ESP_ERR_NO_MEM);
     ESP_ERROR_CHECK(cpu_create(&cmp->cpu));
+#ifdef CONFIG_ORION_CPU_Z80
+    // may be changed until computer_init
+    cmp->cpu->type = CPU_TYPE_Z80;
+#endif
     ESP_ERROR_CHECK(memory_create(&cmp->mem));
+#ifdef CONFIG_ORION_MEMORY_BENCHMARK
+    ESP_ERROR_CHECK(memory_benchmark(cmp->mem));
+#endif
     ESP_ERROR_CHECK(keyboard_create(&cmp->kbd));
+#ifdef CONFIG_ORION_SOUND
+    ESP_ERROR_CHECK(sound_create(&cmp->snd));
+#endif
+#ifdef CONFIG_ORION_TAPE
+    ESP_ERROR_CHECK(tape_create(&cmp->tape));
+#endif
+#ifdef CONFIG_ORION_IDLE_DETECT
+    ESP_ERROR_CHECK(idle_create(&cmp->idle));
+#endif
+#ifdef CONFIG_ORION_VIDEO_RECORDER
+    ESP_ERROR_CHECK(recorder_create(&cmp->recorder));
+#endif
+#ifdef CONFIG_ORION_PERF_COUNTERS
+    computer_perf_create(cmp);
+#endif
+#ifdef CONFIG_ORION_DEBUGGER
+    ESP_ERROR_CHECK(debugger_create(&cmp->debugger));
+#endif
 
     *pcmp = cmp;
     return r;
 }
 
+#ifdef CPU_CYCLES_ENABLE
+static void computer_stats_start(computer_t *cmp)
+{
+    uint64_t cycles = cmp->cpu->cycles;
+    int64_t now = esp_timer_get_time();
+    cmp->stats_cycles = cycles + COMPUTER_FRAME_CYCLES;
+    cmp->stats_start_cycles = cycles;
+    cmp->stats_start_time = now;
+    cmp->stats_frame_time = now;
+    cmp->stats_frames = 0;
+    cmp->stats_max_frame_us = 0;
+#ifdef CONFIG_ORION_FRAME_INTERRUPT
+    cmp->frame_time = now + COMPUTER_FRAME_US;
+#endif
+#ifdef CONFIG_ORION_PERF_COUNTERS
+    ESP_ERROR_CHECK(perf_start(cmp->perf, now));
+#endif
+}
+
+// Once per frame of the emulated time, the idle skip may pass several
+static void computer_stats_frame(computer_t *cmp)
+{
+    uint64_t cycles = cmp->cpu->cycles;
+    int64_t now = esp_timer_get_time();
+    uint32_t frames = (cycles - cmp->stats_cycles) / COMPUTER_FRAME_CYCLES + 1;
+    cmp->stats_cycles += (uint64_t)frames * COMPUTER_FRAME_CYCLES;
+    uint32_t frame_us = (now - cmp->stats_frame_time) / frames;
+    cmp->stats_frame_time = now;
+    if (frame_us > cmp->stats_max_frame_us)
+        cmp->stats_max_frame_us = frame_us;
+#ifdef CONFIG_ORION_PERF_COUNTERS
+    computer_perf_frame(cmp, frame_us, now);
+#endif
+    cmp->stats_frames += frames;
+    if (cmp->stats_frames < COMPUTER_STATS_FRAMES)
+        return;
+    int64_t time = now - cmp->stats_start_time;
+    if (time > 0) {
+        cmp->stats.speed = (cycles - cmp->stats_start_cycles) * 1000 / time;
+        cmp->stats.frame_us = time / cmp->stats_frames;
+        cmp->stats.max_frame_us = cmp->stats_max_frame_us;
+    }
+    cmp->stats_start_cycles = cycles;
+    cmp->stats_start_time = now;
+    cmp->stats_frames = 0;
+    cmp->stats_max_frame_us = 0;
+}
+#endif
+
+esp_err_t computer_get_stats(computer_t *cmp, computer_stats_t *stats)
+{
+    ESP_ERROR_CHECK(cmp && stats ? ESP_OK : ESP_ERR_INVALID_ARG);
+#ifdef CPU_CYCLES_ENABLE
+    *stats = cmp->stats;
+    stats->cycles = cmp->cpu->cycles;
+#else
+    bzero(stats, sizeof(computer_stats_t));
+#endif
+    if (cmp->video_ring) {
+        stats->video_queue = ring_count(cmp->video_ring);
+        stats->video_queue_size = cmp->video_ring->length;
+    }
+    if (cmp->kbd->ring) {
+        stats->key_queue = ring_count(cmp->kbd->ring);
+        stats->key_queue_size = cmp->kbd->ring->length;
+    }
+#ifdef CONFIG_ORION_SOUND
+    if (cmp->snd->ring) {
+        stats->sound_queue = ring_count(cmp->snd->ring);
+        stats->sound_queue_size = cmp->snd->ring->length;
+    }
+#endif
+    return ESP_OK;
+}
+
 esp_err_t computer_init(computer_t *cmp)
 {
     ESP_ERROR_CHECK(keyboard_init(cmp->kbd));
     ESP_ERROR_CHECK(video_init(cmp));
+#ifdef CONFIG_ORION_SOUND
+    ESP_ERROR_CHECK(sound_init(cmp->snd));
+#endif
 
     ESP_ERROR_CHECK(memory_init(cmp->mem));
+#ifdef CONFIG_ORION_IDLE_DETECT
+    ESP_ERROR_CHECK(idle_init(cmp->idle));
+#endif
 
     cpu_t *cpu = cmp->cpu;
     cpu->reader = memory_reader_cb;
     cpu->writer = memory_writer_cb;
     cpu->memory = cmp->mem;
     ESP_ERROR_CHECK(cpu_init(cmp->cpu));
+#ifdef CONFIG_ORION_DEBUGGER
+    // keeps the memory callbacks to wrap them while watching
+    ESP_ERROR_CHECK(debugger_init(cmp->debugger, cpu));
+#endif
+#ifdef CONFIG_ORION_FRAME_INTERRUPT
+    cmp->frame_cycles = cpu->cycles + COMPUTER_FRAME_CYCLES;
+#endif
+#ifdef CPU_CYCLES_ENABLE
+    computer_stats_start(cmp);
+#endif
 
     //comp_init();
     return ESP_OK;
 }
 
+// The reset button: mem->rom and the ROM disk may have been replaced
+// meanwhile, the RAM keeps its contents.
+esp_err_t computer_reset(computer_t *cmp)
+{
+    ESP_ERROR_CHECK(cmp ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(cmp->state != COMPUTER_RUNNING && cmp->state != COMPUTER_PAUSE_REQUEST ? ESP_OK : ESP_ERR_INVALID_STATE);
+    cpu_t *cpu = cmp->cpu;
+#ifdef CPU_CYCLES_ENABLE
+    // the sound and the tape are timed by the cycle counter, it goes on
+    uint64_t cycles = cpu->cycles;
+#endif
+    ESP_ERROR_CHECK(cpu_reset(cpu));
+#ifdef CPU_CYCLES_ENABLE
+    cpu->cycles = cycles;
+#endif
+    ESP_ERROR_CHECK(memory_init(cmp->mem));
+    ESP_ERROR_CHECK(keyboard_reset(cmp->kbd));
+#ifdef CONFIG_ORION_TAPE
+    ESP_ERROR_CHECK(tape_stop(cmp->tape));
+#endif
+#ifdef CONFIG_ORION_IDLE_DETECT
+    ESP_ERROR_CHECK(idle_init(cmp->idle));
+#endif
+    cmp->mem->set_video_invalidate = true;
+    return ESP_OK;
+}
+
+#ifdef CONFIG_ORION_FRAME_INTERRUPT
+// Sleeps the emulation task until the real time of the next frame, the
+// tick is rounded up and the next frame gets the difference back.
+static void computer_frame_wait(computer_t *cmp)
+{
+    int64_t delay = cmp->frame_time - esp_timer_get_time();
+    if (delay > 0)
+        vTaskDelay((delay + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000));
+}
+#endif
+
 esp_err_t computer_step(computer_t *cmp)
 {
+#ifdef CONFIG_ORION_FRAME_INTERRUPT
+    cpu_t *cpu = cmp->cpu;
+    // nothing happens until the next frame, the emulation task sleeps
+    // until it is due, a bare computer_step (the bench) just skips the time
+    if (cpu->halted && cpu->inte && cpu->cycles < cmp->frame_cycles) {
+        if (cmp->task)
+            computer_frame_wait(cmp);
+        cpu->cycles = cmp->frame_cycles;
+    }
+    if (cpu->cycles >= cmp->frame_cycles) {
+        int64_t now = esp_timer_get_time();
+        cmp->frame_cycles += COMPUTER_FRAME_CYCLES;
+        cmp->frame_time += COMPUTER_FRAME_US;
+        // a machine behind the real time doesn't catch up
+        if (cmp->frame_time < now)
+            cmp->frame_time = now;
+        ESP_ERROR_CHECK(cpu_interrupt(cpu, COMPUTER_FRAME_RST));
+    }
+#endif
+#ifdef CONFIG_ORION_ROMDISK_TRAP
+    ESP_ERROR_CHECK(trap_step(cmp));
+#endif
+#ifdef CONFIG_ORION_TAPE
+    if (cmp->tape->state != TAPE_STOPPED)
+        ESP_ERROR_CHECK(tape_step(cmp->tape, cmp->cpu, cmp->mem));
+#endif
     ESP_ERROR_CHECK(cpu_step(cmp->cpu));
+#ifdef CONFIG_ORION_PERF_COUNTERS
+    perf_count(&cmp->counters.steps, 1);
+#endif
+#ifdef CONFIG_ORION_IDLE_DETECT
+#ifdef CONFIG_ORION_TAPE
+    // skipping the time would lose the tape bits
+    if (cmp->tape->state == TAPE_STOPPED)
+#endif
+        ESP_ERROR_CHECK(idle_step(cmp->idle, cmp->cpu, cmp->mem, cmp->kbd));
+#endif
+#ifdef CPU_CYCLES_ENABLE
+    if (cmp->cpu->cycles >= cmp->stats_cycles)
+        computer_stats_frame(cmp);
+#endif
     ESP_ERROR_CHECK(video_step(cmp));
-    ESP_ERROR_CHECK(keyboard_step(cmp->kbd, cmp->mem));
+#ifdef CONFIG_ORION_VIDEO_RECORDER
+    if (cmp->recorder->is_recording)
+        ESP_ERROR_CHECK(recorder_step(cmp->recorder, cmp->mem, cmp->cpu->cycles));
+#endif
+#ifdef CPU_CYCLES_ENABLE
+    ESP_ERROR_CHECK(keyboard_step(cmp->kbd, cmp->mem, cmp->cpu->cycles));
+#else
+    ESP_ERROR_CHECK(keyboard_step(cmp->kbd, cmp->mem, 0));
+#endif
     ESP_ERROR_CHECK(memory_step(cmp->mem));
+    // only port C writes cost anything here
+    if (cmp->mem->set_sound) {
+        cmp->mem->set_sound = false;
+#ifdef CONFIG_ORION_SOUND
+        ESP_ERROR_CHECK(sound_step(cmp->snd, cmp->mem, cmp->cpu->cycles));
+#endif
+#ifdef CONFIG_ORION_TAPE
+        if (cmp->tape->state == TAPE_RECORDING)
+            ESP_ERROR_CHECK(tape_output(cmp->tape, cmp->mem, cmp->cpu->cycles));
+#endif
+    }
+    return ESP_OK;
+}
+
+// The emulation task owns its core, the display and keyboard tasks run on
+// the other one. It only checks for pause requests between the batches.
+static void computer_run(void *arg)
+{
+    computer_t *cmp = (computer_t *)arg;
+    ESP_ERROR_CHECK(cmp ? ESP_OK : ESP_ERR_INVALID_ARG);
+    while (1) {
+#ifdef CONFIG_ORION_DEBUGGER
+        // the breakpoints are checked only when there are any
+        if (cmp->debugger->is_active) {
+            debugger_t *dbg = cmp->debugger;
+            for (size_t i = 0; i < COMPUTER_RUN_BATCH && dbg->stop == DEBUGGER_RUNNING; ++i)
+                ESP_ERROR_CHECK(debugger_step(dbg, cmp));
+            // the app takes the stopped machine to the console
+            if (dbg->stop != DEBUGGER_RUNNING)
+                vTaskDelay(1);
+        }
+        else
+#endif
+        for (size_t i = 0; i < COMPUTER_RUN_BATCH; ++i)
+            ESP_ERROR_CHECK(computer_step(cmp));
+        // a CPU halted with the interrupts disabled waits for the reset
+        if (cmp->cpu->halted)
+            vTaskDelay(1);
+#ifdef CONFIG_ORION_IDLE_DETECT
+        if (cmp->idle->is_idle)
+            ESP_ERROR_CHECK(idle_wait(cmp->idle, cmp->kbd));
+#endif
+        ESP_ERROR_CHECK(computer_yield(cmp));
+    }
+}
+
+esp_err_t computer_yield(computer_t *cmp)
+{
+    ESP_ERROR_CHECK(cmp ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (cmp->state == COMPUTER_PAUSE_REQUEST) {
+        cmp->state = COMPUTER_PAUSED;
+        while (cmp->state == COMPUTER_PAUSED)
+            vTaskDelay(1);
+    }
+    return ESP_OK;
+}
+
+esp_err_t computer_start(computer_t *cmp)
+{
+    ESP_ERROR_CHECK(cmp ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(!cmp->task ? ESP_OK : ESP_ERR_INVALID_STATE);
+    xSemaphoreTake(cmp->pause_mutex, portMAX_DELAY);
+    // an upload may hold a pause already
+    cmp->state = cmp->pauses ? COMPUTER_PAUSED : COMPUTER_RUNNING;
+    xSemaphoreGive(cmp->pause_mutex);
+    BaseType_t result = xTaskCreatePinnedToCore(computer_run, TAG, 4096, cmp,
+        CONFIG_ORION_CPU_TASK_PRIORITY, &cmp->task, CONFIG_ORION_CPU_TASK_CORE);
+    ESP_ERROR_CHECK(result == pdPASS ? ESP_OK : ESP_ERR_NO_MEM);
+    ESP_LOGI(TAG, "started on core %d", CONFIG_ORION_CPU_TASK_CORE);
+    return ESP_OK;
+}
+
+// The thread running the machine only turns a request into the pause and
+// computer_stop may turn it into the stop, the pausers take the mutex.
+esp_err_t computer_pause(computer_t *cmp)
+{
+    ESP_ERROR_CHECK(cmp ? ESP_OK : ESP_ERR_INVALID_ARG);
+    xSemaphoreTake(cmp->pause_mutex, portMAX_DELAY);
+    computer_state_t running = COMPUTER_RUNNING;
+    if (!cmp->pauses++ && __atomic_compare_exchange_n(&cmp->state, &running, COMPUTER_PAUSE_REQUEST,
+            false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        while (cmp->state == COMPUTER_PAUSE_REQUEST)
+            vTaskDelay(1);
+    xSemaphoreGive(cmp->pause_mutex);
+    return ESP_OK;
+}
+
+esp_err_t computer_resume(computer_t *cmp)
+{
+    ESP_ERROR_CHECK(cmp ? ESP_OK : ESP_ERR_INVALID_ARG);
+    xSemaphoreTake(cmp->pause_mutex, portMAX_DELAY);
+    ESP_ERROR_CHECK(cmp->pauses ? ESP_OK : ESP_ERR_INVALID_STATE);
+    if (!--cmp->pauses && cmp->state == COMPUTER_PAUSED) {
+#ifdef CPU_CYCLES_ENABLE
+        // the pause is not the emulation time
+        computer_stats_start(cmp);
+#endif
+        cmp->state = COMPUTER_RUNNING;
+    }
+    xSemaphoreGive(cmp->pause_mutex);
+    return ESP_OK;
+}
+
+esp_err_t computer_stop(computer_t *cmp)
+{
+    ESP_ERROR_CHECK(cmp ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(!cmp->task ? ESP_OK : ESP_ERR_INVALID_STATE);
+    // a pending request sees the stop and returns
+    __atomic_store_n(&cmp->state, COMPUTER_STOPPED, __ATOMIC_SEQ_CST);
     return ESP_OK;
 }
 
 esp_err_t computer_done(computer_t *cmp)
 {
     ESP_ERROR_CHECK(cmp ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (cmp->task) {
+        ESP_ERROR_CHECK(computer_pause(cmp));
+        vTaskDelete(cmp->task);
+        cmp->task = NULL;
+        cmp->state = COMPUTER_STOPPED;
+    }
+    ESP_ERROR_CHECK(video_done(cmp));
+#ifdef CONFIG_ORION_SOUND
+    ESP_ERROR_CHECK(sound_done(cmp->snd));
+#endif
+#ifdef CONFIG_ORION_TAPE
+    ESP_ERROR_CHECK(tape_done(cmp->tape));
+#endif
+#ifdef CONFIG_ORION_IDLE_DETECT
+    ESP_ERROR_CHECK(idle_done(cmp->idle));
+#endif
+#ifdef CONFIG_ORION_VIDEO_RECORDER
+    ESP_ERROR_CHECK(recorder_done(cmp->recorder));
+#endif
     ESP_ERROR_CHECK(keyboard_done(cmp->kbd));
     ESP_ERROR_CHECK(memory_done(cmp->mem));
     ESP_ERROR_CHECK(cpu_done(cmp->cpu));
+#ifdef CONFIG_ORION_PERF_COUNTERS
+    ESP_ERROR_CHECK(perf_done(cmp->perf));
+#endif
+#ifdef CONFIG_ORION_DEBUGGER
+    ESP_ERROR_CHECK(debugger_done(cmp->debugger));
+#endif
+    vSemaphoreDelete(cmp->pause_mutex);
 
     free(cmp);
     return ESP_OK;
@@ -19,6 +19,7 @@
 #include "esp_log.h"
 #include "computer.h"
 #include "cpu.h"
+#include "z80.h"
 
 #ifdef CPU_CYCLES_ENABLE
 #include "esp_timer.h"
@@ -40,27 +41,12 @@
 #define CPU_REG_A 7
 #define CPU_REG_SIZE 8
 
-#define CPU_FILE_B 1
-#define CPU_FILE_C 0
-#define CPU_FILE_D 3
-#define CPU_FILE_E 2
-#define CPU_FILE_H 5
-#define CPU_FILE_L 4
-#define CPU_FLAGS  6
-#define CPU_FILE_A 7
-#define CPU_REG_FILE_SIZE 8
-
 #define CPU_REG_BC 0
 #define CPU_REG_DE 1
 #define CPU_REG_HL 2
 #define CPU_REG_SP 3
 #define CPU_PAIR_SIZE 4
 
-#define CPU_FILE_BC 0
-#define CPU_FILE_DE 2
-#define CPU_FILE_HL 4
-#define CPU_FILE_PSW 6
-
 #define CPU_FLAG_C  0
 #define CPU_FLAG_P  2
 #define CPU_FLAG_AC 4
@@ -73,9 +59,6 @@
 #define CPU_MASK_Z  0x40
 #define CPU_MASK_S  0x80
 
-#define CPU_HL_VAL(cpu)  (*((uint16_t *)&cpu->reg_file[CPU_FILE_L]))
-#define CPU_PSW_VAL(cpu) (*((uint16_t *)&cpu->reg_file[CPU_FILE_A]))
-#define CPU_A_VAL(cpu)   (cpu->reg_file[CPU_FILE_A])
 
 #define CPU_IS_SET_FLAG_C(cpu)  (cpu->reg_file[CPU_FLAGS] & CPU_MASK_C)
 #define CPU_IS_SET_FLAG_P(cpu)  (cpu->reg_file[CPU_FLAGS] & CPU_MASK_P)
@@ -258,8 +241,12 @@ esp_err_t cpu_reset(cpu_t *cpu) {
     cpu->sp = 0;
     cpu->is_word = 0;
     cpu->cmd = 0;
+    cpu->inte = 0;
+    cpu->halted = 0;
+    cpu->irq = 0;
 #ifdef CPU_CYCLES_ENABLE
     cpu->cycles = 0;
+    cpu->speed_cycles = 0;
     cpu->us_timer = cpu_time();
     cpu->speed = 0;
     cpu->steps = 0;
@@ -267,6 +254,10 @@ esp_err_t cpu_reset(cpu_t *cpu) {
 #ifdef CPU_MNEMONIC_ENABLE
     cpu->save_pc = 0;
     cpu->invalid_op = 0;
+#endif
+#ifdef CPU_Z80_ENABLE
+    if (cpu->type == CPU_TYPE_Z80)
+        return z80_reset(cpu);
 #endif
     return ESP_OK;
 }
@@ -578,6 +569,14 @@ __CPU_INLINE__ void cpu_cmd_cmc(cpu_t *cpu) {
 }
 
 // 01dddsss
+// 01110110
+__CPU_INLINE__ void cpu_cmd_hlt(cpu_t *cpu) {
+    cpu->halted = 1;
+#ifdef CPU_MNEMONIC_ENABLE
+    sprintf(&cpu_mnemonic[strlen(cpu_mnemonic)], "HLT           ");
+#endif
+}
+
 __CPU_INLINE__ void cpu_cmd_mov(cpu_t *cpu, uint32_t dst_idx, uint32_t src_idx) {
     *cpu_get_dst_ptr(cpu, dst_idx) = *cpu_get_src_ptr(cpu, src_idx);
 #ifdef CPU_MNEMONIC_ENABLE
@@ -777,10 +776,8 @@ __CPU_INLINE__ void cpu_cmd_j(cpu_t *cpu, uint32_t idx) {
         uint16_t val = *(uint16_t *)cpu_get_read_mem_ptr(cpu, cpu->pc);
         cpu->pc += 2;
 #endif
+        // 10 cycles whether the jump is taken or not
         cpu->pc = val;
-#ifdef CPU_CYCLES_ENABLE
-        cpu->cycles += 6;
-#endif
     }
     else {
 #ifndef CPU_MNEMONIC_ENABLE
@@ -850,6 +847,7 @@ __CPU_INLINE__ void cpu_cmd_xchg(cpu_t *cpu) {
 
 // 11110011
 __CPU_INLINE__ void cpu_cmd_di(cpu_t *cpu) {
+    cpu->inte = 0;
 #ifdef CPU_MNEMONIC_ENABLE
     sprintf(&cpu_mnemonic[strlen(cpu_mnemonic)], "DI            ");
 #endif
@@ -857,6 +855,7 @@ __CPU_INLINE__ void cpu_cmd_di(cpu_t *cpu) {
 
 // 11111011
 __CPU_INLINE__ void cpu_cmd_ei(cpu_t *cpu) {
+    cpu->inte = 1;
 #ifdef CPU_MNEMONIC_ENABLE
     sprintf(&cpu_mnemonic[strlen(cpu_mnemonic)], "EI            ");
 #endif
@@ -1059,7 +1058,72 @@ static void cpu_trace(cpu_t *cpu) {
 }
 #endif
 
+#ifdef CPU_CYCLES_ENABLE
+__CPU_INLINE__ void cpu_speed(cpu_t *cpu) {
+    uint32_t us_timer = cpu_time();
+    if (us_timer < cpu->us_timer) { //65536 us
+        cpu->steps += 1;
+        if (cpu->steps >= 100) {
+            cpu->speed = (cpu->cycles - cpu->speed_cycles) >> 16;
+            cpu->speed_cycles = cpu->cycles;
+            ESP_LOGI(TAG, "speed: %d.%02dMHz", cpu->speed/100, cpu->speed%100);
+            cpu->steps = 0;
+        }
+    }
+    cpu->us_timer = us_timer;
+}
+#endif
+
+// An interrupt is taken between the instructions but not right after EI,
+// cpu->cmd still holds the previous opcode. The 8080 executes the RST
+// from the data bus. A halted CPU only counts the cycles.
+static bool cpu_service(cpu_t *cpu) {
+    if (cpu->irq && cpu->inte && cpu->cmd != 0xfb) {
+        uint8_t rst = cpu->irq & 7;
+        cpu->irq = 0;
+        cpu->inte = 0;
+        cpu->halted = 0;
+        cpu->cmd = 0xc7 | (rst << 3);
+#ifdef CPU_Z80_ENABLE
+        if (cpu->type == CPU_TYPE_Z80) {
+            ESP_ERROR_CHECK(z80_interrupt(cpu, rst));
+            return true;
+        }
+#endif
+#ifdef CPU_CYCLES_ENABLE
+        cpu->cycles += cpu_cycles_num[cpu->cmd];
+#endif
+        cpu_cmd_rst(cpu, rst);
+        return true;
+    }
+    if (cpu->halted) {
+#ifdef CPU_CYCLES_ENABLE
+        cpu->cycles += 4;
+#endif
+        return true;
+    }
+    return false;
+}
+
+esp_err_t cpu_interrupt(cpu_t *cpu, uint8_t rst) {
+    ESP_ERROR_CHECK(cpu ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(rst < 8 ? ESP_OK : ESP_ERR_INVALID_ARG);
+    cpu->irq = CPU_IRQ_PENDING | rst;
+    return ESP_OK;
+}
+
 esp_err_t cpu_step(cpu_t *cpu) {
+    if ((cpu->irq | cpu->halted) && cpu_service(cpu))
+        return ESP_OK;
+#ifdef CPU_Z80_ENABLE
+    if (cpu->type == CPU_TYPE_Z80) {
+        esp_err_t r = z80_step(cpu);
+#ifdef CPU_CYCLES_ENABLE
+        cpu_speed(cpu);
+#endif
+        return r;
+    }
+#endif
 #ifdef CPU_MNEMONIC_ENABLE
     cpu->save_pc = cpu->pc;
 #endif
@@ -1174,7 +1238,10 @@ esp_err_t cpu_step(cpu_t *cpu) {
             break;
         }
         case 0x40:
-            cpu_cmd_mov(cpu, dst_idx, src_idx);
+            if (cpu->cmd == 0x76)
+                cpu_cmd_hlt(cpu);
+            else
+                cpu_cmd_mov(cpu, dst_idx, src_idx);
             break;
         case 0x80:
             cpu_cmd_alu(cpu, dst_idx, src_idx);
@@ -1269,17 +1336,7 @@ esp_err_t cpu_step(cpu_t *cpu) {
         }
     }
 #ifdef CPU_CYCLES_ENABLE
-    uint32_t us_timer = cpu_time();
-    if (us_timer < cpu->us_timer) { //65536 us
-        cpu->steps += 1;
-        if (cpu->steps >= 100) {
-            cpu->speed = cpu->cycles >> 16;
-            cpu->cycles = 0;
-            ESP_LOGI(TAG, "speed: %d.%02dMHz", cpu->speed/100, cpu->speed%100);
-            cpu->steps = 0;
-        }
-    }
-    cpu->us_timer = us_timer;
+    cpu_speed(cpu);
 #endif
 #ifdef CPU_MNEMONIC_ENABLE
     cpu_trace(cpu);
@@ -0,0 +1,651 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "debug.h"
+#include "computer.h"
+#include "debugger.h"
+
+#ifdef CONFIG_ORION_DEBUGGER
+
+static const char __attribute__((unused)) *TAG = "debugger";
+
+// registers of the conditions, the pairs are little endian in reg_file
+static const char *debugger_regs[] = {
+    "A", "F", "B", "C", "D", "E", "H", "L", "AF", "BC", "DE", "HL", "SP", "PC"
+};
+#define DEBUGGER_REGS (sizeof(debugger_regs) / sizeof(debugger_regs[0]))
+
+// A is above the flags, AF is the pair at CPU_FILE_PSW
+#define DEBUGGER_AF_VAL(cpu) (*((uint16_t *)&cpu->reg_file[CPU_FILE_PSW]))
+
+static const char *debugger_ops[] = { "", "==", "!=", "<", ">" };
+
+static const char *debugger_help =
+    "r                      registers\n"
+    "m [addr [len]]         memory dump\n"
+    "s [n]                  step n instructions\n"
+    "b addr [if cond]       breakpoint\n"
+    "w r|w|rw addr[-end] [if cond]\n"
+    "                       watchpoint on reads, writes or both\n"
+    "l                      list breakpoints and watchpoints\n"
+    "bd n, wd n             delete breakpoint or watchpoint n\n"
+    "c                      continue\n"
+#ifdef CONFIG_ORION_GDB_STUB
+    "gdb                    leave the console to the GDB remote protocol\n"
+#endif
+    "cond is reg==hex, reg!=hex, reg<hex or reg>hex, reg is A-L, AF, BC,\n"
+    "DE, HL, SP, PC or [addr] for a memory byte. Numbers are hex.\n";
+
+esp_err_t debugger_create(debugger_t **pdbg)
+{
+    ESP_ERROR_CHECK(pdbg ? ESP_OK : ESP_ERR_INVALID_ARG);
+    debugger_t *dbg = (debugger_t *)malloc(sizeof(debugger_t));
+    ESP_ERROR_CHECK(dbg ? ESP_OK : ESP_ERR_NO_MEM);
+    bzero(dbg, sizeof(debugger_t));
+    dbg->pass_addr = -1;
+
+    *pdbg = dbg;
+    return ESP_OK;
+}
+
+esp_err_t debugger_init(debugger_t *dbg, cpu_t *cpu)
+{
+    ESP_ERROR_CHECK(dbg && cpu ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(cpu->reader && cpu->writer ? ESP_OK : ESP_ERR_INVALID_STATE);
+    dbg->cpu = cpu;
+    dbg->reader = cpu->reader;
+    dbg->writer = cpu->writer;
+    dbg->memory = cpu->memory;
+    return ESP_OK;
+}
+
+esp_err_t debugger_done(debugger_t *dbg)
+{
+    ESP_ERROR_CHECK(dbg ? ESP_OK : ESP_ERR_INVALID_ARG);
+    free(dbg);
+    return ESP_OK;
+}
+
+static inline void debugger_access(debugger_t *dbg, uint16_t addr, uint8_t type)
+{
+    if (dbg->accesses_count < DEBUGGER_ACCESSES_MAX) {
+        dbg->accesses[dbg->accesses_count].addr = addr;
+        dbg->accesses[dbg->accesses_count].type = type;
+        ++dbg->accesses_count;
+    }
+}
+
+static const uint8_t *debugger_reader_cb(uint16_t addr, void *arg)
+{
+    debugger_t *dbg = (debugger_t *)arg;
+    if (dbg->pages[addr >> 8] & DEBUGGER_PAGE_READ)
+        debugger_access(dbg, addr, DEBUGGER_PAGE_READ);
+    return dbg->reader(addr, dbg->memory);
+}
+
+static uint8_t *debugger_writer_cb(uint16_t addr, void *arg)
+{
+    debugger_t *dbg = (debugger_t *)arg;
+    if (dbg->pages[addr >> 8] & DEBUGGER_PAGE_WRITE)
+        debugger_access(dbg, addr, DEBUGGER_PAGE_WRITE);
+    return dbg->writer(addr, dbg->memory);
+}
+
+// The pages of the breakpoints and the watchpoints are flagged, a word
+// access at the byte before a range touches it too. The CPU takes the
+// wrapping callbacks only while there are watchpoints.
+static void debugger_update(debugger_t *dbg)
+{
+    bzero(dbg->pages, sizeof(dbg->pages));
+    for (size_t i = 0; i < dbg->breakpoints_count; ++i)
+        dbg->pages[dbg->breakpoints[i].addr >> 8] |= DEBUGGER_PAGE_EXEC;
+    for (size_t i = 0; i < dbg->watchpoints_count; ++i) {
+        const debugger_watchpoint_t *w = &dbg->watchpoints[i];
+        uint32_t first = (w->start ? w->start - 1 : 0) >> 8;
+        for (uint32_t page = first; page <= (uint32_t)(w->end >> 8); ++page)
+            dbg->pages[page] |= w->type;
+    }
+    cpu_t *cpu = dbg->cpu;
+    if (dbg->watchpoints_count) {
+        cpu->reader = debugger_reader_cb;
+        cpu->writer = debugger_writer_cb;
+        cpu->memory = dbg;
+    }
+    else {
+        cpu->reader = dbg->reader;
+        cpu->writer = dbg->writer;
+        cpu->memory = dbg->memory;
+    }
+    dbg->is_active = dbg->breakpoints_count || dbg->watchpoints_count || dbg->stop != DEBUGGER_RUNNING;
+}
+
+static uint16_t debugger_get_reg(debugger_t *dbg, uint8_t reg)
+{
+    cpu_t *cpu = dbg->cpu;
+    switch (reg) {
+        case 0: return cpu->reg_file[CPU_FILE_A];
+        case 1: return cpu->reg_file[CPU_FLAGS];
+        case 2: return cpu->reg_file[CPU_FILE_B];
+        case 3: return cpu->reg_file[CPU_FILE_C];
+        case 4: return cpu->reg_file[CPU_FILE_D];
+        case 5: return cpu->reg_file[CPU_FILE_E];
+        case 6: return cpu->reg_file[CPU_FILE_H];
+        case 7: return cpu->reg_file[CPU_FILE_L];
+        case 8: return DEBUGGER_AF_VAL(cpu);
+        case 9: return CPU_BC_VAL(cpu);
+        case 10: return CPU_DE_VAL(cpu);
+        case 11: return CPU_HL_VAL(cpu);
+        case 12: return cpu->sp;
+        case 13: return cpu->pc;
+        case DEBUGGER_COND_MEMORY:
+        default:
+            return 0;
+    }
+}
+
+static bool debugger_cond(debugger_t *dbg, const debugger_cond_t *cond)
+{
+    if (cond->op == DEBUGGER_COND_NONE)
+        return true;
+    uint16_t value = cond->reg == DEBUGGER_COND_MEMORY ? debugger_peek(dbg, cond->addr) : debugger_get_reg(dbg, cond->reg);
+    switch (cond->op) {
+        case DEBUGGER_COND_EQ: return value == cond->value;
+        case DEBUGGER_COND_NE: return value != cond->value;
+        case DEBUGGER_COND_LT: return value < cond->value;
+        case DEBUGGER_COND_GT: return value > cond->value;
+        default: return true;
+    }
+}
+
+static void debugger_check_watchpoints(debugger_t *dbg)
+{
+    // a word write goes through one pointer, the next byte changes too
+    uint16_t extra = dbg->cpu->is_word ? 1 : 0;
+    for (size_t a = 0; a < dbg->accesses_count; ++a) {
+        const debugger_access_t *access = &dbg->accesses[a];
+        for (size_t i = 0; i < dbg->watchpoints_count; ++i) {
+            debugger_watchpoint_t *w = &dbg->watchpoints[i];
+            if (!(w->type & access->type))
+                continue;
+            uint16_t addr = access->addr;
+            if (addr < w->start && extra && (uint16_t)(addr + 1) == w->start)
+                addr = w->start;
+            if (addr < w->start || addr > w->end || !debugger_cond(dbg, &w->cond))
+                continue;
+            ++w->hits;
+            dbg->stop = DEBUGGER_STOP_WATCHPOINT;
+            dbg->stop_index = i;
+            dbg->stop_addr = addr;
+            dbg->is_active = true;
+            return;
+        }
+    }
+}
+
+esp_err_t debugger_step(debugger_t *dbg, computer_t *cmp)
+{
+    if (dbg->stop != DEBUGGER_RUNNING)
+        return ESP_OK;
+    cpu_t *cpu = dbg->cpu;
+    uint16_t pc = cpu->pc;
+    if ((dbg->pages[pc >> 8] & DEBUGGER_PAGE_EXEC) && pc != dbg->pass_addr) {
+        for (size_t i = 0; i < dbg->breakpoints_count; ++i) {
+            debugger_breakpoint_t *b = &dbg->breakpoints[i];
+            if (b->addr != pc || !debugger_cond(dbg, &b->cond))
+                continue;
+            ++b->hits;
+            dbg->stop = DEBUGGER_STOP_BREAKPOINT;
+            dbg->stop_index = i;
+            dbg->stop_addr = pc;
+            dbg->is_active = true;
+            return ESP_OK;
+        }
+    }
+    dbg->pass_addr = -1;
+    dbg->accesses_count = 0;
+    ESP_ERROR_CHECK(computer_step(cmp));
+    if (dbg->accesses_count)
+        debugger_check_watchpoints(dbg);
+    return ESP_OK;
+}
+
+esp_err_t debugger_break(debugger_t *dbg)
+{
+    ESP_ERROR_CHECK(dbg ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (dbg->stop == DEBUGGER_RUNNING) {
+        dbg->stop = DEBUGGER_STOP_BREAK;
+        dbg->stop_addr = dbg->cpu->pc;
+    }
+    dbg->is_active = true;
+    return ESP_OK;
+}
+
+esp_err_t debugger_continue(debugger_t *dbg)
+{
+    ESP_ERROR_CHECK(dbg ? ESP_OK : ESP_ERR_INVALID_ARG);
+    dbg->stop = DEBUGGER_RUNNING;
+    // don't stop at the breakpoint the machine stands on
+    dbg->pass_addr = dbg->cpu->pc;
+    debugger_update(dbg);
+    return ESP_OK;
+}
+
+esp_err_t debugger_print_regs(debugger_t *dbg, FILE *out)
+{
+    ESP_ERROR_CHECK(dbg && out ? ESP_OK : ESP_ERR_INVALID_ARG);
+    cpu_t *cpu = dbg->cpu;
+    uint8_t f = cpu->reg_file[CPU_FLAGS];
+    fprintf(out, "PC=%04x SP=%04x AF=%04x BC=%04x DE=%04x HL=%04x %c%c%c%c%c",
+        cpu->pc, cpu->sp, DEBUGGER_AF_VAL(cpu), CPU_BC_VAL(cpu), CPU_DE_VAL(cpu), CPU_HL_VAL(cpu),
+        f & 0x80 ? 'S' : '-', f & 0x40 ? 'Z' : '-', f & 0x10 ? 'A' : '-', f & 0x04 ? 'P' : '-',
+        f & 0x01 ? 'C' : '-');
+#ifdef CPU_Z80_ENABLE
+    if (cpu->type == CPU_TYPE_Z80)
+        fprintf(out, " IX=%04x IY=%04x I=%02x IM%d", cpu->ix, cpu->iy, cpu->i, cpu->im);
+#endif
+    fprintf(out, " %s%s\n", cpu->inte ? "EI" : "DI", cpu->halted ? " HLT" : "");
+    fprintf(out, "%04x: %02x %02x %02x", cpu->pc, debugger_peek(dbg, cpu->pc),
+        debugger_peek(dbg, cpu->pc + 1), debugger_peek(dbg, cpu->pc + 2));
+#ifdef CPU_CYCLES_ENABLE
+    fprintf(out, "    cycles %llu", (unsigned long long)cpu->cycles);
+#endif
+    fprintf(out, "\n");
+    return ESP_OK;
+}
+
+static void debugger_print_cond(const debugger_cond_t *cond, FILE *out)
+{
+    if (cond->op == DEBUGGER_COND_NONE)
+        return;
+    if (cond->reg == DEBUGGER_COND_MEMORY)
+        fprintf(out, " if [%04x]%s%x", cond->addr, debugger_ops[cond->op], cond->value);
+    else
+        fprintf(out, " if %s%s%x", debugger_regs[cond->reg], debugger_ops[cond->op], cond->value);
+}
+
+static const char *debugger_watch_type(uint8_t type)
+{
+    switch (type) {
+        case DEBUGGER_PAGE_READ: return "r";
+        case DEBUGGER_PAGE_WRITE: return "w";
+        default: return "rw";
+    }
+}
+
+esp_err_t debugger_report(debugger_t *dbg, FILE *out)
+{
+    ESP_ERROR_CHECK(dbg && out ? ESP_OK : ESP_ERR_INVALID_ARG);
+    switch (dbg->stop) {
+        case DEBUGGER_STOP_BREAKPOINT:
+            fprintf(out, "breakpoint %u at %04x\n", (unsigned)dbg->stop_index, dbg->stop_addr);
+            break;
+        case DEBUGGER_STOP_WATCHPOINT:
+            fprintf(out, "watchpoint %u: %04x = %02x\n", (unsigned)dbg->stop_index, dbg->stop_addr,
+                debugger_peek(dbg, dbg->stop_addr));
+            break;
+        case DEBUGGER_STOP_BREAK:
+            fprintf(out, "break\n");
+            break;
+        default:
+            break;
+    }
+    return debugger_print_regs(dbg, out);
+}
+
+static bool debugger_parse_hex(const char *s, uint16_t *value)
+{
+    char *end;
+    if (!s || !*s)
+        return false;
+    unsigned long v = strtoul(s, &end, 16);
+    if (*end || v > 0xffff)
+        return false;
+    *value = v;
+    return true;
+}
+
+static bool debugger_parse_cond(const char *s, debugger_cond_t *cond)
+{
+    bzero(cond, sizeof(debugger_cond_t));
+    if (!s)
+        return true;
+    const char *op = strpbrk(s, "=!<>");
+    if (!op || op == s)
+        return false;
+    char name[8];
+    size_t len = op - s;
+    if (len >= sizeof(name))
+        return false;
+    memcpy(name, s, len);
+    name[len] = '\0';
+    if (!strncmp(op, "==", 2))
+        cond->op = DEBUGGER_COND_EQ;
+    else if (!strncmp(op, "!=", 2))
+        cond->op = DEBUGGER_COND_NE;
+    else if (*op == '<')
+        cond->op = DEBUGGER_COND_LT;
+    else if (*op == '>')
+        cond->op = DEBUGGER_COND_GT;
+    else
+        return false;
+    const char *value = op + (cond->op == DEBUGGER_COND_EQ || cond->op == DEBUGGER_COND_NE ? 2 : 1);
+    if (!debugger_parse_hex(value, &cond->value))
+        return false;
+    if (name[0] == '[' && name[len - 1] == ']') {
+        name[len - 1] = '\0';
+        cond->reg = DEBUGGER_COND_MEMORY;
+        return debugger_parse_hex(&name[1], &cond->addr);
+    }
+    for (size_t i = 0; i < DEBUGGER_REGS; ++i)
+        if (!strcasecmp(name, debugger_regs[i])) {
+            cond->reg = i;
+            return true;
+        }
+    return false;
+}
+
+// "if cond" at the end of the command, nothing else
+static bool debugger_parse_if(char **saveptr, debugger_cond_t *cond)
+{
+    char *word = strtok_r(NULL, " ", saveptr);
+    char *expr = word ? strtok_r(NULL, " ", saveptr) : NULL;
+    if (word && (strcmp(word, "if") || !expr || strtok_r(NULL, " ", saveptr)))
+        return false;
+    return debugger_parse_cond(expr, cond);
+}
+
+static void debugger_list(debugger_t *dbg, FILE *out)
+{
+    for (size_t i = 0; i < dbg->breakpoints_count; ++i) {
+        const debugger_breakpoint_t *b = &dbg->breakpoints[i];
+        fprintf(out, "b%u %04x", (unsigned)i, b->addr);
+        debugger_print_cond(&b->cond, out);
+        fprintf(out, ", %u hits\n", b->hits);
+    }
+    for (size_t i = 0; i < dbg->watchpoints_count; ++i) {
+        const debugger_watchpoint_t *w = &dbg->watchpoints[i];
+        fprintf(out, "w%u %s %04x-%04x", (unsigned)i, debugger_watch_type(w->type), w->start, w->end);
+        debugger_print_cond(&w->cond, out);
+        fprintf(out, ", %u hits\n", w->hits);
+    }
+}
+
+static void debugger_dump(debugger_t *dbg, uint16_t addr, uint16_t length, FILE *out)
+{
+    uint8_t data[DEBUGGER_DUMP_SIZE];
+    while (length) {
+        uint16_t n = length < DEBUGGER_DUMP_SIZE ? length : DEBUGGER_DUMP_SIZE;
+        // 0x10000 - addr bytes are left to the end of the address space
+        if (n > 0x10000 - addr)
+            n = 0x10000 - addr;
+        for (uint32_t i = 0; i < n; ++i)
+            data[i] = debugger_peek(dbg, addr + i);
+        debug_hex_dump_addr(out, data, n, addr);
+        length -= n;
+        addr += n;
+        if (!addr)
+            break;
+    }
+}
+
+esp_err_t debugger_single_step(debugger_t *dbg, computer_t *cmp, uint32_t count)
+{
+    ESP_ERROR_CHECK(dbg && cmp ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(debugger_continue(dbg));
+    for (uint32_t i = 0; i < count && dbg->stop == DEBUGGER_RUNNING; ++i)
+        ESP_ERROR_CHECK(debugger_step(dbg, cmp));
+    if (dbg->stop == DEBUGGER_RUNNING) {
+        dbg->stop = DEBUGGER_STOP_STEP;
+        dbg->stop_addr = dbg->cpu->pc;
+    }
+    debugger_update(dbg);
+    return ESP_OK;
+}
+
+esp_err_t debugger_add_breakpoint(debugger_t *dbg, uint16_t addr, const debugger_cond_t *cond)
+{
+    ESP_ERROR_CHECK(dbg ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (dbg->breakpoints_count == DEBUGGER_BREAKPOINTS_MAX)
+        return ESP_ERR_NO_MEM;
+    debugger_breakpoint_t *b = &dbg->breakpoints[dbg->breakpoints_count++];
+    bzero(b, sizeof(debugger_breakpoint_t));
+    b->addr = addr;
+    if (cond)
+        b->cond = *cond;
+    debugger_update(dbg);
+    return ESP_OK;
+}
+
+static void debugger_delete_breakpoint(debugger_t *dbg, size_t i)
+{
+    --dbg->breakpoints_count;
+    memmove(&dbg->breakpoints[i], &dbg->breakpoints[i + 1], (dbg->breakpoints_count - i) * sizeof(debugger_breakpoint_t));
+    debugger_update(dbg);
+}
+
+esp_err_t debugger_remove_breakpoint(debugger_t *dbg, uint16_t addr)
+{
+    ESP_ERROR_CHECK(dbg ? ESP_OK : ESP_ERR_INVALID_ARG);
+    for (size_t i = 0; i < dbg->breakpoints_count; ++i)
+        if (dbg->breakpoints[i].addr == addr) {
+            debugger_delete_breakpoint(dbg, i);
+            return ESP_OK;
+        }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t debugger_add_watchpoint(debugger_t *dbg, uint16_t start, uint16_t end, uint8_t type, const debugger_cond_t *cond)
+{
+    ESP_ERROR_CHECK(dbg && start <= end ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(type && !(type & ~(DEBUGGER_PAGE_READ | DEBUGGER_PAGE_WRITE)) ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (dbg->watchpoints_count == DEBUGGER_WATCHPOINTS_MAX)
+        return ESP_ERR_NO_MEM;
+    debugger_watchpoint_t *w = &dbg->watchpoints[dbg->watchpoints_count++];
+    bzero(w, sizeof(debugger_watchpoint_t));
+    w->start = start;
+    w->end = end;
+    w->type = type;
+    if (cond)
+        w->cond = *cond;
+    debugger_update(dbg);
+    return ESP_OK;
+}
+
+static void debugger_delete_watchpoint(debugger_t *dbg, size_t i)
+{
+    --dbg->watchpoints_count;
+    memmove(&dbg->watchpoints[i], &dbg->watchpoints[i + 1], (dbg->watchpoints_count - i) * sizeof(debugger_watchpoint_t));
+    debugger_update(dbg);
+}
+
+esp_err_t debugger_remove_watchpoint(debugger_t *dbg, uint16_t start, uint16_t end, uint8_t type)
+{
+    ESP_ERROR_CHECK(dbg ? ESP_OK : ESP_ERR_INVALID_ARG);
+    for (size_t i = 0; i < dbg->watchpoints_count; ++i) {
+        const debugger_watchpoint_t *w = &dbg->watchpoints[i];
+        if (w->start == start && w->end == end && w->type == type) {
+            debugger_delete_watchpoint(dbg, i);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t debugger_command(debugger_t *dbg, computer_t *cmp, const char *line, FILE *out)
+{
+    ESP_ERROR_CHECK(dbg && cmp && line && out ? ESP_OK : ESP_ERR_INVALID_ARG);
+    char buf[DEBUGGER_LINE_SIZE];
+    snprintf(buf, sizeof(buf), "%s", line);
+    char *saveptr;
+    char *cmd = strtok_r(buf, " ", &saveptr);
+    if (!cmd)
+        return ESP_OK;
+    char *arg = strtok_r(NULL, " ", &saveptr);
+    uint16_t addr;
+    uint16_t end;
+
+    if (!strcmp(cmd, "h") || !strcmp(cmd, "?"))
+        fputs(debugger_help, out);
+    else if (!strcmp(cmd, "r"))
+        debugger_print_regs(dbg, out);
+    else if (!strcmp(cmd, "m")) {
+        uint16_t length = DEBUGGER_DUMP_SIZE;
+        char *len = arg ? strtok_r(NULL, " ", &saveptr) : NULL;
+        if (!arg)
+            addr = dbg->dump_addr;
+        else if (!debugger_parse_hex(arg, &addr) || (len && !debugger_parse_hex(len, &length)))
+            goto error;
+        debugger_dump(dbg, addr, length, out);
+        dbg->dump_addr = addr + length;
+    }
+    else if (!strcmp(cmd, "s")) {
+        long count = arg ? strtol(arg, NULL, 10) : 1;
+        if (count <= 0)
+            goto error;
+        ESP_ERROR_CHECK(debugger_single_step(dbg, cmp, count));
+        debugger_report(dbg, out);
+    }
+    else if (!strcmp(cmd, "b")) {
+        debugger_cond_t cond;
+        if (!debugger_parse_hex(arg, &addr) || !debugger_parse_if(&saveptr, &cond))
+            goto error;
+        if (debugger_add_breakpoint(dbg, addr, &cond) != ESP_OK) {
+            fprintf(out, "no more breakpoints\n");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    else if (!strcmp(cmd, "w")) {
+        uint8_t type;
+        if (!arg)
+            goto error;
+        if (!strcmp(arg, "r"))
+            type = DEBUGGER_PAGE_READ;
+        else if (!strcmp(arg, "w"))
+            type = DEBUGGER_PAGE_WRITE;
+        else if (!strcmp(arg, "rw"))
+            type = DEBUGGER_PAGE_READ | DEBUGGER_PAGE_WRITE;
+        else
+            goto error;
+        char *range = strtok_r(NULL, " ", &saveptr);
+        char *dash = range ? strchr(range, '-') : NULL;
+        if (dash)
+            *dash++ = '\0';
+        debugger_cond_t cond;
+        if (!debugger_parse_hex(range, &addr) || (dash && !debugger_parse_hex(dash, &end)) ||
+            !debugger_parse_if(&saveptr, &cond))
+            goto error;
+        if (!dash)
+            end = addr;
+        if (end < addr)
+            goto error;
+        if (debugger_add_watchpoint(dbg, addr, end, type, &cond) != ESP_OK) {
+            fprintf(out, "no more watchpoints\n");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    else if (!strcmp(cmd, "l"))
+        debugger_list(dbg, out);
+    else if (!strcmp(cmd, "bd") || !strcmp(cmd, "wd")) {
+        bool is_break = cmd[0] == 'b';
+        size_t count = is_break ? dbg->breakpoints_count : dbg->watchpoints_count;
+        char *endptr;
+        unsigned long i = arg ? strtoul(arg, &endptr, 10) : 0;
+        if (!arg || *endptr || i >= count)
+            goto error;
+        if (is_break)
+            debugger_delete_breakpoint(dbg, i);
+        else
+            debugger_delete_watchpoint(dbg, i);
+    }
+    else if (!strcmp(cmd, "c"))
+        debugger_continue(dbg);
+#ifdef CONFIG_ORION_GDB_STUB
+    else if (!strcmp(cmd, "gdb"))
+        dbg->is_remote = true;
+#endif
+    else
+        goto error;
+    return ESP_OK;
+
+error:
+    fprintf(out, "bad command: %s, h lists the commands\n", line);
+    return ESP_ERR_INVALID_ARG;
+}
+
+// The console task goes on reading stdin, it puts the bytes to the key ring
+// in raw mode. False at the end of input.
+static bool debugger_read_line(keyboard_t *kbd, char *line, size_t size, FILE *out)
+{
+    size_t len = 0;
+    while (1) {
+        uint8_t ch;
+        if (!ring_pop(kbd->ring, &ch, 1)) {
+            if (!kbd->task)
+                return false;
+            vTaskDelay(1);
+            continue;
+        }
+        if (ch == '\r' || ch == '\n') {
+            fputc('\n', out);
+            line[len] = '\0';
+            return true;
+        }
+        if ((ch == 0x08 || ch == 0x7f) && len) {
+            --len;
+            fputs("\b \b", out);
+        }
+        else if (ch >= 0x20 && ch < 0x7f && len < size - 1) {
+            line[len++] = ch;
+            fputc(ch, out);
+        }
+        fflush(out);
+    }
+}
+
+esp_err_t debugger_console(debugger_t *dbg, computer_t *cmp, FILE *out)
+{
+    ESP_ERROR_CHECK(dbg && cmp && out ? ESP_OK : ESP_ERR_INVALID_ARG);
+    keyboard_t *kbd = cmp->kbd;
+    ESP_ERROR_CHECK(debugger_break(dbg));
+    ESP_ERROR_CHECK(keyboard_set_raw(kbd, true));
+    debugger_report(dbg, out);
+    char line[DEBUGGER_LINE_SIZE];
+#ifdef CONFIG_ORION_GDB_STUB
+    dbg->is_remote = false;
+    while (dbg->stop != DEBUGGER_RUNNING && !dbg->is_remote) {
+#else
+    while (dbg->stop != DEBUGGER_RUNNING) {
+#endif
+        fputs("debug> ", out);
+        fflush(out);
+        if (!debugger_read_line(kbd, line, sizeof(line), out)) {
+            ESP_ERROR_CHECK(debugger_continue(dbg));
+            break;
+        }
+        debugger_command(dbg, cmp, line, out);
+    }
+    ESP_ERROR_CHECK(keyboard_set_raw(kbd, false));
+    return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,466 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "computer.h"
+#include "gdb.h"
+
+#ifdef CONFIG_ORION_GDB_STUB
+
+static const char __attribute__((unused)) *TAG = "gdb";
+
+// AF, BC, DE, HL, SP, PC, IX, IY, AF', BC', DE', HL', IR
+#define GDB_REGS 13
+
+static const char gdb_hex[] = "0123456789abcdef";
+static const uint8_t gdb_pairs[] = { CPU_FILE_PSW, CPU_FILE_BC, CPU_FILE_DE, CPU_FILE_HL };
+
+esp_err_t gdb_create(gdb_t **pgdb)
+{
+    ESP_ERROR_CHECK(pgdb ? ESP_OK : ESP_ERR_INVALID_ARG);
+    gdb_t *gdb = (gdb_t *)malloc(sizeof(gdb_t));
+    ESP_ERROR_CHECK(gdb ? ESP_OK : ESP_ERR_NO_MEM);
+    bzero(gdb, sizeof(gdb_t));
+
+    *pgdb = gdb;
+    return ESP_OK;
+}
+
+esp_err_t gdb_init(gdb_t *gdb, computer_t *cmp, gdb_read_cb_t read, gdb_write_cb_t write, void *arg)
+{
+    ESP_ERROR_CHECK(gdb && cmp && read && write ? ESP_OK : ESP_ERR_INVALID_ARG);
+    gdb->cmp = cmp;
+    gdb->dbg = cmp->debugger;
+    gdb->read = read;
+    gdb->write = write;
+    gdb->arg = arg;
+    gdb->state = GDB_WAIT;
+    gdb->is_pending = false;
+    gdb->is_no_ack = false;
+    gdb->is_waiting = false;
+    gdb->is_interrupted = false;
+    gdb->is_attached = true;
+    ESP_LOGI(TAG, "attached");
+    return ESP_OK;
+}
+
+esp_err_t gdb_done(gdb_t *gdb)
+{
+    ESP_ERROR_CHECK(gdb ? ESP_OK : ESP_ERR_INVALID_ARG);
+    free(gdb);
+    return ESP_OK;
+}
+
+static int gdb_hex_value(char ch)
+{
+    if (ch >= '0' && ch <= '9')
+        return ch - '0';
+    if (ch >= 'a' && ch <= 'f')
+        return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F')
+        return ch - 'A' + 10;
+    return -1;
+}
+
+// the hex digits up to the first other character
+static uint32_t gdb_parse_hex(const char **p)
+{
+    uint32_t value = 0;
+    int digit;
+    while ((digit = gdb_hex_value(**p)) >= 0) {
+        value = (value << 4) | digit;
+        ++*p;
+    }
+    return value;
+}
+
+// two hex digits, -1 if they aren't
+static int gdb_parse_byte(const char **p)
+{
+    int high = gdb_hex_value((*p)[0]);
+    int low = high < 0 ? -1 : gdb_hex_value((*p)[1]);
+    if (low < 0)
+        return -1;
+    *p += 2;
+    return (high << 4) | low;
+}
+
+static inline char *gdb_put_byte(char *out, uint8_t value)
+{
+    *out++ = gdb_hex[value >> 4];
+    *out++ = gdb_hex[value & 0x0f];
+    return out;
+}
+
+static void gdb_send(gdb_t *gdb, const char *data)
+{
+    uint8_t sum = 0;
+    size_t length = strlen(data);
+    for (size_t i = 0; i < length; ++i)
+        sum += data[i];
+    char tail[3] = { '#', gdb_hex[sum >> 4], gdb_hex[sum & 0x0f] };
+    gdb->write(gdb->arg, "$", 1);
+    gdb->write(gdb->arg, data, length);
+    gdb->write(gdb->arg, tail, sizeof(tail));
+}
+
+// True when a whole packet with the right checksum is in gdb->packet.
+// The stub never resends, "-" from GDB is ignored as "+" is.
+static bool gdb_input(gdb_t *gdb, uint8_t ch)
+{
+    switch (gdb->state) {
+        case GDB_WAIT:
+            if (ch == '$') {
+                gdb->length = 0;
+                gdb->sum = 0;
+                gdb->is_overflow = false;
+                gdb->state = GDB_PACKET;
+            }
+            return false;
+        case GDB_PACKET:
+            if (ch == '#')
+                gdb->state = GDB_CHECKSUM_HIGH;
+            else {
+                gdb->sum += ch;
+                if (gdb->length < GDB_PACKET_SIZE - 1)
+                    gdb->packet[gdb->length++] = ch;
+                else
+                    gdb->is_overflow = true;
+            }
+            return false;
+        case GDB_CHECKSUM_HIGH:
+            gdb->checksum = gdb_hex_value(ch) << 4;
+            gdb->state = GDB_CHECKSUM_LOW;
+            return false;
+        case GDB_CHECKSUM_LOW:
+        default:
+            gdb->checksum |= gdb_hex_value(ch) & 0x0f;
+            gdb->state = GDB_WAIT;
+            gdb->packet[gdb->length] = '\0';
+            if (gdb->checksum != gdb->sum || gdb->is_overflow) {
+                ESP_LOGW(TAG, "bad packet");
+                if (!gdb->is_no_ack)
+                    gdb->write(gdb->arg, "-", 1);
+                return false;
+            }
+            if (!gdb->is_no_ack)
+                gdb->write(gdb->arg, "+", 1);
+            return true;
+    }
+}
+
+static uint16_t gdb_get_reg(cpu_t *cpu, size_t i)
+{
+    switch (i) {
+        case 0 ... 3: return *(uint16_t *)&cpu->reg_file[gdb_pairs[i]];
+        case 4: return cpu->sp;
+        case 5: return cpu->pc;
+#ifdef CPU_Z80_ENABLE
+        case 6: return cpu->ix;
+        case 7: return cpu->iy;
+        case 8 ... 11: return *(uint16_t *)&cpu->alt_file[gdb_pairs[i - 8]];
+        case 12: return (cpu->i << 8) | cpu->r;
+#endif
+        default: return 0;
+    }
+}
+
+// the Z80 registers of the 8080 are dropped
+static void gdb_set_reg(cpu_t *cpu, size_t i, uint16_t value)
+{
+    switch (i) {
+        case 0 ... 3: *(uint16_t *)&cpu->reg_file[gdb_pairs[i]] = value; break;
+        case 4: cpu->sp = value; break;
+        case 5: cpu->pc = value; break;
+#ifdef CPU_Z80_ENABLE
+        case 6: cpu->ix = value; break;
+        case 7: cpu->iy = value; break;
+        case 8 ... 11: *(uint16_t *)&cpu->alt_file[gdb_pairs[i - 8]] = value; break;
+        case 12:
+            cpu->i = value >> 8;
+            cpu->r = value;
+            break;
+#endif
+        default: break;
+    }
+}
+
+// a register is little endian in the packets
+static bool gdb_parse_reg(const char **p, uint16_t *value)
+{
+    int low = gdb_parse_byte(p);
+    int high = low < 0 ? -1 : gdb_parse_byte(p);
+    if (high < 0)
+        return false;
+    *value = (high << 8) | low;
+    return true;
+}
+
+static void gdb_stop_reply(gdb_t *gdb)
+{
+    debugger_t *dbg = gdb->dbg;
+    if (dbg->stop == DEBUGGER_STOP_WATCHPOINT) {
+        static const char *kinds[] = { "", "rwatch", "watch", "awatch" };
+        uint8_t type = dbg->watchpoints[dbg->stop_index].type;
+        size_t kind = (type & DEBUGGER_PAGE_READ ? 1 : 0) | (type & DEBUGGER_PAGE_WRITE ? 2 : 0);
+        snprintf(gdb->reply, sizeof(gdb->reply), "T05%s:%04x;", kinds[kind], dbg->stop_addr);
+    }
+    else
+        snprintf(gdb->reply, sizeof(gdb->reply), "S%02x", gdb->is_interrupted ? 2 : 5);
+    gdb->is_waiting = false;
+    gdb->is_interrupted = false;
+    gdb_send(gdb, gdb->reply);
+}
+
+static void gdb_detach(gdb_t *gdb)
+{
+    debugger_t *dbg = gdb->dbg;
+    // the machine goes on alone, nobody would take the stops
+    while (dbg->breakpoints_count)
+        debugger_remove_breakpoint(dbg, dbg->breakpoints[0].addr);
+    while (dbg->watchpoints_count)
+        debugger_remove_watchpoint(dbg, dbg->watchpoints[0].start, dbg->watchpoints[0].end, dbg->watchpoints[0].type);
+    gdb->is_attached = false;
+    gdb->is_waiting = false;
+    ESP_LOGI(TAG, "detached");
+}
+
+// "Z0,addr,kind" and "z0,addr,kind": 0 and 1 are breakpoints, 2 are
+// write, 3 read and 4 access watchpoints of kind bytes
+static const char *gdb_point(gdb_t *gdb, const char *p, bool is_insert)
+{
+    int type = *p++ - '0';
+    if (*p++ != ',')
+        return "E01";
+    uint16_t addr = gdb_parse_hex(&p);
+    if (*p++ != ',')
+        return "E01";
+    uint32_t kind = gdb_parse_hex(&p);
+    esp_err_t r;
+    switch (type) {
+        case 0:
+        case 1:
+            r = is_insert ? debugger_add_breakpoint(gdb->dbg, addr, NULL) : debugger_remove_breakpoint(gdb->dbg, addr);
+            break;
+        case 2:
+        case 3:
+        case 4: {
+            static const uint8_t types[] = {
+                DEBUGGER_PAGE_WRITE, DEBUGGER_PAGE_READ, DEBUGGER_PAGE_READ | DEBUGGER_PAGE_WRITE
+            };
+            uint32_t end = addr + (kind ? kind - 1 : 0);
+            if (end > 0xffff)
+                end = 0xffff;
+            r = is_insert ? debugger_add_watchpoint(gdb->dbg, addr, end, types[type - 2], NULL)
+                : debugger_remove_watchpoint(gdb->dbg, addr, end, types[type - 2]);
+            break;
+        }
+        default:
+            return "";
+    }
+    return r == ESP_OK ? "OK" : "E01";
+}
+
+// True when the machine goes on
+static bool gdb_handle(gdb_t *gdb)
+{
+    debugger_t *dbg = gdb->dbg;
+    cpu_t *cpu = dbg->cpu;
+    const char *p = &gdb->packet[1];
+    char *out = gdb->reply;
+    const char *reply = gdb->reply;
+    uint16_t value;
+    *out = '\0';
+
+    switch (gdb->packet[0]) {
+        case '?':
+            gdb_stop_reply(gdb);
+            return false;
+        case 'g':
+            for (size_t i = 0; i < GDB_REGS; ++i) {
+                value = gdb_get_reg(cpu, i);
+                out = gdb_put_byte(out, value);
+                out = gdb_put_byte(out, value >> 8);
+            }
+            *out = '\0';
+            break;
+        case 'G':
+            reply = "OK";
+            for (size_t i = 0; i < GDB_REGS && *p; ++i) {
+                if (!gdb_parse_reg(&p, &value)) {
+                    reply = "E01";
+                    break;
+                }
+                gdb_set_reg(cpu, i, value);
+            }
+            break;
+        case 'p': {
+            uint32_t i = gdb_parse_hex(&p);
+            if (i >= GDB_REGS) {
+                reply = "E01";
+                break;
+            }
+            value = gdb_get_reg(cpu, i);
+            out = gdb_put_byte(out, value);
+            out = gdb_put_byte(out, value >> 8);
+            *out = '\0';
+            break;
+        }
+        case 'P': {
+            uint32_t i = gdb_parse_hex(&p);
+            if (i >= GDB_REGS || *p++ != '=' || !gdb_parse_reg(&p, &value)) {
+                reply = "E01";
+                break;
+            }
+            gdb_set_reg(cpu, i, value);
+            reply = "OK";
+            break;
+        }
+        case 'm': {
+            uint16_t addr = gdb_parse_hex(&p);
+            uint32_t length = *p++ == ',' ? gdb_parse_hex(&p) : 0;
+            if (!length || length > (GDB_PACKET_SIZE - 1) / 2) {
+                reply = "E01";
+                break;
+            }
+            for (uint32_t i = 0; i < length; ++i)
+                out = gdb_put_byte(out, debugger_peek(dbg, addr + i));
+            *out = '\0';
+            break;
+        }
+        case 'M': {
+            uint16_t addr = gdb_parse_hex(&p);
+            uint32_t length = *p++ == ',' ? gdb_parse_hex(&p) : 0;
+            if (*p++ != ':' || strlen(p) != length * 2) {
+                reply = "E01";
+                break;
+            }
+            for (uint32_t i = 0; i < length; ++i)
+                debugger_poke(dbg, addr + i, gdb_parse_byte(&p));
+            reply = "OK";
+            break;
+        }
+        case 'c':
+            if (*p)
+                cpu->pc = gdb_parse_hex(&p);
+            gdb->is_waiting = true;
+            return true;
+        case 's':
+            if (*p)
+                cpu->pc = gdb_parse_hex(&p);
+            ESP_ERROR_CHECK(debugger_single_step(dbg, gdb->cmp, 1));
+            gdb_stop_reply(gdb);
+            return false;
+        case 'Z':
+        case 'z':
+            reply = gdb_point(gdb, p, gdb->packet[0] == 'Z');
+            break;
+        case 'D':
+            gdb_send(gdb, "OK");
+            gdb_detach(gdb);
+            return true;
+        case 'k':
+            gdb_detach(gdb);
+            return true;
+        case 'H':
+        case 'T':
+            reply = "OK";
+            break;
+        case 'q':
+            if (!strncmp(p, "Supported", 9))
+                snprintf(gdb->reply, sizeof(gdb->reply), "PacketSize=%x;QStartNoAckMode+", GDB_PACKET_SIZE);
+            else if (!strcmp(p, "Attached"))
+                reply = "1";
+            else if (!strncmp(p, "Symbol", 6))
+                reply = "OK";
+            break;
+        case 'Q':
+            if (!strcmp(p, "StartNoAckMode")) {
+                gdb_send(gdb, "OK");
+                gdb->is_no_ack = true;
+                return false;
+            }
+            break;
+        default:
+            // an empty reply is "not supported"
+            break;
+    }
+    gdb_send(gdb, reply);
+    return false;
+}
+
+esp_err_t gdb_poll(gdb_t *gdb)
+{
+    ESP_ERROR_CHECK(gdb ? ESP_OK : ESP_ERR_INVALID_ARG);
+    while (gdb->is_attached && !gdb->is_pending) {
+        int ch = gdb->read(gdb->arg);
+        if (ch == GDB_READ_NONE)
+            break;
+        if (ch == GDB_READ_CLOSED) {
+            gdb_detach(gdb);
+            break;
+        }
+        if (gdb->state == GDB_WAIT && ch == 0x03) {
+            gdb->is_interrupted = true;
+            gdb->is_waiting = true;
+            ESP_ERROR_CHECK(debugger_break(gdb->dbg));
+            continue;
+        }
+        // the packets are served with the machine stopped
+        if (gdb->state == GDB_WAIT && ch == '$')
+            ESP_ERROR_CHECK(debugger_break(gdb->dbg));
+        gdb->is_pending = gdb_input(gdb, ch);
+    }
+    return ESP_OK;
+}
+
+esp_err_t gdb_serve(gdb_t *gdb)
+{
+    ESP_ERROR_CHECK(gdb ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (gdb->is_attached && gdb->is_waiting)
+        gdb_stop_reply(gdb);
+    while (gdb->is_attached) {
+        if (gdb->is_pending) {
+            gdb->is_pending = false;
+            if (gdb_handle(gdb))
+                break;
+            continue;
+        }
+        int ch = gdb->read(gdb->arg);
+        if (ch == GDB_READ_NONE) {
+            vTaskDelay(1);
+            continue;
+        }
+        if (ch == GDB_READ_CLOSED) {
+            gdb_detach(gdb);
+            break;
+        }
+        // Ctrl-C of a stopped machine
+        if (gdb->state == GDB_WAIT && ch == 0x03)
+            continue;
+        gdb->is_pending = gdb_input(gdb, ch);
+    }
+    ESP_ERROR_CHECK(debugger_continue(gdb->dbg));
+    return ESP_OK;
+}
+
+#endif
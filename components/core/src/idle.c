@@ -0,0 +1,111 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#include <string.h>
+
+#include "esp_log.h"
+#include "idle.h"
+
+#ifdef CONFIG_ORION_IDLE_DETECT
+
+static const char __attribute__((unused)) *TAG = "idle";
+
+esp_err_t idle_create(idle_t **pidle)
+{
+    ESP_ERROR_CHECK(pidle ? ESP_OK : ESP_ERR_INVALID_ARG);
+    idle_t *idle = (idle_t *)malloc(sizeof(idle_t));
+    ESP_ERROR_CHECK(idle ? ESP_OK : ESP_ERR_NO_MEM);
+    bzero(idle, sizeof(idle_t));
+
+    *pidle = idle;
+    return ESP_OK;
+}
+
+esp_err_t idle_init(idle_t *idle)
+{
+    ESP_ERROR_CHECK(idle ? ESP_OK : ESP_ERR_INVALID_ARG);
+    bzero(idle->history, sizeof(idle->history));
+    idle->history_pos = 0;
+    idle->matches = 0;
+    idle->is_idle = false;
+    return ESP_OK;
+}
+
+esp_err_t idle_done(idle_t *idle)
+{
+    ESP_ERROR_CHECK(idle ? ESP_OK : ESP_ERR_INVALID_ARG);
+    free(idle);
+    return ESP_OK;
+}
+
+static bool idle_seen(idle_t *idle, const idle_state_t *state)
+{
+    for (uint32_t i = 0; i < IDLE_HISTORY_SIZE; ++i)
+        if (!memcmp(&idle->history[i], state, sizeof(idle_state_t)))
+            return true;
+    idle->history[idle->history_pos] = *state;
+    idle->history_pos = (idle->history_pos + 1) % IDLE_HISTORY_SIZE;
+    return false;
+}
+
+// Called after every instruction, before video_step and memory_step take
+// the write flags of the memory.
+esp_err_t idle_step(idle_t *idle, cpu_t *cpu, memory_t *mem, keyboard_t *kbd)
+{
+    // anything visible outside the CPU and the RAM is progress
+    if (mem->video_addr || mem->set_sound || mem->set_video_mode || mem->set_video_buf
+            || mem->set_ram_page || mem->set_rom_disk || kbd->count) {
+        idle->matches = 0;
+        return ESP_OK;
+    }
+    if (!mem->get_keyboard)
+        return ESP_OK;
+    mem->get_keyboard = false;
+
+    idle_state_t state = {
+        pc: cpu->pc,
+        sp: cpu->sp
+    };
+    memcpy(state.reg_file, cpu->reg_file, sizeof(state.reg_file));
+    if (!idle_seen(idle, &state)) {
+        idle->matches = 0;
+        return ESP_OK;
+    }
+    if (++idle->matches < IDLE_MATCHES)
+        return ESP_OK;
+
+    idle->matches = 0;
+    idle->is_idle = true;
+    idle->detections += 1;
+#ifdef CPU_CYCLES_ENABLE
+    cpu->cycles += IDLE_SKIP_CYCLES;
+    idle->skipped_cycles += IDLE_SKIP_CYCLES;
+#endif
+    ESP_LOGD(TAG, "idle at 0x%04x", cpu->pc);
+    return ESP_OK;
+}
+
+esp_err_t idle_wait(idle_t *idle, keyboard_t *kbd)
+{
+    ESP_ERROR_CHECK(idle ? ESP_OK : ESP_ERR_INVALID_ARG);
+    idle->is_idle = false;
+    TickType_t ticks = pdMS_TO_TICKS(IDLE_WAIT_MS);
+    for (TickType_t i = 0; i < ticks && !ring_count(kbd->ring); ++i)
+        vTaskDelay(1);
+    return ESP_OK;
+}
+
+#endif
@@ -14,82 +14,25 @@
  *
  * You should have received a copy of the GNU General Public License
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
- */#include <stdio.h>
+ */#include "sdkconfig.h"
+
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
 #include "esp_log.h"
+#include "esp_vfs_dev.h"
+#include "driver/uart.h"
 
 #include "computer.h"
 #include "keyboard.h"
 
-#define KBD_QUEUE_SIZE 16
-
-#define KBD_KEY_HOME      0x00
-#define KBD_KEY_CLEAR     0x01
-#define KBD_KEY_ESC       0x02
-#define KBD_KEY_F1        0x03
-#define KBD_KEY_F2        0x04
-#define KBD_KEY_F3        0x05
-#define KBD_KEY_F4        0x06
-#define KBD_KEY_F5        0x07
-#define KBD_KEY_TAB       0x08
-#define KBD_KEY_LINEFEED  0x09
-#define KBD_KEY_ENTER     0x0a
-#define KBD_KEY_BACKSPACE 0x0b
-#define KBD_KEY_LEFT      0x0c
-#define KBD_KEY_UP        0x0d
-#define KBD_KEY_RIGHT     0x0e
-#define KBD_KEY_DOWN      0x0f
-#define KBD_KEY_0         0x10
-#define KBD_KEY_1         0x11
-#define KBD_KEY_2         0x12
-#define KBD_KEY_3         0x13
-#define KBD_KEY_4         0x14
-#define KBD_KEY_5         0x15
-#define KBD_KEY_6         0x16
-#define KBD_KEY_7         0x17
-#define KBD_KEY_8         0x18
-#define KBD_KEY_9         0x19
-#define KBD_KEY_COLON     0x1a
-#define KBD_KEY_SEMICOLON 0x1b
-#define KBD_KEY_COMMA     0x1c
-#define KBD_KEY_MINUS     0x1d
-#define KBD_KEY_POINT     0x1e
-#define KBD_KEY_SLASH     0x1f
-#define KBD_KEY_AT        0x20
-#define KBD_KEY_A         0x21
-#define KBD_KEY_B         0x22
-#define KBD_KEY_C         0x23
-#define KBD_KEY_D         0x24
-#define KBD_KEY_E         0x25
-#define KBD_KEY_F         0x26
-#define KBD_KEY_G         0x27
-#define KBD_KEY_H         0x28
-#define KBD_KEY_I         0x29
-#define KBD_KEY_J         0x2a
-#define KBD_KEY_K         0x2b
-#define KBD_KEY_L         0x2c
-#define KBD_KEY_M         0x2d
-#define KBD_KEY_N         0x2e
-#define KBD_KEY_O         0x2f
-#define KBD_KEY_P         0x30
-#define KBD_KEY_Q         0x31
-#define KBD_KEY_R         0x32
-#define KBD_KEY_S         0x33
-#define KBD_KEY_T         0x34
-#define KBD_KEY_U         0x35
-#define KBD_KEY_V         0x36
-#define KBD_KEY_W         0x37
-#define KBD_KEY_X         0x38
-#define KBD_KEY_Y         0x39
-#define KBD_KEY_Z         0x3a
-#define KBD_KEY_SQ_LEFT   0x3b
-#define KBD_KEY_BACKSLASH 0x3c
-#define KBD_KEY_SQ_RIGHT  0x3d
-#define KBD_KEY_AND       0x3e
-#define KBD_KEY_SPACE     0x3f
-#define KBD_KEY_US        0x42
-#define KBD_KEY_SS        0x44
-#define KBD_KEY_RUS       0x48
+#define KBD_RING_SIZE 16
+#define KBD_UART_NUM CONFIG_ESP_CONSOLE_UART_NUM
+#define KBD_UART_RX_BUFFER_SIZE 256
+#define KBD_UART_RX_TIMEOUT 2       // symbols
+#define KBD_ESC_TIMEOUT_MS 25
+#define KBD_ESC_MAX_LENGTH 6
 
 static const char *TAG = "kbd";
 
@@ -105,7 +48,7 @@ void keyboard_key_press(keyboard_t *kbd, uint8_t key) {
     kbd->count = 10000;
 }
 
-static uint8_t keyboard_translate_key(keyboard_t *kbd, uint32_t key) {
+static uint8_t keyboard_translate_key(keyboard_t *kbd, uint64_t key) {
     switch(key) {
         case '[': return KBD_KEY_SQ_LEFT;
         case ']': return KBD_KEY_SQ_RIGHT;
@@ -128,7 +71,7 @@ static uint8_t keyboard_translate_key(keyboard_t *kbd, uint32_t key) {
         case 0x1b4f51: return KBD_KEY_F2;
         case 0x1b4f52: return KBD_KEY_F3;
         case 0x1b4f53: return KBD_KEY_F4;
-        case '`': return KBD_KEY_ESC;
+        case 0x1b: return KBD_KEY_ESC;
         case 0x1b5b48: {
             kbd->tracing = 1;
             return 0xff;
@@ -137,39 +80,161 @@ static uint8_t keyboard_translate_key(keyboard_t *kbd, uint32_t key) {
             kbd->tracing = 0;
             return 0xff;
         }
+        case 0x1b5b357e: {
+            kbd->command = KEYBOARD_COMMAND_SAVE;
+            return 0xff;
+        }
+        case 0x1b5b367e: {
+            kbd->command = KEYBOARD_COMMAND_LOAD;
+            return 0xff;
+        }
+        case 0x1b5b327e: {
+            kbd->command = KEYBOARD_COMMAND_TAPE_PLAY;
+            return 0xff;
+        }
+        case 0x1b5b337e: {
+            kbd->command = KEYBOARD_COMMAND_TAPE_RECORD;
+            return 0xff;
+        }
+        // F10, ESC [ 2 1 ~
+        case 0x1b5b32317e: {
+            kbd->command = KEYBOARD_COMMAND_MENU;
+            return 0xff;
+        }
+        // F5, F6, F7, F8 and F9
+        case 0x1b5b31357e: {
+            kbd->command = KEYBOARD_COMMAND_DEBUG;
+            return 0xff;
+        }
+        case 0x1b5b31377e: {
+            kbd->command = KEYBOARD_COMMAND_PERF;
+            return 0xff;
+        }
+        case 0x1b5b31387e: {
+            kbd->command = KEYBOARD_COMMAND_INPUT_RECORD;
+            return 0xff;
+        }
+        case 0x1b5b31397e: {
+            kbd->command = KEYBOARD_COMMAND_INPUT_REPLAY;
+            return 0xff;
+        }
+        case 0x1b5b32307e: {
+            kbd->command = KEYBOARD_COMMAND_VIDEO_RECORD;
+            return 0xff;
+        }
 
         default: {
             if (key >= '0' && key <= '9') return KBD_KEY_0 + key - '0';
             else if (key >= 'a' && key <= 'z') return KBD_KEY_A + key - 'a';
             else {
-                ESP_LOGI(TAG, "unknown key: 0x%02x", key);
+                ESP_LOGI(TAG, "unknown key: 0x%02llx", (unsigned long long)key);
             }
         }
     }
     return 0xff;
 }
 
+static bool keyboard_push_key(keyboard_t *kbd, uint64_t key) {
+    if (kbd->is_raw) {
+        uint8_t ch = key;
+        return key > 0xff || ring_push(kbd->ring, &ch, 1);
+    }
+    uint8_t data = keyboard_translate_key(kbd, key);
+    return data == 0xff || ring_push(kbd->ring, &data, 1);
+}
+
+static void keyboard_emit_key(keyboard_t *kbd, uint64_t key) {
+    // wait for the emulator to take the keys, like a blocking queue send
+    while (!keyboard_push_key(kbd, key))
+        vTaskDelay(1);
+}
+
+static void keyboard_decode_timeout(keyboard_t *kbd) {
+    // ESC not followed by anything within the timeout is the ESC key itself,
+    // an incomplete sequence is dropped
+    if (kbd->esc_length == 1)
+        keyboard_emit_key(kbd, kbd->esc_key);
+    kbd->esc_key = 0;
+    kbd->esc_length = 0;
+}
+
+static void keyboard_decode(keyboard_t *kbd, uint8_t ch) {
+    switch (kbd->esc_length) {
+        case 0:
+            if (ch == 0x1b) {
+                kbd->esc_key = ch;
+                kbd->esc_length = 1;
+            }
+            else {
+                keyboard_emit_key(kbd, ch);
+            }
+            return;
+        case 1:
+            if (ch != '[' && ch != 'O') {
+                // ESC followed by a plain character: deliver both
+                keyboard_decode_timeout(kbd);
+                keyboard_decode(kbd, ch);
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+
+    kbd->esc_key = (kbd->esc_key << 8) | ch;
+    if (++kbd->esc_length == 2) {
+        kbd->esc_ss3 = (ch == 'O');
+        return;
+    }
+
+    // SS3 sequences (ESC O x) are three bytes long, CSI sequences (ESC [ ...)
+    // end with a final byte in the 0x40..0x7e range
+    if (kbd->esc_ss3 || (ch >= 0x40 && ch <= 0x7e)) {
+        keyboard_emit_key(kbd, kbd->esc_key);
+        kbd->esc_key = 0;
+        kbd->esc_length = 0;
+    }
+    else if (kbd->esc_length >= KBD_ESC_MAX_LENGTH) {
+        kbd->esc_key = 0;
+        kbd->esc_length = 0;
+    }
+}
+
 static void keyboard_wait_key(void *arg) {
     keyboard_t *kbd = (keyboard_t *)arg;
     ESP_ERROR_CHECK(kbd ? ESP_OK : ESP_ERR_INVALID_ARG);
 
-    uint32_t key = 0;
-    int32_t ch;
+    int fd = fileno(stdin);
+    uint8_t buf[16];
     while(1) {
-        vTaskDelay(5);
-        ch = getchar();
-        if (ch == -1) continue;
-        key |= ch & 0xff;
-        if (key == 0x1b || key == 0x1b5b || key == 0x1b4f) {
-            key <<= 8;
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        FD_SET(fd, &rfds);
+        struct timeval tv = {
+            tv_sec: 0,
+            tv_usec: KBD_ESC_TIMEOUT_MS * 1000
+        };
+        // sleep until input arrives, wait only a short time inside escape sequences
+        int s = select(fd + 1, &rfds, NULL, NULL, kbd->esc_length ? &tv : NULL);
+        if (s < 0) {
+            ESP_LOGE(TAG, "select failed");
+            vTaskDelay(1);
             continue;
         }
-        uint8_t data = keyboard_translate_key(kbd, key);
-        if (data != 0xff) {
-            xQueueSend(kbd->queue, &data, portMAX_DELAY);
+        if (s == 0) {
+            keyboard_decode_timeout(kbd);
+            continue;
         }
-        key = 0;
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if (len == 0)
+            break;
+        for (ssize_t i = 0; i < len; ++i)
+            keyboard_decode(kbd, buf[i]);
     }
+    // end of input, the keys can still be put with keyboard_put_key()
+    ESP_LOGI(TAG, "end of input");
+    kbd->task = NULL;
+    vTaskDelete(NULL);
 }
 
 
@@ -187,30 +252,153 @@ esp_err_t keyboard_init(keyboard_t *kbd)
 {
     ESP_ERROR_CHECK(kbd ? ESP_OK : ESP_ERR_INVALID_ARG);
 
-    bzero(kbd->fields, sizeof(kbd->fields));
-    kbd->flags = 0xff;
-    kbd->count = 0;
+    ESP_ERROR_CHECK(keyboard_reset(kbd));
     kbd->tracing = 0;
+    kbd->command = KEYBOARD_COMMAND_NONE;
+    kbd->esc_key = 0;
+    kbd->esc_length = 0;
+    kbd->esc_ss3 = false;
+    kbd->is_raw = false;
+#ifdef CONFIG_ORION_INPUT_REPLAY
+    kbd->record = NULL;
+    kbd->replay = NULL;
+#endif
+
+    ESP_ERROR_CHECK(uart_driver_install(KBD_UART_NUM, KBD_UART_RX_BUFFER_SIZE, 0, 0, NULL, 0));
+    ESP_ERROR_CHECK(uart_set_rx_timeout(KBD_UART_NUM, KBD_UART_RX_TIMEOUT));
+    esp_vfs_dev_uart_use_driver(KBD_UART_NUM);
+    setvbuf(stdin, NULL, _IONBF, 0);
 
-    kbd->queue = xQueueCreate(KBD_QUEUE_SIZE, sizeof(uint8_t));
-    ESP_ERROR_CHECK(kbd->queue ? ESP_OK : ESP_ERR_NO_MEM);
+    ESP_ERROR_CHECK(ring_create(&kbd->ring, KBD_RING_SIZE, sizeof(uint8_t)));
 
-    BaseType_t result = xTaskCreate(keyboard_wait_key, TAG, 2048, kbd, tskIDLE_PRIORITY, &kbd->task);
+    BaseType_t result = xTaskCreatePinnedToCore(keyboard_wait_key, TAG, 2048, kbd,
+        CONFIG_ORION_IO_TASK_PRIORITY, &kbd->task, CONFIG_ORION_IO_TASK_CORE);
     ESP_ERROR_CHECK(result == pdPASS ? ESP_OK : ESP_ERR_NO_MEM);
     return ESP_OK;
 }
 
+esp_err_t keyboard_reset(keyboard_t *kbd)
+{
+    ESP_ERROR_CHECK(kbd ? ESP_OK : ESP_ERR_INVALID_ARG);
+    bzero(kbd->fields, sizeof(kbd->fields));
+    kbd->flags = 0xff;
+    kbd->count = 0;
+    return ESP_OK;
+}
+
 esp_err_t keyboard_done(keyboard_t *kbd)
 {
     ESP_ERROR_CHECK(kbd ? ESP_OK : ESP_ERR_INVALID_ARG);
-    vTaskDelete(kbd->task);
-    vQueueDelete(kbd->queue);
+    if (kbd->task)
+        vTaskDelete(kbd->task);
+    ESP_ERROR_CHECK(ring_done(kbd->ring));
+    esp_vfs_dev_uart_use_nonblocking(KBD_UART_NUM);
+    ESP_ERROR_CHECK(uart_driver_delete(KBD_UART_NUM));
 
     free(kbd);
     return ESP_OK;
 }
 
-esp_err_t keyboard_step(keyboard_t *kbd, memory_t *mem)
+esp_err_t keyboard_put_key(keyboard_t *kbd, uint32_t key)
+{
+    ESP_ERROR_CHECK(kbd ? ESP_OK : ESP_ERR_INVALID_ARG);
+    // the caller may be the emulator itself, so don't wait for a free slot
+    return keyboard_push_key(kbd, key) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t keyboard_set_raw(keyboard_t *kbd, bool is_raw)
+{
+    ESP_ERROR_CHECK(kbd ? ESP_OK : ESP_ERR_INVALID_ARG);
+    uint8_t data[KBD_RING_SIZE];
+    kbd->is_raw = is_raw;
+    ring_pop(kbd->ring, data, KBD_RING_SIZE);
+    return ESP_OK;
+}
+
+#ifdef CONFIG_ORION_INPUT_REPLAY
+// Reads the next key of the replay, KEYBOARD_INPUT_END at the end of file.
+static void keyboard_replay_next(keyboard_t *kbd)
+{
+    char line[64];
+    kbd->replay_cycles = KEYBOARD_INPUT_END;
+    while (fgets(line, sizeof(line), kbd->replay)) {
+        unsigned long long cycles;
+        unsigned key;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "%llu %x", &cycles, &key) != 2 || key > 0xff) {
+            ESP_LOGW(TAG, "bad replay line: %s", line);
+            break;
+        }
+        kbd->replay_cycles = kbd->input_start + cycles;
+        kbd->replay_key = key;
+        return;
+    }
+    ESP_LOGI(TAG, "replay done, %u keys", kbd->input_keys);
+}
+
+esp_err_t keyboard_record(keyboard_t *kbd, FILE *f, uint64_t cycles)
+{
+    ESP_ERROR_CHECK(kbd && f ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (kbd->record || kbd->replay)
+        return ESP_ERR_INVALID_STATE;
+    if (fputs(KEYBOARD_INPUT_HEADER, f) < 0)
+        return ESP_FAIL;
+    kbd->input_start = cycles;
+    kbd->input_keys = 0;
+    kbd->record = f;
+    return ESP_OK;
+}
+
+esp_err_t keyboard_replay(keyboard_t *kbd, FILE *f, uint64_t cycles)
+{
+    ESP_ERROR_CHECK(kbd && f ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (kbd->record || kbd->replay)
+        return ESP_ERR_INVALID_STATE;
+    kbd->input_start = cycles;
+    kbd->input_keys = 0;
+    kbd->replay = f;
+    keyboard_replay_next(kbd);
+    return ESP_OK;
+}
+
+esp_err_t keyboard_input_stop(keyboard_t *kbd)
+{
+    ESP_ERROR_CHECK(kbd ? ESP_OK : ESP_ERR_INVALID_ARG);
+    esp_err_t r = ESP_OK;
+    if (kbd->record && fflush(kbd->record))
+        r = ESP_FAIL;
+    kbd->record = NULL;
+    kbd->replay = NULL;
+    return r;
+}
+
+// The key is taken at the same instruction in the record and in the
+// replay: the key ring is only read when no key is held.
+static bool keyboard_next_key(keyboard_t *kbd, uint8_t *data, uint64_t cycles)
+{
+    if (kbd->replay && kbd->replay_cycles != KEYBOARD_INPUT_END) {
+        // typing would disturb the replay
+        uint8_t dropped;
+        while (ring_pop(kbd->ring, &dropped, 1));
+        if (cycles < kbd->replay_cycles)
+            return false;
+        *data = kbd->replay_key;
+        ++kbd->input_keys;
+        keyboard_replay_next(kbd);
+        return true;
+    }
+    if (!ring_pop(kbd->ring, data, 1))
+        return false;
+    if (kbd->record) {
+        fprintf(kbd->record, "%llu %02x\n", (unsigned long long)(cycles - kbd->input_start), *data);
+        ++kbd->input_keys;
+    }
+    return true;
+}
+#endif
+
+esp_err_t keyboard_step(keyboard_t *kbd, memory_t *mem, uint64_t cycles)
 {
     ESP_ERROR_CHECK(kbd ? ESP_OK : ESP_ERR_INVALID_ARG);
     if (kbd->count) {
@@ -221,9 +409,14 @@ esp_err_t keyboard_step(keyboard_t *kbd, memory_t *mem)
         }
         mem->port_f4r.c.p = (mem->port_f4w.c.p & 0x0f) | kbd->flags;
     }
-    else {
+    // the debugger reads the raw ring, the steps don't take its bytes
+    else if (!kbd->is_raw) {
         uint8_t data;
-        if (xQueueReceive(kbd->queue, &data, (TickType_t)0) == pdTRUE) {
+#ifdef CONFIG_ORION_INPUT_REPLAY
+        if (keyboard_next_key(kbd, &data, cycles)) {
+#else
+        if (ring_pop(kbd->ring, &data, 1)) {
+#endif
             keyboard_key_press(kbd, data);
         }
     }
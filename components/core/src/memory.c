@@ -14,8 +14,13 @@
  *
  * You should have received a copy of the GNU General Public License
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
- */#include <string.h>
+ */#include "sdkconfig.h"
+
+#include <string.h>
 #include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "soc/soc_memory_layout.h"
 #include "memory.h"
 
 static const char __attribute__((unused)) *TAG = "memory";
@@ -25,24 +30,61 @@ esp_err_t memory_create(memory_t **pmem)
     ESP_ERROR_CHECK(pmem ? ESP_OK : ESP_ERR_INVALID_ARG);
     memory_t *mem = (memory_t *)malloc(sizeof(memory_t));
     ESP_ERROR_CHECK(mem ? ESP_OK : ESP_ERR_NO_MEM);
+    bzero(mem, sizeof(memory_t));
 
-    mem->ram_page0 = (uint8_t *)malloc(MEMORY_RAM_PAGE0_SIZE);
-    ESP_ERROR_CHECK(mem->ram_page0 ? ESP_OK : ESP_ERR_NO_MEM);
-    mem->ram_page1 = (uint8_t *)malloc(MEMORY_RAM_PAGE1_SIZE);
-    ESP_ERROR_CHECK(mem->ram_page1 ? ESP_OK : ESP_ERR_NO_MEM);
-    bzero(mem->ram_page0, MEMORY_RAM_PAGE0_SIZE);
-    bzero(mem->ram_page1, MEMORY_RAM_PAGE1_SIZE);
+    // pages 0 and 1 hold the video memory and the system area, they stay in
+    // internal RAM, the expansion pages prefer PSRAM
+    for (size_t i = 0; i < MEMORY_RAM_PAGES; ++i) {
+        size_t size = i ? MEMORY_RAM_PAGE_SIZE : MEMORY_RAM_PAGE0_SIZE;
+        if (i < 2)
+            mem->ram_page[i] = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        else
+            mem->ram_page[i] = (uint8_t *)heap_caps_malloc_prefer(size, 2, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT, MALLOC_CAP_8BIT);
+        ESP_ERROR_CHECK(mem->ram_page[i] ? ESP_OK : ESP_ERR_NO_MEM);
+        bzero(mem->ram_page[i], size);
+    }
+    ESP_LOGI(TAG, "RAM pages: %d", MEMORY_RAM_PAGES);
+    ESP_ERROR_CHECK(romdisk_create(&mem->rom_disk));
+    ESP_ERROR_CHECK(ordos_create(&mem->ram_disk, mem->ram_page[MEMORY_RAM_DISK_PAGE], ORDOS_DISK_SIZE));
 
     *pmem = mem;
     return ESP_OK;
 }
 
 
+static void memory_select_page(memory_t *mem) {
+    uint32_t page = mem->port_f9 & (MEMORY_RAM_PAGES_MAX - 1);
+    mem->ram = page < MEMORY_RAM_PAGES ? mem->ram_page[page] : NULL;
+    // the mounted RAM disk image is copied on the first access only
+    if (page == MEMORY_RAM_DISK_PAGE && ordos_is_pending(mem->ram_disk))
+        ESP_ERROR_CHECK(ordos_attach(mem->ram_disk));
+}
+
 esp_err_t memory_step(memory_t *mem) {
+    if (mem->set_ram_page) {
+        mem->set_ram_page = false;
+        memory_select_page(mem);
+    }
     if (mem->set_rom_disk) {
         mem->set_rom_disk = false;
         uint16_t addr = *(uint16_t *)&mem->port_f5.b;
-        mem->port_f5.a.p = mem->rom_disk[addr];
+        mem->port_f5.a.p = romdisk_read(mem->rom_disk, addr);
+    }
+    if (mem->set_keyboard_ctrl) {
+        mem->set_keyboard_ctrl = false;
+        // bit set/reset of port C, the mode word is kept
+        uint8_t ctrl = mem->port_f4w.ctrl.p;
+        if (!(ctrl & 0x80)) {
+            uint8_t mask = 1 << ((ctrl >> 1) & 0x07);
+            if (ctrl & 0x01)
+                mem->port_f4w.c.p |= mask;
+            else
+                mem->port_f4w.c.p &= ~mask;
+            mem->port_f4w.ctrl.p = mem->port_f4_mode;
+            mem->set_sound = true;
+        }
+        else
+            mem->port_f4_mode = ctrl;
     }
     return ESP_OK;
 }
@@ -53,7 +95,7 @@ esp_err_t memory_init(memory_t *mem)
 {
     ESP_ERROR_CHECK(mem ? ESP_OK : ESP_ERR_INVALID_ARG);
     ESP_ERROR_CHECK(mem->rom ? ESP_OK : ESP_ERR_INVALID_STATE);
-    ESP_ERROR_CHECK(mem->rom_disk ? ESP_OK : ESP_ERR_INVALID_STATE);
+    ESP_ERROR_CHECK(mem->rom_disk->size ? ESP_OK : ESP_ERR_INVALID_STATE);
 
     mem->rom_init = false;
     mem->port_f4r.data = 0xffffffff;
@@ -67,13 +109,20 @@ esp_err_t memory_init(memory_t *mem)
     mem->port_fa = 0;
     mem->port_fb = 0;
     mem->set_keyboard = false;
+    mem->set_keyboard_ctrl = false;
+    mem->set_sound = false;
+    mem->port_f4_mode = 0xff;
     mem->set_video_mode = false;
     mem->set_ram_page = false;
     mem->set_video_buf = false;
+    mem->set_video_refresh = false;
+    mem->set_video_invalidate = false;
     mem->set_rom_disk = false;
+    mem->get_keyboard = false;
     mem->video_addr = 0;
     mem->default_read = 0xffffffff;
     mem->default_write = 0xffffffff;
+    memory_select_page(mem);
 
     return ESP_OK;
 }
@@ -81,8 +130,10 @@ esp_err_t memory_init(memory_t *mem)
 esp_err_t memory_done(memory_t *mem)
 {
     ESP_ERROR_CHECK(mem ? ESP_OK : ESP_ERR_INVALID_ARG);
-    free(mem->ram_page0);
-    free(mem->ram_page1);
+    for (size_t i = 0; i < MEMORY_RAM_PAGES; ++i)
+        heap_caps_free(mem->ram_page[i]);
+    ESP_ERROR_CHECK(romdisk_done(mem->rom_disk));
+    ESP_ERROR_CHECK(ordos_done(mem->ram_disk));
     free(mem);
     return ESP_OK;
 }
@@ -94,10 +145,15 @@ static const uint8_t *memory_get_read_mem_ptr(memory_t *mem, uint16_t addr)
     if (mem->rom_init) {
         switch (addr & 0xfc00) {
             case 0xf000:
-                return &mem->ram_page0[addr];
+                return &mem->ram_page[0][addr];
             case 0xf400:
+#ifdef CONFIG_ORION_PERF_COUNTERS
+                perf_count(&mem->port_reads, 1);
+#endif
                 switch (addr & 0x0300) {
                     case 0x0000:
+                        if ((addr & 0x03) == 0x01)
+                            mem->get_keyboard = true;
                         return ((uint8_t *)&mem->port_f4r) + (addr & 0x03);
                     case 0x0100:
                         return ((uint8_t *)&mem->port_f5) + (addr & 0x03);
@@ -111,12 +167,8 @@ static const uint8_t *memory_get_read_mem_ptr(memory_t *mem, uint16_t addr)
             case 0xfc00:
                 return &mem->rom[addr & 0x7ff];
             default:
-                switch(mem->port_f9 & 3) {
-                    case 0: return &mem->ram_page0[addr];
-                    case 1: return &mem->ram_page1[addr];
-                    case 2:
-                    case 3: return (uint8_t *)&mem->default_read;
-                }
+                if (mem->ram)
+                    return &mem->ram[addr];
                 break;
         }
         return (uint8_t *)&mem->default_read;
@@ -129,11 +181,19 @@ static const uint8_t *memory_get_read_mem_ptr(memory_t *mem, uint16_t addr)
 static uint8_t *memory_get_write_mem_ptr(memory_t *mem, uint16_t addr) {
     switch (addr & 0xfc00) {
         case 0xf000:
-            return &mem->ram_page0[addr];
+            return &mem->ram_page[0][addr];
         case 0xf400:
+#ifdef CONFIG_ORION_PERF_COUNTERS
+            perf_count(&mem->port_writes, 1);
+#endif
             switch (addr & 0x0300) {
                 case 0x0000:
                     mem->set_keyboard = true;
+                    // port C drives the speaker
+                    if ((addr & 0x03) == 0x02)
+                        mem->set_sound = true;
+                    else if ((addr & 0x03) == 0x03)
+                        mem->set_keyboard_ctrl = true;
                     return ((uint8_t *)&mem->port_f4w) + (addr & 0x03);
                 case 0x0100:
                     mem->set_rom_disk = true;
@@ -145,6 +205,9 @@ static uint8_t *memory_get_write_mem_ptr(memory_t *mem, uint16_t addr) {
             }
             break;
         case 0xf800:
+#ifdef CONFIG_ORION_PERF_COUNTERS
+            perf_count(&mem->port_writes, 1);
+#endif
             switch (addr & 0x0300) {
                 case 0x0000:
                     mem->rom_init = true;
@@ -166,12 +229,8 @@ static uint8_t *memory_get_write_mem_ptr(memory_t *mem, uint16_t addr) {
             if ((addr & 0xc000) == (((mem->port_fa & 3) ^ 3) << 14)) {
                 if ((addr & 0x3000) != 0x3000) mem->video_addr = addr;
             }
-            switch(mem->port_f9 & 3) {
-                case 0: return &mem->ram_page0[addr];
-                case 1: return &mem->ram_page1[addr];
-                case 2:
-                case 3: return (uint8_t *)&mem->default_write;
-            }
+            if (mem->ram)
+                return &mem->ram[addr];
             break;
     }
     return (uint8_t *)&mem->default_write;
@@ -189,3 +248,37 @@ uint8_t *memory_writer_cb(uint16_t addr, void *arg)
     return memory_get_write_mem_ptr(mem, addr);
 }
 
+// Goes through the page pointers, the ports, the video address and the
+// contents of the pages stay as they were
+esp_err_t memory_benchmark(memory_t *mem)
+{
+    // even, the inverting writes give the bytes back
+    const uint32_t rounds = 16;
+    ESP_ERROR_CHECK(mem ? ESP_OK : ESP_ERR_INVALID_ARG);
+
+    for (uint32_t page = 0; page < MEMORY_RAM_PAGES; ++page) {
+        volatile uint8_t *data = mem->ram_page[page];
+        uint32_t size = page ? MEMORY_RAM_PAGE_SIZE : MEMORY_RAM_PAGE0_SIZE;
+
+        int64_t start = esp_timer_get_time();
+        for (uint32_t r = 0; r < rounds; ++r)
+            for (uint32_t addr = 0; addr < size; ++addr)
+                (void)data[addr];
+        int64_t seq = esp_timer_get_time() - start;
+
+        // stride through the page to defeat the cache line prefetch
+        start = esp_timer_get_time();
+        for (uint32_t r = 0; r < rounds; ++r)
+            for (uint32_t addr = 0, i = 0; i < size; ++i, addr = (addr + 4099) % size)
+                data[addr] ^= 0xff;
+        int64_t rnd = esp_timer_get_time() - start;
+
+        uint32_t accesses = rounds * size;
+        seq = seq * 10000 / accesses;
+        rnd = rnd * 10000 / accesses;
+        ESP_LOGI(TAG, "page %d %s: sequential read %d.%d ns, random read-modify-write %d.%d ns",
+            page, esp_ptr_external_ram(mem->ram_page[page]) ? "PSRAM" : "internal",
+            (int)(seq / 10), (int)(seq % 10), (int)(rnd / 10), (int)(rnd % 10));
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,265 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "recorder.h"
+
+#ifdef CONFIG_ORION_VIDEO_RECORDER
+
+static const char __attribute__((unused)) *TAG = "recorder";
+
+static inline uint8_t *recorder_put_word(uint8_t *dst, uint16_t value)
+{
+    dst[0] = value & 0xff;
+    dst[1] = value >> 8;
+    return dst + 2;
+}
+
+static inline uint8_t *recorder_put_long(uint8_t *dst, uint32_t value)
+{
+    dst = recorder_put_word(dst, value & 0xffff);
+    return recorder_put_word(dst, value >> 16);
+}
+
+static void recorder_process(void *arg)
+{
+    recorder_t *rec = (recorder_t *)arg;
+    uint8_t batch[RECORDER_WRITE_BATCH];
+    while (1) {
+        size_t count = ring_pop(rec->ring, batch, RECORDER_WRITE_BATCH);
+        if (!count) {
+            vTaskDelay(1);
+            continue;
+        }
+        if (fwrite(batch, count, 1, rec->f) != 1)
+            ESP_LOGW(TAG, "write failed");
+        rec->written += count;
+    }
+}
+
+esp_err_t recorder_create(recorder_t **prec)
+{
+    ESP_ERROR_CHECK(prec ? ESP_OK : ESP_ERR_INVALID_ARG);
+    recorder_t *rec = (recorder_t *)malloc(sizeof(recorder_t));
+    ESP_ERROR_CHECK(rec ? ESP_OK : ESP_ERR_NO_MEM);
+    bzero(rec, sizeof(recorder_t));
+
+    *prec = rec;
+    return ESP_OK;
+}
+
+esp_err_t recorder_done(recorder_t *rec)
+{
+    ESP_ERROR_CHECK(rec ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (rec->is_recording)
+        ESP_ERROR_CHECK(recorder_stop(rec));
+    free(rec);
+    return ESP_OK;
+}
+
+// Frames are dropped whole when the writer falls behind, the next one is
+// a key frame then.
+static bool recorder_push(recorder_t *rec, const uint8_t *data, size_t size)
+{
+    if (rec->ring->length - ring_count(rec->ring) < size) {
+        ++rec->dropped;
+        rec->is_key = true;
+        return false;
+    }
+    ring_push(rec->ring, data, size);
+    rec->pushed += size;
+    return true;
+}
+
+esp_err_t recorder_start(recorder_t *rec, FILE *f, uint64_t cycles)
+{
+    ESP_ERROR_CHECK(rec ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(f ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (rec->is_recording)
+        return ESP_ERR_INVALID_STATE;
+
+    // the buffers live only while recording, in PSRAM when there is one
+    rec->frame = (uint8_t *)heap_caps_malloc_prefer(2 * RECORDER_PAGE_SIZE, 2,
+        MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT, MALLOC_CAP_8BIT);
+    rec->buffer = (uint8_t *)heap_caps_malloc_prefer(RECORDER_MAX_FRAME_SIZE, 2,
+        MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT, MALLOC_CAP_8BIT);
+    if (!rec->frame || !rec->buffer) {
+        heap_caps_free(rec->frame);
+        heap_caps_free(rec->buffer);
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_ERROR_CHECK(ring_create(&rec->ring, RECORDER_RING_SIZE, 1));
+
+    rec->f = f;
+    rec->is_key = true;
+    rec->next_cycles = cycles;
+    rec->skipped = 0;
+    rec->pushed = 0;
+    rec->written = 0;
+    rec->frames = 0;
+    rec->dropped = 0;
+
+    uint8_t *p = rec->buffer;
+    memcpy(p, RECORDER_MAGIC, 4);
+    p = recorder_put_word(p + 4, RECORDER_COLUMNS);
+    p = recorder_put_word(p, RECORDER_ROWS);
+    p = recorder_put_long(p, RECORDER_FRAME_CYCLES);
+    recorder_push(rec, rec->buffer, p - rec->buffer);
+
+    BaseType_t result = xTaskCreatePinnedToCore(recorder_process, TAG, 3072, rec,
+        CONFIG_ORION_IO_TASK_PRIORITY, &rec->task, CONFIG_ORION_IO_TASK_CORE);
+    ESP_ERROR_CHECK(result == pdPASS ? ESP_OK : ESP_ERR_NO_MEM);
+    rec->is_recording = true;
+    return ESP_OK;
+}
+
+esp_err_t recorder_stop(recorder_t *rec)
+{
+    ESP_ERROR_CHECK(rec ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (!rec->is_recording)
+        return ESP_ERR_INVALID_STATE;
+    rec->is_recording = false;
+
+    // an empty frame keeps the time of the unchanged tail
+    uint8_t *p = rec->buffer;
+    if (rec->skipped) {
+        p = recorder_put_word(p, rec->skipped);
+        *p++ = rec->port_f8;
+        *p++ = rec->port_fa;
+        p = recorder_put_word(p, RECORDER_END);
+        recorder_push(rec, rec->buffer, p - rec->buffer);
+    }
+    while (rec->written != rec->pushed)
+        vTaskDelay(1);
+    vTaskDelete(rec->task);
+    fflush(rec->f);
+
+    ESP_ERROR_CHECK(ring_done(rec->ring));
+    heap_caps_free(rec->frame);
+    heap_caps_free(rec->buffer);
+    rec->frame = NULL;
+    rec->buffer = NULL;
+    rec->f = NULL;
+    ESP_LOGI(TAG, "%u frames, %llu bytes, %u dropped", rec->frames, (unsigned long long)rec->pushed, rec->dropped);
+    return ESP_OK;
+}
+
+// Splits a changed span of a column into fill runs of repeated bytes and
+// literal runs of the rest.
+static uint8_t *recorder_put_span(uint8_t *p, uint16_t pos, const uint8_t *data, uint32_t size)
+{
+    uint32_t i = 0;
+    while (i < size) {
+        uint32_t repeat = 1;
+        while (i + repeat < size && data[i + repeat] == data[i])
+            ++repeat;
+        if (repeat >= RECORDER_MIN_FILL) {
+            p = recorder_put_word(p, (pos + i) | RECORDER_FILL);
+            *p++ = repeat - 1;
+            *p++ = data[i];
+            i += repeat;
+            continue;
+        }
+        // the literal ends where a fill run starts
+        uint32_t end = i + repeat;
+        while (end < size) {
+            uint32_t n = 1;
+            while (end + n < size && n < RECORDER_MIN_FILL && data[end + n] == data[end])
+                ++n;
+            if (n >= RECORDER_MIN_FILL)
+                break;
+            end += n;
+        }
+        p = recorder_put_word(p, pos + i);
+        *p++ = end - i - 1;
+        memcpy(p, &data[i], end - i);
+        p += end - i;
+        i = end;
+    }
+    return p;
+}
+
+static uint8_t *recorder_put_column(recorder_t *rec, uint8_t *p, uint16_t pos, const uint8_t *cur, uint8_t *prev)
+{
+    if (rec->is_key) {
+        memcpy(prev, cur, RECORDER_ROWS);
+        return recorder_put_span(p, pos, cur, RECORDER_ROWS);
+    }
+    if (!memcmp(cur, prev, RECORDER_ROWS))
+        return p;
+    uint32_t y = 0;
+    while (1) {
+        while (y < RECORDER_ROWS && cur[y] == prev[y])
+            ++y;
+        if (y == RECORDER_ROWS)
+            break;
+        uint32_t start = y;
+        uint32_t end = y + 1;
+        for (y = end; y < RECORDER_ROWS && y - end < RECORDER_GAP; ++y)
+            if (cur[y] != prev[y])
+                end = y + 1;
+        y = end;
+        memcpy(&prev[start], &cur[start], end - start);
+        p = recorder_put_span(p, pos | start, &cur[start], end - start);
+    }
+    return p;
+}
+
+esp_err_t recorder_step(recorder_t *rec, const memory_t *mem, uint64_t cycles)
+{
+    if (!rec->is_recording || cycles < rec->next_cycles)
+        return ESP_OK;
+    // the idle detector and HLT skip the time by whole frames
+    uint32_t frames = (cycles - rec->next_cycles) / RECORDER_FRAME_CYCLES + 1;
+    rec->next_cycles += (uint64_t)frames * RECORDER_FRAME_CYCLES;
+    rec->skipped += frames;
+    if (!rec->frames)
+        rec->skipped = 0;
+
+    uint32_t base = ((mem->port_fa & 0x03) << 14) ^ 0xc000;
+    uint8_t *p = rec->buffer + RECORDER_FRAME_HEADER_SIZE;
+    for (uint32_t page = 0; page < 2; ++page)
+        for (uint32_t x = 0; x < RECORDER_COLUMNS; ++x)
+            p = recorder_put_column(rec, p, (page ? RECORDER_PAGE1 : 0) | (x << 8),
+                &mem->ram_page[page][base | (x << 8)],
+                &rec->frame[page * RECORDER_PAGE_SIZE + (x << 8)]);
+
+    bool is_changed = p != rec->buffer + RECORDER_FRAME_HEADER_SIZE || rec->is_key ||
+        rec->port_f8 != (uint8_t)mem->port_f8 || rec->port_fa != (uint8_t)mem->port_fa;
+    // the frame counter of the record is 16 bit wide
+    if (!is_changed && rec->skipped < 0xffff)
+        return ESP_OK;
+
+    rec->port_f8 = mem->port_f8;
+    rec->port_fa = mem->port_fa;
+    uint8_t *header = recorder_put_word(rec->buffer, rec->skipped);
+    *header++ = rec->port_f8;
+    *header++ = rec->port_fa;
+    p = recorder_put_word(p, RECORDER_END);
+    rec->is_key = false;
+    // the time of a dropped frame goes to the key frame after it
+    if (recorder_push(rec, rec->buffer, p - rec->buffer)) {
+        ++rec->frames;
+        rec->skipped = 0;
+    }
+    return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#include <string.h>
+#include "esp_log.h"
+#include "romdisk.h"
+
+static const char __attribute__((unused)) *TAG = "romdisk";
+
+static void romdisk_invalidate(romdisk_t *disk)
+{
+    for (size_t i = 0; i < ROMDISK_CACHE_LINES; ++i)
+        disk->tags[i] = ROMDISK_NO_TAG;
+    disk->hits = 0;
+    disk->misses = 0;
+}
+
+esp_err_t romdisk_create(romdisk_t **pdisk)
+{
+    ESP_ERROR_CHECK(pdisk ? ESP_OK : ESP_ERR_INVALID_ARG);
+    romdisk_t *disk = (romdisk_t *)malloc(sizeof(romdisk_t));
+    ESP_ERROR_CHECK(disk ? ESP_OK : ESP_ERR_NO_MEM);
+    bzero(disk, sizeof(romdisk_t));
+    romdisk_invalidate(disk);
+
+    *pdisk = disk;
+    return ESP_OK;
+}
+
+esp_err_t romdisk_set_image(romdisk_t *disk, const uint8_t *data, size_t size)
+{
+    ESP_ERROR_CHECK(disk ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(data ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (size > ROMDISK_IMAGE_MAX_SIZE) {
+        ESP_LOGW(TAG, "image of %d bytes, only %d are addressable", (int)size, ROMDISK_IMAGE_MAX_SIZE);
+        size = ROMDISK_IMAGE_MAX_SIZE;
+    }
+    disk->data = data;
+    disk->offset = 0;
+    disk->size = size;
+    romdisk_invalidate(disk);
+    return ESP_OK;
+}
+
+esp_err_t romdisk_open_partition(romdisk_t *disk, const char *label)
+{
+    ESP_ERROR_CHECK(disk ? ESP_OK : ESP_ERR_INVALID_ARG);
+
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ROMDISK_PARTITION_SUBTYPE, label);
+    if (!part) {
+        ESP_LOGI(TAG, "partition \"%s\" not found", label ? label : "");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    romdisk_dir_header_t header;
+    ESP_ERROR_CHECK(esp_partition_read(part, 0, &header, sizeof(header)));
+    if (memcmp(header.magic, ROMDISK_DIR_MAGIC, sizeof(header.magic)) || header.count > ROMDISK_DIR_ENTRIES) {
+        ESP_LOGI(TAG, "partition \"%s\" has no image directory", part->label);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    size_t dir_size = header.count * sizeof(romdisk_dir_entry_t);
+    romdisk_dir_entry_t *dir = (romdisk_dir_entry_t *)malloc(dir_size + 1);
+    ESP_ERROR_CHECK(dir ? ESP_OK : ESP_ERR_NO_MEM);
+    ESP_ERROR_CHECK(esp_partition_read(part, sizeof(header), dir, dir_size));
+    // the entries starting out of the partition are dropped, the others
+    // cut at its end, without sums: a broken entry may be near 4 GB
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < header.count; ++i) {
+        romdisk_dir_entry_t *entry = &dir[count];
+        *entry = dir[i];
+        entry->name[ROMDISK_NAME_SIZE - 1] = '\0';
+        if (entry->offset >= part->size) {
+            ESP_LOGW(TAG, "image %s: offset 0x%x is out of the partition", entry->name, entry->offset);
+            continue;
+        }
+        if (entry->size > part->size - entry->offset)
+            entry->size = part->size - entry->offset;
+        if (entry->size > ROMDISK_IMAGE_MAX_SIZE) {
+            ESP_LOGW(TAG, "image %d: only %d bytes are addressable", count, ROMDISK_IMAGE_MAX_SIZE);
+            entry->size = ROMDISK_IMAGE_MAX_SIZE;
+        }
+        ESP_LOGI(TAG, "image %d: %s, %d bytes", count, entry->name, entry->size);
+        ++count;
+    }
+
+    if (!disk->cache) {
+        disk->cache = (uint8_t *)malloc(ROMDISK_CACHE_LINES * ROMDISK_CACHE_LINE_SIZE);
+        ESP_ERROR_CHECK(disk->cache ? ESP_OK : ESP_ERR_NO_MEM);
+    }
+    free(disk->dir);
+    disk->dir = dir;
+    disk->dir_count = count;
+    disk->partition = part;
+    return count ? romdisk_select(disk, 0) : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t romdisk_select(romdisk_t *disk, uint32_t index)
+{
+    ESP_ERROR_CHECK(disk ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (!disk->partition || index >= disk->dir_count)
+        return ESP_ERR_NOT_FOUND;
+
+    disk->data = NULL;
+    disk->offset = disk->dir[index].offset;
+    disk->size = disk->dir[index].size;
+    romdisk_invalidate(disk);
+    ESP_LOGI(TAG, "selected image %s", disk->dir[index].name);
+    return ESP_OK;
+}
+
+const char *romdisk_get_name(const romdisk_t *disk, uint32_t index)
+{
+    if (!disk || index >= disk->dir_count)
+        return NULL;
+    return disk->dir[index].name;
+}
+
+esp_err_t romdisk_copy(romdisk_t *disk, uint8_t *dst, uint32_t addr, size_t size)
+{
+    ESP_ERROR_CHECK(disk ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(dst ? ESP_OK : ESP_ERR_INVALID_ARG);
+
+    size_t avail = addr < disk->size ? disk->size - addr : 0;
+    if (avail > size)
+        avail = size;
+    if (avail) {
+        if (disk->data)
+            memcpy(dst, &disk->data[addr], avail);
+        else
+            ESP_ERROR_CHECK(esp_partition_read(disk->partition, disk->offset + addr, dst, avail));
+    }
+    memset(&dst[avail], 0xff, size - avail);
+    return ESP_OK;
+}
+
+esp_err_t romdisk_done(romdisk_t *disk)
+{
+    ESP_ERROR_CHECK(disk ? ESP_OK : ESP_ERR_INVALID_ARG);
+    free(disk->dir);
+    free(disk->cache);
+    free(disk);
+    return ESP_OK;
+}
+
+// Loaders read the disk byte by byte in ascending order, so a miss fetches
+// the requested line together with the following ones in a single flash read.
+void romdisk_fill(romdisk_t *disk, uint32_t tag)
+{
+    uint32_t line = tag % ROMDISK_CACHE_LINES;
+    uint32_t count = ROMDISK_CACHE_PREFETCH;
+    if (line + count > ROMDISK_CACHE_LINES)
+        count = ROMDISK_CACHE_LINES - line;
+
+    uint32_t addr = tag * ROMDISK_CACHE_LINE_SIZE;
+    uint32_t size = count * ROMDISK_CACHE_LINE_SIZE;
+    if (addr + size > disk->size) {
+        size = disk->size - addr;
+        count = (size + ROMDISK_CACHE_LINE_SIZE - 1) / ROMDISK_CACHE_LINE_SIZE;
+    }
+
+    uint8_t *data = &disk->cache[line * ROMDISK_CACHE_LINE_SIZE];
+    ESP_ERROR_CHECK(esp_partition_read(disk->partition, disk->offset + addr, data, size));
+    for (uint32_t i = 0; i < count; ++i)
+        disk->tags[line + i] = tag + i;
+    ++disk->misses;
+}
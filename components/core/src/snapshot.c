@@ -0,0 +1,394 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#include <string.h>
+#include "esp_log.h"
+#include "computer.h"
+
+// Snapshot file, all values are little-endian:
+//   snapshot_header_t
+//   snapshot_state_t
+//   snapshot_z80_state_t, since version 2, zeros for the 8080
+//   for every RAM page:
+//     bitmap of non-zero 256 byte blocks
+//     for every non-zero block: uint16_t length, PackBits encoded block
+
+#define SNAPSHOT_MAGIC "ORSN"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_BLOCK_SIZE 256
+#define SNAPSHOT_PAGE_BLOCKS ((MEMORY_RAM_PAGE0_SIZE + SNAPSHOT_BLOCK_SIZE - 1) / SNAPSHOT_BLOCK_SIZE)
+#define SNAPSHOT_BITMAP_SIZE ((SNAPSHOT_PAGE_BLOCKS + 7) / 8)
+#define SNAPSHOT_PACKED_SIZE (SNAPSHOT_BLOCK_SIZE + SNAPSHOT_BLOCK_SIZE / 128 + 1)
+#define SNAPSHOT_LOADER_SIZE 0x800
+
+#define SNAPSHOT_CPU_INTE   0x01
+#define SNAPSHOT_CPU_HALTED 0x02
+
+typedef struct __attribute__((packed)) snapshot_header {
+    char magic[4];
+    uint8_t version;
+    uint8_t ram_pages;
+    uint16_t reserved;
+    uint32_t rom_hash;
+    uint32_t rom_disk_hash;
+    uint32_t rom_disk_size;
+} snapshot_header_t;
+
+typedef struct __attribute__((packed)) snapshot_state {
+    uint16_t pc;
+    uint16_t sp;
+    uint8_t reg_file[CPU_REG_FILE_SIZE];
+    uint8_t rom_init;
+    uint8_t cpu_flags;
+    uint8_t reserved[2];
+    uint32_t port_f4r;
+    uint32_t port_f4w;
+    uint32_t port_f5;
+    uint32_t port_f6;
+    uint32_t port_f7;
+    uint16_t port_f8;
+    uint16_t port_f9;
+    uint16_t port_fa;
+    uint16_t port_fb;
+    uint8_t kbd_fields[KEYBOARD_FIELDS_NUM];
+    uint8_t kbd_flags;
+    uint32_t kbd_count;
+} snapshot_state_t;
+
+// the registers the Z80 core keeps besides the 8080 ones
+typedef struct __attribute__((packed)) snapshot_z80_state {
+    uint8_t cpu_type;
+    uint8_t i;
+    uint8_t r;
+    uint8_t iff2;
+    uint8_t im;
+    uint8_t reserved[3];
+    uint16_t ix;
+    uint16_t iy;
+    uint16_t wz;
+    uint8_t alt_file[CPU_REG_FILE_SIZE];
+} snapshot_z80_state_t;
+
+static const char __attribute__((unused)) *TAG = "snapshot";
+
+// FNV-1a
+static uint32_t snapshot_hash(uint32_t hash, uint8_t data)
+{
+    return (hash ^ data) * 16777619;
+}
+
+static void snapshot_fill_header(computer_t *cmp, snapshot_header_t *header)
+{
+    memory_t *mem = cmp->mem;
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+    header->version = SNAPSHOT_VERSION;
+    header->ram_pages = MEMORY_RAM_PAGES;
+    header->reserved = 0;
+
+    // the monitor and the ROM disk loader identify the ROM set
+    header->rom_hash = 2166136261;
+    for (uint32_t i = 0; i < 0x800; ++i)
+        header->rom_hash = snapshot_hash(header->rom_hash, mem->rom[i]);
+    header->rom_disk_hash = 2166136261;
+    for (uint32_t i = 0; i < SNAPSHOT_LOADER_SIZE; ++i)
+        header->rom_disk_hash = snapshot_hash(header->rom_disk_hash, romdisk_read(mem->rom_disk, i));
+    header->rom_disk_size = mem->rom_disk->size;
+}
+
+static size_t snapshot_pack(const uint8_t *src, size_t size, uint8_t *dst)
+{
+    size_t len = 0;
+    size_t i = 0;
+    while (i < size) {
+        size_t run = 1;
+        while (i + run < size && run < 128 && src[i + run] == src[i])
+            ++run;
+        if (run > 1) {
+            dst[len++] = 257 - run;
+            dst[len++] = src[i];
+            i += run;
+            continue;
+        }
+        // literal up to the next three equal bytes, shorter repeats don't pay off
+        size_t lit = 1;
+        while (i + lit < size && lit < 128 && !(i + lit + 2 < size
+                && src[i + lit] == src[i + lit + 1] && src[i + lit] == src[i + lit + 2]))
+            ++lit;
+        dst[len++] = lit - 1;
+        memcpy(&dst[len], &src[i], lit);
+        len += lit;
+        i += lit;
+    }
+    return len;
+}
+
+static bool snapshot_unpack(const uint8_t *src, size_t len, uint8_t *dst, size_t size)
+{
+    size_t pos = 0;
+    size_t i = 0;
+    while (i < len) {
+        uint8_t ctrl = src[i++];
+        if (ctrl < 128) {
+            size_t lit = ctrl + 1;
+            if (i + lit > len || pos + lit > size)
+                return false;
+            memcpy(&dst[pos], &src[i], lit);
+            i += lit;
+            pos += lit;
+        }
+        else if (ctrl > 128) {
+            size_t run = 257 - ctrl;
+            if (i >= len || pos + run > size)
+                return false;
+            memset(&dst[pos], src[i++], run);
+            pos += run;
+        }
+    }
+    return pos == size;
+}
+
+static bool snapshot_is_zero(const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+        if (data[i])
+            return false;
+    return true;
+}
+
+static size_t snapshot_page_size(uint32_t page)
+{
+    return page ? MEMORY_RAM_PAGE_SIZE : MEMORY_RAM_PAGE0_SIZE;
+}
+
+static esp_err_t snapshot_save_page(const uint8_t *data, size_t size, FILE *f)
+{
+    uint8_t bitmap[SNAPSHOT_BITMAP_SIZE];
+    bzero(bitmap, sizeof(bitmap));
+    size_t blocks = (size + SNAPSHOT_BLOCK_SIZE - 1) / SNAPSHOT_BLOCK_SIZE;
+    for (size_t i = 0; i < blocks; ++i)
+        if (!snapshot_is_zero(&data[i * SNAPSHOT_BLOCK_SIZE], SNAPSHOT_BLOCK_SIZE))
+            bitmap[i / 8] |= 1 << (i % 8);
+    if (fwrite(bitmap, sizeof(bitmap), 1, f) != 1)
+        return ESP_FAIL;
+
+    uint8_t packed[SNAPSHOT_PACKED_SIZE];
+    for (size_t i = 0; i < blocks; ++i) {
+        if (!(bitmap[i / 8] & (1 << (i % 8))))
+            continue;
+        uint16_t len = snapshot_pack(&data[i * SNAPSHOT_BLOCK_SIZE], SNAPSHOT_BLOCK_SIZE, packed);
+        if (fwrite(&len, sizeof(len), 1, f) != 1 || fwrite(packed, len, 1, f) != 1)
+            return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// Without data only checks the page, the blocks are decoded and dropped
+static esp_err_t snapshot_load_page(uint8_t *data, size_t size, FILE *f)
+{
+    uint8_t bitmap[SNAPSHOT_BITMAP_SIZE];
+    if (fread(bitmap, sizeof(bitmap), 1, f) != 1)
+        return ESP_FAIL;
+
+    uint8_t packed[SNAPSHOT_PACKED_SIZE];
+    uint8_t scratch[SNAPSHOT_BLOCK_SIZE];
+    size_t blocks = (size + SNAPSHOT_BLOCK_SIZE - 1) / SNAPSHOT_BLOCK_SIZE;
+    for (size_t i = 0; i < blocks; ++i) {
+        uint8_t *block = data ? &data[i * SNAPSHOT_BLOCK_SIZE] : scratch;
+        if (!(bitmap[i / 8] & (1 << (i % 8)))) {
+            bzero(block, SNAPSHOT_BLOCK_SIZE);
+            continue;
+        }
+        uint16_t len;
+        if (fread(&len, sizeof(len), 1, f) != 1 || len > sizeof(packed) || fread(packed, len, 1, f) != 1)
+            return ESP_FAIL;
+        if (!snapshot_unpack(packed, len, block, SNAPSHOT_BLOCK_SIZE))
+            return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+esp_err_t computer_save(computer_t *cmp, FILE *f)
+{
+    ESP_ERROR_CHECK(cmp ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(f ? ESP_OK : ESP_ERR_INVALID_ARG);
+    cpu_t *cpu = cmp->cpu;
+    memory_t *mem = cmp->mem;
+    keyboard_t *kbd = cmp->kbd;
+
+    snapshot_header_t header;
+    snapshot_fill_header(cmp, &header);
+
+    snapshot_state_t state = {
+        pc: cpu->pc,
+        sp: cpu->sp,
+        rom_init: mem->rom_init,
+        cpu_flags: (cpu->inte ? SNAPSHOT_CPU_INTE : 0) | (cpu->halted ? SNAPSHOT_CPU_HALTED : 0),
+        port_f4r: mem->port_f4r.data,
+        port_f4w: mem->port_f4w.data,
+        port_f5: mem->port_f5.data,
+        port_f6: mem->port_f6.data,
+        port_f7: mem->port_f7.data,
+        port_f8: mem->port_f8,
+        port_f9: mem->port_f9,
+        port_fa: mem->port_fa,
+        port_fb: mem->port_fb,
+        kbd_flags: kbd->flags,
+        kbd_count: kbd->count
+    };
+    memcpy(state.reg_file, cpu->reg_file, sizeof(state.reg_file));
+    memcpy(state.kbd_fields, kbd->fields, sizeof(state.kbd_fields));
+    snapshot_z80_state_t z80;
+    bzero(&z80, sizeof(z80));
+#ifdef CPU_Z80_ENABLE
+    if (cpu->type == CPU_TYPE_Z80) {
+        z80.cpu_type = CPU_TYPE_Z80;
+        z80.i = cpu->i;
+        z80.r = cpu->r;
+        z80.iff2 = cpu->iff2;
+        z80.im = cpu->im;
+        z80.ix = cpu->ix;
+        z80.iy = cpu->iy;
+        z80.wz = cpu->wz;
+        memcpy(z80.alt_file, cpu->alt_file, sizeof(z80.alt_file));
+    }
+#endif
+
+    if (fwrite(&header, sizeof(header), 1, f) != 1 || fwrite(&state, sizeof(state), 1, f) != 1
+            || fwrite(&z80, sizeof(z80), 1, f) != 1)
+        return ESP_FAIL;
+    // a RAM disk image still waiting for the first access is a part of the page
+    ESP_ERROR_CHECK(ordos_attach(mem->ram_disk));
+    for (uint32_t page = 0; page < MEMORY_RAM_PAGES; ++page) {
+        esp_err_t r = snapshot_save_page(mem->ram_page[page], snapshot_page_size(page), f);
+        if (r != ESP_OK)
+            return r;
+    }
+    ESP_LOGI(TAG, "saved %ld bytes", ftell(f));
+    return ESP_OK;
+}
+
+esp_err_t computer_load(computer_t *cmp, FILE *f)
+{
+    ESP_ERROR_CHECK(cmp ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(f ? ESP_OK : ESP_ERR_INVALID_ARG);
+    cpu_t *cpu = cmp->cpu;
+    memory_t *mem = cmp->mem;
+    keyboard_t *kbd = cmp->kbd;
+
+    snapshot_header_t header;
+    snapshot_state_t state;
+    if (fread(&header, sizeof(header), 1, f) != 1 || fread(&state, sizeof(state), 1, f) != 1)
+        return ESP_FAIL;
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) || header.version > SNAPSHOT_VERSION) {
+        ESP_LOGE(TAG, "unsupported snapshot");
+        return ESP_ERR_INVALID_VERSION;
+    }
+    snapshot_z80_state_t z80;
+    bzero(&z80, sizeof(z80));
+    if (header.version >= 2 && fread(&z80, sizeof(z80), 1, f) != 1)
+        return ESP_FAIL;
+    cpu_type_t cpu_type = CPU_TYPE_8080;
+#ifdef CPU_Z80_ENABLE
+    cpu_type = cpu->type;
+#endif
+    // the registers of one core mean nothing to the other
+    if (z80.cpu_type != cpu_type) {
+        ESP_LOGE(TAG, "snapshot was taken with other CPU");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (header.ram_pages > MEMORY_RAM_PAGES) {
+        ESP_LOGE(TAG, "snapshot needs %d RAM pages", header.ram_pages);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    snapshot_header_t current;
+    snapshot_fill_header(cmp, &current);
+    if (header.rom_hash != current.rom_hash || header.rom_disk_hash != current.rom_disk_hash
+            || header.rom_disk_size != current.rom_disk_size) {
+        ESP_LOGE(TAG, "snapshot was taken with other ROM set");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // a broken file must leave the machine as it was, the pages are checked
+    // before the first byte of them changes
+    long pages_pos = ftell(f);
+    for (uint32_t page = 0; page < header.ram_pages; ++page) {
+        esp_err_t r = snapshot_load_page(NULL, snapshot_page_size(page), f);
+        if (r != ESP_OK) {
+            ESP_LOGE(TAG, "page %d is broken", page);
+            return r;
+        }
+    }
+    if (pages_pos < 0 || fseek(f, pages_pos, SEEK_SET))
+        return ESP_FAIL;
+
+    ESP_ERROR_CHECK(ordos_unmount(mem->ram_disk));
+    for (uint32_t page = 0; page < MEMORY_RAM_PAGES; ++page) {
+        if (page < header.ram_pages) {
+            esp_err_t r = snapshot_load_page(mem->ram_page[page], snapshot_page_size(page), f);
+            if (r != ESP_OK)
+                return r;
+        }
+        else {
+            bzero(mem->ram_page[page], snapshot_page_size(page));
+        }
+    }
+
+    cpu->pc = state.pc;
+    cpu->sp = state.sp;
+    memcpy(cpu->reg_file, state.reg_file, sizeof(state.reg_file));
+    cpu->inte = state.cpu_flags & SNAPSHOT_CPU_INTE ? 1 : 0;
+    cpu->halted = state.cpu_flags & SNAPSHOT_CPU_HALTED ? 1 : 0;
+    cpu->irq = 0;
+#ifdef CPU_Z80_ENABLE
+    if (cpu->type == CPU_TYPE_Z80) {
+        cpu->i = z80.i;
+        cpu->r = z80.r;
+        cpu->iff2 = z80.iff2;
+        cpu->im = z80.im;
+        cpu->ix = z80.ix;
+        cpu->iy = z80.iy;
+        cpu->wz = z80.wz;
+        memcpy(cpu->alt_file, z80.alt_file, sizeof(cpu->alt_file));
+    }
+#endif
+
+    mem->rom_init = state.rom_init;
+    mem->port_f4r.data = state.port_f4r;
+    mem->port_f4w.data = state.port_f4w;
+    // a bit set/reset write never stays in the control register
+    mem->port_f4_mode = mem->port_f4w.ctrl.p;
+    mem->port_f5.data = state.port_f5;
+    mem->port_f6.data = state.port_f6;
+    mem->port_f7.data = state.port_f7;
+    mem->port_f8 = state.port_f8;
+    mem->port_f9 = state.port_f9;
+    mem->port_fa = state.port_fa;
+    mem->port_fb = state.port_fb;
+    mem->set_keyboard = true;
+    mem->set_keyboard_ctrl = false;
+    mem->set_sound = true;
+    mem->set_ram_page = true;
+    mem->set_video_mode = true;
+    mem->set_video_buf = true;
+    mem->set_rom_disk = false;
+
+    memcpy(kbd->fields, state.kbd_fields, sizeof(kbd->fields));
+    kbd->flags = state.kbd_flags;
+    kbd->count = state.kbd_count;
+
+    ESP_LOGI(TAG, "loaded, pc: 0x%04x", cpu->pc);
+    return ESP_OK;
+}
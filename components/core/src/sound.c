@@ -0,0 +1,174 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "sound.h"
+
+#ifdef CONFIG_ORION_SOUND
+
+// events further from the render position are not played in time,
+// the renderer jumps to them instead
+#define SOUND_MAX_LEAD (SOUND_CPU_FREQUENCY / 10)
+#define SOUND_MAX_LAG  (SOUND_CPU_FREQUENCY / 50)
+// delay between a resynchronized event and the render position
+#define SOUND_LATENCY  (2 * SOUND_BLOCK_SAMPLES * (SOUND_CPU_FREQUENCY / SOUND_SAMPLE_RATE))
+
+static const char __attribute__((unused)) *TAG = "sound";
+
+esp_err_t sound_create(sound_t **psnd)
+{
+    ESP_ERROR_CHECK(psnd ? ESP_OK : ESP_ERR_INVALID_ARG);
+    sound_t *snd = (sound_t *)malloc(sizeof(sound_t));
+    ESP_ERROR_CHECK(snd ? ESP_OK : ESP_ERR_NO_MEM);
+    bzero(snd, sizeof(sound_t));
+    ESP_ERROR_CHECK(ring_create(&snd->ring, SOUND_RING_SIZE, sizeof(sound_event_t)));
+
+    // CPU cycles per sample in 16.16 fixed point
+    uint64_t step = ((uint64_t)SOUND_CPU_FREQUENCY << 16) / SOUND_SAMPLE_RATE;
+    snd->step = step >> 16;
+    snd->step_frac = step & 0xffff;
+
+    *psnd = snd;
+    return ESP_OK;
+}
+
+esp_err_t sound_init(sound_t *snd)
+{
+    ESP_ERROR_CHECK(snd ? ESP_OK : ESP_ERR_INVALID_ARG);
+    // the port outputs are high after reset
+    snd->level = 1;
+    snd->render_level = 1;
+    snd->is_synced = false;
+    snd->dc_x = 0;
+    snd->dc_y = 0;
+    snd->event_count = 0;
+    snd->event_index = 0;
+#ifdef SOUND_OUTPUT_ENABLE
+    ESP_ERROR_CHECK(sound_output_start(snd));
+#endif
+    ESP_LOGI(TAG, "sample rate: %d", SOUND_SAMPLE_RATE);
+    return ESP_OK;
+}
+
+esp_err_t sound_done(sound_t *snd)
+{
+    ESP_ERROR_CHECK(snd ? ESP_OK : ESP_ERR_INVALID_ARG);
+#ifdef SOUND_OUTPUT_ENABLE
+    if (snd->task)
+        ESP_ERROR_CHECK(sound_output_stop(snd));
+#endif
+    ESP_ERROR_CHECK(ring_done(snd->ring));
+    free(snd);
+    return ESP_OK;
+}
+
+esp_err_t sound_step(sound_t *snd, memory_t *mem, uint64_t cycles)
+{
+    // the speaker shares the tape output, port C bit 0
+    uint8_t level = mem->port_f4w.c.p0;
+    if (level != snd->level) {
+        snd->level = level;
+        sound_event_t event = {
+            cycles: (uint32_t)cycles,
+            level: level
+        };
+        // a full ring means the renderer is behind, it resynchronizes
+        // on the next event anyway
+        ring_push_lossy(snd->ring, &event, 1);
+    }
+    return ESP_OK;
+}
+
+esp_err_t sound_sync(sound_t *snd, uint32_t cycles)
+{
+    ESP_ERROR_CHECK(snd ? ESP_OK : ESP_ERR_INVALID_ARG);
+    snd->time = cycles;
+    snd->time_frac = 0;
+    snd->is_synced = true;
+    return ESP_OK;
+}
+
+static inline const sound_event_t *sound_next_event(sound_t *snd)
+{
+    if (snd->event_index == snd->event_count) {
+        snd->event_count = ring_pop(snd->ring, snd->events, SOUND_EVENT_BATCH);
+        snd->event_index = 0;
+        if (!snd->event_count)
+            return NULL;
+    }
+    const sound_event_t *event = &snd->events[snd->event_index];
+    int32_t delta = (int32_t)(event->cycles - snd->time);
+    if (!snd->is_synced || delta > SOUND_MAX_LEAD || delta < -SOUND_MAX_LAG) {
+        // the emulation runs at its own pace, the output at the sample rate
+        ESP_LOGD(TAG, "resync: %d cycles", delta);
+        snd->time = event->cycles - SOUND_LATENCY;
+        snd->time_frac = 0;
+        snd->is_synced = true;
+    }
+    return event;
+}
+
+esp_err_t sound_render(sound_t *snd, int16_t *samples, size_t count)
+{
+    ESP_ERROR_CHECK(snd ? ESP_OK : ESP_ERR_INVALID_ARG);
+    for (size_t i = 0; i < count; ++i) {
+        snd->time_frac += snd->step_frac;
+        uint32_t span = snd->step + (snd->time_frac >> 16);
+        snd->time_frac &= 0xffff;
+
+        // box filter: the sample is the part of its span the speaker was on
+        uint32_t start = snd->time;
+        uint32_t pos = start;
+        uint32_t end = start + span;
+        uint32_t high = 0;
+        const sound_event_t *event;
+        while ((event = sound_next_event(snd))) {
+            if (snd->time != start) {
+                // resynchronized, the sample starts over at the new position
+                start = pos = snd->time;
+                end = start + span;
+                high = 0;
+            }
+            if ((int32_t)(event->cycles - end) >= 0)
+                break;
+            if ((int32_t)(event->cycles - pos) > 0) {
+                if (snd->render_level)
+                    high += event->cycles - pos;
+                pos = event->cycles;
+            }
+            snd->render_level = event->level;
+            ++snd->event_index;
+        }
+        if (snd->render_level)
+            high += end - pos;
+        snd->time = end;
+
+        // the DC blocker removes the constant level of an idle speaker
+        int32_t x = (int32_t)(high * 2 * SOUND_AMPLITUDE / span) - SOUND_AMPLITUDE;
+        int32_t y = x - snd->dc_x + snd->dc_y - (snd->dc_y >> 8);
+        snd->dc_x = x;
+        snd->dc_y = y;
+        if (y > INT16_MAX) y = INT16_MAX;
+        if (y < INT16_MIN) y = INT16_MIN;
+        samples[i] = y;
+    }
+    return ESP_OK;
+}
+
+#endif // CONFIG_ORION_SOUND
@@ -0,0 +1,112 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#include "driver/i2s.h"
+#include "esp_log.h"
+#include "sound.h"
+
+#ifdef SOUND_OUTPUT_ENABLE
+
+#define SOUND_I2S_NUM I2S_NUM_0
+#define SOUND_DMA_BUFFERS 4
+
+static const char __attribute__((unused)) *TAG = "sound";
+
+// Renders the speaker transitions block by block, i2s_write blocks until
+// the DMA has room, so the output pace is set by the sample rate.
+static void sound_output_process(void *arg)
+{
+    sound_t *snd = (sound_t *)arg;
+    ESP_ERROR_CHECK(snd ? ESP_OK : ESP_ERR_INVALID_ARG);
+
+    static int16_t samples[SOUND_BLOCK_SAMPLES];
+    static uint16_t frames[SOUND_BLOCK_SAMPLES * 2];
+    while (1) {
+        ESP_ERROR_CHECK(sound_render(snd, samples, SOUND_BLOCK_SAMPLES));
+        for (size_t i = 0; i < SOUND_BLOCK_SAMPLES; ++i) {
+#ifdef CONFIG_ORION_SOUND_OUTPUT_DAC
+            // the built-in DAC takes the unsigned high byte
+            uint16_t sample = (uint16_t)(samples[i] + 0x8000);
+#else
+            uint16_t sample = (uint16_t)samples[i];
+#endif
+            frames[i * 2] = sample;
+            frames[i * 2 + 1] = sample;
+        }
+        size_t written;
+        ESP_ERROR_CHECK(i2s_write(SOUND_I2S_NUM, frames, sizeof(frames), &written, portMAX_DELAY));
+    }
+}
+
+esp_err_t sound_output_start(sound_t *snd)
+{
+    ESP_ERROR_CHECK(snd ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(!snd->task ? ESP_OK : ESP_ERR_INVALID_STATE);
+
+#ifdef CONFIG_ORION_SOUND_OUTPUT_DAC
+    i2s_mode_t mode = I2S_MODE_MASTER | I2S_MODE_TX | I2S_MODE_DAC_BUILT_IN;
+    i2s_comm_format_t format = I2S_COMM_FORMAT_STAND_MSB;
+#else
+    i2s_mode_t mode = I2S_MODE_MASTER | I2S_MODE_TX;
+    i2s_comm_format_t format = I2S_COMM_FORMAT_STAND_I2S;
+#endif
+    i2s_config_t config = {
+        mode: mode,
+        sample_rate: SOUND_SAMPLE_RATE,
+        bits_per_sample: I2S_BITS_PER_SAMPLE_16BIT,
+        channel_format: I2S_CHANNEL_FMT_RIGHT_LEFT,
+        communication_format: format,
+        intr_alloc_flags: 0,
+        dma_buf_count: SOUND_DMA_BUFFERS,
+        dma_buf_len: SOUND_BLOCK_SAMPLES,
+        use_apll: false,
+        tx_desc_auto_clear: true
+    };
+    ESP_ERROR_CHECK(i2s_driver_install(SOUND_I2S_NUM, &config, 0, NULL));
+#ifdef CONFIG_ORION_SOUND_OUTPUT_DAC
+    // DAC channel 1, GPIO25
+    ESP_ERROR_CHECK(i2s_set_pin(SOUND_I2S_NUM, NULL));
+    ESP_ERROR_CHECK(i2s_set_dac_mode(I2S_DAC_CHANNEL_RIGHT_EN));
+#else
+    i2s_pin_config_t pins = {
+        bck_io_num: CONFIG_ORION_SOUND_I2S_BCK_PIN,
+        ws_io_num: CONFIG_ORION_SOUND_I2S_WS_PIN,
+        data_out_num: CONFIG_ORION_SOUND_I2S_DATA_PIN,
+        data_in_num: I2S_PIN_NO_CHANGE
+    };
+    ESP_ERROR_CHECK(i2s_set_pin(SOUND_I2S_NUM, &pins));
+#endif
+
+    BaseType_t result = xTaskCreatePinnedToCore(sound_output_process, TAG, 2048, snd,
+        CONFIG_ORION_IO_TASK_PRIORITY + 1, &snd->task, CONFIG_ORION_IO_TASK_CORE);
+    ESP_ERROR_CHECK(result == pdPASS ? ESP_OK : ESP_ERR_NO_MEM);
+    return ESP_OK;
+}
+
+esp_err_t sound_output_stop(sound_t *snd)
+{
+    ESP_ERROR_CHECK(snd ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(snd->task ? ESP_OK : ESP_ERR_INVALID_STATE);
+    vTaskDelete(snd->task);
+    snd->task = NULL;
+#ifdef CONFIG_ORION_SOUND_OUTPUT_DAC
+    ESP_ERROR_CHECK(i2s_set_dac_mode(I2S_DAC_CHANNEL_DISABLE));
+#endif
+    ESP_ERROR_CHECK(i2s_driver_uninstall(SOUND_I2S_NUM));
+    return ESP_OK;
+}
+
+#endif // SOUND_OUTPUT_ENABLE
@@ -0,0 +1,353 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "tape.h"
+
+#ifdef CONFIG_ORION_TAPE
+
+#define TAPE_CAPACITY_MIN 0x1000
+// no edge for this many half bits ends a record
+#define TAPE_SILENCE_HALVES 8
+
+static const char __attribute__((unused)) *TAG = "tape";
+
+esp_err_t tape_create(tape_t **ptape)
+{
+    ESP_ERROR_CHECK(ptape ? ESP_OK : ESP_ERR_INVALID_ARG);
+    tape_t *tape = (tape_t *)malloc(sizeof(tape_t));
+    ESP_ERROR_CHECK(tape ? ESP_OK : ESP_ERR_NO_MEM);
+    bzero(tape, sizeof(tape_t));
+    tape->level = 1;
+    tape->out_level = 1;
+
+    *ptape = tape;
+    return ESP_OK;
+}
+
+esp_err_t tape_done(tape_t *tape)
+{
+    ESP_ERROR_CHECK(tape ? ESP_OK : ESP_ERR_INVALID_ARG);
+    free(tape->data);
+    free(tape);
+    return ESP_OK;
+}
+
+static esp_err_t tape_reserve(tape_t *tape, size_t size)
+{
+    if (size <= tape->capacity)
+        return ESP_OK;
+    size_t capacity = tape->capacity ? tape->capacity : TAPE_CAPACITY_MIN;
+    while (capacity < size)
+        capacity <<= 1;
+    uint8_t *data = (uint8_t *)realloc(tape->data, capacity);
+    if (!data)
+        return ESP_ERR_NO_MEM;
+    tape->data = data;
+    tape->capacity = capacity;
+    return ESP_OK;
+}
+
+static esp_err_t tape_append(tape_t *tape, const uint8_t *data, size_t size)
+{
+    esp_err_t r = tape_reserve(tape, tape->size + size);
+    if (r != ESP_OK)
+        return r;
+    memcpy(&tape->data[tape->size], data, size);
+    tape->size += size;
+    return ESP_OK;
+}
+
+static esp_err_t tape_append_byte(tape_t *tape, uint8_t value, size_t count)
+{
+    esp_err_t r = tape_reserve(tape, tape->size + count);
+    if (r != ESP_OK)
+        return r;
+    memset(&tape->data[tape->size], value, count);
+    tape->size += count;
+    return ESP_OK;
+}
+
+static esp_err_t tape_append_word(tape_t *tape, uint16_t value)
+{
+    // the monitors write the high byte first
+    uint8_t data[] = { value >> 8, value & 0xff };
+    return tape_append(tape, data, sizeof(data));
+}
+
+static esp_err_t tape_append_sync(tape_t *tape, size_t pilot)
+{
+    esp_err_t r = tape_append_byte(tape, 0, pilot);
+    return r == ESP_OK ? tape_append_byte(tape, TAPE_SYNC_BYTE, 1) : r;
+}
+
+// Monitor checksum (0xF82A): the last byte is added to the low byte only.
+static uint16_t tape_checksum(const uint8_t *data, size_t size)
+{
+    uint8_t lo = 0;
+    uint8_t hi = 0;
+    for (size_t i = 0; i < size; ++i) {
+        uint16_t sum = lo + data[i];
+        lo = sum;
+        if (i + 1 < size)
+            hi += data[i] + (sum >> 8);
+    }
+    return (hi << 8) | lo;
+}
+
+// The ORDOS tape utility writes the name, then the file with its header as
+// a block from 0 to the file size inclusive, like the monitor does.
+static esp_err_t tape_load_ord(tape_t *tape, const uint8_t *file, size_t size)
+{
+    if (size < TAPE_ORD_HEADER_SIZE || size > 0xfff0)
+        return ESP_ERR_INVALID_SIZE;
+    uint8_t *block = (uint8_t *)calloc(size + 1, 1);
+    if (!block)
+        return ESP_ERR_NO_MEM;
+    memcpy(block, file, size);
+
+    esp_err_t r = tape_append_sync(tape, TAPE_PILOT_SIZE);
+    if (r == ESP_OK) r = tape_append(tape, block, TAPE_ORD_NAME_SIZE);
+    if (r == ESP_OK) r = tape_append_sync(tape, TAPE_ORD_GAP_SIZE);
+    if (r == ESP_OK) r = tape_append_word(tape, 0);
+    if (r == ESP_OK) r = tape_append_word(tape, size);
+    if (r == ESP_OK) r = tape_append(tape, block, size + 1);
+    if (r == ESP_OK) r = tape_append_word(tape, 0);
+    if (r == ESP_OK) r = tape_append_byte(tape, TAPE_SYNC_BYTE, 1);
+    if (r == ESP_OK) r = tape_append_word(tape, tape_checksum(block, size + 1));
+    free(block);
+    return r;
+}
+
+esp_err_t tape_load(tape_t *tape, FILE *f, bool is_ord)
+{
+    ESP_ERROR_CHECK(tape && f ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(tape->state == TAPE_STOPPED ? ESP_OK : ESP_ERR_INVALID_STATE);
+
+    if (fseek(f, 0, SEEK_END) != 0)
+        return ESP_FAIL;
+    long size = ftell(f);
+    if (size <= 0 || fseek(f, 0, SEEK_SET) != 0)
+        return size ? ESP_FAIL : ESP_ERR_INVALID_SIZE;
+    uint8_t *file = (uint8_t *)malloc(size);
+    if (!file)
+        return ESP_ERR_NO_MEM;
+    if (fread(file, 1, size, f) != size) {
+        free(file);
+        return ESP_FAIL;
+    }
+
+    tape->size = 0;
+    tape->pos = 0;
+    esp_err_t r;
+    if (is_ord)
+        r = tape_load_ord(tape, file, size);
+    else {
+        // images often start right after the sync byte
+        size_t i = 0;
+        while (i < size && !file[i])
+            ++i;
+        r = ESP_OK;
+        if (i == size || file[i] != TAPE_SYNC_BYTE)
+            r = tape_append_sync(tape, TAPE_PILOT_SIZE);
+        if (r == ESP_OK)
+            r = tape_append(tape, file, size);
+    }
+    free(file);
+    if (r == ESP_OK)
+        ESP_LOGI(TAG, "loaded %u bytes", (unsigned)tape->size);
+    return r;
+}
+
+esp_err_t tape_save(tape_t *tape, FILE *f)
+{
+    ESP_ERROR_CHECK(tape && f ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (tape->size && fwrite(tape->data, tape->size, 1, f) != 1)
+        return ESP_FAIL;
+    return ESP_OK;
+}
+
+static inline uint32_t tape_half_cycles(tape_t *tape)
+{
+    // bits go out MSB first, two halves each
+    uint8_t bit = (tape->data[tape->pos] >> (7 - (tape->half >> 1))) & 1;
+    tape->level = (tape->half & 1) ? bit : bit ^ 1;
+    return tape->half ? TAPE_HALF_BIT_CYCLES : TAPE_HALF_BIT_CYCLES + TAPE_BYTE_GAP_CYCLES;
+}
+
+esp_err_t tape_play(tape_t *tape, bool is_fast, uint64_t cycles)
+{
+    ESP_ERROR_CHECK(tape ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (!tape->size)
+        return ESP_ERR_INVALID_SIZE;
+    tape->state = TAPE_PLAYING;
+    tape->is_fast = is_fast;
+    tape->pos = 0;
+    tape->half = 0;
+    tape->next_edge = cycles + tape_half_cycles(tape);
+    ESP_LOGI(TAG, "play %u bytes%s", (unsigned)tape->size, is_fast ? ", fast" : "");
+    return ESP_OK;
+}
+
+esp_err_t tape_record(tape_t *tape, bool is_fast)
+{
+    ESP_ERROR_CHECK(tape ? ESP_OK : ESP_ERR_INVALID_ARG);
+    tape->state = TAPE_RECORDING;
+    tape->is_fast = is_fast;
+    tape->size = 0;
+    tape->pos = 0;
+    tape->is_synced = false;
+    tape->half_cycles = 0;
+    tape->last_edge = 0;
+    tape->last_mid = 0;
+    ESP_LOGI(TAG, "record%s", is_fast ? ", fast" : "");
+    return ESP_OK;
+}
+
+esp_err_t tape_stop(tape_t *tape)
+{
+    ESP_ERROR_CHECK(tape ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (tape->state != TAPE_STOPPED)
+        ESP_LOGI(TAG, "stop at %u of %u bytes", (unsigned)tape->pos, (unsigned)tape->size);
+    tape->state = TAPE_STOPPED;
+    tape->level = 1;
+    return ESP_OK;
+}
+
+static inline void tape_return(cpu_t *cpu, memory_t *mem)
+{
+    uint16_t lo = *memory_reader_cb(cpu->sp, mem);
+    uint16_t hi = *memory_reader_cb(cpu->sp + 1, mem);
+    cpu->pc = (hi << 8) | lo;
+    cpu->sp += 2;
+#ifdef CPU_CYCLES_ENABLE
+    cpu->cycles += 10;
+#endif
+}
+
+// 0xF806: A = 0xFF searches the sync byte first, the byte read is returned in A
+static void tape_fast_read(tape_t *tape, cpu_t *cpu, memory_t *mem)
+{
+    size_t pos = tape->pos;
+    if (CPU_A_VAL(cpu) == 0xff) {
+        while (pos < tape->size && tape->data[pos] != TAPE_SYNC_BYTE)
+            ++pos;
+        ++pos;
+    }
+    if (pos >= tape->size) {
+        // the monitor waits for the signal then, like with a real tape
+        tape->pos = tape->size;
+        ESP_ERROR_CHECK(tape_stop(tape));
+        return;
+    }
+    CPU_A_VAL(cpu) = tape->data[pos];
+    tape->pos = pos + 1;
+    tape_return(cpu, mem);
+}
+
+// 0xF80C: the byte is in C
+static void tape_fast_write(tape_t *tape, cpu_t *cpu, memory_t *mem)
+{
+    if (tape_append_byte(tape, cpu->reg_file[CPU_FILE_C], 1) != ESP_OK) {
+        ESP_LOGW(TAG, "no memory, recording stopped");
+        ESP_ERROR_CHECK(tape_stop(tape));
+        return;
+    }
+    tape->pos = tape->size;
+    tape_return(cpu, mem);
+}
+
+esp_err_t tape_step(tape_t *tape, cpu_t *cpu, memory_t *mem)
+{
+    if (tape->is_fast) {
+        // only monitors with the standard entry table
+        if (cpu->pc == TAPE_READ_ENTRY && tape->state == TAPE_PLAYING && mem->rom[TAPE_READ_ENTRY & 0x7ff] == 0xc3)
+            tape_fast_read(tape, cpu, mem);
+        else if (cpu->pc == TAPE_WRITE_ENTRY && tape->state == TAPE_RECORDING && mem->rom[TAPE_WRITE_ENTRY & 0x7ff] == 0xc3)
+            tape_fast_write(tape, cpu, mem);
+        return ESP_OK;
+    }
+    if (tape->state != TAPE_PLAYING)
+        return ESP_OK;
+
+    while (cpu->cycles >= tape->next_edge) {
+        if (++tape->half == 16) {
+            tape->half = 0;
+            if (++tape->pos == tape->size) {
+                ESP_ERROR_CHECK(tape_stop(tape));
+                break;
+            }
+        }
+        tape->next_edge += tape_half_cycles(tape);
+    }
+    mem->port_f4r.c.p4 = tape->level;
+    return ESP_OK;
+}
+
+static void tape_capture_bit(tape_t *tape, uint8_t bit)
+{
+    tape->shift = (tape->shift << 1) | bit;
+    if (!tape->is_synced) {
+        if (tape->shift == TAPE_SYNC_BYTE) {
+            // the pilot length is lost, write the usual one
+            tape->is_synced = true;
+            tape->bits = 0;
+            if (tape_append_sync(tape, TAPE_PILOT_SIZE) != ESP_OK)
+                ESP_LOGW(TAG, "no memory for the record");
+        }
+        return;
+    }
+    if (++tape->bits == 8) {
+        tape->bits = 0;
+        if (tape_append_byte(tape, tape->shift, 1) != ESP_OK)
+            ESP_LOGW(TAG, "no memory for the record");
+        tape->pos = tape->size;
+    }
+}
+
+// Decodes the bit stream like the monitor does: the edge in the middle of a
+// bit gives its value, an edge less than 3/4 bit after it is a bit boundary.
+esp_err_t tape_output(tape_t *tape, memory_t *mem, uint64_t cycles)
+{
+    uint8_t level = mem->port_f4w.c.p0;
+    if (tape->is_fast || level == tape->out_level)
+        return ESP_OK;
+    tape->out_level = level;
+
+    uint64_t interval = cycles - tape->last_edge;
+    tape->last_edge = cycles;
+    if (!tape->half_cycles || interval > (uint64_t)tape->half_cycles * TAPE_SILENCE_HALVES) {
+        // a new record, the pilot gives the speed
+        tape->is_synced = false;
+        tape->half_cycles = interval > 0xffff ? 0xffff : interval;
+        tape->last_mid = cycles;
+        return ESP_OK;
+    }
+    if (interval < tape->half_cycles)
+        tape->half_cycles = interval;
+
+    uint32_t window = tape->half_cycles * 3 / 2;
+    if (cycles - tape->last_mid < window && interval < window)
+        return ESP_OK;
+    tape->last_mid = cycles;
+    tape_capture_bit(tape, level);
+    return ESP_OK;
+}
+
+#endif // CONFIG_ORION_TAPE
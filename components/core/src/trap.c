@@ -0,0 +1,200 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#include <string.h>
+#include "esp_log.h"
+#include "trap.h"
+
+static const char __attribute__((unused)) *TAG = "trap";
+
+// monitor 1: LXI D,B800 ... SHLD F501; LDA F500; STAX D; INX D; INX H; MOV A,H; CPI 08; JNZ FB9D
+static const uint8_t trap_monitor1_loop[] = {
+    0x22, 0x01, 0xf5, 0x3a, 0x00, 0xf5, 0x12, 0x13, 0x23, 0x7c, 0xfe, 0x08, 0xc2, 0x9d, 0xfb
+};
+
+// monitor 2: CALL F8C1; STAX D; DCX D; DCX H; MOV A,H; ORA A; JP F8B3
+static const uint8_t trap_monitor2_loop[] = {
+    0xcd, 0xc1, 0xf8, 0x12, 0x1b, 0x2b, 0x7c, 0xb7, 0xf2, 0xb3, 0xf8
+};
+
+// monitor 3: CALL FE23; STAX D; DCX D; DCX H; MOV A,H; ORA A; JP F8A2
+static const uint8_t trap_monitor3_loop[] = {
+    0xcd, 0x23, 0xfe, 0x12, 0x1b, 0x2b, 0x7c, 0xb7, 0xf2, 0xa2, 0xf8
+};
+
+// SHLD F501; LDA F500; RET
+static const uint8_t trap_monitor_read[] = {
+    0x22, 0x01, 0xf5, 0x3a, 0x00, 0xf5, 0xc9
+};
+
+// ORDOS: CALL BB21; STAX B; INX H; INX B; CALL BD33; JNZ BF92
+static const uint8_t trap_ordos_loop[] = {
+    0xcd, 0x21, 0xbb, 0x02, 0x23, 0x03, 0xcd, 0x33, 0xbd, 0xc2, 0x92, 0xbf
+};
+
+// ORDOS drive A read: MVI A,'A' (current drive); RET; CALL BB1E; CPI 'A'; JNZ BB35;
+// MVI A,90; STA F503; SHLD F501; LDA F500; RET
+static const uint8_t trap_ordos_read[] = {
+    0x3e, 0x41, 0xc9, 0xcd, 0x1e, 0xbb, 0xfe, 0x41, 0xc2, 0x35, 0xbb,
+    0x3e, 0x90, 0x32, 0x03, 0xf5, 0x22, 0x01, 0xf5, 0x3a, 0x00, 0xf5, 0xc9
+};
+
+// ORDOS: MOV A,H; CMP D; RNZ; MOV A,L; CMP E; RET
+static const uint8_t trap_ordos_cmp[] = {
+    0x7c, 0xba, 0xc0, 0x7d, 0xbb, 0xc9
+};
+
+static bool trap_overlaps(uint32_t addr, uint32_t size, uint32_t base, uint32_t base_size)
+{
+    return addr < base + base_size && base < addr + size;
+}
+
+// Copies size ROM disk bytes from addr to dst in the current RAM page. The copy is
+// refused when the loop would overwrite its own code or its stack frame, the CPU
+// runs the loop as usual then.
+static bool trap_copy(const trap_t *trap, cpu_t *cpu, memory_t *mem, uint16_t dst, uint16_t addr, uint32_t size)
+{
+    if (!mem->ram || dst + size > MEMORY_RAM_PAGE_SIZE || addr + size > 0x10000)
+        return false;
+    if (trap_overlaps(dst, size, (uint16_t)(cpu->sp - 4), 4))
+        return false;
+    for (size_t i = 0; i < TRAP_CODE_SEGMENTS && trap->code[i].data; ++i)
+        if (trap_overlaps(dst, size, trap->code[i].addr, trap->code[i].size))
+            return false;
+
+    ESP_ERROR_CHECK(romdisk_copy(mem->rom_disk, &mem->ram[dst], addr, size));
+
+    uint32_t video = ((mem->port_fa & 3) ^ 3) << 14;
+    if (trap_overlaps(dst, size, video, 0x3000))
+        mem->set_video_refresh = true;
+    ESP_LOGD(TAG, "%s: 0x%04x bytes from 0x%04x to 0x%04x", trap->name, size, addr, dst);
+    return true;
+}
+
+// The handlers copy all iterations but the last one. The CPU runs the last
+// iteration itself, so the ports, flags, A and the stack end up exactly as
+// after the original loop.
+
+// HL ascending up to 0x0800, DE destination
+static bool trap_ascending(const trap_t *trap, cpu_t *cpu, memory_t *mem)
+{
+    uint16_t addr = CPU_HL_VAL(cpu);
+    uint16_t dst = CPU_DE_VAL(cpu);
+    if (addr >= 0x07ff)
+        return false;
+    uint32_t size = 0x07ff - addr;
+    if (!trap_copy(trap, cpu, mem, dst, addr, size))
+        return false;
+    CPU_HL_VAL(cpu) = addr + size;
+    CPU_DE_VAL(cpu) = dst + size;
+    return true;
+}
+
+// HL descending down to 0, DE destination
+static bool trap_descending(const trap_t *trap, cpu_t *cpu, memory_t *mem)
+{
+    uint16_t addr = CPU_HL_VAL(cpu);
+    uint16_t dst = CPU_DE_VAL(cpu);
+    if (addr == 0 || addr >= 0x8000 || dst < addr)
+        return false;
+    uint32_t size = addr;
+    if (!trap_copy(trap, cpu, mem, dst - size + 1, addr - size + 1, size))
+        return false;
+    CPU_HL_VAL(cpu) = addr - size;
+    CPU_DE_VAL(cpu) = dst - size;
+    return true;
+}
+
+// HL ascending up to DE, BC destination
+static bool trap_ordos(const trap_t *trap, cpu_t *cpu, memory_t *mem)
+{
+    uint16_t addr = CPU_HL_VAL(cpu);
+    uint16_t dst = CPU_BC_VAL(cpu);
+    uint16_t size = CPU_DE_VAL(cpu) - addr;
+    if (size < 2)
+        return false;
+    --size;
+    if (!trap_copy(trap, cpu, mem, dst, addr, size))
+        return false;
+    CPU_HL_VAL(cpu) = addr + size;
+    CPU_BC_VAL(cpu) = dst + size;
+    return true;
+}
+
+static const trap_t trap_table[] = {
+    {
+        name: "monitor 1",
+        pc: 0xfb9d,
+        code: {
+            { addr: 0xfb9d, size: sizeof(trap_monitor1_loop), data: trap_monitor1_loop },
+        },
+        handler: trap_ascending
+    },
+    {
+        name: "monitor 2",
+        pc: 0xf8b3,
+        code: {
+            { addr: 0xf8b3, size: sizeof(trap_monitor2_loop), data: trap_monitor2_loop },
+            { addr: 0xf8c1, size: sizeof(trap_monitor_read), data: trap_monitor_read },
+        },
+        handler: trap_descending
+    },
+    {
+        name: "monitor 3",
+        pc: 0xf8a2,
+        code: {
+            { addr: 0xf8a2, size: sizeof(trap_monitor3_loop), data: trap_monitor3_loop },
+            { addr: 0xfe23, size: sizeof(trap_monitor_read), data: trap_monitor_read },
+        },
+        handler: trap_descending
+    },
+    {
+        name: "ORDOS",
+        pc: 0xbf92,
+        code: {
+            { addr: 0xbf92, size: sizeof(trap_ordos_loop), data: trap_ordos_loop },
+            { addr: 0xbb1e, size: sizeof(trap_ordos_read), data: trap_ordos_read },
+            { addr: 0xbd33, size: sizeof(trap_ordos_cmp), data: trap_ordos_cmp },
+        },
+        handler: trap_ordos
+    },
+};
+
+#define TRAP_TABLE_SIZE (sizeof(trap_table) / sizeof(trap_t))
+
+static bool trap_match(const trap_t *trap, memory_t *mem)
+{
+    for (size_t i = 0; i < TRAP_CODE_SEGMENTS && trap->code[i].data; ++i) {
+        const trap_code_t *code = &trap->code[i];
+        for (uint16_t j = 0; j < code->size; ++j)
+            if (*memory_reader_cb(code->addr + j, mem) != code->data[j])
+                return false;
+    }
+    return true;
+}
+
+esp_err_t trap_step(computer_t *cmp)
+{
+    cpu_t *cpu = cmp->cpu;
+    for (size_t i = 0; i < TRAP_TABLE_SIZE; ++i) {
+        const trap_t *trap = &trap_table[i];
+        if (cpu->pc == trap->pc && trap_match(trap, cmp->mem)) {
+            trap->handler(trap, cpu, cmp->mem);
+            break;
+        }
+    }
+    return ESP_OK;
+}
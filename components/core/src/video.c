@@ -15,17 +15,32 @@
  * You should have received a copy of the GNU General Public License
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
+#include <stdlib.h>
+#include <string.h>
+
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+
+#include "ring.h"
+#include "colors.h"
 
 #include "cpu.h"
 #include "keyboard.h"
 #include "computer.h"
 #include "video.h"
 
-#define VIDEO_QUEUE_SIZE 0x1000
+#define VIDEO_RING_SIZE 0x1000
+#define VIDEO_RING_BATCH 64
+#define VIDEO_REFRESH_ALL 0xffff
+// redraw everything, the shadow does not match the LCD
+#define VIDEO_REFRESH_FORCE 0xfffe
+// the write was 16 bit wide, the next address is dirty too
+#define VIDEO_REFRESH_WORD 0x4000
+// equal rows between two changed runs of a column cheaper to send again
+// than to open a new window
+#define VIDEO_SHADOW_GAP 4
 
 typedef struct video_queue_data {
     uint32_t min_x;
@@ -44,127 +59,162 @@ typedef union video_address {
 
 static const char *TAG = "video";
 
-static inline uint32_t video_get_colors(uint8_t page0, uint8_t page1, uint8_t port) {
-    size_t i;
-    uint32_t colors = 0;
-    switch (port & 7) {
-        case 0:
-            for (i = 0; i < 8; ++i) {
-                colors <<= 4;
-                colors |= (page0 & 1) ? VIDEO_COLOR_GREEN : VIDEO_COLOR_BLACK;
-                page0 >>= 1;
-            }
-            break;
-        case 1:
-            for (i = 0; i < 8; ++i) {
-                colors <<= 4;
-                colors |= (page0 & 1) ? VIDEO_COLOR_LCYAN : VIDEO_COLOR_LBLUE;
-                page0 >>= 1;
-            }
-            break;
-        case 2:
-        case 3:
-            for (i = 0; i < 8; ++i) {
-                colors <<= 4;
-                colors |= VIDEO_COLOR_BLACK;
-            }
-            break;
-        case 4:
-            for (i = 0; i < 8; ++i) {
-                colors <<= 4;
-                if (page1 & 1)
-                    colors |= (page0 & 1) ? VIDEO_COLOR_BLUE : VIDEO_COLOR_RED;
-                else
-                    colors |= (page0 & 1) ? VIDEO_COLOR_GREEN : VIDEO_COLOR_BLACK;
-                page0 >>= 1;
-                page1 >>= 1;
-            }
-            break;
-        case 5:
-            for (i = 0; i < 8; ++i) {
-                colors <<= 4;
-                if (page1 & 1)
-                    colors |= (page0 & 1) ? VIDEO_COLOR_BLUE : VIDEO_COLOR_RED;
-                else
-                    colors |= (page0 & 1) ? VIDEO_COLOR_GREEN : VIDEO_COLOR_BLACK;
-                page0 >>= 1;
-                page1 >>= 1;
+// Modes giving the same colors from the same bytes share the palette
+static inline uint8_t video_palette(uint8_t port) {
+    port &= 7;
+    return port < 2 ? port : port & 6;
+}
+
+static inline uint32_t video_base(const memory_t *mem) {
+    return ((mem->port_fa & 0x03) << 14) ^ 0xc000;
+}
+
+// Fill the window row by row, an Orion row is decoded once to palette
+// indices and every LCD pixel is a lookup through the column map. Rows
+// repeated by the vertical map are copied. Unscaled byte columns go
+// through the two pixel palette lookup of the display straight away.
+static void video_convert(computer_t *cmp, const display_bitmap_t *canvas, uint32_t left, uint32_t top) {
+    video_scale_t *scale = cmp->video_scale;
+    const memory_t *mem = cmp->mem;
+    const display_t *display = canvas->display;
+    const display_hardware_config_t *hw = display->hardware;
+    const display_color_rgb555_t *hw_palette = (const display_color_rgb555_t *)hw->palette;
+    uint32_t width = canvas->bounds.width;
+    uint32_t height = canvas->bounds.height;
+
+    display_color_rgb555_t palette[VIDEO_PALETTE_SIZE];
+    bzero(palette, sizeof(palette));
+    for (size_t i = 0; i < VIDEO_PALETTE_SIZE && i < hw->palette_count; ++i)
+        palette[i] = hw_palette[i];
+
+    const uint16_t *x_map = &scale->x_map[left];
+    uint32_t first = x_map[0] >> 3;
+    uint32_t last = x_map[width - 1] >> 3;
+    uint32_t base = video_base(mem);
+    const uint32_t *lut = NULL;
+    if (display->is_palette_lut && scale->bounds.width == VIDEO_DISPLAY_WIDTH && !(left & 7) && !(width & 7))
+        lut = display->palette_lut;
+    display_color_rgb555_t *dst = (display_color_rgb555_t *)canvas->data;
+    uint32_t prev = VIDEO_DISPLAY_HEIGHT;
+    for (uint32_t y = 0; y < height; ++y, dst += width) {
+        uint32_t row = scale->y_map[top + y];
+        if (row == prev) {
+            memcpy(dst, dst - width, width * sizeof(display_color_rgb555_t));
+            continue;
+        }
+        prev = row;
+        if (lut) {
+            uint32_t *pair = (uint32_t *)dst;
+            for (uint32_t x = first; x <= last; ++x, pair += 4) {
+                uint32_t ofs = base | (x << 8) | row;
+                uint32_t colors = video_get_colors(mem->ram_page[0][ofs], mem->ram_page[1][ofs], mem->port_f8);
+                pair[0] = lut[colors & 0xff];
+                pair[1] = lut[(colors >> 8) & 0xff];
+                pair[2] = lut[(colors >> 16) & 0xff];
+                pair[3] = lut[colors >> 24];
             }
-            break;
-        case 6:
-        case 7: {
-            uint32_t lo = page1 & 0x0f;
-            uint32_t hi = (page1>>4) & 0x0f;
-            for (i = 0; i < 8; ++i) {
-                colors <<= 4;
-                colors |= (page0 & 1) ? lo : hi;
-                page0 >>= 1;
+            continue;
+        }
+        for (uint32_t x = first; x <= last; ++x) {
+            uint32_t ofs = base | (x << 8) | row;
+            uint32_t colors = video_get_colors(mem->ram_page[0][ofs], mem->ram_page[1][ofs], mem->port_f8);
+            uint8_t *line = &scale->line[x << 3];
+            for (size_t i = 0; i < 8; ++i) {
+                line[i] = colors & 0x0f;
+                colors >>= 4;
             }
-            break;
         }
+        for (uint32_t x = 0; x < width; ++x)
+            dst[x] = palette[scale->line[x_map[x]]];
     }
-    return colors;
-}
-
-static int video_mode(const display_point_t *p, const display_refresh_info_t *info, void *color)
-{
-    ESP_ERROR_CHECK(info ? ESP_OK : ESP_ERR_INVALID_ARG);
-    computer_t *cmp = (computer_t *)info->color.args;
-    memory_t *mem = cmp->mem;
-    const display_bitmap_t *bitmap = info->bitmap;
-    const display_t *display = bitmap->display;
-//    ESP_ERROR_CHECK(display ? ESP_OK : ESP_ERR_INVALID_ARG);
-//    ESP_ERROR_CHECK(bitmap ? ESP_OK : ESP_ERR_INVALID_ARG);
-
-    //uint32_t dx = win_info->width;
-    uint32_t x = bitmap->bounds.left + p->x - (display->bounds.width  - VIDEO_DISPLAY_WIDTH) / 2;
-    uint32_t y = bitmap->bounds.top  + p->y - (display->bounds.height - VIDEO_DISPLAY_HEIGHT) / 2;
-    uint32_t ofs = (((mem->port_fa & 0x03) << 14) | ((x << 5) & 0x3f00) | y) ^ 0xc000;
-
-    //ESP_LOGI(TAG, "offset 0x%04x", ofs);
-
-    *(uint32_t *)color = video_get_colors(mem->ram_page0[ofs], mem->ram_page1[ofs], mem->port_f8);
-    return 1;
 }
 
 void video_refresh(computer_t *cmp, uint16_t addr) {
     video_address_t data = {
         addr: addr
     };
-    xQueueSend(cmp->video_queue, &data, portMAX_DELAY);
+    // when the ring is full the address is dropped, the refresh task
+    // notices the drop counter and redraws the whole screen instead
+    ring_push_lossy(cmp->video_ring, &data, 1);
 }
 
+#ifdef CONFIG_ORION_VIDEO_SHADOW
+// Copy the bytes about to be drawn to the shadow. A window drawn with
+// another palette leaves the shadow invalid until the whole screen is
+// redrawn.
+static inline void video_shadow_update(computer_t *cmp, uint32_t left, uint32_t top, uint32_t width, uint32_t height) {
+    const memory_t *mem = cmp->mem;
+    if (cmp->video_shadow_palette != video_palette(mem->port_f8)) {
+        cmp->video_shadow_palette = VIDEO_SHADOW_INVALID;
+        return;
+    }
+    uint32_t base = video_base(mem);
+    uint32_t right = (left + width + 7) >> 3;
+    // the second byte of a word write may fall out of the screen
+    if (right > VIDEO_COLUMNS)
+        right = VIDEO_COLUMNS;
+    for (uint32_t x = left >> 3; x < right; ++x) {
+        uint32_t ofs = base | (x << 8) | top;
+        uint8_t *shadow = &cmp->video_shadow[(x << 8) | top];
+        memcpy(shadow, &mem->ram_page[0][ofs], height);
+        memcpy(shadow + VIDEO_SHADOW_PAGE_SIZE, &mem->ram_page[1][ofs], height);
+    }
+}
+
+static inline bool video_shadow_same(uint8_t palette, const uint8_t *page0, const uint8_t *page1,
+        const uint8_t *shadow, uint32_t y) {
+    switch (palette) {
+        case 0:
+        case 1:
+            return page0[y] == shadow[y];
+        case 2:
+            return true;
+        default:
+            return page0[y] == shadow[y] && page1[y] == shadow[y + VIDEO_SHADOW_PAGE_SIZE];
+    }
+}
+#endif
+
 static inline void video_refresh_window_int(computer_t *cmp, uint32_t left, uint32_t top, uint32_t width, uint32_t height) {
     const display_t *display = cmp->display;
+    const video_scale_t *scale = cmp->video_scale;
+#ifdef CONFIG_ORION_VIDEO_SHADOW
+    video_shadow_update(cmp, left, top, width, height);
+#endif
+    // the window on the LCD, empty when the screen is scaled down
+    uint32_t l = scale->x_first[left];
+    uint32_t t = scale->y_first[top];
+    uint32_t w = scale->x_first[left + width] - l;
+    uint32_t h = scale->y_first[top + height] - t;
+    if (!w || !h)
+        return;
     display_bitmap_t *canvas;
     ESP_ERROR_CHECK(display_bitmap_create(&canvas));
     display_rectangle_t bounds = {
-        left: left + (display->bounds.width - VIDEO_DISPLAY_WIDTH) / 2,
-        top: top + (display->bounds.height - VIDEO_DISPLAY_HEIGHT) / 2,
-        width: width,
-        height: height
+        left: scale->bounds.left + l,
+        top: scale->bounds.top + t,
+        width: w,
+        height: h
     };
     canvas->bounds = bounds;
     canvas->format = DEVICE_COLOR_RGB555;
     ESP_ERROR_CHECK(display_bitmap_init(canvas, display));
-    display_refresh_info_t info = {
-        rectangle: {
-            left: 0,
-            top: 0,
-            width: width,
-            height: height,
-        },
-        bitmap: canvas,
-        color: {
-            format: DISPLAY_COLOR_8I4,
-            args: cmp,
-            get: video_mode
-        }
-    };
 //    ESP_LOGI(TAG, "window %d, %d, %d, %d", left, top, width, height);
-//    ESP_ERROR_CHECK(display->refresh(display, &info));
-    ESP_ERROR_CHECK(display_bitmap_refresh(&info));
+#ifdef CONFIG_ORION_PERF_COUNTERS
+    computer_perf_t *c = &cmp->counters;
+    int64_t start = esp_timer_get_time();
+    video_convert(cmp, canvas, l, t);
+    int64_t converted = esp_timer_get_time();
+    ESP_ERROR_CHECK(display_refresh(canvas));
+    perf_sample(&c->video_transfer_us, esp_timer_get_time() - converted);
+    perf_sample(&c->video_convert_us, converted - start);
+    perf_count(&c->video_windows, 1);
+    perf_count(&c->video_pixels, w * h);
+    perf_count(&c->video_bytes, canvas->data_size);
+#else
+    video_convert(cmp, canvas, l, t);
     ESP_ERROR_CHECK(display_refresh(canvas));
+#endif
     ESP_ERROR_CHECK(display_bitmap_done(canvas));
 }
 
@@ -195,6 +245,68 @@ static inline void video_refresh_window(computer_t *cmp, uint32_t left, uint32_t
     }
 }
 
+#ifdef CONFIG_ORION_VIDEO_SHADOW
+// Redraw the runs of each column differing from the shadow. Neighbouring
+// columns with the same run go to the LCD as one window.
+static void video_refresh_diff(computer_t *cmp) {
+    const memory_t *mem = cmp->mem;
+    uint8_t palette = cmp->video_shadow_palette;
+    uint32_t base = video_base(mem);
+    uint32_t left = 0;
+    uint32_t width = 0;
+    uint32_t top = 0;
+    uint32_t height = 0;
+
+    for (uint32_t x = 0; x < VIDEO_COLUMNS; ++x) {
+        const uint8_t *page0 = &mem->ram_page[0][base | (x << 8)];
+        const uint8_t *page1 = &mem->ram_page[1][base | (x << 8)];
+        const uint8_t *shadow = &cmp->video_shadow[x << 8];
+        if (!memcmp(page0, shadow, VIDEO_DISPLAY_HEIGHT) &&
+            (palette < 4 || !memcmp(page1, shadow + VIDEO_SHADOW_PAGE_SIZE, VIDEO_DISPLAY_HEIGHT)))
+            continue;
+
+        uint32_t y = 0;
+        while (1) {
+            while (y < VIDEO_DISPLAY_HEIGHT && video_shadow_same(palette, page0, page1, shadow, y))
+                ++y;
+            if (y == VIDEO_DISPLAY_HEIGHT)
+                break;
+            uint32_t start = y;
+            uint32_t end = y + 1;
+            for (y = end; y < VIDEO_DISPLAY_HEIGHT && y - end < VIDEO_SHADOW_GAP; ++y)
+                if (!video_shadow_same(palette, page0, page1, shadow, y))
+                    end = y + 1;
+            y = end;
+
+            if (width && left + width == x && top == start && height == end - start) {
+                ++width;
+                continue;
+            }
+            if (width)
+                video_refresh_window(cmp, left << 3, top, width << 3, height);
+            left = x;
+            width = 1;
+            top = start;
+            height = end - start;
+        }
+    }
+    if (width)
+        video_refresh_window(cmp, left << 3, top, width << 3, height);
+}
+#endif
+
+static void video_refresh_all(computer_t *cmp, bool force) {
+#ifdef CONFIG_ORION_VIDEO_SHADOW
+    uint8_t palette = video_palette(cmp->mem->port_f8);
+    if (!force && cmp->video_shadow_palette == palette) {
+        video_refresh_diff(cmp);
+        return;
+    }
+    cmp->video_shadow_palette = palette;
+#endif
+    video_refresh_window(cmp, 0, 0, VIDEO_DISPLAY_WIDTH, VIDEO_DISPLAY_HEIGHT);
+}
+
 static void video_refresh_process(void *arg) {
     static uint8_t state = 1;
 
@@ -205,31 +317,36 @@ static void video_refresh_process(void *arg) {
 
     computer_t *cmp = (computer_t *)arg;
     ESP_ERROR_CHECK(cmp ? ESP_OK : ESP_ERR_INVALID_ARG);
-    cpu_t *cpu = cmp->cpu;
-    ESP_ERROR_CHECK(cpu ? ESP_OK : ESP_ERR_INVALID_STATE);
 
     uint8_t mix = 0;
     uint8_t miy = 0;
     uint8_t max = 0;
     uint8_t may = 0;
 
-    video_address_t data;
+    size_t dropped = 0;
+    video_address_t batch[VIDEO_RING_BATCH];
     while (1) {
-        if (xQueueReceive(cmp->video_queue, &data, (TickType_t)1) != pdTRUE) {
-            vTaskPrioritySet(NULL, tskIDLE_PRIORITY);
-            if (state == 1) continue;
-            video_refresh_window(cmp, min_x<<3, min_y, (max_x-min_x+1)<<3, max_y-min_y+1);
-            state = 1;
+        size_t count = ring_pop(cmp->video_ring, batch, VIDEO_RING_BATCH);
+        if (!count) {
+            if (state == 0) {
+                video_refresh_window(cmp, min_x<<3, min_y, (max_x-min_x+1)<<3, max_y-min_y+1);
+                state = 1;
+            }
+            vTaskDelay(1);
             continue;
         }
-        else vTaskPrioritySet(NULL, tskIDLE_PRIORITY+2);
 
-        if (data.addr == 0xffff) {
-            video_refresh_window(cmp, 0, 0, VIDEO_DISPLAY_WIDTH, VIDEO_DISPLAY_HEIGHT);
-            state = 1;
-        }
-        else {
-            uint8_t is_word_op = cpu->is_word;
+#ifdef CONFIG_ORION_PERF_COUNTERS
+        perf_count(&cmp->counters.video_dirty, count);
+#endif
+        for (size_t i = 0; i < count; ++i) {
+            video_address_t data = batch[i];
+            if (data.addr == VIDEO_REFRESH_ALL || data.addr == VIDEO_REFRESH_FORCE) {
+                video_refresh_all(cmp, data.addr == VIDEO_REFRESH_FORCE);
+                state = 1;
+                continue;
+            }
+            uint8_t is_word_op = (data.addr & VIDEO_REFRESH_WORD) != 0;
             while (1) {
                 data.addr &= 0x3fff;
                 if (state == 1) {
@@ -251,8 +368,7 @@ static void video_refresh_process(void *arg) {
                     if (may < data.y) may = data.y;
 
                     if ((max - mix > 7) || (may - miy > 63)) {
-//                        ESP_LOGI(TAG, "begin  (0x%03x, 0x%02x) 0x%03x, 0x%02x, %d", data.x, data.y, (max - mix), (may - miy), cpu_is_word);
-                        video_refresh_window(cmp, min_x<<3, min_y, (max_x-min_x+1)<<3, max_y-min_y+1); 
+                        video_refresh_window(cmp, min_x<<3, min_y, (max_x-min_x+1)<<3, max_y-min_y+1);
                         min_x = data.x;
                         max_x = data.x;
                         min_y = data.y;
@@ -273,38 +389,148 @@ static void video_refresh_process(void *arg) {
                 break;
             }
         }
+
+        // some addresses were lost on overflow, redraw everything
+        size_t lost = ring_get_dropped(cmp->video_ring);
+        if (lost != dropped) {
+            ESP_LOGD(TAG, "%u addresses dropped", (unsigned)(lost - dropped));
+            dropped = lost;
+            video_refresh_all(cmp, false);
+            state = 1;
+        }
+    }
+}
+
+static void video_scale_map(uint16_t *map, uint16_t *first, uint32_t size, uint32_t scaled) {
+    uint32_t i = 0;
+    for (uint32_t j = 0; j < scaled; ++j) {
+        // the source pixel under the center of the scaled one
+        map[j] = (2 * j + 1) * size / (2 * scaled);
+        while (i <= map[j])
+            first[i++] = j;
+    }
+    while (i <= size)
+        first[i++] = scaled;
+}
+
+esp_err_t video_scale_create(video_scale_t **pscale, const display_t *display, video_scale_mode_t mode) {
+    ESP_ERROR_CHECK(pscale ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(display ? ESP_OK : ESP_ERR_INVALID_ARG);
+    video_scale_t *scale = (video_scale_t *)malloc(sizeof(video_scale_t));
+    ESP_ERROR_CHECK(scale ? ESP_OK : ESP_ERR_NO_MEM);
+    bzero(scale, sizeof(video_scale_t));
+
+    uint32_t width = display->bounds.width;
+    uint32_t height = display->bounds.height;
+    switch (mode) {
+        case VIDEO_SCALE_ASPECT:
+            // 4:3 of the TV set the computer was connected to
+            if (width * 3 > height * 4)
+                width = height * 4 / 3;
+            else
+                height = width * 3 / 4;
+            break;
+        case VIDEO_SCALE_FILL:
+            break;
+        default:
+            width = VIDEO_DISPLAY_WIDTH;
+            height = VIDEO_DISPLAY_HEIGHT;
+            break;
     }
+    display_rectangle_t bounds = {
+        left: (display->bounds.width - width) / 2,
+        top: (display->bounds.height - height) / 2,
+        width: width,
+        height: height
+    };
+    scale->bounds = bounds;
+    scale->x_map = (uint16_t *)malloc(width * sizeof(uint16_t));
+    ESP_ERROR_CHECK(scale->x_map ? ESP_OK : ESP_ERR_NO_MEM);
+    scale->y_map = (uint16_t *)malloc(height * sizeof(uint16_t));
+    ESP_ERROR_CHECK(scale->y_map ? ESP_OK : ESP_ERR_NO_MEM);
+    video_scale_map(scale->x_map, scale->x_first, VIDEO_DISPLAY_WIDTH, width);
+    video_scale_map(scale->y_map, scale->y_first, VIDEO_DISPLAY_HEIGHT, height);
+    ESP_LOGI(TAG, "screen %dx%d at %d, %d", width, height, bounds.left, bounds.top);
+    *pscale = scale;
+    return ESP_OK;
 }
 
+esp_err_t video_scale_done(video_scale_t *scale) {
+    ESP_ERROR_CHECK(scale ? ESP_OK : ESP_ERR_INVALID_ARG);
+    free(scale->x_map);
+    free(scale->y_map);
+    free(scale);
+    return ESP_OK;
+}
 
 esp_err_t video_init(computer_t *cmp) {
 
     ESP_ERROR_CHECK(cmp ? ESP_OK : ESP_ERR_INVALID_ARG);
     ESP_ERROR_CHECK(cmp->display ? ESP_OK : ESP_ERR_INVALID_STATE);
 
-    cmp->video_queue = xQueueCreate(VIDEO_QUEUE_SIZE, sizeof(video_address_t));
-    ESP_ERROR_CHECK(cmp->video_queue ? ESP_OK : ESP_ERR_NO_MEM);
+    ESP_ERROR_CHECK(ring_create(&cmp->video_ring, VIDEO_RING_SIZE, sizeof(video_address_t)));
+    ESP_ERROR_CHECK(video_scale_create(&cmp->video_scale, cmp->display, VIDEO_SCALE_DEFAULT));
+#ifdef CONFIG_ORION_VIDEO_SHADOW
+    cmp->video_shadow = (uint8_t *)malloc(2 * VIDEO_SHADOW_PAGE_SIZE);
+    ESP_ERROR_CHECK(cmp->video_shadow ? ESP_OK : ESP_ERR_NO_MEM);
+    cmp->video_shadow_palette = VIDEO_SHADOW_INVALID;
+#endif
 
-    BaseType_t result = xTaskCreate(video_refresh_process, TAG, 2048, cmp, tskIDLE_PRIORITY, &cmp->video_task);
+    BaseType_t result = xTaskCreatePinnedToCore(video_refresh_process, TAG, 2048, cmp,
+        CONFIG_ORION_IO_TASK_PRIORITY, &cmp->video_task, CONFIG_ORION_IO_TASK_CORE);
     ESP_ERROR_CHECK(result == pdPASS ? ESP_OK : ESP_ERR_NO_MEM);
 
     return ESP_OK;
 }
 
+esp_err_t video_done(computer_t *cmp) {
+    ESP_ERROR_CHECK(cmp ? ESP_OK : ESP_ERR_INVALID_ARG);
+    vTaskDelete(cmp->video_task);
+    ESP_ERROR_CHECK(ring_done(cmp->video_ring));
+    ESP_ERROR_CHECK(video_scale_done(cmp->video_scale));
+#ifdef CONFIG_ORION_VIDEO_SHADOW
+    free(cmp->video_shadow);
+#endif
+    return ESP_OK;
+}
+
+esp_err_t video_draw(computer_t *cmp, uint32_t left, uint32_t top, uint32_t width, uint32_t height) {
+    ESP_ERROR_CHECK(cmp ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(left + width <= VIDEO_DISPLAY_WIDTH && top + height <= VIDEO_DISPLAY_HEIGHT ?
+        ESP_OK : ESP_ERR_INVALID_ARG);
+    video_refresh_window(cmp, left, top, width, height);
+    return ESP_OK;
+}
+
+esp_err_t video_redraw(computer_t *cmp, bool force) {
+    ESP_ERROR_CHECK(cmp ? ESP_OK : ESP_ERR_INVALID_ARG);
+    video_refresh_all(cmp, force);
+    return ESP_OK;
+}
+
 esp_err_t video_step(computer_t *cmp) {
     memory_t *mem = cmp->mem;
     if (mem->set_video_mode) {
         mem->set_video_mode = false;
-        video_refresh(cmp, 0xffff);
+        video_refresh(cmp, VIDEO_REFRESH_ALL);
 //        ESP_LOGI(TAG, "port 0xF8: 0x%02x, pc: 0x%04x", comp_port_f8, cpu_pc);
     }
     if (mem->set_video_buf) {
         mem->set_video_buf = false;
-        video_refresh(cmp, 0xffff);
+        video_refresh(cmp, VIDEO_REFRESH_ALL);
 //        ESP_LOGI(TAG, "port 0xFA: 0x%02x, pc: 0x%04x", comp_port_fa, cpu_pc);
     }
+    if (mem->set_video_refresh) {
+        mem->set_video_refresh = false;
+        video_refresh(cmp, VIDEO_REFRESH_ALL);
+    }
+    if (mem->set_video_invalidate) {
+        mem->set_video_invalidate = false;
+        video_refresh(cmp, VIDEO_REFRESH_FORCE);
+    }
     if (mem->video_addr) {
-        video_refresh(cmp, mem->video_addr);
+        // the refresh task runs on the other core, pass the access width along
+        video_refresh(cmp, (mem->video_addr & 0x3fff) | (cmp->cpu->is_word ? VIDEO_REFRESH_WORD : 0));
         mem->video_addr = 0;
     }
 
@@ -0,0 +1,1276 @@
+/*
+ * This file is part of the orion128-core distribution
+ * (https://gitlab.romanchenko.su/esp/components/orion128-core.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */#include <string.h>
+
+#include "esp_log.h"
+#include "cpu.h"
+#include "z80.h"
+
+#ifdef CPU_Z80_ENABLE
+
+// Z80 core sharing cpu_t and the memory callbacks with the 8080 one.
+// Every opcode of the base, CB and ED pages has its handler in a table,
+// the DD and FD prefixes only switch cpu->hl to IX or IY and dispatch
+// the next opcode through the base table again.
+
+#define Z80_FLAG_C  0x01
+#define Z80_FLAG_N  0x02
+#define Z80_FLAG_P  0x04
+#define Z80_FLAG_X  0x08
+#define Z80_FLAG_H  0x10
+#define Z80_FLAG_Y  0x20
+#define Z80_FLAG_Z  0x40
+#define Z80_FLAG_S  0x80
+#define Z80_FLAG_XY (Z80_FLAG_X | Z80_FLAG_Y)
+
+#define Z80_REG_H 4
+#define Z80_REG_L 5
+#define Z80_REG_M 6
+
+// pair indexes of cpu->pair, AF takes the place of SP in PUSH and POP
+#define Z80_PAIR_HL 2
+#define Z80_PAIR_SP 3
+
+#define Z80_A(cpu)  ((cpu)->reg_file[CPU_FILE_A])
+#define Z80_F(cpu)  ((cpu)->reg_file[CPU_FLAGS])
+#define Z80_B(cpu)  ((cpu)->reg_file[CPU_FILE_B])
+#define Z80_C(cpu)  ((cpu)->reg_file[CPU_FILE_C])
+#define Z80_BC(cpu) CPU_BC_VAL(cpu)
+#define Z80_DE(cpu) CPU_DE_VAL(cpu)
+#define Z80_HL(cpu) CPU_HL_VAL(cpu)
+
+#ifdef CPU_CYCLES_ENABLE
+#define Z80_CYCLES(cpu, n) ((cpu)->cycles += (n))
+#else
+#define Z80_CYCLES(cpu, n)
+#endif
+
+typedef void (*z80_cmd_t)(cpu_t *cpu, uint8_t op);
+
+static const char __attribute__((unused)) *TAG = "Z80";
+
+// T states of the base page, conditional instructions are counted as not
+// taken, the handlers add the rest. The prefixes cost one M1 cycle here.
+static const uint8_t z80_cycles_num[256] = {
+//  0   1   2   3   4   5   6   7   8   9   a   b   c   d   e   f
+    4,  10, 7,  6,  4,  4,  7,  4,  4,  11, 7,  6,  4,  4,  7,  4,  // 0
+    8,  10, 7,  6,  4,  4,  7,  4,  12, 11, 7,  6,  4,  4,  7,  4,  // 1
+    7,  10, 16, 6,  4,  4,  7,  4,  7,  11, 16, 6,  4,  4,  7,  4,  // 2
+    7,  10, 13, 6,  11, 11, 10, 4,  7,  11, 13, 6,  4,  4,  7,  4,  // 3
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 4
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 5
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 6
+    7,  7,  7,  7,  7,  7,  4,  7,  4,  4,  4,  4,  4,  4,  7,  4,  // 7
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 8
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 9
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // a
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // b
+    5,  10, 10, 10, 10, 11, 7,  11, 5,  10, 10, 4,  10, 17, 7,  11, // c
+    5,  10, 10, 11, 10, 11, 7,  11, 5,  4,  10, 11, 10, 4,  7,  11, // d
+    5,  10, 10, 19, 10, 11, 7,  11, 5,  4,  10, 4,  10, 4,  7,  11, // e
+    5,  10, 10, 4,  10, 11, 7,  11, 5,  6,  10, 4,  10, 4,  7,  11  // f
+};
+
+// T states of the ED page without the prefix
+static const uint8_t z80_ed_cycles_num[256] = {
+    [0x00 ... 0xff] = 4,
+    [0x40] = 8, [0x41] = 8, [0x42] = 11, [0x43] = 16, [0x44] = 4, [0x45] = 10, [0x46] = 4, [0x47] = 5,
+    [0x48] = 8, [0x49] = 8, [0x4a] = 11, [0x4b] = 16, [0x4c] = 4, [0x4d] = 10, [0x4e] = 4, [0x4f] = 5,
+    [0x50] = 8, [0x51] = 8, [0x52] = 11, [0x53] = 16, [0x54] = 4, [0x55] = 10, [0x56] = 4, [0x57] = 5,
+    [0x58] = 8, [0x59] = 8, [0x5a] = 11, [0x5b] = 16, [0x5c] = 4, [0x5d] = 10, [0x5e] = 4, [0x5f] = 5,
+    [0x60] = 8, [0x61] = 8, [0x62] = 11, [0x63] = 16, [0x64] = 4, [0x65] = 10, [0x66] = 4, [0x67] = 14,
+    [0x68] = 8, [0x69] = 8, [0x6a] = 11, [0x6b] = 16, [0x6c] = 4, [0x6d] = 10, [0x6e] = 4, [0x6f] = 14,
+    [0x70] = 8, [0x71] = 8, [0x72] = 11, [0x73] = 16, [0x74] = 4, [0x75] = 10, [0x76] = 4,
+    [0x78] = 8, [0x79] = 8, [0x7a] = 11, [0x7b] = 16, [0x7c] = 4, [0x7d] = 10, [0x7e] = 4,
+    [0xa0 ... 0xa3] = 12,
+    [0xa8 ... 0xab] = 12,
+    [0xb0 ... 0xb3] = 12,
+    [0xb8 ... 0xbb] = 12
+};
+
+// S, Z, undocumented X and Y flags and the parity of a byte
+static uint8_t z80_sz53[256];
+static uint8_t z80_sz53p[256];
+
+static const uint8_t z80_half_add[8] = { 0, Z80_FLAG_H, Z80_FLAG_H, Z80_FLAG_H, 0, 0, 0, Z80_FLAG_H };
+static const uint8_t z80_half_sub[8] = { 0, 0, Z80_FLAG_H, 0, Z80_FLAG_H, 0, Z80_FLAG_H, Z80_FLAG_H };
+static const uint8_t z80_overflow_add[8] = { 0, 0, 0, Z80_FLAG_P, Z80_FLAG_P, 0, 0, 0 };
+static const uint8_t z80_overflow_sub[8] = { 0, Z80_FLAG_P, 0, 0, 0, 0, Z80_FLAG_P, 0 };
+
+static const z80_cmd_t z80_cmd[256];
+static const z80_cmd_t z80_cmd_cb[256];
+static const z80_cmd_t z80_cmd_ed[256];
+
+static void z80_init_tables(void)
+{
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint8_t p = 1;
+        for (uint32_t b = i; b; b >>= 1)
+            p ^= b & 1;
+        z80_sz53[i] = (i & (Z80_FLAG_S | Z80_FLAG_XY)) | (i ? 0 : Z80_FLAG_Z);
+        z80_sz53p[i] = z80_sz53[i] | (p ? Z80_FLAG_P : 0);
+    }
+}
+
+static inline uint8_t z80_read(cpu_t *cpu, uint16_t addr)
+{
+    return *cpu->reader(addr, cpu->memory);
+}
+
+static inline void z80_write(cpu_t *cpu, uint16_t addr, uint8_t val)
+{
+    *cpu->writer(addr, cpu->memory) = val;
+}
+
+// the high byte goes first, the memory reports the low address of the word
+static inline void z80_write_word(cpu_t *cpu, uint16_t addr, uint16_t val)
+{
+    z80_write(cpu, addr + 1, val >> 8);
+    z80_write(cpu, addr, val);
+    cpu->is_word = 1;
+}
+
+static inline uint16_t z80_read_word(cpu_t *cpu, uint16_t addr)
+{
+    return z80_read(cpu, addr) | (z80_read(cpu, addr + 1) << 8);
+}
+
+// the ports are decoded from the high address half as with the 8080 core
+static inline uint8_t z80_in(cpu_t *cpu, uint8_t port)
+{
+    return *cpu->reader(port << 8, cpu->memory);
+}
+
+static inline void z80_out(cpu_t *cpu, uint8_t port, uint8_t val)
+{
+    *cpu->writer(port << 8, cpu->memory) = val;
+}
+
+static inline uint8_t z80_fetch(cpu_t *cpu)
+{
+    return z80_read(cpu, cpu->pc++);
+}
+
+static inline uint16_t z80_fetch_word(cpu_t *cpu)
+{
+    uint16_t val = z80_read_word(cpu, cpu->pc);
+    cpu->pc += 2;
+    return val;
+}
+
+static inline uint8_t z80_fetch_opcode(cpu_t *cpu)
+{
+    cpu->r = (cpu->r & 0x80) | ((cpu->r + 1) & 0x7f);
+    return z80_fetch(cpu);
+}
+
+static inline void z80_push(cpu_t *cpu, uint16_t val)
+{
+    cpu->sp -= 2;
+    z80_write_word(cpu, cpu->sp, val);
+}
+
+static inline uint16_t z80_pop(cpu_t *cpu)
+{
+    uint16_t val = z80_read_word(cpu, cpu->sp);
+    cpu->sp += 2;
+    return val;
+}
+
+// B, C, D, E, H, L, -, A with H and L replaced by the halves of IX or IY
+static inline uint8_t *z80_reg(cpu_t *cpu, uint32_t idx)
+{
+    if (cpu->prefix && (idx == Z80_REG_H || idx == Z80_REG_L))
+        return (uint8_t *)cpu->hl + (idx == Z80_REG_H ? 1 : 0);
+    return cpu->reg[idx];
+}
+
+// BC, DE, HL (IX, IY), SP
+static inline uint16_t *z80_pair(cpu_t *cpu, uint32_t idx)
+{
+    return idx == Z80_PAIR_HL ? cpu->hl : cpu->pair[idx];
+}
+
+// (HL) or (IX+d), the displacement follows the opcode
+static inline uint16_t z80_addr_m(cpu_t *cpu)
+{
+    if (!cpu->prefix)
+        return Z80_HL(cpu);
+    uint16_t addr = *cpu->hl + (int8_t)z80_fetch(cpu);
+    cpu->wz = addr;
+    Z80_CYCLES(cpu, 8);
+    return addr;
+}
+
+static inline uint8_t z80_condition(cpu_t *cpu, uint32_t idx)
+{
+    static const uint8_t mask[4] = { Z80_FLAG_Z, Z80_FLAG_C, Z80_FLAG_P, Z80_FLAG_S };
+    return !(Z80_F(cpu) & mask[idx >> 1]) ^ (idx & 1);
+}
+
+// 8-bit arithmetic
+
+static inline void z80_add(cpu_t *cpu, uint8_t val, uint8_t carry)
+{
+    uint8_t a = Z80_A(cpu);
+    uint32_t res = a + val + carry;
+    uint32_t idx = ((a & 0x88) >> 3) | ((val & 0x88) >> 2) | ((res & 0x88) >> 1);
+    Z80_A(cpu) = res;
+    Z80_F(cpu) = (res & 0x100 ? Z80_FLAG_C : 0) | z80_half_add[idx & 7]
+        | z80_overflow_add[idx >> 4] | z80_sz53[res & 0xff];
+}
+
+static inline uint8_t z80_sub_flags(cpu_t *cpu, uint8_t val, uint8_t carry, uint8_t *pres)
+{
+    uint8_t a = Z80_A(cpu);
+    uint32_t res = a - val - carry;
+    uint32_t idx = ((a & 0x88) >> 3) | ((val & 0x88) >> 2) | ((res & 0x88) >> 1);
+    *pres = res;
+    return (res & 0x100 ? Z80_FLAG_C : 0) | Z80_FLAG_N | z80_half_sub[idx & 7]
+        | z80_overflow_sub[idx >> 4];
+}
+
+static inline void z80_sub(cpu_t *cpu, uint8_t val, uint8_t carry)
+{
+    uint8_t res;
+    uint8_t f = z80_sub_flags(cpu, val, carry, &res);
+    Z80_A(cpu) = res;
+    Z80_F(cpu) = f | z80_sz53[res];
+}
+
+// the undocumented flags come from the operand
+static inline void z80_cp(cpu_t *cpu, uint8_t val)
+{
+    uint8_t res;
+    uint8_t f = z80_sub_flags(cpu, val, 0, &res);
+    Z80_F(cpu) = f | (z80_sz53[res] & ~Z80_FLAG_XY) | (val & Z80_FLAG_XY);
+}
+
+static inline void z80_alu(cpu_t *cpu, uint32_t idx, uint8_t val)
+{
+    switch (idx) {
+        case 0:
+            z80_add(cpu, val, 0);
+            break;
+        case 1:
+            z80_add(cpu, val, Z80_F(cpu) & Z80_FLAG_C);
+            break;
+        case 2:
+            z80_sub(cpu, val, 0);
+            break;
+        case 3:
+            z80_sub(cpu, val, Z80_F(cpu) & Z80_FLAG_C);
+            break;
+        case 4:
+            Z80_A(cpu) &= val;
+            Z80_F(cpu) = Z80_FLAG_H | z80_sz53p[Z80_A(cpu)];
+            break;
+        case 5:
+            Z80_A(cpu) ^= val;
+            Z80_F(cpu) = z80_sz53p[Z80_A(cpu)];
+            break;
+        case 6:
+            Z80_A(cpu) |= val;
+            Z80_F(cpu) = z80_sz53p[Z80_A(cpu)];
+            break;
+        case 7:
+            z80_cp(cpu, val);
+            break;
+    }
+}
+
+static inline uint8_t z80_inc(cpu_t *cpu, uint8_t val)
+{
+    uint8_t res = val + 1;
+    Z80_F(cpu) = (Z80_F(cpu) & Z80_FLAG_C) | (res == 0x80 ? Z80_FLAG_P : 0)
+        | ((res & 0x0f) ? 0 : Z80_FLAG_H) | z80_sz53[res];
+    return res;
+}
+
+static inline uint8_t z80_dec(cpu_t *cpu, uint8_t val)
+{
+    uint8_t res = val - 1;
+    Z80_F(cpu) = (Z80_F(cpu) & Z80_FLAG_C) | Z80_FLAG_N | (res == 0x7f ? Z80_FLAG_P : 0)
+        | ((val & 0x0f) ? 0 : Z80_FLAG_H) | z80_sz53[res];
+    return res;
+}
+
+// 16-bit arithmetic
+
+static inline uint16_t z80_add16(cpu_t *cpu, uint16_t a, uint16_t b)
+{
+    uint32_t res = a + b;
+    cpu->wz = a + 1;
+    Z80_F(cpu) = (Z80_F(cpu) & (Z80_FLAG_S | Z80_FLAG_Z | Z80_FLAG_P))
+        | (res & 0x10000 ? Z80_FLAG_C : 0) | ((res >> 8) & Z80_FLAG_XY)
+        | (((a & 0x0fff) + (b & 0x0fff)) & 0x1000 ? Z80_FLAG_H : 0);
+    return res;
+}
+
+static inline uint16_t z80_adc16(cpu_t *cpu, uint16_t a, uint16_t b)
+{
+    uint32_t res = a + b + (Z80_F(cpu) & Z80_FLAG_C);
+    uint32_t idx = ((a & 0x8800) >> 11) | ((b & 0x8800) >> 10) | ((res & 0x8800) >> 9);
+    cpu->wz = a + 1;
+    Z80_F(cpu) = (res & 0x10000 ? Z80_FLAG_C : 0) | z80_overflow_add[idx >> 4]
+        | ((res >> 8) & (Z80_FLAG_S | Z80_FLAG_XY)) | z80_half_add[idx & 7]
+        | ((res & 0xffff) ? 0 : Z80_FLAG_Z);
+    return res;
+}
+
+static inline uint16_t z80_sbc16(cpu_t *cpu, uint16_t a, uint16_t b)
+{
+    uint32_t res = a - b - (Z80_F(cpu) & Z80_FLAG_C);
+    uint32_t idx = ((a & 0x8800) >> 11) | ((b & 0x8800) >> 10) | ((res & 0x8800) >> 9);
+    cpu->wz = a + 1;
+    Z80_F(cpu) = (res & 0x10000 ? Z80_FLAG_C : 0) | Z80_FLAG_N | z80_overflow_sub[idx >> 4]
+        | ((res >> 8) & (Z80_FLAG_S | Z80_FLAG_XY)) | z80_half_sub[idx & 7]
+        | ((res & 0xffff) ? 0 : Z80_FLAG_Z);
+    return res;
+}
+
+// rotations and shifts of the CB page
+
+static inline uint8_t z80_shift(cpu_t *cpu, uint32_t idx, uint8_t val)
+{
+    uint8_t res = 0;
+    uint8_t carry = 0;
+    switch (idx) {
+        case 0: // RLC
+            res = (val << 1) | (val >> 7);
+            carry = val >> 7;
+            break;
+        case 1: // RRC
+            res = (val >> 1) | (val << 7);
+            carry = val & 1;
+            break;
+        case 2: // RL
+            res = (val << 1) | (Z80_F(cpu) & Z80_FLAG_C);
+            carry = val >> 7;
+            break;
+        case 3: // RR
+            res = (val >> 1) | ((Z80_F(cpu) & Z80_FLAG_C) << 7);
+            carry = val & 1;
+            break;
+        case 4: // SLA
+            res = val << 1;
+            carry = val >> 7;
+            break;
+        case 5: // SRA
+            res = (val >> 1) | (val & 0x80);
+            carry = val & 1;
+            break;
+        case 6: // SLL, undocumented
+            res = (val << 1) | 1;
+            carry = val >> 7;
+            break;
+        case 7: // SRL
+            res = val >> 1;
+            carry = val & 1;
+            break;
+    }
+    Z80_F(cpu) = carry | z80_sz53p[res];
+    return res;
+}
+
+// BIT takes the undocumented flags from the value or from MEMPTR
+static inline void z80_bit(cpu_t *cpu, uint32_t bit, uint8_t val, uint8_t xy)
+{
+    uint8_t res = val & (1 << bit);
+    Z80_F(cpu) = (Z80_F(cpu) & Z80_FLAG_C) | Z80_FLAG_H | (xy & Z80_FLAG_XY)
+        | (res ? (res & Z80_FLAG_S) : (Z80_FLAG_Z | Z80_FLAG_P));
+}
+
+// base page
+
+static void z80_cmd_nop(cpu_t *cpu, uint8_t op)
+{
+}
+
+// 00rr0001
+static void z80_cmd_ld_rr_nn(cpu_t *cpu, uint8_t op)
+{
+    *z80_pair(cpu, (op >> 4) & 3) = z80_fetch_word(cpu);
+}
+
+// 00rr1001
+static void z80_cmd_add_hl_rr(cpu_t *cpu, uint8_t op)
+{
+    *cpu->hl = z80_add16(cpu, *cpu->hl, *z80_pair(cpu, (op >> 4) & 3));
+}
+
+// 000r0010
+static void z80_cmd_ld_rr_a(cpu_t *cpu, uint8_t op)
+{
+    uint16_t addr = op & 0x10 ? Z80_DE(cpu) : Z80_BC(cpu);
+    z80_write(cpu, addr, Z80_A(cpu));
+    cpu->wz = ((addr + 1) & 0xff) | (Z80_A(cpu) << 8);
+}
+
+// 000r1010
+static void z80_cmd_ld_a_rr(cpu_t *cpu, uint8_t op)
+{
+    uint16_t addr = op & 0x10 ? Z80_DE(cpu) : Z80_BC(cpu);
+    Z80_A(cpu) = z80_read(cpu, addr);
+    cpu->wz = addr + 1;
+}
+
+// 00100010
+static void z80_cmd_ld_nn_hl(cpu_t *cpu, uint8_t op)
+{
+    uint16_t addr = z80_fetch_word(cpu);
+    z80_write_word(cpu, addr, *cpu->hl);
+    cpu->wz = addr + 1;
+}
+
+// 00101010
+static void z80_cmd_ld_hl_nn(cpu_t *cpu, uint8_t op)
+{
+    uint16_t addr = z80_fetch_word(cpu);
+    *cpu->hl = z80_read_word(cpu, addr);
+    cpu->wz = addr + 1;
+}
+
+// 00110010
+static void z80_cmd_ld_nn_a(cpu_t *cpu, uint8_t op)
+{
+    uint16_t addr = z80_fetch_word(cpu);
+    z80_write(cpu, addr, Z80_A(cpu));
+    cpu->wz = ((addr + 1) & 0xff) | (Z80_A(cpu) << 8);
+}
+
+// 00111010
+static void z80_cmd_ld_a_nn(cpu_t *cpu, uint8_t op)
+{
+    uint16_t addr = z80_fetch_word(cpu);
+    Z80_A(cpu) = z80_read(cpu, addr);
+    cpu->wz = addr + 1;
+}
+
+// 00rr0011
+static void z80_cmd_inc_rr(cpu_t *cpu, uint8_t op)
+{
+    ++*z80_pair(cpu, (op >> 4) & 3);
+}
+
+// 00rr1011
+static void z80_cmd_dec_rr(cpu_t *cpu, uint8_t op)
+{
+    --*z80_pair(cpu, (op >> 4) & 3);
+}
+
+// 00rrr100
+static void z80_cmd_inc_r(cpu_t *cpu, uint8_t op)
+{
+    uint8_t *pr = z80_reg(cpu, op >> 3);
+    *pr = z80_inc(cpu, *pr);
+}
+
+// 00110100
+static void z80_cmd_inc_m(cpu_t *cpu, uint8_t op)
+{
+    uint16_t addr = z80_addr_m(cpu);
+    z80_write(cpu, addr, z80_inc(cpu, z80_read(cpu, addr)));
+}
+
+// 00rrr101
+static void z80_cmd_dec_r(cpu_t *cpu, uint8_t op)
+{
+    uint8_t *pr = z80_reg(cpu, op >> 3);
+    *pr = z80_dec(cpu, *pr);
+}
+
+// 00110101
+static void z80_cmd_dec_m(cpu_t *cpu, uint8_t op)
+{
+    uint16_t addr = z80_addr_m(cpu);
+    z80_write(cpu, addr, z80_dec(cpu, z80_read(cpu, addr)));
+}
+
+// 00rrr110
+static void z80_cmd_ld_r_n(cpu_t *cpu, uint8_t op)
+{
+    *z80_reg(cpu, op >> 3) = z80_fetch(cpu);
+}
+
+// 00110110
+static void z80_cmd_ld_m_n(cpu_t *cpu, uint8_t op)
+{
+    uint16_t addr = z80_addr_m(cpu);
+    if (cpu->prefix) {
+        // the operand is read while the address is computed
+        Z80_CYCLES(cpu, -3);
+    }
+    z80_write(cpu, addr, z80_fetch(cpu));
+}
+
+// 00000111, 00001111, 00010111, 00011111
+static void z80_cmd_rot_a(cpu_t *cpu, uint8_t op)
+{
+    uint8_t a = Z80_A(cpu);
+    uint8_t carry;
+    switch ((op >> 3) & 3) {
+        case 0:
+            a = (a << 1) | (a >> 7);
+            carry = a & 1;
+            break;
+        case 1:
+            carry = a & 1;
+            a = (a >> 1) | (a << 7);
+            break;
+        case 2:
+            carry = a >> 7;
+            a = (a << 1) | (Z80_F(cpu) & Z80_FLAG_C);
+            break;
+        default:
+            carry = a & 1;
+            a = (a >> 1) | ((Z80_F(cpu) & Z80_FLAG_C) << 7);
+            break;
+    }
+    Z80_A(cpu) = a;
+    Z80_F(cpu) = (Z80_F(cpu) & (Z80_FLAG_S | Z80_FLAG_Z | Z80_FLAG_P)) | (a & Z80_FLAG_XY) | carry;
+}
+
+// 00001000
+static void z80_cmd_ex_af(cpu_t *cpu, uint8_t op)
+{
+    uint16_t *paf = (uint16_t *)&cpu->reg_file[CPU_FILE_PSW];
+    uint16_t *palt = (uint16_t *)&cpu->alt_file[CPU_FILE_PSW];
+    uint16_t tmp = *paf;
+    *paf = *palt;
+    *palt = tmp;
+}
+
+// 00010000
+static void z80_cmd_djnz(cpu_t *cpu, uint8_t op)
+{
+    int8_t offset = z80_fetch(cpu);
+    if (--Z80_B(cpu)) {
+        cpu->pc += offset;
+        cpu->wz = cpu->pc;
+        Z80_CYCLES(cpu, 5);
+    }
+}
+
+// 00011000
+static void z80_cmd_jr(cpu_t *cpu, uint8_t op)
+{
+    int8_t offset = z80_fetch(cpu);
+    cpu->pc += offset;
+    cpu->wz = cpu->pc;
+}
+
+// 001cc000
+static void z80_cmd_jr_cc(cpu_t *cpu, uint8_t op)
+{
+    int8_t offset = z80_fetch(cpu);
+    if (z80_condition(cpu, (op >> 3) & 3)) {
+        cpu->pc += offset;
+        cpu->wz = cpu->pc;
+        Z80_CYCLES(cpu, 5);
+    }
+}
+
+// 00100111
+static void z80_cmd_daa(cpu_t *cpu, uint8_t op)
+{
+    uint8_t a = Z80_A(cpu);
+    uint8_t f = Z80_F(cpu);
+    uint8_t add = 0;
+    uint8_t carry = f & Z80_FLAG_C;
+    if ((f & Z80_FLAG_H) || (a & 0x0f) > 9)
+        add = 0x06;
+    if (carry || a > 0x99)
+        add |= 0x60;
+    if (a > 0x99)
+        carry = Z80_FLAG_C;
+    if (f & Z80_FLAG_N)
+        z80_sub(cpu, add, 0);
+    else
+        z80_add(cpu, add, 0);
+    Z80_F(cpu) = (Z80_F(cpu) & ~(Z80_FLAG_C | Z80_FLAG_P)) | carry | (z80_sz53p[Z80_A(cpu)] & Z80_FLAG_P);
+}
+
+// 00101111
+static void z80_cmd_cpl(cpu_t *cpu, uint8_t op)
+{
+    Z80_A(cpu) ^= 0xff;
+    Z80_F(cpu) = (Z80_F(cpu) & (Z80_FLAG_C | Z80_FLAG_P | Z80_FLAG_Z | Z80_FLAG_S))
+        | (Z80_A(cpu) & Z80_FLAG_XY) | Z80_FLAG_N | Z80_FLAG_H;
+}
+
+// 00110111
+static void z80_cmd_scf(cpu_t *cpu, uint8_t op)
+{
+    Z80_F(cpu) = (Z80_F(cpu) & (Z80_FLAG_P | Z80_FLAG_Z | Z80_FLAG_S))
+        | (Z80_A(cpu) & Z80_FLAG_XY) | Z80_FLAG_C;
+}
+
+// 00111111
+static void z80_cmd_ccf(cpu_t *cpu, uint8_t op)
+{
+    uint8_t f = Z80_F(cpu);
+    Z80_F(cpu) = (f & (Z80_FLAG_P | Z80_FLAG_Z | Z80_FLAG_S)) | (Z80_A(cpu) & Z80_FLAG_XY)
+        | ((f & Z80_FLAG_C) ? Z80_FLAG_H : Z80_FLAG_C);
+}
+
+// 01dddsss
+static void z80_cmd_ld_r_r(cpu_t *cpu, uint8_t op)
+{
+    *z80_reg(cpu, (op >> 3) & 7) = *z80_reg(cpu, op & 7);
+}
+
+// 01ddd110, the destination is never IXH or IXL
+static void z80_cmd_ld_r_m(cpu_t *cpu, uint8_t op)
+{
+    *cpu->reg[(op >> 3) & 7] = z80_read(cpu, z80_addr_m(cpu));
+}
+
+// 01110sss
+static void z80_cmd_ld_m_r(cpu_t *cpu, uint8_t op)
+{
+    uint16_t addr = z80_addr_m(cpu);
+    z80_write(cpu, addr, *cpu->reg[op & 7]);
+}
+
+// 01110110
+static void z80_cmd_halt(cpu_t *cpu, uint8_t op)
+{
+    cpu->halted = 1;
+}
+
+// 10aaasss
+static void z80_cmd_alu_r(cpu_t *cpu, uint8_t op)
+{
+    z80_alu(cpu, (op >> 3) & 7, *z80_reg(cpu, op & 7));
+}
+
+// 10aaa110
+static void z80_cmd_alu_m(cpu_t *cpu, uint8_t op)
+{
+    z80_alu(cpu, (op >> 3) & 7, z80_read(cpu, z80_addr_m(cpu)));
+}
+
+// 11aaa110
+static void z80_cmd_alu_n(cpu_t *cpu, uint8_t op)
+{
+    z80_alu(cpu, (op >> 3) & 7, z80_fetch(cpu));
+}
+
+// 11ccc000
+static void z80_cmd_ret_cc(cpu_t *cpu, uint8_t op)
+{
+    if (z80_condition(cpu, (op >> 3) & 7)) {
+        cpu->pc = z80_pop(cpu);
+        cpu->wz = cpu->pc;
+        Z80_CYCLES(cpu, 6);
+    }
+}
+
+// 11001001
+static void z80_cmd_ret(cpu_t *cpu, uint8_t op)
+{
+    cpu->pc = z80_pop(cpu);
+    cpu->wz = cpu->pc;
+}
+
+// 11rr0001, AF instead of SP
+static void z80_cmd_pop(cpu_t *cpu, uint8_t op)
+{
+    uint32_t idx = (op >> 4) & 3;
+    uint16_t *pr = idx == Z80_PAIR_SP ? (uint16_t *)&cpu->reg_file[CPU_FILE_PSW] : z80_pair(cpu, idx);
+    *pr = z80_pop(cpu);
+}
+
+// 11rr0101
+static void z80_cmd_push(cpu_t *cpu, uint8_t op)
+{
+    uint32_t idx = (op >> 4) & 3;
+    uint16_t *pr = idx == Z80_PAIR_SP ? (uint16_t *)&cpu->reg_file[CPU_FILE_PSW] : z80_pair(cpu, idx);
+    z80_push(cpu, *pr);
+}
+
+// 11ccc010
+static void z80_cmd_jp_cc(cpu_t *cpu, uint8_t op)
+{
+    cpu->wz = z80_fetch_word(cpu);
+    if (z80_condition(cpu, (op >> 3) & 7))
+        cpu->pc = cpu->wz;
+}
+
+// 11000011
+static void z80_cmd_jp(cpu_t *cpu, uint8_t op)
+{
+    cpu->wz = z80_fetch_word(cpu);
+    cpu->pc = cpu->wz;
+}
+
+// 11ccc100
+static void z80_cmd_call_cc(cpu_t *cpu, uint8_t op)
+{
+    cpu->wz = z80_fetch_word(cpu);
+    if (z80_condition(cpu, (op >> 3) & 7)) {
+        z80_push(cpu, cpu->pc);
+        cpu->pc = cpu->wz;
+        Z80_CYCLES(cpu, 7);
+    }
+}
+
+// 11001101
+static void z80_cmd_call(cpu_t *cpu, uint8_t op)
+{
+    cpu->wz = z80_fetch_word(cpu);
+    z80_push(cpu, cpu->pc);
+    cpu->pc = cpu->wz;
+}
+
+// 11nnn111
+static void z80_cmd_rst(cpu_t *cpu, uint8_t op)
+{
+    z80_push(cpu, cpu->pc);
+    cpu->pc = op & 0x38;
+    cpu->wz = cpu->pc;
+}
+
+// 11011001
+static void z80_cmd_exx(cpu_t *cpu, uint8_t op)
+{
+    uint8_t tmp[CPU_FILE_PSW];
+    memcpy(tmp, cpu->reg_file, sizeof(tmp));
+    memcpy(cpu->reg_file, cpu->alt_file, sizeof(tmp));
+    memcpy(cpu->alt_file, tmp, sizeof(tmp));
+}
+
+// 11101001
+static void z80_cmd_jp_hl(cpu_t *cpu, uint8_t op)
+{
+    cpu->pc = *cpu->hl;
+}
+
+// 11111001
+static void z80_cmd_ld_sp_hl(cpu_t *cpu, uint8_t op)
+{
+    cpu->sp = *cpu->hl;
+}
+
+// 11010011
+static void z80_cmd_out_n_a(cpu_t *cpu, uint8_t op)
+{
+    uint8_t port = z80_fetch(cpu);
+    z80_out(cpu, port, Z80_A(cpu));
+    cpu->wz = ((port + 1) & 0xff) | (Z80_A(cpu) << 8);
+}
+
+// 11011011
+static void z80_cmd_in_a_n(cpu_t *cpu, uint8_t op)
+{
+    uint8_t port = z80_fetch(cpu);
+    cpu->wz = ((Z80_A(cpu) << 8) | port) + 1;
+    Z80_A(cpu) = z80_in(cpu, port);
+}
+
+// 11100011
+static void z80_cmd_ex_sp_hl(cpu_t *cpu, uint8_t op)
+{
+    uint16_t val = z80_read_word(cpu, cpu->sp);
+    z80_write_word(cpu, cpu->sp, *cpu->hl);
+    *cpu->hl = val;
+    cpu->wz = val;
+}
+
+// 11101011, never affected by the prefixes
+static void z80_cmd_ex_de_hl(cpu_t *cpu, uint8_t op)
+{
+    uint16_t tmp = Z80_DE(cpu);
+    Z80_DE(cpu) = Z80_HL(cpu);
+    Z80_HL(cpu) = tmp;
+}
+
+// 11110011
+static void z80_cmd_di(cpu_t *cpu, uint8_t op)
+{
+    cpu->inte = cpu->iff2 = 0;
+}
+
+// 11111011
+static void z80_cmd_ei(cpu_t *cpu, uint8_t op)
+{
+    cpu->inte = cpu->iff2 = 1;
+}
+
+// 11001011, DDCB and FDCB put the displacement before the opcode and
+// copy the result of the undocumented register forms into the register
+static void z80_cmd_prefix_cb(cpu_t *cpu, uint8_t op)
+{
+    if (!cpu->prefix) {
+        op = z80_fetch_opcode(cpu);
+        Z80_CYCLES(cpu, 4);
+        z80_cmd_cb[op](cpu, op);
+        return;
+    }
+    uint16_t addr = *cpu->hl + (int8_t)z80_fetch(cpu);
+    op = z80_fetch(cpu);
+    cpu->wz = addr;
+    uint8_t val = z80_read(cpu, addr);
+    uint32_t bit = (op >> 3) & 7;
+    switch (op & 0xc0) {
+        case 0x00:
+            val = z80_shift(cpu, bit, val);
+            break;
+        case 0x40:
+            z80_bit(cpu, bit, val, addr >> 8);
+            Z80_CYCLES(cpu, 12);
+            return;
+        case 0x80:
+            val &= ~(1 << bit);
+            break;
+        case 0xc0:
+            val |= 1 << bit;
+            break;
+    }
+    z80_write(cpu, addr, val);
+    if ((op & 7) != Z80_REG_M)
+        *cpu->reg[op & 7] = val;
+    Z80_CYCLES(cpu, 15);
+}
+
+// 11011101, 11111101
+static void z80_cmd_prefix_xy(cpu_t *cpu, uint8_t op)
+{
+    cpu->prefix = op;
+    cpu->hl = op == 0xdd ? &cpu->ix : &cpu->iy;
+    op = z80_fetch_opcode(cpu);
+    Z80_CYCLES(cpu, z80_cycles_num[op]);
+    z80_cmd[op](cpu, op);
+}
+
+// 11101101, the index prefixes have no effect on the ED page
+static void z80_cmd_prefix_ed(cpu_t *cpu, uint8_t op)
+{
+    cpu->prefix = 0;
+    cpu->hl = cpu->pair[Z80_PAIR_HL];
+    op = z80_fetch_opcode(cpu);
+    Z80_CYCLES(cpu, z80_ed_cycles_num[op]);
+    z80_cmd_ed[op](cpu, op);
+}
+
+// CB page
+
+// 00ooorrr
+static void z80_cmd_shift_r(cpu_t *cpu, uint8_t op)
+{
+    uint8_t *pr = cpu->reg[op & 7];
+    *pr = z80_shift(cpu, (op >> 3) & 7, *pr);
+}
+
+// 00ooo110
+static void z80_cmd_shift_m(cpu_t *cpu, uint8_t op)
+{
+    uint16_t addr = Z80_HL(cpu);
+    z80_write(cpu, addr, z80_shift(cpu, (op >> 3) & 7, z80_read(cpu, addr)));
+    Z80_CYCLES(cpu, 7);
+}
+
+// 01bbbrrr
+static void z80_cmd_bit_r(cpu_t *cpu, uint8_t op)
+{
+    uint8_t val = *cpu->reg[op & 7];
+    z80_bit(cpu, (op >> 3) & 7, val, val);
+}
+
+// 01bbb110
+static void z80_cmd_bit_m(cpu_t *cpu, uint8_t op)
+{
+    z80_bit(cpu, (op >> 3) & 7, z80_read(cpu, Z80_HL(cpu)), cpu->wz >> 8);
+    Z80_CYCLES(cpu, 4);
+}
+
+// 10bbbrrr
+static void z80_cmd_res_r(cpu_t *cpu, uint8_t op)
+{
+    *cpu->reg[op & 7] &= ~(1 << ((op >> 3) & 7));
+}
+
+// 10bbb110
+static void z80_cmd_res_m(cpu_t *cpu, uint8_t op)
+{
+    uint16_t addr = Z80_HL(cpu);
+    z80_write(cpu, addr, z80_read(cpu, addr) & ~(1 << ((op >> 3) & 7)));
+    Z80_CYCLES(cpu, 7);
+}
+
+// 11bbbrrr
+static void z80_cmd_set_r(cpu_t *cpu, uint8_t op)
+{
+    *cpu->reg[op & 7] |= 1 << ((op >> 3) & 7);
+}
+
+// 11bbb110
+static void z80_cmd_set_m(cpu_t *cpu, uint8_t op)
+{
+    uint16_t addr = Z80_HL(cpu);
+    z80_write(cpu, addr, z80_read(cpu, addr) | (1 << ((op >> 3) & 7)));
+    Z80_CYCLES(cpu, 7);
+}
+
+// ED page
+
+// 01rrr000, IN F,(C) only sets the flags
+static void z80_cmd_in_r_c(cpu_t *cpu, uint8_t op)
+{
+    uint8_t val = z80_in(cpu, Z80_C(cpu));
+    cpu->wz = Z80_BC(cpu) + 1;
+    if (((op >> 3) & 7) != Z80_REG_M)
+        *cpu->reg[(op >> 3) & 7] = val;
+    Z80_F(cpu) = (Z80_F(cpu) & Z80_FLAG_C) | z80_sz53p[val];
+}
+
+// 01rrr001, OUT (C),0 for the (HL) slot
+static void z80_cmd_out_c_r(cpu_t *cpu, uint8_t op)
+{
+    uint32_t idx = (op >> 3) & 7;
+    z80_out(cpu, Z80_C(cpu), idx == Z80_REG_M ? 0 : *cpu->reg[idx]);
+    cpu->wz = Z80_BC(cpu) + 1;
+}
+
+// 01rr0010
+static void z80_cmd_sbc_hl_rr(cpu_t *cpu, uint8_t op)
+{
+    Z80_HL(cpu) = z80_sbc16(cpu, Z80_HL(cpu), *cpu->pair[(op >> 4) & 3]);
+}
+
+// 01rr1010
+static void z80_cmd_adc_hl_rr(cpu_t *cpu, uint8_t op)
+{
+    Z80_HL(cpu) = z80_adc16(cpu, Z80_HL(cpu), *cpu->pair[(op >> 4) & 3]);
+}
+
+// 01rr0011
+static void z80_cmd_ld_nn_rr(cpu_t *cpu, uint8_t op)
+{
+    uint16_t addr = z80_fetch_word(cpu);
+    z80_write_word(cpu, addr, *cpu->pair[(op >> 4) & 3]);
+    cpu->wz = addr + 1;
+}
+
+// 01rr1011
+static void z80_cmd_ld_rr_mm(cpu_t *cpu, uint8_t op)
+{
+    uint16_t addr = z80_fetch_word(cpu);
+    *cpu->pair[(op >> 4) & 3] = z80_read_word(cpu, addr);
+    cpu->wz = addr + 1;
+}
+
+// 01xxx100
+static void z80_cmd_neg(cpu_t *cpu, uint8_t op)
+{
+    uint8_t a = Z80_A(cpu);
+    Z80_A(cpu) = 0;
+    z80_sub(cpu, a, 0);
+}
+
+// 01xxx101, RETI differs from RETN for the peripherals only
+static void z80_cmd_retn(cpu_t *cpu, uint8_t op)
+{
+    cpu->inte = cpu->iff2;
+    cpu->pc = z80_pop(cpu);
+    cpu->wz = cpu->pc;
+}
+
+// 01xxx110
+static void z80_cmd_im(cpu_t *cpu, uint8_t op)
+{
+    static const uint8_t mode[4] = { 0, 0, 1, 2 };
+    cpu->im = mode[(op >> 3) & 3];
+}
+
+// 01000111
+static void z80_cmd_ld_i_a(cpu_t *cpu, uint8_t op)
+{
+    cpu->i = Z80_A(cpu);
+}
+
+// 01001111
+static void z80_cmd_ld_r_a(cpu_t *cpu, uint8_t op)
+{
+    cpu->r = Z80_A(cpu);
+}
+
+// 01010111
+static void z80_cmd_ld_a_i(cpu_t *cpu, uint8_t op)
+{
+    Z80_A(cpu) = cpu->i;
+    Z80_F(cpu) = (Z80_F(cpu) & Z80_FLAG_C) | z80_sz53[Z80_A(cpu)] | (cpu->iff2 ? Z80_FLAG_P : 0);
+}
+
+// 01011111
+static void z80_cmd_ld_a_r(cpu_t *cpu, uint8_t op)
+{
+    Z80_A(cpu) = cpu->r;
+    Z80_F(cpu) = (Z80_F(cpu) & Z80_FLAG_C) | z80_sz53[Z80_A(cpu)] | (cpu->iff2 ? Z80_FLAG_P : 0);
+}
+
+// 01100111
+static void z80_cmd_rrd(cpu_t *cpu, uint8_t op)
+{
+    uint16_t addr = Z80_HL(cpu);
+    uint8_t val = z80_read(cpu, addr);
+    uint8_t a = Z80_A(cpu);
+    z80_write(cpu, addr, (a << 4) | (val >> 4));
+    Z80_A(cpu) = (a & 0xf0) | (val & 0x0f);
+    Z80_F(cpu) = (Z80_F(cpu) & Z80_FLAG_C) | z80_sz53p[Z80_A(cpu)];
+    cpu->wz = addr + 1;
+}
+
+// 01101111
+static void z80_cmd_rld(cpu_t *cpu, uint8_t op)
+{
+    uint16_t addr = Z80_HL(cpu);
+    uint8_t val = z80_read(cpu, addr);
+    uint8_t a = Z80_A(cpu);
+    z80_write(cpu, addr, (val << 4) | (a & 0x0f));
+    Z80_A(cpu) = (a & 0xf0) | (val >> 4);
+    Z80_F(cpu) = (Z80_F(cpu) & Z80_FLAG_C) | z80_sz53p[Z80_A(cpu)];
+    cpu->wz = addr + 1;
+}
+
+// the repeated forms go back to the prefix while the counter runs,
+// so every iteration is a separate step
+static inline void z80_repeat(cpu_t *cpu)
+{
+    cpu->pc -= 2;
+    cpu->wz = cpu->pc + 1;
+    Z80_CYCLES(cpu, 5);
+}
+
+// 101r0000: LDI, LDD, LDIR, LDDR
+static void z80_cmd_ldi(cpu_t *cpu, uint8_t op)
+{
+    int16_t step = op & 0x08 ? -1 : 1;
+    uint8_t val = z80_read(cpu, Z80_HL(cpu));
+    z80_write(cpu, Z80_DE(cpu), val);
+    Z80_HL(cpu) += step;
+    Z80_DE(cpu) += step;
+    uint16_t bc = --Z80_BC(cpu);
+    val += Z80_A(cpu);
+    Z80_F(cpu) = (Z80_F(cpu) & (Z80_FLAG_C | Z80_FLAG_Z | Z80_FLAG_S)) | (bc ? Z80_FLAG_P : 0)
+        | (val & Z80_FLAG_X) | ((val & 0x02) ? Z80_FLAG_Y : 0);
+    if ((op & 0x10) && bc)
+        z80_repeat(cpu);
+}
+
+// 101r0001: CPI, CPD, CPIR, CPDR
+static void z80_cmd_cpi(cpu_t *cpu, uint8_t op)
+{
+    int16_t step = op & 0x08 ? -1 : 1;
+    uint8_t val = z80_read(cpu, Z80_HL(cpu));
+    uint8_t a = Z80_A(cpu);
+    uint8_t res = a - val;
+    uint8_t idx = ((a & 0x08) >> 3) | ((val & 0x08) >> 2) | ((res & 0x08) >> 1);
+    Z80_HL(cpu) += step;
+    cpu->wz += step;
+    uint16_t bc = --Z80_BC(cpu);
+    uint8_t f = (Z80_F(cpu) & Z80_FLAG_C) | Z80_FLAG_N | (bc ? Z80_FLAG_P : 0)
+        | z80_half_sub[idx] | (res ? 0 : Z80_FLAG_Z) | (res & Z80_FLAG_S);
+    if (f & Z80_FLAG_H)
+        --res;
+    Z80_F(cpu) = f | (res & Z80_FLAG_X) | ((res & 0x02) ? Z80_FLAG_Y : 0);
+    if ((op & 0x10) && bc && (f & Z80_FLAG_Z) == 0)
+        z80_repeat(cpu);
+}
+
+// 101r0010: INI, IND, INIR, INDR
+static void z80_cmd_ini(cpu_t *cpu, uint8_t op)
+{
+    int16_t step = op & 0x08 ? -1 : 1;
+    uint8_t val = z80_in(cpu, Z80_C(cpu));
+    cpu->wz = Z80_BC(cpu) + step;
+    z80_write(cpu, Z80_HL(cpu), val);
+    Z80_HL(cpu) += step;
+    uint8_t b = --Z80_B(cpu);
+    uint8_t sum = val + Z80_C(cpu) + step;
+    Z80_F(cpu) = (val & 0x80 ? Z80_FLAG_N : 0) | (sum < val ? Z80_FLAG_H | Z80_FLAG_C : 0)
+        | (z80_sz53p[(sum & 0x07) ^ b] & Z80_FLAG_P) | z80_sz53[b];
+    if ((op & 0x10) && b)
+        z80_repeat(cpu);
+}
+
+// 101r0011: OUTI, OUTD, OTIR, OTDR
+static void z80_cmd_outi(cpu_t *cpu, uint8_t op)
+{
+    int16_t step = op & 0x08 ? -1 : 1;
+    uint8_t val = z80_read(cpu, Z80_HL(cpu));
+    uint8_t b = --Z80_B(cpu);
+    cpu->wz = Z80_BC(cpu) + step;
+    z80_out(cpu, Z80_C(cpu), val);
+    Z80_HL(cpu) += step;
+    uint8_t sum = val + cpu->reg_file[CPU_FILE_L];
+    Z80_F(cpu) = (val & 0x80 ? Z80_FLAG_N : 0) | (sum < val ? Z80_FLAG_H | Z80_FLAG_C : 0)
+        | (z80_sz53p[(sum & 0x07) ^ b] & Z80_FLAG_P) | z80_sz53[b];
+    if ((op & 0x10) && b)
+        z80_repeat(cpu);
+}
+
+static const z80_cmd_t z80_cmd[256] = {
+    [0x00 ... 0xff] = z80_cmd_nop,
+
+    [0x01] = z80_cmd_ld_rr_nn, [0x11] = z80_cmd_ld_rr_nn, [0x21] = z80_cmd_ld_rr_nn, [0x31] = z80_cmd_ld_rr_nn,
+    [0x09] = z80_cmd_add_hl_rr, [0x19] = z80_cmd_add_hl_rr, [0x29] = z80_cmd_add_hl_rr, [0x39] = z80_cmd_add_hl_rr,
+    [0x02] = z80_cmd_ld_rr_a, [0x12] = z80_cmd_ld_rr_a,
+    [0x0a] = z80_cmd_ld_a_rr, [0x1a] = z80_cmd_ld_a_rr,
+    [0x22] = z80_cmd_ld_nn_hl, [0x2a] = z80_cmd_ld_hl_nn,
+    [0x32] = z80_cmd_ld_nn_a, [0x3a] = z80_cmd_ld_a_nn,
+    [0x03] = z80_cmd_inc_rr, [0x13] = z80_cmd_inc_rr, [0x23] = z80_cmd_inc_rr, [0x33] = z80_cmd_inc_rr,
+    [0x0b] = z80_cmd_dec_rr, [0x1b] = z80_cmd_dec_rr, [0x2b] = z80_cmd_dec_rr, [0x3b] = z80_cmd_dec_rr,
+    [0x04] = z80_cmd_inc_r, [0x0c] = z80_cmd_inc_r, [0x14] = z80_cmd_inc_r, [0x1c] = z80_cmd_inc_r,
+    [0x24] = z80_cmd_inc_r, [0x2c] = z80_cmd_inc_r, [0x34] = z80_cmd_inc_m, [0x3c] = z80_cmd_inc_r,
+    [0x05] = z80_cmd_dec_r, [0x0d] = z80_cmd_dec_r, [0x15] = z80_cmd_dec_r, [0x1d] = z80_cmd_dec_r,
+    [0x25] = z80_cmd_dec_r, [0x2d] = z80_cmd_dec_r, [0x35] = z80_cmd_dec_m, [0x3d] = z80_cmd_dec_r,
+    [0x06] = z80_cmd_ld_r_n, [0x0e] = z80_cmd_ld_r_n, [0x16] = z80_cmd_ld_r_n, [0x1e] = z80_cmd_ld_r_n,
+    [0x26] = z80_cmd_ld_r_n, [0x2e] = z80_cmd_ld_r_n, [0x36] = z80_cmd_ld_m_n, [0x3e] = z80_cmd_ld_r_n,
+    [0x07] = z80_cmd_rot_a, [0x0f] = z80_cmd_rot_a, [0x17] = z80_cmd_rot_a, [0x1f] = z80_cmd_rot_a,
+    [0x08] = z80_cmd_ex_af,
+    [0x10] = z80_cmd_djnz, [0x18] = z80_cmd_jr,
+    [0x20] = z80_cmd_jr_cc, [0x28] = z80_cmd_jr_cc, [0x30] = z80_cmd_jr_cc, [0x38] = z80_cmd_jr_cc,
+    [0x27] = z80_cmd_daa, [0x2f] = z80_cmd_cpl, [0x37] = z80_cmd_scf, [0x3f] = z80_cmd_ccf,
+
+    [0x40 ... 0x7f] = z80_cmd_ld_r_r,
+    [0x46] = z80_cmd_ld_r_m, [0x4e] = z80_cmd_ld_r_m, [0x56] = z80_cmd_ld_r_m, [0x5e] = z80_cmd_ld_r_m,
+    [0x66] = z80_cmd_ld_r_m, [0x6e] = z80_cmd_ld_r_m, [0x7e] = z80_cmd_ld_r_m,
+    [0x70 ... 0x75] = z80_cmd_ld_m_r, [0x77] = z80_cmd_ld_m_r,
+    [0x76] = z80_cmd_halt,
+
+    [0x80 ... 0xbf] = z80_cmd_alu_r,
+    [0x86] = z80_cmd_alu_m, [0x8e] = z80_cmd_alu_m, [0x96] = z80_cmd_alu_m, [0x9e] = z80_cmd_alu_m,
+    [0xa6] = z80_cmd_alu_m, [0xae] = z80_cmd_alu_m, [0xb6] = z80_cmd_alu_m, [0xbe] = z80_cmd_alu_m,
+
+    [0xc0] = z80_cmd_ret_cc, [0xc8] = z80_cmd_ret_cc, [0xd0] = z80_cmd_ret_cc, [0xd8] = z80_cmd_ret_cc,
+    [0xe0] = z80_cmd_ret_cc, [0xe8] = z80_cmd_ret_cc, [0xf0] = z80_cmd_ret_cc, [0xf8] = z80_cmd_ret_cc,
+    [0xc1] = z80_cmd_pop, [0xd1] = z80_cmd_pop, [0xe1] = z80_cmd_pop, [0xf1] = z80_cmd_pop,
+    [0xc5] = z80_cmd_push, [0xd5] = z80_cmd_push, [0xe5] = z80_cmd_push, [0xf5] = z80_cmd_push,
+    [0xc2] = z80_cmd_jp_cc, [0xca] = z80_cmd_jp_cc, [0xd2] = z80_cmd_jp_cc, [0xda] = z80_cmd_jp_cc,
+    [0xe2] = z80_cmd_jp_cc, [0xea] = z80_cmd_jp_cc, [0xf2] = z80_cmd_jp_cc, [0xfa] = z80_cmd_jp_cc,
+    [0xc4] = z80_cmd_call_cc, [0xcc] = z80_cmd_call_cc, [0xd4] = z80_cmd_call_cc, [0xdc] = z80_cmd_call_cc,
+    [0xe4] = z80_cmd_call_cc, [0xec] = z80_cmd_call_cc, [0xf4] = z80_cmd_call_cc, [0xfc] = z80_cmd_call_cc,
+    [0xc6] = z80_cmd_alu_n, [0xce] = z80_cmd_alu_n, [0xd6] = z80_cmd_alu_n, [0xde] = z80_cmd_alu_n,
+    [0xe6] = z80_cmd_alu_n, [0xee] = z80_cmd_alu_n, [0xf6] = z80_cmd_alu_n, [0xfe] = z80_cmd_alu_n,
+    [0xc7] = z80_cmd_rst, [0xcf] = z80_cmd_rst, [0xd7] = z80_cmd_rst, [0xdf] = z80_cmd_rst,
+    [0xe7] = z80_cmd_rst, [0xef] = z80_cmd_rst, [0xf7] = z80_cmd_rst, [0xff] = z80_cmd_rst,
+    [0xc3] = z80_cmd_jp, [0xc9] = z80_cmd_ret, [0xcd] = z80_cmd_call,
+    [0xd9] = z80_cmd_exx, [0xe9] = z80_cmd_jp_hl, [0xf9] = z80_cmd_ld_sp_hl,
+    [0xd3] = z80_cmd_out_n_a, [0xdb] = z80_cmd_in_a_n,
+    [0xe3] = z80_cmd_ex_sp_hl, [0xeb] = z80_cmd_ex_de_hl,
+    [0xf3] = z80_cmd_di, [0xfb] = z80_cmd_ei,
+    [0xcb] = z80_cmd_prefix_cb, [0xed] = z80_cmd_prefix_ed,
+    [0xdd] = z80_cmd_prefix_xy, [0xfd] = z80_cmd_prefix_xy
+};
+
+static const z80_cmd_t z80_cmd_cb[256] = {
+    [0x00 ... 0x3f] = z80_cmd_shift_r,
+    [0x40 ... 0x7f] = z80_cmd_bit_r,
+    [0x80 ... 0xbf] = z80_cmd_res_r,
+    [0xc0 ... 0xff] = z80_cmd_set_r,
+    [0x06] = z80_cmd_shift_m, [0x0e] = z80_cmd_shift_m, [0x16] = z80_cmd_shift_m, [0x1e] = z80_cmd_shift_m,
+    [0x26] = z80_cmd_shift_m, [0x2e] = z80_cmd_shift_m, [0x36] = z80_cmd_shift_m, [0x3e] = z80_cmd_shift_m,
+    [0x46] = z80_cmd_bit_m, [0x4e] = z80_cmd_bit_m, [0x56] = z80_cmd_bit_m, [0x5e] = z80_cmd_bit_m,
+    [0x66] = z80_cmd_bit_m, [0x6e] = z80_cmd_bit_m, [0x76] = z80_cmd_bit_m, [0x7e] = z80_cmd_bit_m,
+    [0x86] = z80_cmd_res_m, [0x8e] = z80_cmd_res_m, [0x96] = z80_cmd_res_m, [0x9e] = z80_cmd_res_m,
+    [0xa6] = z80_cmd_res_m, [0xae] = z80_cmd_res_m, [0xb6] = z80_cmd_res_m, [0xbe] = z80_cmd_res_m,
+    [0xc6] = z80_cmd_set_m, [0xce] = z80_cmd_set_m, [0xd6] = z80_cmd_set_m, [0xde] = z80_cmd_set_m,
+    [0xe6] = z80_cmd_set_m, [0xee] = z80_cmd_set_m, [0xf6] = z80_cmd_set_m, [0xfe] = z80_cmd_set_m
+};
+
+// the holes of the ED page act as two NOPs
+static const z80_cmd_t z80_cmd_ed[256] = {
+    [0x00 ... 0xff] = z80_cmd_nop,
+    [0x40] = z80_cmd_in_r_c, [0x48] = z80_cmd_in_r_c, [0x50] = z80_cmd_in_r_c, [0x58] = z80_cmd_in_r_c,
+    [0x60] = z80_cmd_in_r_c, [0x68] = z80_cmd_in_r_c, [0x70] = z80_cmd_in_r_c, [0x78] = z80_cmd_in_r_c,
+    [0x41] = z80_cmd_out_c_r, [0x49] = z80_cmd_out_c_r, [0x51] = z80_cmd_out_c_r, [0x59] = z80_cmd_out_c_r,
+    [0x61] = z80_cmd_out_c_r, [0x69] = z80_cmd_out_c_r, [0x71] = z80_cmd_out_c_r, [0x79] = z80_cmd_out_c_r,
+    [0x42] = z80_cmd_sbc_hl_rr, [0x52] = z80_cmd_sbc_hl_rr, [0x62] = z80_cmd_sbc_hl_rr, [0x72] = z80_cmd_sbc_hl_rr,
+    [0x4a] = z80_cmd_adc_hl_rr, [0x5a] = z80_cmd_adc_hl_rr, [0x6a] = z80_cmd_adc_hl_rr, [0x7a] = z80_cmd_adc_hl_rr,
+    [0x43] = z80_cmd_ld_nn_rr, [0x53] = z80_cmd_ld_nn_rr, [0x63] = z80_cmd_ld_nn_rr, [0x73] = z80_cmd_ld_nn_rr,
+    [0x4b] = z80_cmd_ld_rr_mm, [0x5b] = z80_cmd_ld_rr_mm, [0x6b] = z80_cmd_ld_rr_mm, [0x7b] = z80_cmd_ld_rr_mm,
+    [0x44] = z80_cmd_neg, [0x4c] = z80_cmd_neg, [0x54] = z80_cmd_neg, [0x5c] = z80_cmd_neg,
+    [0x64] = z80_cmd_neg, [0x6c] = z80_cmd_neg, [0x74] = z80_cmd_neg, [0x7c] = z80_cmd_neg,
+    [0x45] = z80_cmd_retn, [0x4d] = z80_cmd_retn, [0x55] = z80_cmd_retn, [0x5d] = z80_cmd_retn,
+    [0x65] = z80_cmd_retn, [0x6d] = z80_cmd_retn, [0x75] = z80_cmd_retn, [0x7d] = z80_cmd_retn,
+    [0x46] = z80_cmd_im, [0x4e] = z80_cmd_im, [0x56] = z80_cmd_im, [0x5e] = z80_cmd_im,
+    [0x66] = z80_cmd_im, [0x6e] = z80_cmd_im, [0x76] = z80_cmd_im, [0x7e] = z80_cmd_im,
+    [0x47] = z80_cmd_ld_i_a, [0x4f] = z80_cmd_ld_r_a, [0x57] = z80_cmd_ld_a_i, [0x5f] = z80_cmd_ld_a_r,
+    [0x67] = z80_cmd_rrd, [0x6f] = z80_cmd_rld,
+    [0xa0] = z80_cmd_ldi, [0xa8] = z80_cmd_ldi, [0xb0] = z80_cmd_ldi, [0xb8] = z80_cmd_ldi,
+    [0xa1] = z80_cmd_cpi, [0xa9] = z80_cmd_cpi, [0xb1] = z80_cmd_cpi, [0xb9] = z80_cmd_cpi,
+    [0xa2] = z80_cmd_ini, [0xaa] = z80_cmd_ini, [0xb2] = z80_cmd_ini, [0xba] = z80_cmd_ini,
+    [0xa3] = z80_cmd_outi, [0xab] = z80_cmd_outi, [0xb3] = z80_cmd_outi, [0xbb] = z80_cmd_outi
+};
+
+esp_err_t z80_reset(cpu_t *cpu)
+{
+    if (!z80_sz53[0])
+        z80_init_tables();
+    bzero(cpu->alt_file, sizeof(cpu->alt_file));
+    cpu->prefix = 0;
+    cpu->i = 0;
+    cpu->r = 0;
+    cpu->iff2 = 0;
+    cpu->im = 0;
+    cpu->ix = 0;
+    cpu->iy = 0;
+    cpu->wz = 0;
+    cpu->hl = cpu->pair[Z80_PAIR_HL];
+    return ESP_OK;
+}
+
+// IM 0 takes the RST from the data bus, IM 1 always goes to 0x0038 and
+// IM 2 reads the address from the table at I, indexed by the RST opcode
+esp_err_t z80_interrupt(cpu_t *cpu, uint8_t rst)
+{
+    cpu->iff2 = 0;
+    cpu->r = (cpu->r & 0x80) | ((cpu->r + 1) & 0x7f);
+    z80_push(cpu, cpu->pc);
+    switch (cpu->im) {
+        case 0:
+            cpu->pc = rst << 3;
+            Z80_CYCLES(cpu, 13);
+            break;
+        case 1:
+            cpu->pc = 0x0038;
+            Z80_CYCLES(cpu, 13);
+            break;
+        default:
+            cpu->pc = z80_read_word(cpu, (cpu->i << 8) | 0xc7 | (rst << 3));
+            Z80_CYCLES(cpu, 19);
+            break;
+    }
+    cpu->wz = cpu->pc;
+    return ESP_OK;
+}
+
+esp_err_t z80_step(cpu_t *cpu)
+{
+    cpu->prefix = 0;
+    cpu->hl = cpu->pair[Z80_PAIR_HL];
+    cpu->is_word = 0;
+    uint8_t op = z80_fetch_opcode(cpu);
+    cpu->cmd = op;
+    Z80_CYCLES(cpu, z80_cycles_num[op]);
+    z80_cmd[op](cpu, op);
+    return ESP_OK;
+}
+
+#endif
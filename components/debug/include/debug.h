@@ -15,9 +15,10 @@
  * You should have received a copy of the GNU General Public License
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
-#ifndef __DEBUG_H___
+#ifndef __DEBUG_H__
 #define __DEBUG_H__
 
+#include <stdint.h>
 #include "esp_log.h"
 #include "stdio.h"
 
@@ -29,4 +30,9 @@
 
 #define TRACEI(format, ...) ESP_LOGI(TAG, "Trace at %s:%d. " format, __FUNCTION__, __LINE__, ##__VA_ARGS__)
 
+void debug_hex_dump(FILE *fout, uint8_t *data, size_t length);
+// The lines are labeled from addr instead of the data pointer, e.g. with the
+// addresses of an emulated machine
+void debug_hex_dump_addr(FILE *fout, const uint8_t *data, size_t length, uint32_t addr);
+
 #endif // __DEBUG_H__
@@ -20,22 +20,24 @@
 
 #include "stdio.h"
 
-void debug_hex_dump(FILE *fout, uint8_t *data, size_t length)
+void debug_hex_dump_addr(FILE *fout, const uint8_t *data, size_t length, uint32_t addr)
 {
     const size_t line_bytes = 16;
     static const char hex[16] = "0123456789abcdef";
     char buf[100] = {0};
-    uint8_t *ptr = (uint8_t *)(((uint32_t)data) & ~0x0f);
-    fprintf(fout, "%p > %04x\n", data, length);
+    uint32_t end = addr + length;
+    uint32_t line = addr & ~0x0f;
+    fprintf(fout, "%08x > %04x\n", addr, (unsigned)length);
 
     while (1) {
         memset(buf, ' ', sizeof(buf));
-        sprintf(buf, "%08x", (uint32_t)ptr);
+        sprintf(buf, "%08x", line);
         buf[8] = ':';
         for (size_t i = 0; i < line_bytes; ++i) 
-            if ((data <= ptr+i) && (ptr+i < data+length)) {
-                buf[10+3*i] = hex[(ptr[i]>>4)&0x0f];
-                buf[11+3*i] = hex[ptr[i]&0x0f];
+            if ((addr <= line+i) && (line+i < end)) {
+                uint8_t b = data[line + i - addr];
+                buf[10+3*i] = hex[(b>>4)&0x0f];
+                buf[11+3*i] = hex[b&0x0f];
             }
             else {
                 buf[10+3*i] = '.';
@@ -43,16 +45,21 @@ void debug_hex_dump(FILE *fout, uint8_t *data, size_t length)
             }
 
         for (size_t i = 0; i < line_bytes; ++i) 
-            if ((data <= ptr+i) && (ptr+i < data+length))
-                buf[10+3*line_bytes+i] = ptr[i] < 0x20 ? '.' : (char)ptr[i];
+            if ((addr <= line+i) && (line+i < end))
+                buf[10+3*line_bytes+i] = data[line + i - addr] < 0x20 || data[line + i - addr] >= 0x7f ? '.' : (char)data[line + i - addr];
             else
                 buf[10+3*line_bytes+i] = '.';
 
 
         buf[10+4*line_bytes] = 0x00;
         fprintf(fout, "%s\n", buf);
-        ptr += line_bytes;
-        if (ptr > data+length)
+        line += line_bytes;
+        if (line >= end)
             break;
     }
 }
+
+void debug_hex_dump(FILE *fout, uint8_t *data, size_t length)
+{
+    debug_hex_dump_addr(fout, data, length, (uint32_t)(uintptr_t)data);
+}
@@ -22,6 +22,8 @@
 #include "bitmap.h"
 #include "esp_err.h"
 
+#define DISPLAY_PALETTE_LUT_SIZE 256
+
 struct display;
 
 typedef enum {
@@ -63,6 +65,11 @@ typedef struct display {
     display_color_t background;
     display_color_t foreground;
 
+    // two device pixels for every byte of two 4 bit palette indices, the
+    // lower nibble is the first pixel
+    bool is_palette_lut;
+    uint32_t palette_lut[DISPLAY_PALETTE_LUT_SIZE];
+
     display_get_config_t get_config;
     display_init_t init;
     display_done_t done;
@@ -73,6 +80,8 @@ int display_get_color(const display_point_t *p, const display_refresh_info_t *re
 int display_get_color_with_background(const display_point_t *p, const display_refresh_info_t *info, void *color);
 
 esp_err_t display_get_config(display_t *display, int type);
+// Build the palette lookup of the 16 bit formats, again after a palette change
+esp_err_t display_palette_lut_init(display_t *display);
 esp_err_t display_init(display_t *display, const display_initialization_t *init);
 esp_err_t display_done(display_t *display);
 esp_err_t display_refresh(const display_bitmap_t *bitmap);
@@ -15,6 +15,7 @@
  * You should have received a copy of the GNU General Public License
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
+#include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
 
@@ -121,36 +122,51 @@ static void display_format_bw1y(const display_refresh_info_t *info, bool is_le)
     }
 }
 
+// Every 8 pixels come from one 32 bit word of palette indices. With the
+// palette lookup built and the destination aligned, each byte of the word
+// is stored as one 32 bit pair of pixels.
 static void display_format_8i4_to_rgb555(display_refresh_info_t *refresh_info)
 {
     const display_rectangle_t *r = &refresh_info->rectangle;
     const display_bitmap_t *bitmap = refresh_info->bitmap;
     const display_t *display = bitmap->display;
+    const display_hardware_config_t *hw = display->hardware;
+    const display_color_rgb555_t *palette = (const display_color_rgb555_t *)hw->palette;
+    const uint32_t *lut = display->is_palette_lut ? display->palette_lut : NULL;
     const display_rectangle_t *b = &bitmap->bounds;
     display_color_rgb555_t *dst = (display_color_rgb555_t *)bitmap->data;
     display_point_t p;
 
-    size_t bit;
     int ofs = r->top * b->width + r->left;
     int delta = b->width - r->width;
+    int right = r->left + r->width;
     dst += ofs;
     for (p.y = r->top; p.y < r->top + r->height; ++p.y) {
-        uint32_t in_color = 0;
-        int ok = 0;
-        for (p.x = r->left, bit = 0; p.x < r->left + r->width; ++p.x, ++bit) {
-            if ((bit & 7) == 0) {
-                in_color = 0;
-                ok = display_get_color_with_background(&p, refresh_info, &in_color);
+        for (p.x = r->left; p.x < right; p.x += 8) {
+            int count = right - p.x < 8 ? right - p.x : 8;
+            uint32_t in_color = 0;
+            if (!display_get_color_with_background(&p, refresh_info, &in_color)) {
+                dst += count;
+                continue;
+            }
+            if (lut && count == 8 && !((uintptr_t)dst & 3)) {
+                uint32_t *pair = (uint32_t *)dst;
+                pair[0] = lut[in_color & 0xff];
+                pair[1] = lut[(in_color >> 8) & 0xff];
+                pair[2] = lut[(in_color >> 16) & 0xff];
+                pair[3] = lut[in_color >> 24];
+                dst += 8;
+                continue;
             }
-            if (ok) {
-                const display_hardware_config_t *hw = display->hardware;
-                display_color_rgb555_t *src = (display_color_rgb555_t *)hw->palette;
-                int idx = (in_color & 0x0f); // % display->palette_count;
+            // past the palette is black, as in the lookup
+            for (int i = 0; i < count; ++i, ++dst) {
+                int idx = in_color & 0x0f;
                 if (idx < hw->palette_count)
-                    *dst = src[idx];
+                    *dst = palette[idx];
+                else
+                    dst->rgb = 0;
                 in_color >>= 4;
             }
-            ++dst;
         }
         dst += delta;
     }
@@ -278,6 +294,24 @@ esp_err_t display_get_config(display_t *display, int type)
     return display->get_config(display, type);
 }
 
+// The palette entries are kept in the byte order of the bus already, so
+// the pairs are stored as they are sent. Indices past the palette are black.
+esp_err_t display_palette_lut_init(display_t *display)
+{
+    ESP_ERROR_CHECK(display ? ESP_OK : ESP_ERR_INVALID_ARG);
+    const display_hardware_config_t *hw = display->hardware;
+    ESP_ERROR_CHECK(hw && hw->palette ? ESP_OK : ESP_ERR_INVALID_STATE);
+    ESP_ERROR_CHECK(hw->bpp == 16 ? ESP_OK : ESP_ERR_NOT_SUPPORTED);
+    const display_color_rgb555_t *palette = (const display_color_rgb555_t *)hw->palette;
+    uint16_t colors[16];
+    for (int i = 0; i < 16; ++i)
+        colors[i] = i < hw->palette_count ? palette[i].rgb : 0;
+    for (int i = 0; i < DISPLAY_PALETTE_LUT_SIZE; ++i)
+        display->palette_lut[i] = colors[i & 0x0f] | ((uint32_t)colors[i >> 4] << 16);
+    display->is_palette_lut = true;
+    return ESP_OK;
+}
+
 esp_err_t display_init(display_t *display, const display_initialization_t *init)
 {
     ESP_ERROR_CHECK(display ? ESP_OK : ESP_ERR_INVALID_ARG);
@@ -0,0 +1,81 @@
+/*
+ * This file is part of the ring component distribution
+ * (https://gitlab.romanchenko.su/esp/components/ring.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+
+#define ORDOS_NAME_SIZE 8
+#define ORDOS_HEADER_SIZE 16
+// ORDOS keeps disk B in RAM page 1 below the colour plane
+#define ORDOS_DISK_SIZE 0xc000
+// the first name byte after the last file
+#define ORDOS_END_MARK 0xff
+
+// File header, the body follows it, the next file follows the body.
+typedef struct __attribute__((packed)) ordos_header {
+    char name[ORDOS_NAME_SIZE];
+    uint16_t addr;
+    uint16_t size;
+    uint8_t attr;
+    uint8_t reserved[3];
+} ordos_header_t;
+
+// RAM disk in a RAM page. A mounted image is copied to the page only when
+// the disk is attached: by the first access to the page or to the files.
+typedef struct ordos {
+    uint8_t *disk;
+    size_t size;
+    const uint8_t *image;
+    size_t image_size;
+} ordos_t;
+
+// Returns false to stop the listing.
+typedef bool (*ordos_list_cb_t)(const ordos_header_t *header, size_t offset, void *arg);
+
+esp_err_t ordos_create(ordos_t **pordos, uint8_t *disk, size_t size);
+esp_err_t ordos_done(ordos_t *ordos);
+
+// The image must stay valid until the disk is attached or unmounted.
+esp_err_t ordos_mount(ordos_t *ordos, const uint8_t *image, size_t size);
+esp_err_t ordos_unmount(ordos_t *ordos);
+esp_err_t ordos_attach(ordos_t *ordos);
+static inline bool ordos_is_pending(ordos_t *ordos)
+{
+    return ordos->image != NULL;
+}
+
+esp_err_t ordos_format(ordos_t *ordos);
+esp_err_t ordos_list(ordos_t *ordos, ordos_list_cb_t cb, void *arg);
+// Free bytes for the next file, its header included.
+esp_err_t ordos_get_free(ordos_t *ordos, size_t *pfree);
+esp_err_t ordos_find(ordos_t *ordos, const char *name, ordos_header_t *header, size_t *poffset);
+esp_err_t ordos_delete(ordos_t *ordos, const char *name);
+
+// .ord files: the header, then the body. A file with the same name is
+// replaced, name overrides the name of the header if it is not NULL. f is
+// seekable, a short body or a file too big leaves the disk as it was.
+esp_err_t ordos_import(ordos_t *ordos, FILE *f, const char *name);
+esp_err_t ordos_export(ordos_t *ordos, const char *name, FILE *f);
+
+// Space padded upper case disk name of a host file name, without the extension.
+void ordos_file_name(char name[ORDOS_NAME_SIZE], const char *file);
@@ -0,0 +1,243 @@
+/*
+ * This file is part of the ring component distribution
+ * (https://gitlab.romanchenko.su/esp/components/ring.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "esp_log.h"
+#include "ordos.h"
+
+static const char __attribute__((unused)) *TAG = "ordos";
+
+esp_err_t ordos_create(ordos_t **pordos, uint8_t *disk, size_t size)
+{
+    ESP_ERROR_CHECK(pordos && disk ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(size > ORDOS_HEADER_SIZE ? ESP_OK : ESP_ERR_INVALID_SIZE);
+    ordos_t *ordos = (ordos_t *)malloc(sizeof(ordos_t));
+    ESP_ERROR_CHECK(ordos ? ESP_OK : ESP_ERR_NO_MEM);
+    bzero(ordos, sizeof(ordos_t));
+    ordos->disk = disk;
+    ordos->size = size;
+
+    *pordos = ordos;
+    return ESP_OK;
+}
+
+esp_err_t ordos_done(ordos_t *ordos)
+{
+    ESP_ERROR_CHECK(ordos ? ESP_OK : ESP_ERR_INVALID_ARG);
+    free(ordos);
+    return ESP_OK;
+}
+
+esp_err_t ordos_mount(ordos_t *ordos, const uint8_t *image, size_t size)
+{
+    ESP_ERROR_CHECK(ordos && image ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (size > ordos->size)
+        size = ordos->size;
+    ordos->image = image;
+    ordos->image_size = size;
+    return ESP_OK;
+}
+
+esp_err_t ordos_unmount(ordos_t *ordos)
+{
+    ESP_ERROR_CHECK(ordos ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ordos->image = NULL;
+    ordos->image_size = 0;
+    return ESP_OK;
+}
+
+esp_err_t ordos_attach(ordos_t *ordos)
+{
+    ESP_ERROR_CHECK(ordos ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (!ordos->image)
+        return ESP_OK;
+    memcpy(ordos->disk, ordos->image, ordos->image_size);
+    // images may end right after the last file
+    if (ordos->image_size < ordos->size)
+        ordos->disk[ordos->image_size] = ORDOS_END_MARK;
+    ESP_LOGI(TAG, "attached %u bytes", (unsigned)ordos->image_size);
+    ordos->image = NULL;
+    ordos->image_size = 0;
+    return ESP_OK;
+}
+
+esp_err_t ordos_format(ordos_t *ordos)
+{
+    ESP_ERROR_CHECK(ordos ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ordos->image = NULL;
+    ordos->disk[0] = ORDOS_END_MARK;
+    return ESP_OK;
+}
+
+// Empty names end the disk as well, so a cleared page reads as an empty
+// disk. A size past the end of the disk ends it too.
+static bool ordos_read_header(ordos_t *ordos, size_t offset, ordos_header_t *header)
+{
+    if (offset + ORDOS_HEADER_SIZE > ordos->size)
+        return false;
+    uint8_t c = ordos->disk[offset];
+    if (c == ORDOS_END_MARK || !c)
+        return false;
+    memcpy(header, &ordos->disk[offset], ORDOS_HEADER_SIZE);
+    return offset + ORDOS_HEADER_SIZE + header->size <= ordos->size;
+}
+
+// offset of the end mark
+static size_t ordos_end(ordos_t *ordos)
+{
+    ordos_header_t header;
+    size_t offset = 0;
+    while (ordos_read_header(ordos, offset, &header))
+        offset += ORDOS_HEADER_SIZE + header.size;
+    return offset;
+}
+
+esp_err_t ordos_list(ordos_t *ordos, ordos_list_cb_t cb, void *arg)
+{
+    ESP_ERROR_CHECK(ordos && cb ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(ordos_attach(ordos));
+    ordos_header_t header;
+    size_t offset = 0;
+    while (ordos_read_header(ordos, offset, &header) && cb(&header, offset, arg))
+        offset += ORDOS_HEADER_SIZE + header.size;
+    return ESP_OK;
+}
+
+esp_err_t ordos_get_free(ordos_t *ordos, size_t *pfree)
+{
+    ESP_ERROR_CHECK(ordos && pfree ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(ordos_attach(ordos));
+    // the end mark stays
+    size_t end = ordos_end(ordos) + 1;
+    *pfree = end < ordos->size ? ordos->size - end : 0;
+    return ESP_OK;
+}
+
+void ordos_file_name(char name[ORDOS_NAME_SIZE], const char *file)
+{
+    const char *base = strrchr(file, '/');
+    base = base ? base + 1 : file;
+    const char *ext = strrchr(base, '.');
+    size_t length = ext && ext != base ? (size_t)(ext - base) : strlen(base);
+    for (size_t i = 0; i < ORDOS_NAME_SIZE; ++i)
+        name[i] = i < length ? toupper((unsigned char)base[i]) : ' ';
+}
+
+static bool ordos_name_equal(const char *disk_name, const char *name)
+{
+    char padded[ORDOS_NAME_SIZE];
+    size_t length = strnlen(name, ORDOS_NAME_SIZE);
+    memset(padded, ' ', ORDOS_NAME_SIZE);
+    memcpy(padded, name, length);
+    return !strncasecmp(disk_name, padded, ORDOS_NAME_SIZE);
+}
+
+esp_err_t ordos_find(ordos_t *ordos, const char *name, ordos_header_t *header, size_t *poffset)
+{
+    ESP_ERROR_CHECK(ordos && name && header ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(ordos_attach(ordos));
+    size_t offset = 0;
+    while (ordos_read_header(ordos, offset, header)) {
+        if (ordos_name_equal(header->name, name)) {
+            if (poffset)
+                *poffset = offset;
+            return ESP_OK;
+        }
+        offset += ORDOS_HEADER_SIZE + header->size;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t ordos_delete(ordos_t *ordos, const char *name)
+{
+    ordos_header_t header;
+    size_t offset;
+    esp_err_t r = ordos_find(ordos, name, &header, &offset);
+    if (r != ESP_OK)
+        return r;
+    size_t end = ordos_end(ordos);
+    size_t length = ORDOS_HEADER_SIZE + header.size;
+    memmove(&ordos->disk[offset], &ordos->disk[offset + length], end - offset - length);
+    ordos->disk[end - length] = ORDOS_END_MARK;
+    ESP_LOGI(TAG, "deleted %.8s", header.name);
+    return ESP_OK;
+}
+
+esp_err_t ordos_import(ordos_t *ordos, FILE *f, const char *name)
+{
+    ESP_ERROR_CHECK(ordos && f ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ordos_header_t header;
+    if (fread(&header, ORDOS_HEADER_SIZE, 1, f) != 1)
+        return ESP_ERR_INVALID_SIZE;
+    if (name) {
+        size_t length = strnlen(name, ORDOS_NAME_SIZE);
+        memset(header.name, ' ', ORDOS_NAME_SIZE);
+        memcpy(header.name, name, length);
+    }
+    if ((uint8_t)header.name[0] == ORDOS_END_MARK || !header.name[0])
+        return ESP_ERR_INVALID_ARG;
+
+    // the body is all there and fits in place of the old file, before the
+    // old file is deleted
+    long pos = ftell(f);
+    if (pos < 0 || fseek(f, 0, SEEK_END))
+        return ESP_ERR_NOT_SUPPORTED;
+    long file_size = ftell(f);
+    if (file_size < 0 || fseek(f, pos, SEEK_SET))
+        return ESP_ERR_NOT_SUPPORTED;
+    if (file_size - pos < header.size)
+        return ESP_ERR_INVALID_SIZE;
+
+    char file_name[ORDOS_NAME_SIZE + 1] = { 0 };
+    memcpy(file_name, header.name, ORDOS_NAME_SIZE);
+    ordos_header_t old;
+    size_t old_length = 0;
+    if (ordos_find(ordos, file_name, &old, NULL) == ESP_OK)
+        old_length = ORDOS_HEADER_SIZE + old.size;
+    size_t end = ordos_end(ordos) - old_length;
+    if (end + ORDOS_HEADER_SIZE + header.size + 1 > ordos->size)
+        return ESP_ERR_NO_MEM;
+    if (old_length)
+        ESP_ERROR_CHECK(ordos_delete(ordos, file_name));
+
+    uint8_t *body = &ordos->disk[end + ORDOS_HEADER_SIZE];
+    if (header.size && fread(body, header.size, 1, f) != 1) {
+        ordos->disk[end] = ORDOS_END_MARK;
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(&ordos->disk[end], &header, ORDOS_HEADER_SIZE);
+    ordos->disk[end + ORDOS_HEADER_SIZE + header.size] = ORDOS_END_MARK;
+    ESP_LOGI(TAG, "imported %.8s, %u bytes", header.name, header.size);
+    return ESP_OK;
+}
+
+esp_err_t ordos_export(ordos_t *ordos, const char *name, FILE *f)
+{
+    ESP_ERROR_CHECK(ordos && name && f ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ordos_header_t header;
+    size_t offset;
+    esp_err_t r = ordos_find(ordos, name, &header, &offset);
+    if (r != ESP_OK)
+        return r;
+    if (fwrite(&ordos->disk[offset], ORDOS_HEADER_SIZE + header.size, 1, f) != 1)
+        return ESP_FAIL;
+    return ESP_OK;
+}
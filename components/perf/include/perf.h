@@ -0,0 +1,138 @@
+/*
+ * This file is part of the perf component distribution
+ * (https://gitlab.romanchenko.su/esp/components/perf.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+#include "esp_err.h"
+
+#define PERF_ITEMS_MAX 32
+#define PERF_PERIOD_US 1000000
+
+typedef enum {
+    PERF_COUNTER = 0,
+    PERF_RANGE
+} perf_type_t;
+
+// Event counter. Only one task adds to it, so a plain load and store is
+// enough; it wraps, the snapshots take the difference.
+typedef struct perf_counter {
+    atomic_uint value;
+} perf_counter_t;
+
+// Samples of a value, e.g. a time in us. The writing task owns count, sum,
+// min, max and seen, the snapshot only bumps epoch to start the min and
+// max over.
+typedef struct perf_range {
+    atomic_uint count;
+    atomic_uint sum;
+    atomic_uint min;
+    atomic_uint max;
+    atomic_uint epoch;
+    uint32_t seen;
+} perf_range_t;
+
+// An item over the last period
+typedef struct perf_value {
+    // events or samples since the item was added
+    uint64_t total;
+    // events or samples of the period
+    uint32_t delta;
+    // the samples of the period, zero without samples
+    uint32_t min;
+    uint32_t avg;
+    uint32_t max;
+} perf_value_t;
+
+typedef struct perf_item {
+    const char *name;
+    perf_type_t type;
+    perf_counter_t *counter;
+    perf_range_t *range;
+    uint32_t last_value;
+    uint32_t last_sum;
+    perf_value_t value;
+} perf_item_t;
+
+// The items are added before the first snapshot. perf_snapshot() is called
+// by one task, the readers copy the values under the sequence counter.
+typedef struct perf {
+    perf_item_t items[PERF_ITEMS_MAX];
+    size_t count;
+    // odd while a snapshot is written
+    atomic_uint seq;
+    int64_t time;
+    uint32_t period_us;
+    uint32_t snapshots;
+} perf_t;
+
+esp_err_t perf_create(perf_t **pperf);
+esp_err_t perf_done(perf_t *perf);
+
+// name is kept, "subsystem.counter" by convention
+esp_err_t perf_add_counter(perf_t *perf, const char *name, perf_counter_t *counter);
+esp_err_t perf_add_range(perf_t *perf, const char *name, perf_range_t *range);
+
+// Starts a period, the time since the previous snapshot is not reported,
+// e.g. after a pause
+esp_err_t perf_start(perf_t *perf, int64_t now);
+// Takes a snapshot when PERF_PERIOD_US passed since the period started
+esp_err_t perf_step(perf_t *perf, int64_t now);
+esp_err_t perf_snapshot(perf_t *perf, int64_t now);
+
+// Consistent copy of the last snapshot, values has PERF_ITEMS_MAX entries
+esp_err_t perf_get(perf_t *perf, perf_value_t *values, uint32_t *pperiod_us);
+esp_err_t perf_print(perf_t *perf, FILE *f);
+// One JSON object, returns its length as snprintf does
+int perf_json(perf_t *perf, char *buf, size_t size);
+
+static inline void perf_count(perf_counter_t *counter, uint32_t n)
+{
+    atomic_store_explicit(&counter->value, atomic_load_explicit(&counter->value, memory_order_relaxed) + n,
+        memory_order_relaxed);
+}
+
+// The counter follows an outside running value, e.g. the cycle counter
+static inline void perf_set(perf_counter_t *counter, uint32_t value)
+{
+    atomic_store_explicit(&counter->value, value, memory_order_relaxed);
+}
+
+static inline void perf_sample(perf_range_t *range, uint32_t value)
+{
+    uint32_t epoch = atomic_load_explicit(&range->epoch, memory_order_relaxed);
+    if (range->seen != epoch) {
+        range->seen = epoch;
+        atomic_store_explicit(&range->min, value, memory_order_relaxed);
+        atomic_store_explicit(&range->max, value, memory_order_relaxed);
+    }
+    else {
+        if (value < atomic_load_explicit(&range->min, memory_order_relaxed))
+            atomic_store_explicit(&range->min, value, memory_order_relaxed);
+        if (value > atomic_load_explicit(&range->max, memory_order_relaxed))
+            atomic_store_explicit(&range->max, value, memory_order_relaxed);
+    }
+    atomic_store_explicit(&range->sum, atomic_load_explicit(&range->sum, memory_order_relaxed) + value,
+        memory_order_relaxed);
+    // the last one, the snapshot reads the count first
+    atomic_store_explicit(&range->count, atomic_load_explicit(&range->count, memory_order_relaxed) + 1,
+        memory_order_release);
+}
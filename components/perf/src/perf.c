@@ -0,0 +1,224 @@
+/*
+ * This file is part of the perf component distribution
+ * (https://gitlab.romanchenko.su/esp/components/perf.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "perf.h"
+
+static const char __attribute__((unused)) *TAG = "perf";
+
+esp_err_t perf_create(perf_t **pperf)
+{
+    ESP_ERROR_CHECK(pperf ? ESP_OK : ESP_ERR_INVALID_ARG);
+    perf_t *perf = (perf_t *)malloc(sizeof(perf_t));
+    ESP_ERROR_CHECK(perf ? ESP_OK : ESP_ERR_NO_MEM);
+    bzero(perf, sizeof(perf_t));
+    atomic_init(&perf->seq, 0);
+
+    *pperf = perf;
+    return ESP_OK;
+}
+
+esp_err_t perf_done(perf_t *perf)
+{
+    ESP_ERROR_CHECK(perf ? ESP_OK : ESP_ERR_INVALID_ARG);
+    free(perf);
+    return ESP_OK;
+}
+
+static esp_err_t perf_add(perf_t *perf, const char *name, perf_type_t type, perf_counter_t *counter,
+    perf_range_t *range)
+{
+    ESP_ERROR_CHECK(perf && name ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (perf->count == PERF_ITEMS_MAX) {
+        ESP_LOGW(TAG, "no room for %s", name);
+        return ESP_ERR_NO_MEM;
+    }
+    perf_item_t *item = &perf->items[perf->count++];
+    bzero(item, sizeof(perf_item_t));
+    item->name = name;
+    item->type = type;
+    item->counter = counter;
+    item->range = range;
+    if (counter)
+        item->last_value = atomic_load_explicit(&counter->value, memory_order_relaxed);
+    else {
+        item->last_value = atomic_load_explicit(&range->count, memory_order_acquire);
+        item->last_sum = atomic_load_explicit(&range->sum, memory_order_relaxed);
+    }
+    return ESP_OK;
+}
+
+esp_err_t perf_add_counter(perf_t *perf, const char *name, perf_counter_t *counter)
+{
+    ESP_ERROR_CHECK(counter ? ESP_OK : ESP_ERR_INVALID_ARG);
+    return perf_add(perf, name, PERF_COUNTER, counter, NULL);
+}
+
+esp_err_t perf_add_range(perf_t *perf, const char *name, perf_range_t *range)
+{
+    ESP_ERROR_CHECK(range ? ESP_OK : ESP_ERR_INVALID_ARG);
+    return perf_add(perf, name, PERF_RANGE, NULL, range);
+}
+
+static void perf_collect(perf_item_t *item, perf_value_t *v)
+{
+    if (item->type == PERF_COUNTER) {
+        uint32_t value = atomic_load_explicit(&item->counter->value, memory_order_relaxed);
+        v->delta = value - item->last_value;
+        item->last_value = value;
+    }
+    else {
+        perf_range_t *range = item->range;
+        uint32_t count = atomic_load_explicit(&range->count, memory_order_acquire);
+        uint32_t sum = atomic_load_explicit(&range->sum, memory_order_relaxed);
+        v->delta = count - item->last_value;
+        if (v->delta) {
+            v->min = atomic_load_explicit(&range->min, memory_order_relaxed);
+            v->max = atomic_load_explicit(&range->max, memory_order_relaxed);
+            v->avg = (sum - item->last_sum) / v->delta;
+        }
+        else {
+            v->min = 0;
+            v->avg = 0;
+            v->max = 0;
+        }
+        item->last_value = count;
+        item->last_sum = sum;
+        atomic_store_explicit(&range->epoch, atomic_load_explicit(&range->epoch, memory_order_relaxed) + 1,
+            memory_order_relaxed);
+    }
+    v->total += v->delta;
+}
+
+// The writer half of a sequence lock, the readers retry while it is odd or
+// when it changed under them.
+static void perf_publish(perf_t *perf, bool is_snapshot, int64_t now)
+{
+    uint32_t seq = atomic_load_explicit(&perf->seq, memory_order_relaxed);
+    atomic_store_explicit(&perf->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (size_t i = 0; i < perf->count; ++i) {
+        perf_item_t *item = &perf->items[i];
+        if (is_snapshot)
+            perf_collect(item, &item->value);
+        else {
+            // the totals go on, the period starts over
+            perf_value_t value = item->value;
+            perf_collect(item, &value);
+            item->value.total = value.total;
+        }
+    }
+    if (is_snapshot) {
+        perf->period_us = now - perf->time;
+        ++perf->snapshots;
+    }
+    perf->time = now;
+    atomic_store_explicit(&perf->seq, seq + 2, memory_order_release);
+}
+
+esp_err_t perf_start(perf_t *perf, int64_t now)
+{
+    ESP_ERROR_CHECK(perf ? ESP_OK : ESP_ERR_INVALID_ARG);
+    perf_publish(perf, false, now);
+    return ESP_OK;
+}
+
+esp_err_t perf_snapshot(perf_t *perf, int64_t now)
+{
+    ESP_ERROR_CHECK(perf ? ESP_OK : ESP_ERR_INVALID_ARG);
+    perf_publish(perf, true, now);
+    return ESP_OK;
+}
+
+esp_err_t perf_step(perf_t *perf, int64_t now)
+{
+    ESP_ERROR_CHECK(perf ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (now - perf->time >= PERF_PERIOD_US)
+        perf_publish(perf, true, now);
+    return ESP_OK;
+}
+
+esp_err_t perf_get(perf_t *perf, perf_value_t *values, uint32_t *pperiod_us)
+{
+    ESP_ERROR_CHECK(perf && values ? ESP_OK : ESP_ERR_INVALID_ARG);
+    uint32_t seq;
+    uint32_t period_us;
+    do {
+        seq = atomic_load_explicit(&perf->seq, memory_order_acquire);
+        for (size_t i = 0; i < perf->count; ++i)
+            values[i] = perf->items[i].value;
+        period_us = perf->period_us;
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || atomic_load_explicit(&perf->seq, memory_order_relaxed) != seq);
+    if (pperiod_us)
+        *pperiod_us = period_us;
+    return ESP_OK;
+}
+
+static inline uint64_t perf_rate(const perf_value_t *v, uint32_t period_us)
+{
+    return period_us ? (uint64_t)v->delta * PERF_PERIOD_US / period_us : 0;
+}
+
+esp_err_t perf_print(perf_t *perf, FILE *f)
+{
+    ESP_ERROR_CHECK(perf && f ? ESP_OK : ESP_ERR_INVALID_ARG);
+    perf_value_t values[PERF_ITEMS_MAX];
+    uint32_t period_us;
+    ESP_ERROR_CHECK(perf_get(perf, values, &period_us));
+    if (!period_us) {
+        fprintf(f, "perf: no snapshot yet\n");
+        return ESP_OK;
+    }
+    fprintf(f, "perf: %u.%03u s\n", period_us / 1000000, period_us / 1000 % 1000);
+    for (size_t i = 0; i < perf->count; ++i) {
+        const perf_value_t *v = &values[i];
+        if (perf->items[i].type == PERF_COUNTER)
+            fprintf(f, "  %-20s %10" PRIu64 "/s %14" PRIu64 "\n", perf->items[i].name,
+                perf_rate(v, period_us), v->total);
+        else
+            fprintf(f, "  %-20s %10" PRIu64 "/s %14" PRIu64 "  min %u avg %u max %u\n", perf->items[i].name,
+                perf_rate(v, period_us), v->total, v->min, v->avg, v->max);
+    }
+    return ESP_OK;
+}
+
+int perf_json(perf_t *perf, char *buf, size_t size)
+{
+    ESP_ERROR_CHECK(perf && buf ? ESP_OK : ESP_ERR_INVALID_ARG);
+    perf_value_t values[PERF_ITEMS_MAX];
+    uint32_t period_us;
+    ESP_ERROR_CHECK(perf_get(perf, values, &period_us));
+    size_t len = snprintf(buf, size, "{\"period_us\":%u", period_us);
+    for (size_t i = 0; i < perf->count && len < size; ++i) {
+        const perf_value_t *v = &values[i];
+        len += snprintf(buf + len, size - len, ",\"%s\":{\"rate\":%" PRIu64 ",\"total\":%" PRIu64,
+            perf->items[i].name, perf_rate(v, period_us), v->total);
+        if (len < size && perf->items[i].type == PERF_RANGE)
+            len += snprintf(buf + len, size - len, ",\"min\":%u,\"avg\":%u,\"max\":%u", v->min, v->avg, v->max);
+        if (len < size)
+            len += snprintf(buf + len, size - len, "}");
+    }
+    if (len < size)
+        len += snprintf(buf + len, size - len, "}");
+    return len;
+}
@@ -0,0 +1,121 @@
+/*
+ * This file is part of the ring component distribution
+ * (https://gitlab.romanchenko.su/esp/components/ring.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "esp_err.h"
+
+#define RING_CACHE_LINE_SIZE 64
+
+// Lock-free single-producer/single-consumer ring buffer. The producer only
+// writes head and dropped, the consumer only writes tail, so no locks and
+// no read-modify-write atomics are needed.
+typedef struct ring {
+    _Alignas(RING_CACHE_LINE_SIZE) atomic_size_t head;
+    size_t dropped_items;
+    atomic_size_t dropped;
+    _Alignas(RING_CACHE_LINE_SIZE) atomic_size_t tail;
+    _Alignas(RING_CACHE_LINE_SIZE) size_t length;
+    size_t mask;
+    size_t item_size;
+    uint8_t *data;
+} ring_t;
+
+esp_err_t ring_create(ring_t **pring, size_t length, size_t item_size);
+esp_err_t ring_done(ring_t *ring);
+
+static inline void ring_copy_in(ring_t *ring, size_t pos, const uint8_t *items, size_t count)
+{
+    size_t idx = pos & ring->mask;
+    size_t first = ring->length - idx;
+    if (first > count)
+        first = count;
+    memcpy(&ring->data[idx * ring->item_size], items, first * ring->item_size);
+    memcpy(ring->data, &items[first * ring->item_size], (count - first) * ring->item_size);
+}
+
+static inline void ring_copy_out(ring_t *ring, size_t pos, uint8_t *items, size_t count)
+{
+    size_t idx = pos & ring->mask;
+    size_t first = ring->length - idx;
+    if (first > count)
+        first = count;
+    memcpy(items, &ring->data[idx * ring->item_size], first * ring->item_size);
+    memcpy(&items[first * ring->item_size], ring->data, (count - first) * ring->item_size);
+}
+
+// Producer side. Pushes as many items as fit and returns their number.
+static inline size_t ring_push(ring_t *ring, const void *items, size_t count)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t space = ring->length - (head - tail);
+    if (count > space)
+        count = space;
+    if (count) {
+        ring_copy_in(ring, head, (const uint8_t *)items, count);
+        atomic_store_explicit(&ring->head, head + count, memory_order_release);
+    }
+    return count;
+}
+
+// Producer side. Same as ring_push, but the items that don't fit are
+// counted in ring_get_dropped() for the consumer to notice.
+static inline size_t ring_push_lossy(ring_t *ring, const void *items, size_t count)
+{
+    size_t pushed = ring_push(ring, items, count);
+    if (pushed != count) {
+        ring->dropped_items += count - pushed;
+        atomic_store_explicit(&ring->dropped, ring->dropped_items, memory_order_release);
+    }
+    return pushed;
+}
+
+// Consumer side. Pops up to count items and returns their number.
+static inline size_t ring_pop(ring_t *ring, void *items, size_t count)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t avail = head - tail;
+    if (count > avail)
+        count = avail;
+    if (count) {
+        ring_copy_out(ring, tail, (uint8_t *)items, count);
+        atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+    }
+    return count;
+}
+
+// Number of items in the ring, exact for the consumer, an estimate for others.
+static inline size_t ring_count(ring_t *ring)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    return head - tail;
+}
+
+// Total number of items dropped on overflow since the ring was created.
+// The consumer compares it with the previously seen value.
+static inline size_t ring_get_dropped(ring_t *ring)
+{
+    return atomic_load_explicit(&ring->dropped, memory_order_acquire);
+}
@@ -0,0 +1,55 @@
+/*
+ * This file is part of the ring component distribution
+ * (https://gitlab.romanchenko.su/esp/components/ring.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <strings.h>
+
+#include "esp_log.h"
+#include "ring.h"
+
+static const char __attribute__((unused)) *TAG = "ring";
+
+esp_err_t ring_create(ring_t **pring, size_t length, size_t item_size)
+{
+    ESP_ERROR_CHECK(pring ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(length && !(length & (length - 1)) ? ESP_OK : ESP_ERR_INVALID_SIZE);
+    ESP_ERROR_CHECK(item_size ? ESP_OK : ESP_ERR_INVALID_SIZE);
+    ring_t *ring = (ring_t *)malloc(sizeof(ring_t));
+    ESP_ERROR_CHECK(ring ? ESP_OK : ESP_ERR_NO_MEM);
+    bzero(ring, sizeof(ring_t));
+    ring->data = (uint8_t *)malloc(length * item_size);
+    ESP_ERROR_CHECK(ring->data ? ESP_OK : ESP_ERR_NO_MEM);
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->dropped, 0);
+    ring->dropped_items = 0;
+    ring->length = length;
+    ring->mask = length - 1;
+    ring->item_size = item_size;
+
+    *pring = ring;
+    return ESP_OK;
+}
+
+esp_err_t ring_done(ring_t *ring)
+{
+    ESP_ERROR_CHECK(ring ? ESP_OK : ESP_ERR_INVALID_ARG);
+    free(ring->data);
+    free(ring);
+    return ESP_OK;
+}
@@ -0,0 +1,110 @@
+/*
+ * This file is part of the server component distribution
+ * (https://gitlab.romanchenko.su/esp/components/server.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "esp_http_server.h"
+#include "computer.h"
+
+#define SERVER_TARGETS_MAX 8
+#define SERVER_NAME_SIZE 32
+// bytes passed from the socket to the target at a time
+#define SERVER_CHUNK_SIZE 4096
+// flash is erased ahead of the data in blocks, faster than sector by sector
+#define SERVER_ERASE_SIZE 0x10000
+// the statistics are put together in the chunk buffer
+#define SERVER_STATS_SIZE SERVER_CHUNK_SIZE
+
+typedef enum {
+    SERVER_TARGET_FILE = 0,
+    // files of a directory, the file name follows the target name
+    SERVER_TARGET_DIRECTORY,
+    SERVER_TARGET_PARTITION,
+    SERVER_TARGET_MEMORY
+} server_target_type_t;
+
+typedef enum {
+    // before the upload, an error refuses it
+    SERVER_HOOK_BEGIN = 0,
+    // after the upload is written
+    SERVER_HOOK_DONE,
+    // the upload failed after the begin hook took it
+    SERVER_HOOK_ABORT
+} server_hook_stage_t;
+
+// Called with the upload size at each stage, the begin hook is followed by
+// the done or the abort one.
+typedef esp_err_t (*server_hook_t)(void *arg, size_t size, server_hook_stage_t stage);
+
+// Appends "name":value pairs of the statistics, returns their length.
+typedef int (*server_stats_cb_t)(char *buf, size_t size, void *arg);
+
+typedef struct server_target {
+    char name[SERVER_NAME_SIZE];
+    server_target_type_t type;
+    const char *path;
+    const esp_partition_t *partition;
+    uint8_t *data;
+    size_t size;
+    server_hook_t hook;
+    void *arg;
+} server_target_t;
+
+// Routes:
+//   GET  /                       the targets
+//   GET  /stats                  the statistics, JSON
+//   POST /upload/NAME[/FILE]     the request body to the target
+//   GET  /download/NAME[/FILE]   the target contents
+// The bodies are streamed by SERVER_CHUNK_SIZE bytes, nothing buffers a
+// whole file.
+typedef struct server {
+    httpd_handle_t httpd;
+    server_target_t targets[SERVER_TARGETS_MAX];
+    size_t targets_count;
+    server_stats_cb_t stats_cb;
+    void *stats_arg;
+    uint8_t *chunk;
+    // statistics
+    uint32_t uploads;
+    uint64_t upload_bytes;
+    uint32_t upload_kbps;
+} server_t;
+
+esp_err_t server_create(server_t **psrv);
+esp_err_t server_done(server_t *srv);
+esp_err_t server_start(server_t *srv, uint16_t port);
+esp_err_t server_stop(server_t *srv);
+
+// A file is replaced by the upload, it is removed if the upload fails.
+esp_err_t server_add_file(server_t *srv, const char *name, const char *path);
+esp_err_t server_add_directory(server_t *srv, const char *name, const char *path);
+// The partition is erased as the data arrives.
+esp_err_t server_add_partition(server_t *srv, const char *name, const esp_partition_t *partition,
+    server_hook_t hook, void *arg);
+esp_err_t server_add_memory(server_t *srv, const char *name, uint8_t *data, size_t size,
+    server_hook_t hook, void *arg);
+esp_err_t server_set_stats(server_t *srv, server_stats_cb_t cb, void *arg);
+
+// The statistics of the computer and its RAM disk as the "ramdisk" target,
+// the machine is paused while the disk is uploaded.
+esp_err_t server_add_computer(server_t *srv, computer_t *cmp);
@@ -0,0 +1,411 @@
+/*
+ * This file is part of the server component distribution
+ * (https://gitlab.romanchenko.su/esp/components/server.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "server.h"
+
+#define SERVER_UPLOAD_URI "/upload/"
+#define SERVER_DOWNLOAD_URI "/download/"
+#define SERVER_PATH_SIZE 256
+// receive timeouts in a row before the upload is given up
+#define SERVER_RETRIES 3
+
+// An upload or a download in progress
+typedef struct server_stream {
+    server_target_t *target;
+    char path[SERVER_PATH_SIZE];
+    FILE *f;
+    size_t size;
+    size_t pos;
+    size_t erased;
+} server_stream_t;
+
+static const char __attribute__((unused)) *TAG = "server";
+
+static const char *server_type_names[] = { "file", "directory", "partition", "memory" };
+
+esp_err_t server_create(server_t **psrv)
+{
+    ESP_ERROR_CHECK(psrv ? ESP_OK : ESP_ERR_INVALID_ARG);
+    server_t *srv = (server_t *)malloc(sizeof(server_t));
+    ESP_ERROR_CHECK(srv ? ESP_OK : ESP_ERR_NO_MEM);
+    bzero(srv, sizeof(server_t));
+    srv->chunk = (uint8_t *)malloc(SERVER_CHUNK_SIZE);
+    ESP_ERROR_CHECK(srv->chunk ? ESP_OK : ESP_ERR_NO_MEM);
+
+    *psrv = srv;
+    return ESP_OK;
+}
+
+esp_err_t server_done(server_t *srv)
+{
+    ESP_ERROR_CHECK(srv ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (srv->httpd)
+        ESP_ERROR_CHECK(server_stop(srv));
+    free(srv->chunk);
+    free(srv);
+    return ESP_OK;
+}
+
+static esp_err_t server_add(server_t *srv, const server_target_t *target)
+{
+    ESP_ERROR_CHECK(srv && target->name[0] ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (srv->targets_count == SERVER_TARGETS_MAX)
+        return ESP_ERR_NO_MEM;
+    srv->targets[srv->targets_count++] = *target;
+    return ESP_OK;
+}
+
+esp_err_t server_add_file(server_t *srv, const char *name, const char *path)
+{
+    ESP_ERROR_CHECK(name && path ? ESP_OK : ESP_ERR_INVALID_ARG);
+    server_target_t target = {
+        type: SERVER_TARGET_FILE,
+        path: path
+    };
+    strncpy(target.name, name, SERVER_NAME_SIZE - 1);
+    return server_add(srv, &target);
+}
+
+esp_err_t server_add_directory(server_t *srv, const char *name, const char *path)
+{
+    ESP_ERROR_CHECK(name && path ? ESP_OK : ESP_ERR_INVALID_ARG);
+    server_target_t target = {
+        type: SERVER_TARGET_DIRECTORY,
+        path: path
+    };
+    strncpy(target.name, name, SERVER_NAME_SIZE - 1);
+    return server_add(srv, &target);
+}
+
+esp_err_t server_add_partition(server_t *srv, const char *name, const esp_partition_t *partition,
+    server_hook_t hook, void *arg)
+{
+    ESP_ERROR_CHECK(name && partition ? ESP_OK : ESP_ERR_INVALID_ARG);
+    server_target_t target = {
+        type: SERVER_TARGET_PARTITION,
+        partition: partition,
+        size: partition->size,
+        hook: hook,
+        arg: arg
+    };
+    strncpy(target.name, name, SERVER_NAME_SIZE - 1);
+    return server_add(srv, &target);
+}
+
+esp_err_t server_add_memory(server_t *srv, const char *name, uint8_t *data, size_t size,
+    server_hook_t hook, void *arg)
+{
+    ESP_ERROR_CHECK(name && data ? ESP_OK : ESP_ERR_INVALID_ARG);
+    server_target_t target = {
+        type: SERVER_TARGET_MEMORY,
+        data: data,
+        size: size,
+        hook: hook,
+        arg: arg
+    };
+    strncpy(target.name, name, SERVER_NAME_SIZE - 1);
+    return server_add(srv, &target);
+}
+
+esp_err_t server_set_stats(server_t *srv, server_stats_cb_t cb, void *arg)
+{
+    ESP_ERROR_CHECK(srv ? ESP_OK : ESP_ERR_INVALID_ARG);
+    srv->stats_cb = cb;
+    srv->stats_arg = arg;
+    return ESP_OK;
+}
+
+// Finds the target of "NAME[/FILE][?query]", the file only for the
+// directories. The file names stay inside the directory.
+static server_target_t *server_find(server_t *srv, const char *uri, server_stream_t *stream)
+{
+    size_t length = strcspn(uri, "?");
+    const char *file = memchr(uri, '/', length);
+    size_t name_length = file ? (size_t)(file - uri) : length;
+    for (size_t i = 0; i < srv->targets_count; ++i) {
+        server_target_t *target = &srv->targets[i];
+        if (strlen(target->name) != name_length || strncmp(target->name, uri, name_length))
+            continue;
+        if (target->type != SERVER_TARGET_DIRECTORY) {
+            if (file)
+                return NULL;
+            if (target->path)
+                snprintf(stream->path, SERVER_PATH_SIZE, "%s", target->path);
+            return target;
+        }
+        if (!file)
+            return NULL;
+        ++file;
+        size_t file_length = length - (file - uri);
+        if (!file_length || file_length >= SERVER_NAME_SIZE || file[0] == '.' || memchr(file, '/', file_length))
+            return NULL;
+        snprintf(stream->path, SERVER_PATH_SIZE, "%s/%.*s", target->path, (int)file_length, file);
+        return target;
+    }
+    return NULL;
+}
+
+static esp_err_t server_open(server_stream_t *stream, size_t size)
+{
+    server_target_t *target = stream->target;
+    if (target->type == SERVER_TARGET_PARTITION || target->type == SERVER_TARGET_MEMORY) {
+        if (size > target->size)
+            return ESP_ERR_INVALID_SIZE;
+    }
+    if (target->hook) {
+        esp_err_t r = target->hook(target->arg, size, SERVER_HOOK_BEGIN);
+        if (r != ESP_OK)
+            return r;
+    }
+    stream->size = size;
+    stream->pos = 0;
+    stream->erased = 0;
+    if (target->type == SERVER_TARGET_FILE || target->type == SERVER_TARGET_DIRECTORY) {
+        stream->f = fopen(stream->path, "wb");
+        if (!stream->f) {
+            if (target->hook)
+                target->hook(target->arg, size, SERVER_HOOK_ABORT);
+            return ESP_ERR_NOT_FOUND;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t server_write(server_stream_t *stream, const uint8_t *data, size_t size)
+{
+    server_target_t *target = stream->target;
+    switch (target->type) {
+        case SERVER_TARGET_FILE:
+        case SERVER_TARGET_DIRECTORY:
+            if (fwrite(data, size, 1, stream->f) != 1)
+                return ESP_FAIL;
+            break;
+        case SERVER_TARGET_PARTITION:
+            while (stream->pos + size > stream->erased) {
+                size_t erase = SERVER_ERASE_SIZE;
+                if (erase > target->size - stream->erased)
+                    erase = target->size - stream->erased;
+                esp_err_t r = esp_partition_erase_range(target->partition, stream->erased, erase);
+                if (r != ESP_OK)
+                    return r;
+                stream->erased += erase;
+            }
+            {
+                esp_err_t r = esp_partition_write(target->partition, stream->pos, data, size);
+                if (r != ESP_OK)
+                    return r;
+            }
+            break;
+        case SERVER_TARGET_MEMORY:
+            memcpy(&target->data[stream->pos], data, size);
+            break;
+    }
+    stream->pos += size;
+    return ESP_OK;
+}
+
+static esp_err_t server_close(server_stream_t *stream, bool is_ok)
+{
+    server_target_t *target = stream->target;
+    if (stream->f) {
+        if (fclose(stream->f))
+            is_ok = false;
+        stream->f = NULL;
+        if (!is_ok)
+            remove(stream->path);
+    }
+    if (!target->hook)
+        return is_ok ? ESP_OK : ESP_FAIL;
+    if (!is_ok) {
+        // the hook undoes its begin, the upload has failed anyway
+        target->hook(target->arg, stream->size, SERVER_HOOK_ABORT);
+        return ESP_FAIL;
+    }
+    return target->hook(target->arg, stream->size, SERVER_HOOK_DONE);
+}
+
+static esp_err_t server_upload_handler(httpd_req_t *req)
+{
+    server_t *srv = (server_t *)req->user_ctx;
+    server_stream_t stream;
+    bzero(&stream, sizeof(stream));
+    stream.target = server_find(srv, req->uri + strlen(SERVER_UPLOAD_URI), &stream);
+    if (!stream.target)
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "no such target");
+    // esp_http_server reads the bodies by Content-Length only
+    if (!req->content_len)
+        return httpd_resp_send_err(req, HTTPD_411_LENGTH_REQUIRED, "Content-Length is required");
+    esp_err_t r = server_open(&stream, req->content_len);
+    if (r != ESP_OK) {
+        ESP_LOGW(TAG, "%s: %s", req->uri, esp_err_to_name(r));
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, esp_err_to_name(r));
+    }
+
+    int64_t start = esp_timer_get_time();
+    size_t left = req->content_len;
+    size_t retries = 0;
+    while (left && r == ESP_OK) {
+        int n = httpd_req_recv(req, (char *)srv->chunk, left < SERVER_CHUNK_SIZE ? left : SERVER_CHUNK_SIZE);
+        if (n == HTTPD_SOCK_ERR_TIMEOUT && ++retries < SERVER_RETRIES)
+            continue;
+        if (n <= 0) {
+            r = ESP_ERR_TIMEOUT;
+            break;
+        }
+        retries = 0;
+        r = server_write(&stream, srv->chunk, n);
+        left -= n;
+    }
+    esp_err_t close_r = server_close(&stream, r == ESP_OK);
+    if (r == ESP_OK)
+        r = close_r;
+    if (r != ESP_OK) {
+        ESP_LOGW(TAG, "%s failed at %u: %s", req->uri, (unsigned)stream.pos, esp_err_to_name(r));
+        // the client may be gone, the answer is a courtesy
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, esp_err_to_name(r));
+        return ESP_FAIL;
+    }
+
+    int64_t time = esp_timer_get_time() - start;
+    ++srv->uploads;
+    srv->upload_bytes += stream.size;
+    if (time > 0)
+        srv->upload_kbps = (uint64_t)stream.size * 8000 / time;
+    ESP_LOGI(TAG, "%s: %u bytes, %u kbit/s", req->uri, (unsigned)stream.size, srv->upload_kbps);
+    char answer[64];
+    snprintf(answer, sizeof(answer), "%u bytes\n", (unsigned)stream.size);
+    httpd_resp_set_type(req, "text/plain");
+    return httpd_resp_send(req, answer, HTTPD_RESP_USE_STRLEN);
+}
+
+static esp_err_t server_download_handler(httpd_req_t *req)
+{
+    server_t *srv = (server_t *)req->user_ctx;
+    server_stream_t stream;
+    bzero(&stream, sizeof(stream));
+    server_target_t *target = server_find(srv, req->uri + strlen(SERVER_DOWNLOAD_URI), &stream);
+    if (!target)
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "no such target");
+    FILE *f = NULL;
+    if (target->type == SERVER_TARGET_FILE || target->type == SERVER_TARGET_DIRECTORY) {
+        f = fopen(stream.path, "rb");
+        if (!f)
+            return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "no such file");
+    }
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    esp_err_t r = ESP_OK;
+    size_t pos = 0;
+    while (r == ESP_OK) {
+        size_t n = SERVER_CHUNK_SIZE;
+        if (f)
+            n = fread(srv->chunk, 1, n, f);
+        else {
+            if (n > target->size - pos)
+                n = target->size - pos;
+            if (target->type == SERVER_TARGET_PARTITION)
+                r = esp_partition_read(target->partition, pos, srv->chunk, n);
+            else
+                memcpy(srv->chunk, &target->data[pos], n);
+        }
+        if (!n || r != ESP_OK)
+            break;
+        r = httpd_resp_send_chunk(req, (const char *)srv->chunk, n);
+        pos += n;
+    }
+    if (f)
+        fclose(f);
+    if (r != ESP_OK)
+        return ESP_FAIL;
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static esp_err_t server_stats_handler(httpd_req_t *req)
+{
+    server_t *srv = (server_t *)req->user_ctx;
+    // the handlers run one at a time in the server task
+    char *stats = (char *)srv->chunk;
+    const int size = SERVER_STATS_SIZE;
+    int n = snprintf(stats, size, "{\"uploads\":%u,\"upload_bytes\":%llu,\"upload_kbps\":%u",
+        srv->uploads, (unsigned long long)srv->upload_bytes, srv->upload_kbps);
+    if (srv->stats_cb && n < size - 2) {
+        stats[n++] = ',';
+        n += srv->stats_cb(&stats[n], size - n, srv->stats_arg);
+    }
+    if (n > size - 3)
+        n = size - 3;
+    strcpy(&stats[n], "}\n");
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, stats, HTTPD_RESP_USE_STRLEN);
+}
+
+static esp_err_t server_index_handler(httpd_req_t *req)
+{
+    server_t *srv = (server_t *)req->user_ctx;
+    char line[SERVER_NAME_SIZE + 64];
+    httpd_resp_set_type(req, "text/plain");
+    for (size_t i = 0; i < srv->targets_count; ++i) {
+        const server_target_t *target = &srv->targets[i];
+        snprintf(line, sizeof(line), "%s %s %u\n", target->name, server_type_names[target->type], (unsigned)target->size);
+        if (httpd_resp_send_chunk(req, line, HTTPD_RESP_USE_STRLEN) != ESP_OK)
+            return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+esp_err_t server_start(server_t *srv, uint16_t port)
+{
+    ESP_ERROR_CHECK(srv ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(!srv->httpd ? ESP_OK : ESP_ERR_INVALID_STATE);
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = port;
+    // the emulation task owns the other core
+    config.core_id = CONFIG_ORION_IO_TASK_CORE;
+    config.task_priority = CONFIG_ORION_IO_TASK_PRIORITY;
+    config.uri_match_fn = httpd_uri_match_wildcard;
+    esp_err_t r = httpd_start(&srv->httpd, &config);
+    if (r != ESP_OK)
+        return r;
+
+    const httpd_uri_t handlers[] = {
+        { uri: "/", method: HTTP_GET, handler: server_index_handler, user_ctx: srv },
+        { uri: "/stats", method: HTTP_GET, handler: server_stats_handler, user_ctx: srv },
+        { uri: SERVER_UPLOAD_URI "*", method: HTTP_POST, handler: server_upload_handler, user_ctx: srv },
+        { uri: SERVER_UPLOAD_URI "*", method: HTTP_PUT, handler: server_upload_handler, user_ctx: srv },
+        { uri: SERVER_DOWNLOAD_URI "*", method: HTTP_GET, handler: server_download_handler, user_ctx: srv }
+    };
+    for (size_t i = 0; i < sizeof(handlers) / sizeof(handlers[0]); ++i)
+        ESP_ERROR_CHECK(httpd_register_uri_handler(srv->httpd, &handlers[i]));
+    ESP_LOGI(TAG, "listening on port %u", port);
+    return ESP_OK;
+}
+
+esp_err_t server_stop(server_t *srv)
+{
+    ESP_ERROR_CHECK(srv ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(srv->httpd ? ESP_OK : ESP_ERR_INVALID_STATE);
+    ESP_ERROR_CHECK(httpd_stop(srv->httpd));
+    srv->httpd = NULL;
+    return ESP_OK;
+}
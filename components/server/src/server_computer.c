@@ -0,0 +1,79 @@
+/*
+ * This file is part of the server component distribution
+ * (https://gitlab.romanchenko.su/esp/components/server.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "ordos.h"
+#include "server.h"
+
+static const char __attribute__((unused)) *TAG = "server";
+
+static int server_computer_stats(char *buf, size_t size, void *arg)
+{
+    computer_stats_t stats;
+    ESP_ERROR_CHECK(computer_get_stats((computer_t *)arg, &stats));
+    int n = snprintf(buf, size,
+        "\"cycles\":%llu,\"mhz\":%u.%03u,\"frame_us\":%u,\"max_frame_us\":%u,"
+        "\"queues\":{\"video\":[%u,%u],\"keys\":[%u,%u],\"sound\":[%u,%u]}",
+        (unsigned long long)stats.cycles, stats.speed / 1000, stats.speed % 1000,
+        stats.frame_us, stats.max_frame_us,
+        stats.video_queue, stats.video_queue_size, stats.key_queue, stats.key_queue_size,
+        stats.sound_queue, stats.sound_queue_size);
+#ifdef CONFIG_ORION_PERF_COUNTERS
+    if (n < (int)size)
+        n += snprintf(buf + n, size - n, ",\"perf\":");
+    if (n < (int)size)
+        n += perf_json(((computer_t *)arg)->perf, buf + n, size - n);
+#endif
+    return n < (int)size ? n : (int)size - 1;
+}
+
+// The upload goes straight to the RAM page of ORDOS disk B, the machine
+// is paused meanwhile, ORDOS would mount the disk under it
+static esp_err_t server_computer_ram_disk(void *arg, size_t size, server_hook_stage_t stage)
+{
+    computer_t *cmp = (computer_t *)arg;
+    ordos_t *ram_disk = cmp->mem->ram_disk;
+    esp_err_t r = ESP_OK;
+    switch (stage) {
+        case SERVER_HOOK_BEGIN:
+            ESP_ERROR_CHECK(computer_pause(cmp));
+            // a lazily mounted image would overwrite the upload
+            r = ordos_unmount(ram_disk);
+            if (r != ESP_OK)
+                ESP_ERROR_CHECK(computer_resume(cmp));
+            return r;
+        case SERVER_HOOK_DONE:
+            // images may end right after the last file
+            if (size < ram_disk->size)
+                ram_disk->disk[size] = ORDOS_END_MARK;
+            break;
+        case SERVER_HOOK_ABORT:
+            break;
+    }
+    ESP_ERROR_CHECK(computer_resume(cmp));
+    return r;
+}
+
+esp_err_t server_add_computer(server_t *srv, computer_t *cmp)
+{
+    ESP_ERROR_CHECK(srv && cmp ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ordos_t *ram_disk = cmp->mem->ram_disk;
+    ESP_ERROR_CHECK(server_set_stats(srv, server_computer_stats, cmp));
+    return server_add_memory(srv, "ramdisk", ram_disk->disk, ram_disk->size, server_computer_ram_disk, cmp);
+}
@@ -0,0 +1,59 @@
+/*
+ * This file is part of the esp32-orion128 distribution
+ * (https://gitlab.romanchenko.su/esp/esp32/esp32-orion128.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "display.h"
+
+#define HOST_DISPLAY_WIDTH 480
+#define HOST_DISPLAY_HEIGHT 320
+// bus bytes of a window setup on the panel: column and page address set,
+// 1 + 4 bytes each, and the memory write command
+#define HOST_DISPLAY_WINDOW_BYTES 11
+
+typedef struct host_display_stats {
+    // windows set up, one bus transaction each
+    uint32_t refreshes;
+    uint64_t pixels;
+    uint64_t bytes;
+    // frames closed by host_display_frame and the busiest of them
+    uint32_t frames;
+    uint32_t max_frame_refreshes;
+    uint64_t max_frame_pixels;
+    uint64_t max_frame_bytes;
+} host_display_stats_t;
+
+// Display in memory, the refreshed bitmaps are drawn to a RGB565
+// framebuffer and counted.
+esp_err_t host_display_create(display_t **pdisplay);
+esp_err_t host_display_get_stats(const display_t *display, host_display_stats_t *stats);
+// Close a frame of the per frame counters
+esp_err_t host_display_frame(display_t *display);
+esp_err_t host_display_save_ppm(const display_t *display, const char *path);
+// Paint the whole panel, the counters stay
+esp_err_t host_display_fill(display_t *display, uint16_t color);
+// Copy of the panel, HOST_DISPLAY_WIDTH * HOST_DISPLAY_HEIGHT pixels row by row
+esp_err_t host_display_get_frame(const display_t *display, uint16_t *frame);
+
+// Bytes the panel bus carries for the counted refreshes
+static inline uint64_t host_display_bus_bytes(uint32_t refreshes, uint64_t bytes)
+{
+    return bytes + (uint64_t)refreshes * HOST_DISPLAY_WINDOW_BYTES;
+}
@@ -0,0 +1,42 @@
+/*
+ * This file is part of the esp32-orion128 distribution
+ * (https://gitlab.romanchenko.su/esp/esp32/esp32-orion128.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "recorder.h"
+
+// Reader of the video records, see recorder.h. A broken record ends the
+// program with an error.
+typedef struct orv_reader {
+    FILE *f;
+    // the video memory shown, page 0 and page 1
+    uint8_t page[2][RECORDER_PAGE_SIZE];
+    uint8_t port_f8;
+    uint8_t port_fa;
+    // emulated frames since the start of the record
+    uint32_t frame;
+    uint32_t frame_cycles;
+} orv_reader_t;
+
+// Reads the header, false if the stream is not a video record
+bool orv_reader_open(orv_reader_t *orv, FILE *f);
+// Applies the runs of the next frame, false at the end of the record
+bool orv_reader_frame(orv_reader_t *orv);
@@ -0,0 +1,751 @@
+/*
+ * This file is part of the esp32-orion128 distribution
+ * (https://gitlab.romanchenko.su/esp/esp32/esp32-orion128.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "computer.h"
+#include "host_display.h"
+#include "server.h"
+#ifdef CONFIG_ORION_SOUND
+#include "sound.h"
+#endif
+#ifdef CONFIG_ORION_GDB_STUB
+#include "gdb.h"
+#endif
+
+#ifndef CONFIG_CPU_CYCLES_ENABLE
+#error "orion128-bench needs CONFIG_CPU_CYCLES_ENABLE"
+#endif
+
+#define BENCH_CPU_FREQUENCY 2500000
+#define BENCH_ROM_SIZE 0x800
+
+typedef struct bench {
+    const char *roms_dir;
+    const char *monitor;
+    const char *rom_disk;
+    const char *partition;
+    const char *snapshot_load;
+    const char *snapshot_save;
+    const char *keys;
+    const char *wav;
+    const char *tape_play;
+    const char *tape_record;
+    const char *ram_disk;
+    const char *ram_disk_file;
+    const char *screenshot;
+    const char *video;
+    const char *input_record;
+    const char *input_replay;
+    const char *perf;
+    const char *debug;
+    int server_port;
+    int gdb_port;
+#ifdef CONFIG_ORION_GDB_STUB
+    // attached to the -G connection
+    gdb_t *gdb;
+#endif
+    double seconds;
+    double keys_start;
+    double keys_interval;
+    bool console;
+    bool is_tape_fast;
+    bool is_z80;
+    bool is_memory_benchmark;
+} bench_t;
+
+static const char __attribute__((unused)) *TAG = "bench";
+
+static void bench_usage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -r dir      ROM directory (%s)\n"
+        "  -m file     monitor ROM (monitor2.rom)\n"
+        "  -d file     ROM disk image (romdisk2.rom)\n"
+        "  -p file     ROM disk partition image, see romdisk_pack.rb\n"
+        "  -s seconds  emulated time (10)\n"
+        "  -k keys     keys to type, \\n is Enter, \\e is Esc\n"
+        "  -t seconds  emulated time of the first key (2)\n"
+        "  -i ms       emulated time between keys (200)\n"
+        "  -b file     mount a RAM disk image (ORDOS disk B)\n"
+        "  -o file     import an .ord file to the RAM disk\n"
+        "  -l file     load snapshot before the run\n"
+        "  -w file     save snapshot after the run\n"
+        "  -a file     write the speaker sound to a WAV file\n"
+        "  -T file     play a tape image (.ord files are converted)\n"
+        "  -R file     record the tape output to a file\n"
+        "  -f          fast tape, trap the monitor tape routines\n"
+        "  -P file     save the LCD picture after the run to a PPM file\n"
+#ifdef CONFIG_ORION_VIDEO_RECORDER
+        "  -V file     record the screen to a file, see orv-render\n"
+#endif
+#ifdef CONFIG_ORION_INPUT_REPLAY
+        "  -K file     record the keys the machine takes with the cycle counter\n"
+        "  -L file     replay the recorded keys instead of -k and -c\n"
+#endif
+#ifdef CONFIG_CPU_Z80_ENABLE
+        "  -z          run the Z80 core instead of the 8080 one\n"
+#endif
+#ifdef CONFIG_ORION_PERF_COUNTERS
+        "  -J file     write the performance counters once a second, a JSON object per line\n"
+#endif
+#ifdef CONFIG_ORION_DEBUGGER
+        "  -D cmds     debugger commands before the run separated by ';', a stop\n"
+        "              prints the registers and continues, opens the debugger with -c\n"
+#endif
+#ifdef CONFIG_ORION_GDB_STUB
+        "  -G port     wait for GDB on localhost, the machine stops before the first instruction\n"
+#endif
+        "  -S port     serve uploads and statistics on localhost, run in real time\n"
+        "  -M          print the access time of every RAM page before the run\n"
+        "  -c          read the keyboard from stdin\n"
+        "  -q          print warnings and errors only\n"
+        "  -v          print debug messages\n",
+        name, ORION_ROMS_DIR);
+}
+
+static uint8_t *bench_load_file(const char *dir, const char *name, size_t *psize)
+{
+    char path[1024];
+    if (strchr(name, '/'))
+        snprintf(path, sizeof(path), "%s", name);
+    else
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        ESP_LOGE(TAG, "can't open %s", path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    size_t size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = (uint8_t *)malloc(size < BENCH_ROM_SIZE ? BENCH_ROM_SIZE : size);
+    ESP_ERROR_CHECK(data ? ESP_OK : ESP_ERR_NO_MEM);
+    memset(data, 0xff, size < BENCH_ROM_SIZE ? BENCH_ROM_SIZE : size);
+    if (fread(data, size, 1, f) != 1) {
+        ESP_LOGE(TAG, "can't read %s", path);
+        exit(1);
+    }
+    fclose(f);
+    if (psize)
+        *psize = size;
+    return data;
+}
+
+static void bench_snapshot(computer_t *cmp, const char *path, bool is_save)
+{
+    FILE *f = fopen(path, is_save ? "wb" : "rb");
+    if (!f) {
+        ESP_LOGE(TAG, "can't open %s", path);
+        exit(1);
+    }
+    esp_err_t r = is_save ? computer_save(cmp, f) : computer_load(cmp, f);
+    if (r != ESP_OK) {
+        ESP_LOGE(TAG, "snapshot %s: %s", path, esp_err_to_name(r));
+        exit(1);
+    }
+    fclose(f);
+}
+
+#ifdef CONFIG_ORION_SOUND
+typedef struct __attribute__((packed)) bench_wav_header {
+    char riff[4];
+    uint32_t riff_size;
+    char wave[4];
+    char fmt[4];
+    uint32_t fmt_size;
+    uint16_t format;
+    uint16_t channels;
+    uint32_t sample_rate;
+    uint32_t byte_rate;
+    uint16_t block_align;
+    uint16_t bits_per_sample;
+    char data[4];
+    uint32_t data_size;
+} bench_wav_header_t;
+
+// 16 bit mono PCM, the host is little endian like the format
+static void bench_wav_header(FILE *f, uint32_t samples)
+{
+    bench_wav_header_t header = {
+        riff: "RIFF",
+        riff_size: sizeof(header) - 8 + samples * 2,
+        wave: "WAVE",
+        fmt: "fmt ",
+        fmt_size: 16,
+        format: 1,
+        channels: 1,
+        sample_rate: SOUND_SAMPLE_RATE,
+        byte_rate: SOUND_SAMPLE_RATE * 2,
+        block_align: 2,
+        bits_per_sample: 16,
+        data: "data",
+        data_size: samples * 2
+    };
+    fseek(f, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, f);
+}
+#endif
+
+#ifdef CONFIG_ORION_TAPE
+static void bench_tape(computer_t *cmp, bench_t *bench, bool is_save)
+{
+    const char *path = is_save ? bench->tape_record : bench->tape_play;
+    FILE *f = fopen(path, is_save ? "wb" : "rb");
+    if (!f) {
+        ESP_LOGE(TAG, "can't open %s", path);
+        exit(1);
+    }
+    esp_err_t r;
+    if (is_save)
+        r = tape_save(cmp->tape, f);
+    else {
+        const char *ext = strrchr(path, '.');
+        r = tape_load(cmp->tape, f, ext && !strcasecmp(ext, ".ord"));
+    }
+    if (r != ESP_OK) {
+        ESP_LOGE(TAG, "tape %s: %s", path, esp_err_to_name(r));
+        exit(1);
+    }
+    fclose(f);
+}
+#endif
+
+// next key of the script, the escapes are \n, \e and \\ only
+static uint32_t bench_next_key(const char **pkeys)
+{
+    const char *keys = *pkeys;
+    uint32_t key = (uint8_t)*keys++;
+    if (key == '\\' && *keys) {
+        switch (*keys++) {
+            case 'n': key = 0x0a; break;
+            case 'e': key = 0x1b; break;
+            default: key = (uint8_t)keys[-1]; break;
+        }
+    }
+    *pkeys = keys;
+    return key;
+}
+
+#ifdef CONFIG_ORION_DEBUGGER
+// -D "b f800;w w c000-c0ff if A==0"
+static void bench_debug_commands(computer_t *cmp, const char *commands)
+{
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "%s", commands);
+    char *saveptr;
+    for (char *line = strtok_r(buf, ";", &saveptr); line; line = strtok_r(NULL, ";", &saveptr))
+        if (debugger_command(cmp->debugger, cmp, line, stderr) != ESP_OK)
+            exit(1);
+}
+
+#ifdef CONFIG_ORION_GDB_STUB
+static int bench_gdb_read(void *arg)
+{
+    uint8_t ch;
+    ssize_t len = recv((int)(intptr_t)arg, &ch, 1, MSG_DONTWAIT);
+    if (len == 1)
+        return ch;
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return GDB_READ_NONE;
+    return GDB_READ_CLOSED;
+}
+
+static esp_err_t bench_gdb_write(void *arg, const void *data, size_t size)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    while (size) {
+        ssize_t len = send((int)(intptr_t)arg, p, size, MSG_NOSIGNAL);
+        if (len <= 0)
+            return ESP_FAIL;
+        p += len;
+        size -= len;
+    }
+    return ESP_OK;
+}
+
+// a single connection on localhost, -1 on errors
+static int bench_gdb_accept(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    struct sockaddr_in addr = {
+        sin_family: AF_INET,
+        sin_port: htons(port),
+        sin_addr: { s_addr: htonl(INADDR_LOOPBACK) }
+    };
+    if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 1)) {
+        ESP_LOGE(TAG, "can't listen on port %d", port);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    ESP_LOGW(TAG, "waiting for GDB on localhost:%d", port);
+    int conn = accept(fd, NULL, NULL);
+    close(fd);
+    if (conn >= 0)
+        setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return conn;
+}
+#endif
+
+// GDB takes the stops while it is attached. The debugger takes stdin with
+// -c, otherwise the stop is only reported.
+static void bench_debug(bench_t *bench, computer_t *cmp)
+{
+    debugger_t *dbg = cmp->debugger;
+#ifdef CONFIG_ORION_GDB_STUB
+    if (bench->gdb && bench->gdb->is_attached) {
+        ESP_ERROR_CHECK(gdb_serve(bench->gdb));
+        return;
+    }
+#endif
+    if (bench->console) {
+        ESP_ERROR_CHECK(debugger_console(dbg, cmp, stderr));
+        return;
+    }
+    ESP_ERROR_CHECK(debugger_report(dbg, stderr));
+    ESP_ERROR_CHECK(debugger_continue(dbg));
+}
+#endif
+
+static void bench_run(bench_t *bench)
+{
+    uint8_t *rom = bench_load_file(bench->roms_dir, bench->monitor, NULL);
+    size_t rom_disk_size;
+    uint8_t *rom_disk = bench_load_file(bench->roms_dir, bench->rom_disk, &rom_disk_size);
+    if (bench->partition)
+        ESP_ERROR_CHECK(host_partition_add(CONFIG_ORION_ROMDISK_PARTITION, ESP_PARTITION_TYPE_DATA, 0x40, bench->partition));
+    if (!bench->console && !freopen("/dev/null", "r", stdin))
+        ESP_LOGW(TAG, "can't detach stdin");
+
+    computer_t *cmp;
+    ESP_ERROR_CHECK(computer_create(&cmp));
+#ifdef CONFIG_CPU_Z80_ENABLE
+    if (bench->is_z80)
+        cmp->cpu->type = CPU_TYPE_Z80;
+#endif
+    ESP_ERROR_CHECK(host_display_create(&cmp->display));
+    memory_t *mem = cmp->mem;
+    if (bench->is_memory_benchmark)
+        ESP_ERROR_CHECK(memory_benchmark(mem));
+    mem->rom = rom;
+    if (romdisk_open_partition(mem->rom_disk, CONFIG_ORION_ROMDISK_PARTITION) != ESP_OK)
+        ESP_ERROR_CHECK(romdisk_set_image(mem->rom_disk, rom_disk, rom_disk_size));
+    ESP_ERROR_CHECK(computer_init(cmp));
+    if (bench->snapshot_load)
+        bench_snapshot(cmp, bench->snapshot_load, false);
+    // mounted after the snapshot, it would drop the image
+    uint8_t *ram_disk = NULL;
+    if (bench->ram_disk) {
+        size_t ram_disk_size;
+        ram_disk = bench_load_file(bench->roms_dir, bench->ram_disk, &ram_disk_size);
+        ESP_ERROR_CHECK(ordos_mount(mem->ram_disk, ram_disk, ram_disk_size));
+    }
+    if (bench->ram_disk_file) {
+        FILE *f = fopen(bench->ram_disk_file, "rb");
+        esp_err_t r = f ? ordos_import(mem->ram_disk, f, NULL) : ESP_ERR_NOT_FOUND;
+        if (r != ESP_OK) {
+            ESP_LOGE(TAG, "import %s: %s", bench->ram_disk_file, esp_err_to_name(r));
+            exit(1);
+        }
+        fclose(f);
+    }
+
+    cpu_t *cpu = cmp->cpu;
+#ifdef CONFIG_ORION_TAPE
+    if (bench->tape_play) {
+        bench_tape(cmp, bench, false);
+        ESP_ERROR_CHECK(tape_play(cmp->tape, bench->is_tape_fast, cpu->cycles));
+    }
+    else if (bench->tape_record)
+        ESP_ERROR_CHECK(tape_record(cmp->tape, bench->is_tape_fast));
+#endif
+    const char *keys = bench->keys;
+    uint64_t start_cycles = cpu->cycles;
+#ifdef CONFIG_ORION_IDLE_DETECT
+    uint64_t start_skipped = cmp->idle->skipped_cycles;
+#endif
+    uint64_t end_cycles = start_cycles + (uint64_t)(bench->seconds * BENCH_CPU_FREQUENCY);
+    uint64_t key_cycles = start_cycles + (uint64_t)(bench->keys_start * BENCH_CPU_FREQUENCY);
+    uint64_t key_interval = (uint64_t)(bench->keys_interval * BENCH_CPU_FREQUENCY / 1000);
+    uint64_t steps = 0;
+    // the LCD counters are split into frames of the emulated time
+    uint64_t frame_cycles = start_cycles + COMPUTER_FRAME_CYCLES;
+
+#ifdef CONFIG_ORION_SOUND
+    // the samples are rendered behind the CPU, one block at a time
+    sound_t *snd = cmp->snd;
+    const int32_t sound_block_cycles = (uint64_t)SOUND_BLOCK_SAMPLES * SOUND_CPU_FREQUENCY / SOUND_SAMPLE_RATE + 1;
+    int16_t sound_block[SOUND_BLOCK_SAMPLES];
+    uint32_t sound_samples = 0;
+    FILE *wav = NULL;
+    if (bench->wav) {
+        wav = fopen(bench->wav, "wb");
+        if (!wav) {
+            ESP_LOGE(TAG, "can't create %s", bench->wav);
+            exit(1);
+        }
+        bench_wav_header(wav, 0);
+        ESP_ERROR_CHECK(sound_sync(snd, cpu->cycles));
+    }
+#endif
+
+#ifdef CONFIG_ORION_INPUT_REPLAY
+    // the keys are timed from here, as the tape and the sound are
+    FILE *input = NULL;
+    if (bench->input_record || bench->input_replay) {
+        const char *path = bench->input_record ? bench->input_record : bench->input_replay;
+        input = fopen(path, bench->input_record ? "w" : "r");
+        if (!input) {
+            ESP_LOGE(TAG, "can't open %s", path);
+            exit(1);
+        }
+        if (bench->input_record)
+            ESP_ERROR_CHECK(keyboard_record(cmp->kbd, input, start_cycles));
+        else
+            ESP_ERROR_CHECK(keyboard_replay(cmp->kbd, input, start_cycles));
+    }
+#endif
+#ifdef CONFIG_ORION_VIDEO_RECORDER
+    FILE *video = NULL;
+    if (bench->video) {
+        video = fopen(bench->video, "wb");
+        if (!video) {
+            ESP_LOGE(TAG, "can't create %s", bench->video);
+            exit(1);
+        }
+        ESP_ERROR_CHECK(recorder_start(cmp->recorder, video, cpu->cycles));
+    }
+#endif
+
+#ifdef CONFIG_ORION_PERF_COUNTERS
+    FILE *perf = NULL;
+    uint32_t perf_snapshots = cmp->perf->snapshots;
+    char perf_json_buf[4096];
+    if (bench->perf) {
+        perf = fopen(bench->perf, "w");
+        if (!perf) {
+            ESP_LOGE(TAG, "can't create %s", bench->perf);
+            exit(1);
+        }
+    }
+#endif
+
+    // the directory of uploaded files is the current one
+    server_t *srv = NULL;
+    if (bench->server_port) {
+        ESP_ERROR_CHECK(server_create(&srv));
+        ESP_ERROR_CHECK(server_add_computer(srv, cmp));
+        ESP_ERROR_CHECK(server_add_directory(srv, "files", "."));
+        const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+            ROMDISK_PARTITION_SUBTYPE, CONFIG_ORION_ROMDISK_PARTITION);
+        if (part)
+            ESP_ERROR_CHECK(server_add_partition(srv, "romdisk", part, NULL, NULL));
+        if (server_start(srv, bench->server_port) != ESP_OK)
+            exit(1);
+    }
+
+#ifdef CONFIG_ORION_DEBUGGER
+    debugger_t *dbg = cmp->debugger;
+    if (bench->debug)
+        bench_debug_commands(cmp, bench->debug);
+#endif
+#ifdef CONFIG_ORION_GDB_STUB
+    int gdb_fd = -1;
+    if (bench->gdb_port) {
+        gdb_fd = bench_gdb_accept(bench->gdb_port);
+        if (gdb_fd < 0)
+            exit(1);
+        ESP_ERROR_CHECK(gdb_create(&bench->gdb));
+        ESP_ERROR_CHECK(gdb_init(bench->gdb, cmp, bench_gdb_read, bench_gdb_write, (void *)(intptr_t)gdb_fd));
+        ESP_ERROR_CHECK(debugger_break(dbg));
+    }
+#endif
+
+    // the server uploads pause the machine between the frames
+    if (srv)
+        cmp->state = COMPUTER_RUNNING;
+    int64_t start = esp_timer_get_time();
+    while (cpu->cycles < end_cycles) {
+#ifdef CONFIG_ORION_DEBUGGER
+        if (dbg->is_active) {
+            ESP_ERROR_CHECK(debugger_step(dbg, cmp));
+            if (dbg->stop != DEBUGGER_RUNNING)
+                bench_debug(bench, cmp);
+        }
+        else
+#endif
+        ESP_ERROR_CHECK(computer_step(cmp));
+        ++steps;
+#ifdef CONFIG_ORION_SOUND
+        // the idle detector skips the time by whole frames
+        while (wav && (int32_t)((uint32_t)cpu->cycles - snd->time) >= sound_block_cycles) {
+            ESP_ERROR_CHECK(sound_render(snd, sound_block, SOUND_BLOCK_SAMPLES));
+            fwrite(sound_block, sizeof(sound_block), 1, wav);
+            sound_samples += SOUND_BLOCK_SAMPLES;
+        }
+#endif
+        if (keys && *keys && cpu->cycles >= key_cycles) {
+            // retry the same key later if the key ring is full
+            const char *next = keys;
+            if (keyboard_put_key(cmp->kbd, bench_next_key(&next)) == ESP_OK)
+                keys = next;
+            key_cycles += key_interval;
+        }
+#ifdef CONFIG_ORION_PERF_COUNTERS
+        // the computer takes the snapshots in this thread
+        if (cmp->perf->snapshots != perf_snapshots) {
+            perf_snapshots = cmp->perf->snapshots;
+            if (perf && perf_json(cmp->perf, perf_json_buf, sizeof(perf_json_buf)) < (int)sizeof(perf_json_buf))
+                fprintf(perf, "%s\n", perf_json_buf);
+        }
+        if (cmp->kbd->command == KEYBOARD_COMMAND_PERF) {
+            cmp->kbd->command = KEYBOARD_COMMAND_NONE;
+            ESP_ERROR_CHECK(perf_print(cmp->perf, stderr));
+        }
+#endif
+#ifdef CONFIG_ORION_DEBUGGER
+        if (cmp->kbd->command == KEYBOARD_COMMAND_DEBUG) {
+            cmp->kbd->command = KEYBOARD_COMMAND_NONE;
+            bench_debug(bench, cmp);
+        }
+#endif
+        while (cpu->cycles >= frame_cycles) {
+            ESP_ERROR_CHECK(host_display_frame(cmp->display));
+            frame_cycles += COMPUTER_FRAME_CYCLES;
+#ifdef CONFIG_ORION_GDB_STUB
+            // Ctrl-C stops the machine at the next step
+            if (bench->gdb && bench->gdb->is_attached)
+                ESP_ERROR_CHECK(gdb_poll(bench->gdb));
+#endif
+            // the server clients see the machine at its own speed
+            if (srv) {
+                int64_t ahead = (int64_t)((cpu->cycles - start_cycles) * 1000000 / BENCH_CPU_FREQUENCY)
+                    - (esp_timer_get_time() - start);
+                if (ahead > 0)
+                    usleep(ahead);
+                ESP_ERROR_CHECK(computer_yield(cmp));
+            }
+        }
+    }
+    int64_t time = esp_timer_get_time() - start;
+    if (srv)
+        ESP_ERROR_CHECK(computer_stop(cmp));
+#ifdef CONFIG_ORION_GDB_STUB
+    if (bench->gdb) {
+        ESP_ERROR_CHECK(gdb_done(bench->gdb));
+        bench->gdb = NULL;
+        close(gdb_fd);
+    }
+#endif
+
+    // let the video task flush the pending windows
+    while (ring_count(cmp->video_ring))
+        usleep(1000);
+    usleep(50000);
+
+    if (bench->snapshot_save)
+        bench_snapshot(cmp, bench->snapshot_save, true);
+    if (bench->screenshot && host_display_save_ppm(cmp->display, bench->screenshot) != ESP_OK)
+        exit(1);
+#ifdef CONFIG_ORION_TAPE
+    if (bench->tape_play || bench->tape_record)
+        printf("tape:           %u of %u bytes%s\n", (unsigned)cmp->tape->pos, (unsigned)cmp->tape->size,
+            cmp->tape->state == TAPE_STOPPED ? ", stopped" : "");
+    if (bench->tape_record) {
+        ESP_ERROR_CHECK(tape_stop(cmp->tape));
+        bench_tape(cmp, bench, true);
+    }
+#endif
+
+    host_display_stats_t stats;
+    ESP_ERROR_CHECK(host_display_get_stats(cmp->display, &stats));
+    uint64_t cycles = cpu->cycles - start_cycles;
+    double seconds = time / 1e6;
+    printf("emulated time:  %.2f s, %llu cycles\n", (double)cycles / BENCH_CPU_FREQUENCY, (unsigned long long)cycles);
+    printf("host time:      %.3f s\n", seconds);
+    // the idle loops skipped forward were not emulated, the speed counts
+    // the executed cycles only
+    uint64_t executed = cycles;
+#ifdef CONFIG_ORION_IDLE_DETECT
+    uint64_t skipped = cmp->idle->skipped_cycles - start_skipped;
+    executed -= skipped;
+#endif
+    printf("emulated speed: %.2f MHz, %.1fx real time\n", executed / seconds / 1e6,
+        executed / seconds / BENCH_CPU_FREQUENCY);
+#ifdef CONFIG_ORION_IDLE_DETECT
+    printf("idle skipped:   %llu cycles, %.1f%% of the emulated time\n", (unsigned long long)skipped,
+        cycles ? skipped * 100.0 / cycles : 0.0);
+#endif
+    printf("instructions:   %llu, %.0f per second\n", (unsigned long long)steps, steps / seconds);
+    printf("video:          %u refreshes, %llu pixels, %llu bytes\n",
+        stats.refreshes, (unsigned long long)stats.pixels, (unsigned long long)stats.bytes);
+    if (stats.frames) {
+        // window setups cost bus time too, see HOST_DISPLAY_WINDOW_BYTES
+        printf("video bus:      %llu bytes, per frame %llu on average, %llu at most (%u refreshes, %llu pixels)\n",
+            (unsigned long long)host_display_bus_bytes(stats.refreshes, stats.bytes),
+            (unsigned long long)(host_display_bus_bytes(stats.refreshes, stats.bytes) / stats.frames),
+            (unsigned long long)host_display_bus_bytes(stats.max_frame_refreshes, stats.max_frame_bytes),
+            stats.max_frame_refreshes, (unsigned long long)stats.max_frame_pixels);
+    }
+    printf("rom disk cache: %u hits, %u misses\n", mem->rom_disk->hits, mem->rom_disk->misses);
+#ifdef CONFIG_ORION_IDLE_DETECT
+    printf("idle:           %u detections, %llu cycles skipped\n", cmp->idle->detections,
+        (unsigned long long)cmp->idle->skipped_cycles);
+#endif
+#ifdef CONFIG_ORION_SOUND
+    if (wav) {
+        bench_wav_header(wav, sound_samples);
+        fclose(wav);
+        printf("sound:          %u samples, %u transitions dropped\n", sound_samples, (unsigned)ring_get_dropped(snd->ring));
+    }
+#endif
+#ifdef CONFIG_ORION_INPUT_REPLAY
+    if (input) {
+        keyboard_t *kbd = cmp->kbd;
+        printf("keys:           %u %s%s\n", kbd->input_keys, bench->input_record ? "recorded" : "replayed",
+            kbd->replay && kbd->replay_cycles != KEYBOARD_INPUT_END ? ", more left" : "");
+        ESP_ERROR_CHECK(keyboard_input_stop(kbd));
+        fclose(input);
+    }
+#endif
+#ifdef CONFIG_ORION_VIDEO_RECORDER
+    if (video) {
+        recorder_t *rec = cmp->recorder;
+        ESP_ERROR_CHECK(recorder_stop(rec));
+        fclose(video);
+        printf("video record:   %u frames, %llu bytes, %u frames dropped\n", rec->frames,
+            (unsigned long long)rec->pushed, rec->dropped);
+    }
+#endif
+
+#ifdef CONFIG_ORION_PERF_COUNTERS
+    if (perf) {
+        printf("perf:           %u snapshots\n", cmp->perf->snapshots);
+        fclose(perf);
+    }
+#endif
+
+    if (srv) {
+        printf("server:         %u uploads, %llu bytes\n", srv->uploads, (unsigned long long)srv->upload_bytes);
+        ESP_ERROR_CHECK(server_done(srv));
+    }
+
+    display_t *display = cmp->display;
+    ESP_ERROR_CHECK(computer_done(cmp));
+    ESP_ERROR_CHECK(display_done(display));
+    free(ram_disk);
+    free(rom_disk);
+    free(rom);
+}
+
+int main(int argc, char **argv)
+{
+    bench_t bench = {
+        roms_dir: ORION_ROMS_DIR,
+        monitor: "monitor2.rom",
+        rom_disk: "romdisk2.rom",
+        seconds: 10,
+        keys_start: 2,
+        keys_interval: 200
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:m:d:p:s:k:t:i:b:o:l:w:a:T:R:P:V:K:L:J:D:G:S:fzMcqvh")) != -1) {
+        switch (opt) {
+            case 'r': bench.roms_dir = optarg; break;
+            case 'm': bench.monitor = optarg; break;
+            case 'd': bench.rom_disk = optarg; break;
+            case 'p': bench.partition = optarg; break;
+            case 's': bench.seconds = atof(optarg); break;
+            case 'k': bench.keys = optarg; break;
+            case 't': bench.keys_start = atof(optarg); break;
+            case 'i': bench.keys_interval = atof(optarg); break;
+            case 'b': bench.ram_disk = optarg; break;
+            case 'o': bench.ram_disk_file = optarg; break;
+            case 'l': bench.snapshot_load = optarg; break;
+            case 'w': bench.snapshot_save = optarg; break;
+            case 'a': bench.wav = optarg; break;
+            case 'T': bench.tape_play = optarg; break;
+            case 'R': bench.tape_record = optarg; break;
+            case 'f': bench.is_tape_fast = true; break;
+            case 'P': bench.screenshot = optarg; break;
+            case 'M': bench.is_memory_benchmark = true; break;
+#ifdef CONFIG_ORION_VIDEO_RECORDER
+            case 'V': bench.video = optarg; break;
+#endif
+#ifdef CONFIG_ORION_INPUT_REPLAY
+            case 'K': bench.input_record = optarg; break;
+            case 'L': bench.input_replay = optarg; break;
+#endif
+#ifdef CONFIG_CPU_Z80_ENABLE
+            case 'z': bench.is_z80 = true; break;
+#endif
+#ifdef CONFIG_ORION_PERF_COUNTERS
+            case 'J': bench.perf = optarg; break;
+#endif
+#ifdef CONFIG_ORION_DEBUGGER
+            case 'D': bench.debug = optarg; break;
+#endif
+#ifdef CONFIG_ORION_GDB_STUB
+            case 'G': bench.gdb_port = atoi(optarg); break;
+#endif
+            case 'S': bench.server_port = atoi(optarg); break;
+            case 'c': bench.console = true; break;
+            case 'q': esp_log_level_set("*", ESP_LOG_WARN); break;
+            case 'v': esp_log_level_set("*", ESP_LOG_DEBUG); break;
+            default:
+                bench_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    // both feed the single-producer key ring
+    if (bench.console && bench.keys) {
+        fprintf(stderr, "%s: -c and -k can't be used together\n", argv[0]);
+        return 1;
+    }
+
+    // the replay takes the place of the key ring
+    if (bench.input_replay && (bench.console || bench.keys || bench.input_record)) {
+        fprintf(stderr, "%s: -L can't be used with -c, -k or -K\n", argv[0]);
+        return 1;
+    }
+
+    // one tape recorder
+    if (bench.tape_play && bench.tape_record) {
+        fprintf(stderr, "%s: -T and -R can't be used together\n", argv[0]);
+        return 1;
+    }
+
+    bench_run(&bench);
+    return 0;
+}
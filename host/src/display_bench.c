@@ -0,0 +1,511 @@
+/*
+ * This file is part of the esp32-orion128 distribution
+ * (https://gitlab.romanchenko.su/esp/esp32/esp32-orion128.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "colors.h"
+#include "display.h"
+#include "console.h"
+#include "host_display.h"
+#include "computer.h"
+#include "memory.h"
+#include "video.h"
+
+#define DISPLAY_BENCH_WIDTH 384
+#define DISPLAY_BENCH_HEIGHT 256
+#define DISPLAY_BENCH_WORDS (DISPLAY_BENCH_WIDTH / 8 * DISPLAY_BENCH_HEIGHT)
+#define DISPLAY_BENCH_FONT_SIZE 0x800
+// not in the palette, the panel outside the Orion screen keeps it
+#define DISPLAY_BENCH_BACKGROUND 0x1234
+// bytes of the bitmaps before a conversion
+#define DISPLAY_BENCH_GARBAGE 0x5a
+// palette entries of the display with a short palette
+#define DISPLAY_BENCH_SHORT_PALETTE 5
+#define DISPLAY_BENCH_VIDEO_WINDOWS 500
+#define DISPLAY_BENCH_VIDEO_PAGE_SIZE 0x10000
+#define DISPLAY_BENCH_SHADOW_ROUNDS 200
+
+typedef void (*display_bench_format_t)(display_refresh_info_t *info);
+
+static const char __attribute__((unused)) *TAG = "display-bench";
+
+static uint32_t display_bench_words[DISPLAY_BENCH_WORDS];
+
+static int display_bench_color(const display_point_t *p, const display_refresh_info_t *info, void *color)
+{
+    *(uint32_t *)color = display_bench_words[p->y * (DISPLAY_BENCH_WIDTH / 8) + (p->x >> 3)];
+    return 1;
+}
+
+// The 8I4 to RGB555 converter as it was before the palette lookup, kept
+// as the reference for the output and the speed. The indices past the
+// palette are black now, they left the pixel as it was.
+static void display_bench_scalar(display_refresh_info_t *refresh_info)
+{
+    const display_rectangle_t *r = &refresh_info->rectangle;
+    const display_bitmap_t *bitmap = refresh_info->bitmap;
+    const display_t *display = bitmap->display;
+    const display_rectangle_t *b = &bitmap->bounds;
+    display_color_rgb555_t *dst = (display_color_rgb555_t *)bitmap->data;
+    display_point_t p;
+
+    size_t bit;
+    int ofs = r->top * b->width + r->left;
+    int delta = b->width - r->width;
+    dst += ofs;
+    for (p.y = r->top; p.y < r->top + r->height; ++p.y) {
+        uint32_t in_color = 0;
+        int ok = 0;
+        for (p.x = r->left, bit = 0; p.x < r->left + r->width; ++p.x, ++bit) {
+            if ((bit & 7) == 0) {
+                in_color = 0;
+                ok = display_get_color_with_background(&p, refresh_info, &in_color);
+            }
+            if (ok) {
+                const display_hardware_config_t *hw = display->hardware;
+                display_color_rgb555_t *src = (display_color_rgb555_t *)hw->palette;
+                int idx = (in_color & 0x0f); // % display->palette_count;
+                if (idx < hw->palette_count)
+                    *dst = src[idx];
+                else
+                    dst->rgb = 0;
+                in_color >>= 4;
+            }
+            ++dst;
+        }
+        dst += delta;
+    }
+}
+
+static void display_bench_refresh(display_refresh_info_t *info)
+{
+    ESP_ERROR_CHECK(display_bitmap_refresh(info));
+}
+
+// Convert the rectangle of a bitmap as big as the Orion screen, return
+// Mpixels per second and leave the picture in the bitmap. The bitmap is
+// not blank before, a pixel left out shows.
+static double display_bench_run(display_bitmap_t *bitmap, const display_rectangle_t *r,
+        display_bench_format_t format, uint32_t frames)
+{
+    display_refresh_info_t info = {
+        rectangle: *r,
+        bitmap: bitmap,
+        color: {
+            format: DISPLAY_COLOR_8I4,
+            get: display_bench_color
+        }
+    };
+    memset(bitmap->data, DISPLAY_BENCH_GARBAGE, bitmap->data_size);
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < frames; ++i)
+        format(&info);
+    int64_t time = esp_timer_get_time() - start;
+    return (double)r->width * r->height * frames / time;
+}
+
+static bool display_bench_compare(display_t *display, const display_rectangle_t *r, const char *name, uint32_t frames)
+{
+    display_bitmap_t *reference;
+    display_bitmap_t *bitmap;
+    display_rectangle_t bounds = {
+        left: 0,
+        top: 0,
+        width: DISPLAY_BENCH_WIDTH,
+        height: DISPLAY_BENCH_HEIGHT
+    };
+    ESP_ERROR_CHECK(display_bitmap_create(&reference));
+    reference->bounds = bounds;
+    reference->format = DEVICE_COLOR_RGB555;
+    ESP_ERROR_CHECK(display_bitmap_init(reference, display));
+    ESP_ERROR_CHECK(display_bitmap_create(&bitmap));
+    bitmap->bounds = bounds;
+    bitmap->format = DEVICE_COLOR_RGB555;
+    ESP_ERROR_CHECK(display_bitmap_init(bitmap, display));
+
+    double scalar = display_bench_run(reference, r, display_bench_scalar, frames);
+    display->is_palette_lut = false;
+    double no_lut = display_bench_run(bitmap, r, display_bench_refresh, frames);
+    bool ok = !memcmp(reference->data, bitmap->data, bitmap->data_size);
+    ESP_ERROR_CHECK(display_palette_lut_init(display));
+    double lut = display_bench_run(bitmap, r, display_bench_refresh, frames);
+    ok = ok && !memcmp(reference->data, bitmap->data, bitmap->data_size);
+
+    printf("%s, %dx%d at %d, %d: %s\n", name, r->width, r->height, r->left, r->top, ok ? "ok" : "FAILED");
+    if (frames > 1) {
+        printf("  scalar:   %8.2f Mpixels/s\n", scalar);
+        printf("  no table: %8.2f Mpixels/s\n", no_lut);
+        printf("  table:    %8.2f Mpixels/s, %.1fx\n", lut, lut / scalar);
+    }
+    ESP_ERROR_CHECK(display_bitmap_done(reference));
+    ESP_ERROR_CHECK(display_bitmap_done(bitmap));
+    return ok;
+}
+
+// Rectangle of the panel the Orion screen is expected at
+static display_rectangle_t display_bench_video_bounds(const display_t *display, video_scale_mode_t mode)
+{
+    uint32_t width = display->bounds.width;
+    uint32_t height = display->bounds.height;
+    if (mode == VIDEO_SCALE_NONE) {
+        width = DISPLAY_BENCH_WIDTH;
+        height = DISPLAY_BENCH_HEIGHT;
+    }
+    else if (mode == VIDEO_SCALE_ASPECT) {
+        if (height * 4 / 3 < width)
+            width = height * 4 / 3;
+        else
+            height = width * 3 / 4;
+    }
+    display_rectangle_t bounds = {
+        left: (display->bounds.width - width) / 2,
+        top: (display->bounds.height - height) / 2,
+        width: width,
+        height: height
+    };
+    return bounds;
+}
+
+// Compare the panel with the Orion screen drawn pixel by pixel from the
+// video memory: 1:1 without the scale, the nearest pixel under the center
+// of the panel pixel with it. The panel around the screen is untouched.
+static bool display_bench_video_check(const display_t *display, const computer_t *cmp, video_scale_mode_t mode)
+{
+    static uint16_t frame[HOST_DISPLAY_WIDTH * HOST_DISPLAY_HEIGHT];
+    const display_color_rgb555_t *palette = (const display_color_rgb555_t *)display->hardware->palette;
+    const memory_t *mem = cmp->mem;
+    display_rectangle_t b = display_bench_video_bounds(display, mode);
+    uint32_t base = ((mem->port_fa & 0x03) << 14) ^ 0xc000;
+    ESP_ERROR_CHECK(host_display_get_frame(display, frame));
+    for (int y = 0; y < HOST_DISPLAY_HEIGHT; ++y) {
+        for (int x = 0; x < HOST_DISPLAY_WIDTH; ++x) {
+            uint16_t expected = DISPLAY_BENCH_BACKGROUND;
+            if (x >= b.left && x < b.left + b.width && y >= b.top && y < b.top + b.height) {
+                uint32_t ox = x - b.left;
+                uint32_t oy = y - b.top;
+                if (mode != VIDEO_SCALE_NONE) {
+                    ox = (uint32_t)((ox + 0.5) * DISPLAY_BENCH_WIDTH / b.width);
+                    oy = (uint32_t)((oy + 0.5) * DISPLAY_BENCH_HEIGHT / b.height);
+                }
+                uint32_t ofs = base | (ox >> 3) << 8 | oy;
+                uint32_t colors = video_get_colors(mem->ram_page[0][ofs], mem->ram_page[1][ofs], mem->port_f8);
+                expected = palette[(colors >> ((ox & 7) * 4)) & 0x0f].rgb;
+            }
+            if (frame[y * HOST_DISPLAY_WIDTH + x] != expected) {
+                ESP_LOGE(TAG, "pixel %d, %d: 0x%04x instead of 0x%04x", x, y,
+                    frame[y * HOST_DISPLAY_WIDTH + x], expected);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Just the parts of the computer the video converter reads, the refresh
+// task isn't started
+static void display_bench_video_create(computer_t *cmp, memory_t *mem, display_t *display, video_scale_mode_t mode)
+{
+    bzero(mem, sizeof(memory_t));
+    for (size_t i = 0; i < 2; ++i) {
+        mem->ram_page[i] = (uint8_t *)malloc(DISPLAY_BENCH_VIDEO_PAGE_SIZE);
+        ESP_ERROR_CHECK(mem->ram_page[i] ? ESP_OK : ESP_ERR_NO_MEM);
+    }
+    bzero(cmp, sizeof(computer_t));
+    cmp->mem = mem;
+    cmp->display = display;
+    ESP_ERROR_CHECK(video_scale_create(&cmp->video_scale, display, mode));
+#ifdef CONFIG_ORION_VIDEO_SHADOW
+    cmp->video_shadow = (uint8_t *)malloc(2 * VIDEO_SHADOW_PAGE_SIZE);
+    ESP_ERROR_CHECK(cmp->video_shadow ? ESP_OK : ESP_ERR_NO_MEM);
+    cmp->video_shadow_palette = VIDEO_SHADOW_INVALID;
+#endif
+}
+
+static void display_bench_video_done(computer_t *cmp)
+{
+#ifdef CONFIG_ORION_VIDEO_SHADOW
+    free(cmp->video_shadow);
+#endif
+    ESP_ERROR_CHECK(video_scale_done(cmp->video_scale));
+    free(cmp->mem->ram_page[0]);
+    free(cmp->mem->ram_page[1]);
+}
+
+// Draw the Orion screen through the video converter in a few modes: the
+// whole screen first, then random dirty windows over changed bytes the
+// way the refresh task sends them.
+static bool display_bench_video(display_t *display, video_scale_mode_t mode, const char *name)
+{
+    static const uint8_t ports[] = { 0, 1, 4, 6 };
+    memory_t mem;
+    computer_t cmp;
+    display_bench_video_create(&cmp, &mem, display, mode);
+
+    bool ok = true;
+    unsigned seed = 2;
+    for (size_t i = 0; i < sizeof(ports) && ok; ++i) {
+        for (size_t j = 0; j < 2; ++j)
+            for (size_t k = 0; k < DISPLAY_BENCH_VIDEO_PAGE_SIZE; ++k)
+                mem.ram_page[j][k] = rand_r(&seed);
+        mem.port_f8 = ports[i];
+        mem.port_fa = i & 3;
+        ESP_ERROR_CHECK(host_display_fill(display, DISPLAY_BENCH_BACKGROUND));
+        ESP_ERROR_CHECK(video_redraw(&cmp, true));
+        ok = display_bench_video_check(display, &cmp, mode);
+
+        uint32_t base = ((mem.port_fa & 0x03) << 14) ^ 0xc000;
+        for (uint32_t n = 0; n < DISPLAY_BENCH_VIDEO_WINDOWS && ok; ++n) {
+            uint32_t x = rand_r(&seed) % (DISPLAY_BENCH_WIDTH / 8);
+            uint32_t y = rand_r(&seed) % DISPLAY_BENCH_HEIGHT;
+            uint32_t w = 1 + rand_r(&seed) % 8;
+            uint32_t h = 1 + rand_r(&seed) % 64;
+            if (x + w > DISPLAY_BENCH_WIDTH / 8)
+                w = DISPLAY_BENCH_WIDTH / 8 - x;
+            if (y + h > DISPLAY_BENCH_HEIGHT)
+                h = DISPLAY_BENCH_HEIGHT - y;
+            for (uint32_t c = x; c < x + w; ++c) {
+                for (uint32_t r = y; r < y + h; ++r) {
+                    mem.ram_page[0][base | c << 8 | r] = rand_r(&seed);
+                    mem.ram_page[1][base | c << 8 | r] = rand_r(&seed);
+                }
+            }
+            ESP_ERROR_CHECK(video_draw(&cmp, x << 3, y, w << 3, h));
+        }
+        ok = ok && display_bench_video_check(display, &cmp, mode);
+    }
+    const video_scale_t *scale = cmp.video_scale;
+    printf("%s, %dx%d at %d, %d: %s\n", name, scale->bounds.width, scale->bounds.height,
+        scale->bounds.left, scale->bounds.top, ok ? "ok" : "FAILED");
+
+    display_bench_video_done(&cmp);
+    return ok;
+}
+
+#ifdef CONFIG_ORION_VIDEO_SHADOW
+// Change the video memory behind the back of the refresh task, let the
+// shadow redraw just the differences and compare the panel with a forced
+// redraw of the whole screen: column runs with gaps, blocks and bytes
+// changed back to what they were, in every palette.
+static bool display_bench_shadow(display_t *display, const char *name)
+{
+    static const uint8_t ports[] = { 0, 1, 2, 4, 6 };
+    static uint16_t diff[HOST_DISPLAY_WIDTH * HOST_DISPLAY_HEIGHT];
+    static uint16_t full[HOST_DISPLAY_WIDTH * HOST_DISPLAY_HEIGHT];
+    memory_t mem;
+    computer_t cmp;
+    display_bench_video_create(&cmp, &mem, display, VIDEO_SCALE_DEFAULT);
+
+    bool ok = true;
+    unsigned seed = 3;
+    uint64_t diff_bytes = 0;
+    uint64_t full_bytes = 0;
+    host_display_stats_t before;
+    host_display_stats_t after;
+    for (size_t i = 0; i < sizeof(ports) && ok; ++i) {
+        for (size_t j = 0; j < 2; ++j)
+            for (size_t k = 0; k < DISPLAY_BENCH_VIDEO_PAGE_SIZE; ++k)
+                mem.ram_page[j][k] = rand_r(&seed);
+        mem.port_f8 = ports[i];
+        mem.port_fa = i & 3;
+        uint32_t base = ((mem.port_fa & 0x03) << 14) ^ 0xc000;
+        ESP_ERROR_CHECK(host_display_fill(display, DISPLAY_BENCH_BACKGROUND));
+        ESP_ERROR_CHECK(video_redraw(&cmp, true));
+
+        for (uint32_t n = 0; n < DISPLAY_BENCH_SHADOW_ROUNDS && ok; ++n) {
+            for (uint32_t m = rand_r(&seed) % 8; m > 0; --m) {
+                uint32_t x = rand_r(&seed) % (DISPLAY_BENCH_WIDTH / 8);
+                uint32_t y = rand_r(&seed) % DISPLAY_BENCH_HEIGHT;
+                uint32_t w = 1 + rand_r(&seed) % 4;
+                uint32_t h = 1 + rand_r(&seed) % 32;
+                uint32_t step = 1 + rand_r(&seed) % 8;
+                uint32_t page = rand_r(&seed) & 1;
+                for (uint32_t c = x; c < x + w && c < DISPLAY_BENCH_WIDTH / 8; ++c) {
+                    for (uint32_t r = y; r < y + h && r < DISPLAY_BENCH_HEIGHT; r += step) {
+                        uint8_t *p = &mem.ram_page[page][base | c << 8 | r];
+                        uint8_t old = *p;
+                        *p = rand_r(&seed);
+                        if (!(rand_r(&seed) & 7))
+                            *p = old;
+                    }
+                }
+            }
+            ESP_ERROR_CHECK(host_display_get_stats(display, &before));
+            ESP_ERROR_CHECK(video_redraw(&cmp, false));
+            ESP_ERROR_CHECK(host_display_get_stats(display, &after));
+            diff_bytes += after.bytes - before.bytes;
+            ESP_ERROR_CHECK(host_display_get_frame(display, diff));
+            ESP_ERROR_CHECK(video_redraw(&cmp, true));
+            ESP_ERROR_CHECK(host_display_get_stats(display, &before));
+            full_bytes += before.bytes - after.bytes;
+            ESP_ERROR_CHECK(host_display_get_frame(display, full));
+            for (size_t k = 0; k < HOST_DISPLAY_WIDTH * HOST_DISPLAY_HEIGHT && ok; ++k) {
+                if (diff[k] != full[k]) {
+                    ESP_LOGE(TAG, "port 0x%02x, pixel %d, %d: 0x%04x instead of 0x%04x", mem.port_f8,
+                        (int)(k % HOST_DISPLAY_WIDTH), (int)(k / HOST_DISPLAY_WIDTH), diff[k], full[k]);
+                    ok = false;
+                }
+            }
+        }
+        ok = ok && display_bench_video_check(display, &cmp, VIDEO_SCALE_DEFAULT);
+    }
+    printf("%s, %u rounds: %s\n", name, (unsigned)(sizeof(ports) * DISPLAY_BENCH_SHADOW_ROUNDS), ok ? "ok" : "FAILED");
+    printf("  bus:      %llu bytes of the differences, %llu of the whole screen\n",
+        (unsigned long long)diff_bytes, (unsigned long long)full_bytes);
+    display_bench_video_done(&cmp);
+    return ok;
+}
+#endif
+
+// Print lines through the console the way the boot menu does, every
+// symbol is a window of its own and the last lines scroll the screen.
+static bool display_bench_console(display_t *display, uint32_t lines)
+{
+    static uint8_t data[DISPLAY_BENCH_FONT_SIZE];
+    FILE *f = fopen(ORION_FONT_FILE, "rb");
+    if (!f || fread(data, sizeof(data), 1, f) != 1) {
+        ESP_LOGE(TAG, "can't read %s", ORION_FONT_FILE);
+        if (f)
+            fclose(f);
+        return false;
+    }
+    fclose(f);
+
+    font_t *font;
+    screen_t *screen;
+    console_t *cout;
+    ESP_ERROR_CHECK(font_create(&font));
+    font->data = data;
+    font->width = 8;
+    font->height = 8;
+    font->type = FONT_TYPE_I1;
+    font->is_mirror = true;
+    ESP_ERROR_CHECK(font_init(font));
+    ESP_ERROR_CHECK(screen_create(&screen));
+    ESP_ERROR_CHECK(screen_init_display(screen, display, font));
+    ESP_ERROR_CHECK(console_create(&cout));
+    ESP_ERROR_CHECK(console_init(cout, screen));
+
+    host_display_stats_t before;
+    host_display_stats_t after;
+    ESP_ERROR_CHECK(host_display_get_stats(display, &before));
+    char line[64];
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < lines; ++i) {
+        snprintf(line, sizeof(line), "%5u: The quick brown fox jumps over the lazy dog\r\n", i);
+        console_out_string(cout, line);
+    }
+    int64_t time = esp_timer_get_time() - start;
+    ESP_ERROR_CHECK(host_display_get_stats(display, &after));
+    uint32_t refreshes = after.refreshes - before.refreshes;
+    uint64_t bytes = after.bytes - before.bytes;
+    printf("console, %u lines:\n", lines);
+    printf("  speed:    %8.0f lines/s\n", lines * 1e6 / time);
+    printf("  bus:      %u windows, %llu bytes, %llu per line\n", refreshes,
+        (unsigned long long)host_display_bus_bytes(refreshes, bytes),
+        (unsigned long long)(host_display_bus_bytes(refreshes, bytes) / lines));
+
+    ESP_ERROR_CHECK(console_done(cout));
+    ESP_ERROR_CHECK(screen_done(screen));
+    ESP_ERROR_CHECK(font_done(font));
+    return true;
+}
+
+static void display_bench_usage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -n frames   frames per run (2000)\n"
+        "  -l lines    console lines (500)\n"
+        "  -P file     save the LCD picture after the console run to a PPM file\n",
+        name);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t frames = 2000;
+    uint32_t lines = 500;
+    const char *screenshot = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:l:P:h")) != -1) {
+        switch (opt) {
+            case 'n': frames = strtoul(optarg, NULL, 0); break;
+            case 'l': lines = strtoul(optarg, NULL, 0); break;
+            case 'P': screenshot = optarg; break;
+            default:
+                display_bench_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    unsigned seed = 1;
+    for (size_t i = 0; i < DISPLAY_BENCH_WORDS; ++i)
+        display_bench_words[i] = (uint32_t)rand_r(&seed) << 16 ^ rand_r(&seed);
+
+    display_t *display;
+    ESP_ERROR_CHECK(host_display_create(&display));
+
+    display_rectangle_t screen = {
+        left: 0,
+        top: 0,
+        width: DISPLAY_BENCH_WIDTH,
+        height: DISPLAY_BENCH_HEIGHT
+    };
+    // a partial last group, the table is used for the whole groups only
+    display_rectangle_t odd = {
+        left: 2,
+        top: 5,
+        width: 371,
+        height: 200
+    };
+    // no group is aligned, the table is not used at all
+    display_rectangle_t unaligned = {
+        left: 3,
+        top: 1,
+        width: 64,
+        height: 64
+    };
+    bool ok = display_bench_compare(display, &screen, "screen", frames);
+    ok = display_bench_compare(display, &odd, "odd window", 1) && ok;
+    ok = display_bench_compare(display, &unaligned, "unaligned window", 1) && ok;
+    // the indices past the palette in both converters
+    display_hardware_config_t *hardware = display->hardware;
+    display_hardware_config_t short_hardware = *hardware;
+    short_hardware.palette_count = DISPLAY_BENCH_SHORT_PALETTE;
+    display->hardware = &short_hardware;
+    ok = display_bench_compare(display, &screen, "short palette", 1) && ok;
+    ok = display_bench_compare(display, &odd, "short palette, odd window", 1) && ok;
+    display->hardware = hardware;
+    ESP_ERROR_CHECK(display_palette_lut_init(display));
+    ok = display_bench_video(display, VIDEO_SCALE_NONE, "video 1:1") && ok;
+    ok = display_bench_video(display, VIDEO_SCALE_FILL, "video fill") && ok;
+    ok = display_bench_video(display, VIDEO_SCALE_ASPECT, "video aspect") && ok;
+#ifdef CONFIG_ORION_VIDEO_SHADOW
+    ok = display_bench_shadow(display, "video shadow") && ok;
+#endif
+    ok = display_bench_console(display, lines) && ok;
+    if (screenshot && host_display_save_ppm(display, screenshot) != ESP_OK)
+        ok = false;
+
+    ESP_ERROR_CHECK(display_done(display));
+    return ok ? 0 : 1;
+}
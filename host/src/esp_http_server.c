@@ -0,0 +1,327 @@
+/*
+ * This file is part of the esp32-orion128 distribution
+ * (https://gitlab.romanchenko.su/esp/esp32/esp32-orion128.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "esp_log.h"
+#include "esp_http_server.h"
+#include "freertos/task.h"
+
+#define HTTPD_HEADER_SIZE 2048
+
+typedef struct httpd {
+    int fd;
+    TaskHandle_t task;
+    httpd_config_t config;
+    httpd_uri_t *handlers;
+    size_t handlers_count;
+} httpd_t;
+
+// the connection of the request being handled
+typedef struct httpd_conn {
+    int fd;
+    char header[HTTPD_HEADER_SIZE + 1];
+    // body bytes read along with the header
+    size_t body_pos;
+    size_t body_end;
+    size_t body_left;
+    const char *status;
+    const char *type;
+    bool is_chunked;
+} httpd_conn_t;
+
+static const char __attribute__((unused)) *TAG = "httpd";
+
+static const char *httpd_status(httpd_err_code_t error)
+{
+    switch (error) {
+        case HTTPD_400_BAD_REQUEST: return HTTPD_400;
+        case HTTPD_404_NOT_FOUND: return HTTPD_404;
+        case HTTPD_405_METHOD_NOT_ALLOWED: return "405 Method Not Allowed";
+        case HTTPD_408_REQ_TIMEOUT: return "408 Request Timeout";
+        case HTTPD_411_LENGTH_REQUIRED: return "411 Length Required";
+        case HTTPD_414_URI_TOO_LONG: return "414 URI Too Long";
+        case HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE: return "431 Request Header Fields Too Large";
+        case HTTPD_501_METHOD_NOT_IMPLEMENTED: return "501 Not Implemented";
+        default: return HTTPD_500;
+    }
+}
+
+static bool httpd_write(int fd, const void *data, size_t size)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    while (size) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool httpd_write_header(httpd_conn_t *conn, ssize_t length)
+{
+    char header[256];
+    int n = snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Type: %s\r\n", conn->status, conn->type);
+    if (length >= 0)
+        n += snprintf(header + n, sizeof(header) - n, "Content-Length: %zd\r\n", length);
+    else
+        n += snprintf(header + n, sizeof(header) - n, "Transfer-Encoding: chunked\r\n");
+    n += snprintf(header + n, sizeof(header) - n, "Connection: close\r\n\r\n");
+    return httpd_write(conn->fd, header, n);
+}
+
+bool httpd_uri_match_wildcard(const char *uri_template, const char *uri_to_match, size_t match_upto)
+{
+    size_t len = strlen(uri_template);
+    if (len && uri_template[len - 1] == '*')
+        return match_upto >= len - 1 && !strncmp(uri_template, uri_to_match, len - 1);
+    return len == match_upto && !strncmp(uri_template, uri_to_match, len);
+}
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len)
+{
+    httpd_conn_t *conn = (httpd_conn_t *)r->aux;
+    if (buf_len > conn->body_left)
+        buf_len = conn->body_left;
+    if (!buf_len)
+        return 0;
+    ssize_t n;
+    if (conn->body_pos < conn->body_end) {
+        n = conn->body_end - conn->body_pos;
+        if ((size_t)n > buf_len)
+            n = buf_len;
+        memcpy(buf, &conn->header[conn->body_pos], n);
+        conn->body_pos += n;
+    }
+    else {
+        n = recv(conn->fd, buf, buf_len, 0);
+        // 0 is the connection closed by the client
+        if (n <= 0)
+            return n ? HTTPD_SOCK_ERR_TIMEOUT : 0;
+    }
+    conn->body_left -= n;
+    return n;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status)
+{
+    ((httpd_conn_t *)r->aux)->status = status;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+    ((httpd_conn_t *)r->aux)->type = type;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    httpd_conn_t *conn = (httpd_conn_t *)r->aux;
+    if (buf_len == HTTPD_RESP_USE_STRLEN)
+        buf_len = buf ? strlen(buf) : 0;
+    if (!httpd_write_header(conn, buf_len) || !httpd_write(conn->fd, buf, buf_len))
+        return ESP_FAIL;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    httpd_conn_t *conn = (httpd_conn_t *)r->aux;
+    if (buf_len == HTTPD_RESP_USE_STRLEN)
+        buf_len = buf ? strlen(buf) : 0;
+    if (!conn->is_chunked) {
+        if (!httpd_write_header(conn, -1))
+            return ESP_FAIL;
+        conn->is_chunked = true;
+    }
+    char size[16];
+    int n = snprintf(size, sizeof(size), "%zx\r\n", buf ? buf_len : 0);
+    if (!httpd_write(conn->fd, size, n))
+        return ESP_FAIL;
+    if (buf && buf_len && !httpd_write(conn->fd, buf, buf_len))
+        return ESP_FAIL;
+    return httpd_write(conn->fd, "\r\n", 2) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *r, httpd_err_code_t error, const char *msg)
+{
+    httpd_resp_set_status(r, httpd_status(error));
+    httpd_resp_set_type(r, "text/plain");
+    return httpd_resp_send(r, msg ? msg : httpd_status(error), HTTPD_RESP_USE_STRLEN);
+}
+
+// Reads the request line and the headers, the start of the body may follow
+static bool httpd_read_header(httpd_t *httpd, httpd_conn_t *conn, httpd_req_t *req)
+{
+    size_t size = 0;
+    char *end = NULL;
+    while (!end) {
+        if (size == HTTPD_HEADER_SIZE) {
+            httpd_resp_send_err(req, HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE, NULL);
+            return false;
+        }
+        ssize_t n = recv(conn->fd, &conn->header[size], HTTPD_HEADER_SIZE - size, 0);
+        if (n <= 0)
+            return false;
+        size += n;
+        conn->header[size] = 0;
+        end = strstr(conn->header, "\r\n\r\n");
+    }
+    *end = 0;
+    conn->body_pos = end + 4 - conn->header;
+    conn->body_end = size;
+
+    char method[8];
+    char uri[HTTPD_MAX_URI_LEN + 1];
+    if (sscanf(conn->header, "%7s %512s", method, uri) != 2) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, NULL);
+        return false;
+    }
+    static const char *methods[] = { "DELETE", "GET", "HEAD", "POST", "PUT" };
+    req->method = -1;
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); ++i)
+        if (!strcmp(method, methods[i]))
+            req->method = i;
+    strcpy((char *)req->uri, uri);
+
+    for (char *line = strstr(conn->header, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (!strncasecmp(line, "Content-Length:", 15))
+            req->content_len = strtoul(line + 15, NULL, 10);
+        else if (!strncasecmp(line, "Transfer-Encoding:", 18)) {
+            httpd_resp_send_err(req, HTTPD_411_LENGTH_REQUIRED, "Content-Length is required");
+            return false;
+        }
+    }
+    conn->body_left = req->content_len;
+    return true;
+}
+
+static void httpd_handle(httpd_t *httpd, int fd)
+{
+    static httpd_conn_t conn;
+    static httpd_req_t req;
+    bzero(&conn, sizeof(conn));
+    bzero(&req, sizeof(req));
+    conn.fd = fd;
+    conn.status = HTTPD_200;
+    conn.type = "text/html";
+    req.handle = httpd;
+    req.aux = &conn;
+    if (!httpd_read_header(httpd, &conn, &req))
+        return;
+
+    const char *query = strchr(req.uri, '?');
+    size_t length = query ? (size_t)(query - req.uri) : strlen(req.uri);
+    for (size_t i = 0; i < httpd->handlers_count; ++i) {
+        const httpd_uri_t *handler = &httpd->handlers[i];
+        if (handler->method != req.method)
+            continue;
+        bool is_match = httpd->config.uri_match_fn ? httpd->config.uri_match_fn(handler->uri, req.uri, length)
+            : strlen(handler->uri) == length && !strncmp(handler->uri, req.uri, length);
+        if (!is_match)
+            continue;
+        req.user_ctx = handler->user_ctx;
+        if (handler->handler(&req) != ESP_OK)
+            ESP_LOGD(TAG, "%s failed", req.uri);
+        return;
+    }
+    httpd_resp_send_err(&req, HTTPD_404_NOT_FOUND, NULL);
+}
+
+static void httpd_process(void *arg)
+{
+    httpd_t *httpd = (httpd_t *)arg;
+    while (1) {
+        int fd = accept(httpd->fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        struct timeval tv = {
+            tv_sec: httpd->config.recv_wait_timeout,
+            tv_usec: 0
+        };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        tv.tv_sec = httpd->config.send_wait_timeout;
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        httpd_handle(httpd, fd);
+        close(fd);
+    }
+}
+
+// Listens on the loopback interface only
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+    ESP_ERROR_CHECK(handle && config ? ESP_OK : ESP_ERR_INVALID_ARG);
+    httpd_t *httpd = (httpd_t *)calloc(1, sizeof(httpd_t));
+    ESP_ERROR_CHECK(httpd ? ESP_OK : ESP_ERR_NO_MEM);
+    httpd->config = *config;
+    httpd->handlers = (httpd_uri_t *)calloc(config->max_uri_handlers, sizeof(httpd_uri_t));
+    ESP_ERROR_CHECK(httpd->handlers ? ESP_OK : ESP_ERR_NO_MEM);
+
+    httpd->fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(httpd->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config->server_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (httpd->fd < 0 || bind(httpd->fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(httpd->fd, 4)) {
+        ESP_LOGE(TAG, "can't listen on port %u", config->server_port);
+        if (httpd->fd >= 0)
+            close(httpd->fd);
+        free(httpd->handlers);
+        free(httpd);
+        return ESP_FAIL;
+    }
+    BaseType_t result = xTaskCreate(httpd_process, TAG, config->stack_size, httpd, config->task_priority, &httpd->task);
+    ESP_ERROR_CHECK(result == pdPASS ? ESP_OK : ESP_ERR_NO_MEM);
+    *handle = httpd;
+    return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+    ESP_ERROR_CHECK(handle ? ESP_OK : ESP_ERR_INVALID_ARG);
+    httpd_t *httpd = (httpd_t *)handle;
+    vTaskDelete(httpd->task);
+    close(httpd->fd);
+    free(httpd->handlers);
+    free(httpd);
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+    ESP_ERROR_CHECK(handle && uri_handler ? ESP_OK : ESP_ERR_INVALID_ARG);
+    httpd_t *httpd = (httpd_t *)handle;
+    if (httpd->handlers_count == httpd->config.max_uri_handlers)
+        return ESP_ERR_NO_MEM;
+    httpd->handlers[httpd->handlers_count++] = *uri_handler;
+    return ESP_OK;
+}
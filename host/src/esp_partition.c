@@ -0,0 +1,112 @@
+/*
+ * This file is part of the esp32-orion128 distribution
+ * (https://gitlab.romanchenko.su/esp/esp32/esp32-orion128.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+
+#define HOST_PARTITIONS_MAX 8
+
+typedef struct host_partition {
+    esp_partition_t partition;
+    FILE *file;
+} host_partition_t;
+
+static host_partition_t host_partitions[HOST_PARTITIONS_MAX];
+static size_t host_partitions_count = 0;
+
+static const char __attribute__((unused)) *TAG = "partition";
+
+esp_err_t host_partition_add(const char *label, esp_partition_type_t type, esp_partition_subtype_t subtype, const char *path)
+{
+    ESP_ERROR_CHECK(label ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(path ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (host_partitions_count == HOST_PARTITIONS_MAX)
+        return ESP_ERR_NO_MEM;
+    // written in place, read only images can still be read
+    FILE *f = fopen(path, "r+b");
+    if (!f)
+        f = fopen(path, "rb");
+    if (!f) {
+        ESP_LOGE(TAG, "can't open %s", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    fseek(f, 0, SEEK_END);
+
+    host_partition_t *part = &host_partitions[host_partitions_count++];
+    bzero(part, sizeof(host_partition_t));
+    part->partition.type = type;
+    part->partition.subtype = subtype;
+    part->partition.size = ftell(f);
+    strncpy(part->partition.label, label, sizeof(part->partition.label) - 1);
+    part->file = f;
+    return ESP_OK;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    for (size_t i = 0; i < host_partitions_count; ++i) {
+        const esp_partition_t *part = &host_partitions[i].partition;
+        if (part->type == type && (subtype == ESP_PARTITION_SUBTYPE_ANY || part->subtype == subtype)
+                && (!label || !strcmp(part->label, label)))
+            return part;
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    ESP_ERROR_CHECK(partition ? ESP_OK : ESP_ERR_INVALID_ARG);
+    const host_partition_t *part = (const host_partition_t *)partition;
+    if (src_offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    if (fseek(part->file, src_offset, SEEK_SET) || fread(dst, size, 1, part->file) != 1)
+        return ESP_FAIL;
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    ESP_ERROR_CHECK(partition ? ESP_OK : ESP_ERR_INVALID_ARG);
+    const host_partition_t *part = (const host_partition_t *)partition;
+    if (dst_offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    if (fseek(part->file, dst_offset, SEEK_SET) || fwrite(src, size, 1, part->file) != 1 || fflush(part->file))
+        return ESP_FAIL;
+    return ESP_OK;
+}
+
+// the flash erases to 0xff in whole sectors
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    ESP_ERROR_CHECK(partition ? ESP_OK : ESP_ERR_INVALID_ARG);
+    if (offset % SPI_FLASH_SEC_SIZE || size % SPI_FLASH_SEC_SIZE)
+        return ESP_ERR_INVALID_ARG;
+    if (offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    uint8_t sector[SPI_FLASH_SEC_SIZE];
+    memset(sector, 0xff, sizeof(sector));
+    for (size_t pos = 0; pos < size; pos += SPI_FLASH_SEC_SIZE) {
+        esp_err_t r = esp_partition_write(partition, offset + pos, sector, sizeof(sector));
+        if (r != ESP_OK)
+            return r;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,245 @@
+/*
+ * This file is part of the esp32-orion128 distribution
+ * (https://gitlab.romanchenko.su/esp/esp32/esp32-orion128.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+struct task {
+    pthread_t thread;
+    TaskFunction_t function;
+    void *arg;
+};
+
+struct queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    uint8_t *items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+struct semaphore {
+    pthread_mutex_t mutex;
+};
+
+static __thread struct task *freertos_current_task = NULL;
+static struct timespec freertos_start;
+
+static void *freertos_task_start(void *arg)
+{
+    struct task *task = (struct task *)arg;
+    freertos_current_task = task;
+    task->function(task->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth,
+        void *arg, UBaseType_t priority, TaskHandle_t *handle)
+{
+    struct task *task = (struct task *)malloc(sizeof(struct task));
+    if (!task)
+        return pdFAIL;
+    task->function = function;
+    task->arg = arg;
+    if (handle)
+        *handle = task;
+    if (pthread_create(&task->thread, NULL, freertos_task_start, task)) {
+        free(task);
+        return pdFAIL;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_depth,
+        void *arg, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core_id)
+{
+    return xTaskCreate(function, name, stack_depth, arg, priority, handle);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (!task || task == freertos_current_task) {
+        task = freertos_current_task;
+        if (task) {
+            pthread_detach(task->thread);
+            free(task);
+        }
+        pthread_exit(NULL);
+    }
+    pthread_cancel(task->thread);
+    pthread_join(task->thread, NULL);
+    free(task);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    usleep(ticks * portTICK_PERIOD_MS * 1000);
+}
+
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority)
+{
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (!freertos_start.tv_sec && !freertos_start.tv_nsec)
+        freertos_start = now;
+    uint64_t ms = (now.tv_sec - freertos_start.tv_sec) * 1000 + (now.tv_nsec - freertos_start.tv_nsec) / 1000000;
+    return ms / portTICK_PERIOD_MS;
+}
+
+static void freertos_deadline(struct timespec *ts, TickType_t ticks)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+    uint64_t ns = ts->tv_nsec + (uint64_t)ticks * portTICK_PERIOD_MS * 1000000;
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+}
+
+static void freertos_unlock(void *arg)
+{
+    pthread_mutex_unlock((pthread_mutex_t *)arg);
+}
+
+// waits for the condition, returns false on timeout
+static bool freertos_wait(struct queue *queue, pthread_cond_t *cond, bool is_send, TickType_t ticks)
+{
+    struct timespec deadline;
+    if (ticks != portMAX_DELAY)
+        freertos_deadline(&deadline, ticks);
+    while (is_send ? queue->count == queue->length : queue->count == 0) {
+        if (ticks == 0)
+            return false;
+        if (ticks == portMAX_DELAY)
+            pthread_cond_wait(cond, &queue->mutex);
+        else if (pthread_cond_timedwait(cond, &queue->mutex, &deadline))
+            return false;
+    }
+    return true;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct queue *queue = (struct queue *)malloc(sizeof(struct queue));
+    if (!queue)
+        return NULL;
+    bzero(queue, sizeof(struct queue));
+    queue->items = (uint8_t *)malloc(length * item_size);
+    if (!queue->items) {
+        free(queue);
+        return NULL;
+    }
+    queue->length = length;
+    queue->item_size = item_size;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_cond_destroy(&queue->not_full);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_mutex_destroy(&queue->mutex);
+    free(queue->items);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    BaseType_t result = pdFALSE;
+    pthread_mutex_lock(&queue->mutex);
+    pthread_cleanup_push(freertos_unlock, &queue->mutex);
+    if (freertos_wait(queue, &queue->not_full, true, ticks)) {
+        UBaseType_t tail = (queue->head + queue->count) % queue->length;
+        memcpy(&queue->items[tail * queue->item_size], item, queue->item_size);
+        ++queue->count;
+        pthread_cond_signal(&queue->not_empty);
+        result = pdTRUE;
+    }
+    pthread_cleanup_pop(1);
+    return result;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    BaseType_t result = pdFALSE;
+    pthread_mutex_lock(&queue->mutex);
+    pthread_cleanup_push(freertos_unlock, &queue->mutex);
+    if (freertos_wait(queue, &queue->not_empty, false, ticks)) {
+        memcpy(item, &queue->items[queue->head * queue->item_size], queue->item_size);
+        queue->head = (queue->head + 1) % queue->length;
+        --queue->count;
+        pthread_cond_signal(&queue->not_full);
+        result = pdTRUE;
+    }
+    pthread_cleanup_pop(1);
+    return result;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+    return count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    struct semaphore *semaphore = (struct semaphore *)malloc(sizeof(struct semaphore));
+    if (!semaphore)
+        return NULL;
+    pthread_mutex_init(&semaphore->mutex, NULL);
+    return semaphore;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    pthread_mutex_destroy(&semaphore->mutex);
+    free(semaphore);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY)
+        return pthread_mutex_lock(&semaphore->mutex) ? pdFALSE : pdTRUE;
+    if (ticks == 0)
+        return pthread_mutex_trylock(&semaphore->mutex) ? pdFALSE : pdTRUE;
+    struct timespec deadline;
+    freertos_deadline(&deadline, ticks);
+    return pthread_mutex_timedlock(&semaphore->mutex, &deadline) ? pdFALSE : pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    return pthread_mutex_unlock(&semaphore->mutex) ? pdFALSE : pdTRUE;
+}
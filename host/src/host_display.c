@@ -0,0 +1,197 @@
+/*
+ * This file is part of the esp32-orion128 distribution
+ * (https://gitlab.romanchenko.su/esp/esp32/esp32-orion128.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "esp_log.h"
+#include "colors.h"
+#include "host_display.h"
+
+#define HOST_DISPLAY_PALETTE_SIZE 16
+
+static display_color_rgb555_t host_display_palette[HOST_DISPLAY_PALETTE_SIZE] = {
+    { rgb: 0x0000 }, { rgb: 0x0010 }, { rgb: 0x0400 }, { rgb: 0x0410 },
+    { rgb: 0x8000 }, { rgb: 0x8010 }, { rgb: 0x8400 }, { rgb: 0x8410 },
+    { rgb: 0x0000 }, { rgb: 0x001f }, { rgb: 0x07e0 }, { rgb: 0x07ff },
+    { rgb: 0xf800 }, { rgb: 0xf81f }, { rgb: 0xffe0 }, { rgb: 0xffff }
+};
+
+typedef struct host_display {
+    // the video task draws while the bench reads the counters
+    pthread_mutex_t mutex;
+    host_display_stats_t stats;
+    uint32_t frame_refreshes;
+    uint64_t frame_pixels;
+    uint64_t frame_bytes;
+    uint16_t frame[HOST_DISPLAY_WIDTH * HOST_DISPLAY_HEIGHT];
+} host_display_t;
+
+static const char __attribute__((unused)) *TAG = "host_display";
+
+static display_hardware_config_t host_display_hardware = {
+    bitmap_extra_size: 0,
+    bpp: 16,
+    default_format: DEVICE_COLOR_RGB555,
+    palette: host_display_palette,
+    palette_count: HOST_DISPLAY_PALETTE_SIZE,
+    type: 0
+};
+
+static esp_err_t host_display_refresh(const display_bitmap_t *bitmap)
+{
+    host_display_t *host = (host_display_t *)bitmap->display->device;
+    const display_rectangle_t *b = &bitmap->bounds;
+    ESP_ERROR_CHECK(bitmap->bpp == 16 ? ESP_OK : ESP_ERR_NOT_SUPPORTED);
+    // the panel clips the window the same way
+    int left = b->left < 0 ? 0 : b->left;
+    int top = b->top < 0 ? 0 : b->top;
+    int right = b->left + b->width > HOST_DISPLAY_WIDTH ? HOST_DISPLAY_WIDTH : b->left + b->width;
+    int bottom = b->top + b->height > HOST_DISPLAY_HEIGHT ? HOST_DISPLAY_HEIGHT : b->top + b->height;
+
+    pthread_mutex_lock(&host->mutex);
+    const uint16_t *src = (const uint16_t *)bitmap->data;
+    for (int y = top; y < bottom && right > left; ++y)
+        memcpy(&host->frame[y * HOST_DISPLAY_WIDTH + left], &src[(y - b->top) * b->width + left - b->left],
+            (right - left) * sizeof(uint16_t));
+    host_display_stats_t *stats = &host->stats;
+    ++stats->refreshes;
+    stats->pixels += b->width * b->height;
+    stats->bytes += bitmap->data_size;
+    ++host->frame_refreshes;
+    host->frame_pixels += b->width * b->height;
+    host->frame_bytes += bitmap->data_size;
+    pthread_mutex_unlock(&host->mutex);
+    return ESP_OK;
+}
+
+static esp_err_t host_display_done(display_t *display)
+{
+    ESP_ERROR_CHECK(display ? ESP_OK : ESP_ERR_INVALID_ARG);
+    host_display_t *host = (host_display_t *)display->device;
+    pthread_mutex_destroy(&host->mutex);
+    free(host);
+    free(display);
+    return ESP_OK;
+}
+
+esp_err_t host_display_create(display_t **pdisplay)
+{
+    ESP_ERROR_CHECK(pdisplay ? ESP_OK : ESP_ERR_INVALID_ARG);
+    display_t *display = (display_t *)malloc(sizeof(display_t));
+    ESP_ERROR_CHECK(display ? ESP_OK : ESP_ERR_NO_MEM);
+    bzero(display, sizeof(display_t));
+    host_display_t *host = (host_display_t *)malloc(sizeof(host_display_t));
+    ESP_ERROR_CHECK(host ? ESP_OK : ESP_ERR_NO_MEM);
+    bzero(host, sizeof(host_display_t));
+    pthread_mutex_init(&host->mutex, NULL);
+    display->device = host;
+
+    display->hardware = &host_display_hardware;
+    display->bounds.width = HOST_DISPLAY_WIDTH;
+    display->bounds.height = HOST_DISPLAY_HEIGHT;
+    display->orientation = DISPLAY_LANDSCAPE;
+    display->refresh = host_display_refresh;
+    display->done = host_display_done;
+    ESP_ERROR_CHECK(display_palette_lut_init(display));
+
+    *pdisplay = display;
+    return ESP_OK;
+}
+
+esp_err_t host_display_get_stats(const display_t *display, host_display_stats_t *stats)
+{
+    ESP_ERROR_CHECK(display ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(stats ? ESP_OK : ESP_ERR_INVALID_ARG);
+    host_display_t *host = (host_display_t *)display->device;
+    pthread_mutex_lock(&host->mutex);
+    memcpy(stats, &host->stats, sizeof(host_display_stats_t));
+    pthread_mutex_unlock(&host->mutex);
+    return ESP_OK;
+}
+
+esp_err_t host_display_frame(display_t *display)
+{
+    ESP_ERROR_CHECK(display ? ESP_OK : ESP_ERR_INVALID_ARG);
+    host_display_t *host = (host_display_t *)display->device;
+    host_display_stats_t *stats = &host->stats;
+    pthread_mutex_lock(&host->mutex);
+    ++stats->frames;
+    if (stats->max_frame_refreshes < host->frame_refreshes)
+        stats->max_frame_refreshes = host->frame_refreshes;
+    if (stats->max_frame_pixels < host->frame_pixels)
+        stats->max_frame_pixels = host->frame_pixels;
+    if (stats->max_frame_bytes < host->frame_bytes)
+        stats->max_frame_bytes = host->frame_bytes;
+    host->frame_refreshes = 0;
+    host->frame_pixels = 0;
+    host->frame_bytes = 0;
+    pthread_mutex_unlock(&host->mutex);
+    return ESP_OK;
+}
+
+esp_err_t host_display_fill(display_t *display, uint16_t color)
+{
+    ESP_ERROR_CHECK(display ? ESP_OK : ESP_ERR_INVALID_ARG);
+    host_display_t *host = (host_display_t *)display->device;
+    pthread_mutex_lock(&host->mutex);
+    for (size_t i = 0; i < HOST_DISPLAY_WIDTH * HOST_DISPLAY_HEIGHT; ++i)
+        host->frame[i] = color;
+    pthread_mutex_unlock(&host->mutex);
+    return ESP_OK;
+}
+
+esp_err_t host_display_get_frame(const display_t *display, uint16_t *frame)
+{
+    ESP_ERROR_CHECK(display ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(frame ? ESP_OK : ESP_ERR_INVALID_ARG);
+    host_display_t *host = (host_display_t *)display->device;
+    pthread_mutex_lock(&host->mutex);
+    memcpy(frame, host->frame, sizeof(host->frame));
+    pthread_mutex_unlock(&host->mutex);
+    return ESP_OK;
+}
+
+// Binary PPM of the whole panel, the palette is plain RGB565
+esp_err_t host_display_save_ppm(const display_t *display, const char *path)
+{
+    ESP_ERROR_CHECK(display ? ESP_OK : ESP_ERR_INVALID_ARG);
+    ESP_ERROR_CHECK(path ? ESP_OK : ESP_ERR_INVALID_ARG);
+    host_display_t *host = (host_display_t *)display->device;
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        ESP_LOGE(TAG, "can't create %s", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", HOST_DISPLAY_WIDTH, HOST_DISPLAY_HEIGHT);
+    uint8_t line[HOST_DISPLAY_WIDTH * 3];
+    pthread_mutex_lock(&host->mutex);
+    for (int y = 0; y < HOST_DISPLAY_HEIGHT; ++y) {
+        for (int x = 0; x < HOST_DISPLAY_WIDTH; ++x) {
+            uint16_t c = host->frame[y * HOST_DISPLAY_WIDTH + x];
+            line[x * 3] = ((c >> 11) & 0x1f) * 255 / 31;
+            line[x * 3 + 1] = ((c >> 5) & 0x3f) * 255 / 63;
+            line[x * 3 + 2] = (c & 0x1f) * 255 / 31;
+        }
+        fwrite(line, sizeof(line), 1, f);
+    }
+    pthread_mutex_unlock(&host->mutex);
+    fclose(f);
+    return ESP_OK;
+}
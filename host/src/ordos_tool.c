@@ -0,0 +1,153 @@
+/*
+ * This file is part of the esp32-orion128 distribution
+ * (https://gitlab.romanchenko.su/esp/esp32/esp32-orion128.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "ordos.h"
+
+// Host access to ORDOS RAM disk images (disk B, RAM page 1).
+//   ordos-tool image list
+//   ordos-tool image export NAME file.ord
+//   ordos-tool image import file.ord [NAME]
+//   ordos-tool image delete NAME
+//   ordos-tool image format
+
+typedef struct ordos_tool {
+    uint8_t disk[ORDOS_DISK_SIZE];
+    ordos_t *ordos;
+    size_t used;
+} ordos_tool_t;
+
+static const char __attribute__((unused)) *TAG = "ordos-tool";
+
+static void ordos_tool_usage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s image command [args]\n"
+        "  list                   list the files\n"
+        "  export NAME file.ord   write a file with its header\n"
+        "  import file.ord [NAME] add or replace a file\n"
+        "  delete NAME            delete a file\n"
+        "  format                 create an empty disk\n",
+        name);
+}
+
+static bool ordos_tool_list_cb(const ordos_header_t *header, size_t offset, void *arg)
+{
+    printf("%04x  %.8s  %04x  %5u  %02x\n", (unsigned)offset, header->name, header->addr, header->size, header->attr);
+    return true;
+}
+
+static bool ordos_tool_used_cb(const ordos_header_t *header, size_t offset, void *arg)
+{
+    *(size_t *)arg = offset + ORDOS_HEADER_SIZE + header->size;
+    return true;
+}
+
+static FILE *ordos_tool_open(const char *path, const char *mode)
+{
+    FILE *f = fopen(path, mode);
+    if (!f) {
+        ESP_LOGE(TAG, "can't open %s", path);
+        exit(1);
+    }
+    return f;
+}
+
+static void ordos_tool_check(esp_err_t r, const char *what)
+{
+    if (r != ESP_OK) {
+        ESP_LOGE(TAG, "%s: %s", what, esp_err_to_name(r));
+        exit(1);
+    }
+}
+
+// the image is the disk up to the end mark, like ramdisk1.rom
+static void ordos_tool_save(ordos_tool_t *tool, const char *path)
+{
+    size_t used = 0;
+    ESP_ERROR_CHECK(ordos_list(tool->ordos, ordos_tool_used_cb, &used));
+    if (used < ORDOS_DISK_SIZE)
+        ++used;
+    FILE *f = ordos_tool_open(path, "wb");
+    if (fwrite(tool->disk, used, 1, f) != 1) {
+        ESP_LOGE(TAG, "can't write %s", path);
+        exit(1);
+    }
+    fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        ordos_tool_usage(argv[0]);
+        return 1;
+    }
+    const char *image = argv[1];
+    const char *command = argv[2];
+    ordos_tool_t *tool = (ordos_tool_t *)calloc(1, sizeof(ordos_tool_t));
+    ESP_ERROR_CHECK(tool ? ESP_OK : ESP_ERR_NO_MEM);
+    ESP_ERROR_CHECK(ordos_create(&tool->ordos, tool->disk, ORDOS_DISK_SIZE));
+
+    if (!strcmp(command, "format")) {
+        ESP_ERROR_CHECK(ordos_format(tool->ordos));
+        ordos_tool_save(tool, image);
+        return 0;
+    }
+
+    FILE *f = ordos_tool_open(image, "rb");
+    size_t size = fread(tool->disk, 1, ORDOS_DISK_SIZE, f);
+    fclose(f);
+    if (size < ORDOS_DISK_SIZE)
+        tool->disk[size] = ORDOS_END_MARK;
+
+    if (!strcmp(command, "list")) {
+        ESP_ERROR_CHECK(ordos_list(tool->ordos, ordos_tool_list_cb, NULL));
+        size_t free_size;
+        ESP_ERROR_CHECK(ordos_get_free(tool->ordos, &free_size));
+        printf("%u bytes free\n", (unsigned)free_size);
+    }
+    else if (!strcmp(command, "export") && argc == 5) {
+        f = ordos_tool_open(argv[4], "wb");
+        ordos_tool_check(ordos_export(tool->ordos, argv[3], f), argv[3]);
+        fclose(f);
+    }
+    else if (!strcmp(command, "import") && (argc == 4 || argc == 5)) {
+        char name[ORDOS_NAME_SIZE + 1] = { 0 };
+        if (argc == 5)
+            strncpy(name, argv[4], ORDOS_NAME_SIZE);
+        f = ordos_tool_open(argv[3], "rb");
+        ordos_tool_check(ordos_import(tool->ordos, f, argc == 5 ? name : NULL), argv[3]);
+        fclose(f);
+        ordos_tool_save(tool, image);
+    }
+    else if (!strcmp(command, "delete") && argc == 4) {
+        ordos_tool_check(ordos_delete(tool->ordos, argv[3]), argv[3]);
+        ordos_tool_save(tool, image);
+    }
+    else {
+        ordos_tool_usage(argv[0]);
+        return 1;
+    }
+
+    ESP_ERROR_CHECK(ordos_done(tool->ordos));
+    free(tool);
+    return 0;
+}
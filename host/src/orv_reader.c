@@ -0,0 +1,86 @@
+/*
+ * This file is part of the esp32-orion128 distribution
+ * (https://gitlab.romanchenko.su/esp/esp32/esp32-orion128.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "orv_reader.h"
+
+static const char __attribute__((unused)) *TAG = "orv-reader";
+
+static void orv_reader_read(orv_reader_t *orv, void *data, size_t size)
+{
+    if (fread(data, size, 1, orv->f) != 1) {
+        ESP_LOGE(TAG, "unexpected end of the record");
+        exit(1);
+    }
+}
+
+static uint16_t orv_reader_word(orv_reader_t *orv)
+{
+    uint8_t data[2];
+    orv_reader_read(orv, data, sizeof(data));
+    return data[0] | (data[1] << 8);
+}
+
+bool orv_reader_open(orv_reader_t *orv, FILE *f)
+{
+    memset(orv, 0, sizeof(orv_reader_t));
+    orv->f = f;
+    uint8_t header[RECORDER_HEADER_SIZE];
+    if (fread(header, sizeof(header), 1, f) != 1)
+        return false;
+    uint16_t columns = header[4] | (header[5] << 8);
+    uint16_t rows = header[6] | (header[7] << 8);
+    if (memcmp(header, RECORDER_MAGIC, 4) || columns != RECORDER_COLUMNS || rows != RECORDER_ROWS)
+        return false;
+    orv->frame_cycles = header[8] | (header[9] << 8) | (header[10] << 16) | ((uint32_t)header[11] << 24);
+    return true;
+}
+
+bool orv_reader_frame(orv_reader_t *orv)
+{
+    uint8_t header[RECORDER_FRAME_HEADER_SIZE];
+    if (fread(header, sizeof(header), 1, orv->f) != 1)
+        return false;
+    orv->frame += header[0] | (header[1] << 8);
+    orv->port_f8 = header[2];
+    orv->port_fa = header[3];
+    while (1) {
+        uint16_t pos = orv_reader_word(orv);
+        if (pos == RECORDER_END)
+            break;
+        uint8_t length;
+        orv_reader_read(orv, &length, 1);
+        size_t count = length + 1;
+        size_t row = pos & 0xff;
+        if (row + count > RECORDER_ROWS || ((pos >> 8) & 0x3f) >= RECORDER_COLUMNS) {
+            ESP_LOGE(TAG, "bad run %04x in frame %u", pos, orv->frame);
+            exit(1);
+        }
+        uint8_t *dst = &orv->page[(pos & RECORDER_PAGE1) ? 1 : 0][pos & 0x3fff & ~RECORDER_PAGE1];
+        if (pos & RECORDER_FILL) {
+            uint8_t value;
+            orv_reader_read(orv, &value, 1);
+            memset(dst, value, count);
+        }
+        else
+            orv_reader_read(orv, dst, count);
+    }
+    return true;
+}
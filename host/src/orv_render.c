@@ -0,0 +1,97 @@
+/*
+ * This file is part of the esp32-orion128 distribution
+ * (https://gitlab.romanchenko.su/esp/esp32/esp32-orion128.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "esp_log.h"
+#include "orv_reader.h"
+#include "video.h"
+
+// Renders a video record of the emulator, see recorder.h, to a sequence of
+// PPM pictures, one per recorded frame:
+//   orv-render record.orv prefix
+// writes prefix-NNNNN.ppm numbered by the emulated frame, the frames
+// without changes are left out.
+
+#define ORV_RENDER_WIDTH (RECORDER_COLUMNS * 8)
+
+static const char __attribute__((unused)) *TAG = "orv-render";
+
+// the colors of the LCD palette, the light gray is black there too
+static const uint8_t orv_render_palette[VIDEO_PALETTE_SIZE][3] = {
+    { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x80 }, { 0x00, 0x80, 0x00 }, { 0x00, 0x80, 0x80 },
+    { 0x80, 0x00, 0x00 }, { 0x80, 0x00, 0x80 }, { 0x80, 0x80, 0x00 }, { 0x80, 0x80, 0x80 },
+    { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0xff }, { 0x00, 0xff, 0x00 }, { 0x00, 0xff, 0xff },
+    { 0xff, 0x00, 0x00 }, { 0xff, 0x00, 0xff }, { 0xff, 0xff, 0x00 }, { 0xff, 0xff, 0xff }
+};
+
+static void orv_render_save(orv_reader_t *orv, const char *prefix)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s-%05u.ppm", prefix, orv->frame);
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        ESP_LOGE(TAG, "can't create %s", path);
+        exit(1);
+    }
+    fprintf(f, "P6\n%d %d\n255\n", ORV_RENDER_WIDTH, RECORDER_ROWS);
+    uint8_t line[ORV_RENDER_WIDTH * 3];
+    for (size_t y = 0; y < RECORDER_ROWS; ++y) {
+        uint8_t *p = line;
+        for (size_t x = 0; x < RECORDER_COLUMNS; ++x) {
+            size_t ofs = (x << 8) | y;
+            uint32_t colors = video_get_colors(orv->page[0][ofs], orv->page[1][ofs], orv->port_f8);
+            for (size_t i = 0; i < 8; ++i) {
+                memcpy(p, orv_render_palette[colors & 0x0f], 3);
+                p += 3;
+                colors >>= 4;
+            }
+        }
+        fwrite(line, sizeof(line), 1, f);
+    }
+    fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s record.orv prefix\n", argv[0]);
+        return 1;
+    }
+    static orv_reader_t orv;
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) {
+        ESP_LOGE(TAG, "can't open %s", argv[1]);
+        return 1;
+    }
+    if (!orv_reader_open(&orv, f)) {
+        ESP_LOGE(TAG, "%s is not a video record", argv[1]);
+        return 1;
+    }
+
+    size_t pictures = 0;
+    while (orv_reader_frame(&orv)) {
+        orv_render_save(&orv, argv[2]);
+        ++pictures;
+    }
+    fclose(f);
+    printf("%u pictures, %u frames of %u cycles\n", (unsigned)pictures, orv.frame + 1, orv.frame_cycles);
+    return 0;
+}
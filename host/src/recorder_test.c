@@ -0,0 +1,150 @@
+/*
+ * This file is part of the esp32-orion128 distribution
+ * (https://gitlab.romanchenko.su/esp/esp32/esp32-orion128.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "memory.h"
+#include "recorder.h"
+#include "orv_reader.h"
+
+// Records the screen patterns the encoder finds hardest and checks that
+// the reader of orv-render gets every frame back:
+//   recorder-test
+
+#define RECORDER_TEST_FRAMES 10
+#define RECORDER_TEST_BASE 0xc000
+
+static const char __attribute__((unused)) *TAG = "recorder-test";
+
+typedef struct recorder_test_frame {
+    uint8_t page[2][RECORDER_PAGE_SIZE];
+    uint8_t port_f8;
+} recorder_test_frame_t;
+
+static uint8_t recorder_test_byte(size_t frame, size_t page, size_t x, size_t y)
+{
+    switch (frame) {
+        case 0:
+            // an odd byte and RECORDER_MIN_FILL equal ones, a literal and
+            // a fill run per 5 rows: the largest key frame
+            return y % 5 ? 0xaa + page : (uint8_t)(y + x);
+        case 1:
+            // the same shifted by a row, every byte changes
+            return (y + 1) % 5 ? 0xaa + page : (uint8_t)(y + x);
+        case 2:
+            return rand();
+        case 3:
+            // a change every RECORDER_GAP + 1 rows, a run per change
+        case 4:
+            return y % (RECORDER_GAP + 1) ? 0 : (uint8_t)(frame + x + y);
+        case 5:
+            // long fills and literals longer than a run holds
+            return y < 128 ? 0x11 : (uint8_t)(y * 7 + x);
+        case 6:
+            // pairs of equal bytes don't start a fill run
+            return (y / 2) & 1 ? 0x33 : 0x44;
+        case 7:
+            // no changes, only the palette port
+        case 8:
+            return (y / 2) & 1 ? 0x33 : 0x44;
+        default:
+            return 0;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static recorder_test_frame_t frames[RECORDER_TEST_FRAMES];
+    memory_t *mem;
+    recorder_t *rec;
+    ESP_ERROR_CHECK(memory_create(&mem));
+    ESP_ERROR_CHECK(recorder_create(&rec));
+    FILE *f = tmpfile();
+    if (!f) {
+        ESP_LOGE(TAG, "can't create a temporary file");
+        return 1;
+    }
+    // RECORDER_TEST_BASE is shown with port 0xFA 0
+    mem->port_fa = 0;
+    ESP_ERROR_CHECK(recorder_start(rec, f, 0));
+
+    int errors = 0;
+    for (size_t i = 0; i < RECORDER_TEST_FRAMES; ++i) {
+        recorder_test_frame_t *frame = &frames[i];
+        for (size_t page = 0; page < 2; ++page)
+            for (size_t x = 0; x < RECORDER_COLUMNS; ++x)
+                for (size_t y = 0; y < RECORDER_ROWS; ++y) {
+                    uint8_t value = recorder_test_byte(i, page, x, y);
+                    frame->page[page][(x << 8) | y] = value;
+                    mem->ram_page[page][RECORDER_TEST_BASE | (x << 8) | y] = value;
+                }
+        frame->port_f8 = i >= 8 ? 0x5 : 0;
+        mem->port_f8 = frame->port_f8;
+        uint64_t pushed = rec->pushed;
+        ESP_ERROR_CHECK(recorder_step(rec, mem, (uint64_t)i * RECORDER_FRAME_CYCLES));
+        if (rec->pushed - pushed > RECORDER_MAX_FRAME_SIZE) {
+            ESP_LOGE(TAG, "frame %u: %u bytes, RECORDER_MAX_FRAME_SIZE is %u", (unsigned)i,
+                (unsigned)(rec->pushed - pushed), (unsigned)RECORDER_MAX_FRAME_SIZE);
+            ++errors;
+        }
+        printf("frame %u: %u bytes\n", (unsigned)i, (unsigned)(rec->pushed - pushed));
+        // a drop would only hide the frame
+        while (rec->written != rec->pushed)
+            vTaskDelay(1);
+    }
+    ESP_ERROR_CHECK(recorder_stop(rec));
+    if (rec->dropped) {
+        ESP_LOGE(TAG, "%u frames dropped", rec->dropped);
+        ++errors;
+    }
+
+    static orv_reader_t orv;
+    rewind(f);
+    if (!orv_reader_open(&orv, f)) {
+        ESP_LOGE(TAG, "bad record header");
+        return 1;
+    }
+    size_t decoded = 0;
+    while (orv_reader_frame(&orv)) {
+        if (orv.frame >= RECORDER_TEST_FRAMES) {
+            ESP_LOGE(TAG, "frame %u is out of the record", orv.frame);
+            ++errors;
+            break;
+        }
+        const recorder_test_frame_t *frame = &frames[orv.frame];
+        if (memcmp(orv.page, frame->page, sizeof(orv.page)) || orv.port_f8 != frame->port_f8) {
+            ESP_LOGE(TAG, "frame %u differs", orv.frame);
+            ++errors;
+        }
+        ++decoded;
+    }
+    // frame 7 has no changes, its time goes to frame 8
+    if (decoded != RECORDER_TEST_FRAMES - 1) {
+        ESP_LOGE(TAG, "%u frames decoded", (unsigned)decoded);
+        ++errors;
+    }
+    fclose(f);
+    ESP_ERROR_CHECK(recorder_done(rec));
+    ESP_ERROR_CHECK(memory_done(mem));
+    printf("%s\n", errors ? "FAILED" : "OK");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,228 @@
+/*
+ * This file is part of the esp32-orion128 distribution
+ * (https://gitlab.romanchenko.su/esp/esp32/esp32-orion128.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "ring.h"
+
+#define RING_BENCH_LENGTH 0x1000
+#define RING_BENCH_BATCH 64
+
+typedef struct ring_bench {
+    ring_t *ring;
+    QueueHandle_t queue;
+    uint32_t items;
+    bool is_batch;
+    unsigned seed;
+} ring_bench_t;
+
+static const char __attribute__((unused)) *TAG = "ring-bench";
+
+static size_t ring_bench_random_batch(unsigned *seed)
+{
+    return 1 + rand_r(seed) % RING_BENCH_BATCH;
+}
+
+static void *ring_bench_producer(void *arg)
+{
+    ring_bench_t *bench = (ring_bench_t *)arg;
+    uint32_t batch[RING_BENCH_BATCH];
+    uint32_t seq = 0;
+    while (seq < bench->items) {
+        size_t count = bench->is_batch ? ring_bench_random_batch(&bench->seed) : 1;
+        if (count > bench->items - seq)
+            count = bench->items - seq;
+        for (size_t i = 0; i < count; ++i)
+            batch[i] = seq + i;
+        size_t done = 0;
+        while (done < count) {
+            size_t n = ring_push(bench->ring, &batch[done], count - done);
+            if (!n)
+                sched_yield();
+            done += n;
+        }
+        seq += count;
+    }
+    return NULL;
+}
+
+static void *ring_bench_queue_producer(void *arg)
+{
+    ring_bench_t *bench = (ring_bench_t *)arg;
+    for (uint32_t seq = 0; seq < bench->items; ++seq)
+        xQueueSend(bench->queue, &seq, portMAX_DELAY);
+    return NULL;
+}
+
+// Random sized batches from both sides, every item must come out once and
+// in order. A lost or reordered item aborts the run.
+static bool ring_bench_stress(uint32_t items, size_t length)
+{
+    ring_bench_t bench = {
+        items: items,
+        is_batch: true,
+        seed: 1
+    };
+    ESP_ERROR_CHECK(ring_create(&bench.ring, length, sizeof(uint32_t)));
+
+    pthread_t producer;
+    pthread_create(&producer, NULL, ring_bench_producer, &bench);
+
+    unsigned seed = 2;
+    uint32_t batch[RING_BENCH_BATCH];
+    uint32_t expected = 0;
+    bool ok = true;
+    while (ok && expected < items) {
+        size_t count = ring_pop(bench.ring, batch, ring_bench_random_batch(&seed));
+        if (!count)
+            sched_yield();
+        for (size_t i = 0; i < count; ++i, ++expected) {
+            if (batch[i] != expected) {
+                fprintf(stderr, "stress: got %u, expected %u\n", batch[i], expected);
+                ok = false;
+                break;
+            }
+        }
+    }
+    pthread_join(producer, NULL);
+
+    if (ok && ring_count(bench.ring)) {
+        fprintf(stderr, "stress: %u items left\n", (unsigned)ring_count(bench.ring));
+        ok = false;
+    }
+    if (ok && ring_get_dropped(bench.ring)) {
+        fprintf(stderr, "stress: %u items dropped\n", (unsigned)ring_get_dropped(bench.ring));
+        ok = false;
+    }
+    ESP_ERROR_CHECK(ring_done(bench.ring));
+    printf("stress: %u items, ring of %u: %s\n", items, (unsigned)length, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// A full ring must keep the old items, the lossy push counts the new ones
+// as dropped.
+static bool ring_bench_overflow(void)
+{
+    ring_t *ring;
+    ESP_ERROR_CHECK(ring_create(&ring, 8, sizeof(uint32_t)));
+    uint32_t items[12];
+    for (uint32_t i = 0; i < 12; ++i)
+        items[i] = i;
+    bool ok = ring_push_lossy(ring, items, 12) == 8 && ring_get_dropped(ring) == 4;
+    ok = ok && ring_push(ring, items, 1) == 0 && ring_get_dropped(ring) == 4;
+    ok = ok && ring_pop(ring, items, 12) == 8 && items[0] == 0 && items[7] == 7;
+    ok = ok && ring_pop(ring, items, 1) == 0;
+    ESP_ERROR_CHECK(ring_done(ring));
+    printf("overflow: %s\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static double ring_bench_ring(uint32_t items, bool is_batch)
+{
+    ring_bench_t bench = {
+        items: items,
+        is_batch: is_batch,
+        seed: 1
+    };
+    ESP_ERROR_CHECK(ring_create(&bench.ring, RING_BENCH_LENGTH, sizeof(uint32_t)));
+
+    int64_t start = esp_timer_get_time();
+    pthread_t producer;
+    pthread_create(&producer, NULL, ring_bench_producer, &bench);
+    uint32_t batch[RING_BENCH_BATCH];
+    uint32_t received = 0;
+    while (received < items) {
+        size_t count = ring_pop(bench.ring, batch, is_batch ? RING_BENCH_BATCH : 1);
+        if (!count)
+            sched_yield();
+        received += count;
+    }
+    pthread_join(producer, NULL);
+    int64_t time = esp_timer_get_time() - start;
+
+    ESP_ERROR_CHECK(ring_done(bench.ring));
+    return (double)items / time;
+}
+
+static double ring_bench_queue(uint32_t items)
+{
+    ring_bench_t bench = {
+        items: items
+    };
+    bench.queue = xQueueCreate(RING_BENCH_LENGTH, sizeof(uint32_t));
+    ESP_ERROR_CHECK(bench.queue ? ESP_OK : ESP_ERR_NO_MEM);
+
+    int64_t start = esp_timer_get_time();
+    pthread_t producer;
+    pthread_create(&producer, NULL, ring_bench_queue_producer, &bench);
+    uint32_t item;
+    for (uint32_t received = 0; received < items; ++received)
+        xQueueReceive(bench.queue, &item, portMAX_DELAY);
+    pthread_join(producer, NULL);
+    int64_t time = esp_timer_get_time() - start;
+
+    vQueueDelete(bench.queue);
+    return (double)items / time;
+}
+
+static void ring_bench_usage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -n items    items per run (4000000)\n"
+        "  -s          stress runs only\n",
+        name);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t items = 4000000;
+    bool is_throughput = true;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:sh")) != -1) {
+        switch (opt) {
+            case 'n': items = strtoul(optarg, NULL, 0); break;
+            case 's': is_throughput = false; break;
+            default:
+                ring_bench_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    bool ok = ring_bench_overflow();
+    ok = ring_bench_stress(items, 2) && ok;
+    ok = ring_bench_stress(items, 64) && ok;
+    ok = ring_bench_stress(items, RING_BENCH_LENGTH) && ok;
+    if (!ok)
+        return 1;
+
+    if (is_throughput) {
+        printf("xQueue:        %8.2f Mitems/s\n", ring_bench_queue(items));
+        printf("ring, single:  %8.2f Mitems/s\n", ring_bench_ring(items, false));
+        printf("ring, batches: %8.2f Mitems/s\n", ring_bench_ring(items, true));
+    }
+    return 0;
+}
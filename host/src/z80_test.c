@@ -0,0 +1,526 @@
+/*
+ * This file is part of the esp32-orion128 distribution
+ * (https://gitlab.romanchenko.su/esp/esp32/esp32-orion128.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "cpu.h"
+
+// Runs short instruction sequences on the Z80 core and checks the
+// registers, the flags with the undocumented X and Y bits, the memory and
+// the T states against the values worked out by hand. Then sweeps the
+// flag setting instructions over all their operands against a reference
+// model written here from the documented behaviour, the undocumented
+// flags as the FUSE emulator has them:
+//   z80-test
+
+#define Z80_TEST_RAM_SIZE 0x10000
+#define Z80_TEST_DATA 0x8000
+#define Z80_TEST_DATA_SIZE 16
+// mismatches logged per sweep
+#define Z80_TEST_SWEEP_LOG 4
+#define Z80_TEST_SWEEP_PAIRS 200000
+
+#define Z80_TEST_C 0x01
+#define Z80_TEST_N 0x02
+#define Z80_TEST_P 0x04
+#define Z80_TEST_H 0x10
+#define Z80_TEST_Z 0x40
+#define Z80_TEST_S 0x80
+#define Z80_TEST_XY 0x28
+
+typedef struct z80_test_regs {
+    uint16_t af;
+    uint16_t bc;
+    uint16_t de;
+    uint16_t hl;
+    uint16_t ix;
+    uint16_t iy;
+} z80_test_regs_t;
+
+typedef struct z80_test_case {
+    const char *name;
+    uint8_t code[8];
+    uint8_t steps;
+    z80_test_regs_t in;
+    z80_test_regs_t out;
+    uint16_t pc;
+    uint8_t cycles;
+    // at Z80_TEST_DATA before and after
+    uint8_t data[Z80_TEST_DATA_SIZE];
+    uint8_t data_out[Z80_TEST_DATA_SIZE];
+} z80_test_case_t;
+
+static const char __attribute__((unused)) *TAG = "z80-test";
+
+static const z80_test_case_t z80_test_cases[] = {
+    { name: "ADD A,B overflow", code: { 0x80 }, steps: 1,
+        in: { af: 0x7f00, bc: 0x0100 }, out: { af: 0x8094, bc: 0x0100 }, pc: 1, cycles: 4 },
+    { name: "SUB B borrow", code: { 0x90 }, steps: 1,
+        in: { af: 0x0000, bc: 0x0100 }, out: { af: 0xffbb, bc: 0x0100 }, pc: 1, cycles: 4 },
+    { name: "ADD A,B; DAA", code: { 0x80, 0x27 }, steps: 2,
+        in: { af: 0x1500, bc: 0x2700 }, out: { af: 0x4214, bc: 0x2700 }, pc: 2, cycles: 8 },
+    { name: "INC A keeps C", code: { 0x3c }, steps: 1,
+        in: { af: 0x7f01 }, out: { af: 0x8095 }, pc: 1, cycles: 4 },
+    { name: "NEG 0x80", code: { 0xed, 0x44 }, steps: 1,
+        in: { af: 0x8000 }, out: { af: 0x8087 }, pc: 2, cycles: 8 },
+    { name: "SBC HL,DE", code: { 0xed, 0x52 }, steps: 1,
+        in: { af: 0x0001, de: 0x0001, hl: 0x8000 }, out: { af: 0x003e, de: 0x0001, hl: 0x7ffe }, pc: 2, cycles: 15 },
+    { name: "ADC HL,BC carry", code: { 0xed, 0x4a }, steps: 1,
+        in: { af: 0x0001, hl: 0xffff }, out: { af: 0x0051, hl: 0x0000 }, pc: 2, cycles: 15 },
+    { name: "RLD", code: { 0xed, 0x6f }, steps: 1,
+        in: { af: 0x1200, hl: 0x8000 }, out: { af: 0x1300, hl: 0x8000 }, pc: 2, cycles: 18,
+        data: { 0x34 }, data_out: { 0x42 } },
+    { name: "SLL B", code: { 0xcb, 0x30 }, steps: 1,
+        in: { bc: 0x8000 }, out: { af: 0x0001, bc: 0x0100 }, pc: 2, cycles: 8 },
+    { name: "DJNZ", code: { 0x10, 0xfe }, steps: 2,
+        in: { bc: 0x0200 }, out: { bc: 0x0000 }, pc: 2, cycles: 21 },
+    { name: "LDIR", code: { 0xed, 0xb0 }, steps: 3,
+        in: { bc: 0x0003, de: 0x8008, hl: 0x8000 }, out: { af: 0x0020, bc: 0x0000, de: 0x800b, hl: 0x8003 },
+        pc: 2, cycles: 58,
+        data: { 0x11, 0x22, 0x33 }, data_out: { 0x11, 0x22, 0x33, 0, 0, 0, 0, 0, 0x11, 0x22, 0x33 } },
+    { name: "CPIR found", code: { 0xed, 0xb1 }, steps: 3,
+        in: { af: 0x3300, bc: 0x0005, hl: 0x8000 }, out: { af: 0x3346, bc: 0x0002, hl: 0x8003 }, pc: 2, cycles: 58,
+        data: { 0x11, 0x22, 0x33 }, data_out: { 0x11, 0x22, 0x33 } },
+    { name: "LD A,(IX+5)", code: { 0xdd, 0x7e, 0x05 }, steps: 1,
+        in: { ix: 0x8000 }, out: { af: 0x5a00, ix: 0x8000 }, pc: 3, cycles: 19,
+        data: { [5] = 0x5a }, data_out: { [5] = 0x5a } },
+    { name: "LD (IY-2),n", code: { 0xfd, 0x36, 0xfe, 0x77 }, steps: 1,
+        in: { iy: 0x8002 }, out: { iy: 0x8002 }, pc: 4, cycles: 19,
+        data_out: { 0x77 } },
+    { name: "LD IXH,n; ADD A,IXL", code: { 0xdd, 0x26, 0x12, 0xdd, 0x85 }, steps: 2,
+        in: { af: 0x0100, ix: 0x0034 }, out: { af: 0x3520, ix: 0x1234 }, pc: 5, cycles: 19 },
+    { name: "ADD IX,BC", code: { 0xdd, 0x09 }, steps: 1,
+        in: { bc: 0x0001, ix: 0x0fff }, out: { af: 0x0010, bc: 0x0001, ix: 0x1000 }, pc: 2, cycles: 15 },
+    { name: "RLC (IX+1)", code: { 0xdd, 0xcb, 0x01, 0x06 }, steps: 1,
+        in: { ix: 0x8000 }, out: { af: 0x0005, ix: 0x8000 }, pc: 4, cycles: 23,
+        data: { 0, 0x81 }, data_out: { 0, 0x03 } },
+    { name: "RLC (IX+1),B", code: { 0xdd, 0xcb, 0x01, 0x00 }, steps: 1,
+        in: { ix: 0x8000 }, out: { af: 0x0005, bc: 0x0300, ix: 0x8000 }, pc: 4, cycles: 23,
+        data: { 0, 0x81 }, data_out: { 0, 0x03 } },
+    { name: "BIT 7,(IX+0)", code: { 0xdd, 0xcb, 0x00, 0x7e }, steps: 1,
+        in: { af: 0x0001, ix: 0x8000 }, out: { af: 0x0091, ix: 0x8000 }, pc: 4, cycles: 20,
+        data: { 0x80 }, data_out: { 0x80 } },
+};
+
+#define Z80_TEST_CASES (sizeof(z80_test_cases) / sizeof(z80_test_cases[0]))
+
+static const uint8_t *z80_test_reader(uint16_t addr, void *arg)
+{
+    return &((uint8_t *)arg)[addr];
+}
+
+static uint8_t *z80_test_writer(uint16_t addr, void *arg)
+{
+    return &((uint8_t *)arg)[addr];
+}
+
+static void z80_test_set(cpu_t *cpu, const z80_test_regs_t *regs)
+{
+    cpu->reg_file[CPU_FILE_A] = regs->af >> 8;
+    cpu->reg_file[CPU_FLAGS] = regs->af & 0xff;
+    CPU_BC_VAL(cpu) = regs->bc;
+    CPU_DE_VAL(cpu) = regs->de;
+    CPU_HL_VAL(cpu) = regs->hl;
+    cpu->ix = regs->ix;
+    cpu->iy = regs->iy;
+}
+
+static void z80_test_get(const cpu_t *cpu, z80_test_regs_t *regs)
+{
+    regs->af = cpu->reg_file[CPU_FILE_A] << 8 | cpu->reg_file[CPU_FLAGS];
+    regs->bc = CPU_BC_VAL(cpu);
+    regs->de = CPU_DE_VAL(cpu);
+    regs->hl = CPU_HL_VAL(cpu);
+    regs->ix = cpu->ix;
+    regs->iy = cpu->iy;
+}
+
+static size_t z80_test_run(cpu_t *cpu, const z80_test_case_t *test)
+{
+    uint8_t *ram = (uint8_t *)cpu->memory;
+    memset(ram, 0, Z80_TEST_RAM_SIZE);
+    memcpy(ram, test->code, sizeof(test->code));
+    memcpy(&ram[Z80_TEST_DATA], test->data, Z80_TEST_DATA_SIZE);
+    ESP_ERROR_CHECK(cpu_reset(cpu));
+    z80_test_set(cpu, &test->in);
+    cpu->sp = 0xfff0;
+#ifdef CPU_CYCLES_ENABLE
+    uint64_t cycles = cpu->cycles;
+#endif
+    for (size_t i = 0; i < test->steps; ++i)
+        ESP_ERROR_CHECK(cpu_step(cpu));
+
+    size_t errors = 0;
+    z80_test_regs_t out;
+    z80_test_get(cpu, &out);
+    if (memcmp(&out, &test->out, sizeof(out))) {
+        ESP_LOGE(TAG, "%s: AF %04x BC %04x DE %04x HL %04x IX %04x IY %04x, expected %04x %04x %04x %04x %04x %04x",
+            test->name, out.af, out.bc, out.de, out.hl, out.ix, out.iy,
+            test->out.af, test->out.bc, test->out.de, test->out.hl, test->out.ix, test->out.iy);
+        ++errors;
+    }
+    if (cpu->pc != test->pc) {
+        ESP_LOGE(TAG, "%s: PC %04x, expected %04x", test->name, cpu->pc, test->pc);
+        ++errors;
+    }
+#ifdef CPU_CYCLES_ENABLE
+    if (cpu->cycles - cycles != test->cycles) {
+        ESP_LOGE(TAG, "%s: %u T states, expected %u", test->name, (unsigned)(cpu->cycles - cycles), test->cycles);
+        ++errors;
+    }
+#endif
+    if (memcmp(&ram[Z80_TEST_DATA], test->data_out, Z80_TEST_DATA_SIZE)) {
+        ESP_LOGE(TAG, "%s: memory differs", test->name);
+        ++errors;
+    }
+    return errors;
+}
+
+// Sign, zero, X, Y and parity of a result
+static uint8_t z80_test_szxyp(uint8_t r)
+{
+    uint8_t f = (r & (Z80_TEST_S | Z80_TEST_XY)) | (r ? 0 : Z80_TEST_Z);
+    return __builtin_parity(r) ? f : f | Z80_TEST_P;
+}
+
+static uint8_t z80_test_add(uint8_t a, uint8_t b, int c, uint8_t *pf)
+{
+    unsigned r = a + b + c;
+    uint8_t f = (r & (Z80_TEST_S | Z80_TEST_XY)) | ((uint8_t)r ? 0 : Z80_TEST_Z) | ((a ^ b ^ r) & Z80_TEST_H);
+    if ((a ^ ~b) & (a ^ r) & 0x80)
+        f |= Z80_TEST_P;
+    *pf = r > 0xff ? f | Z80_TEST_C : f;
+    return r;
+}
+
+static uint8_t z80_test_sub(uint8_t a, uint8_t b, int c, uint8_t *pf)
+{
+    int r = a - b - c;
+    uint8_t f = (r & (Z80_TEST_S | Z80_TEST_XY)) | ((uint8_t)r ? 0 : Z80_TEST_Z) | ((a ^ b ^ r) & Z80_TEST_H)
+        | Z80_TEST_N;
+    if ((a ^ b) & (a ^ r) & 0x80)
+        f |= Z80_TEST_P;
+    *pf = r < 0 ? f | Z80_TEST_C : f;
+    return r;
+}
+
+// ADD, ADC, SUB, SBC, AND, XOR, OR and CP by the bits 3-5 of the opcode
+static uint8_t z80_test_alu(uint8_t op, uint8_t a, uint8_t b, uint8_t f, uint8_t *pf)
+{
+    int c = f & Z80_TEST_C;
+    uint8_t r;
+    switch (op) {
+        case 0: return z80_test_add(a, b, 0, pf);
+        case 1: return z80_test_add(a, b, c, pf);
+        case 2: return z80_test_sub(a, b, 0, pf);
+        case 3: return z80_test_sub(a, b, c, pf);
+        case 4: r = a & b; *pf = z80_test_szxyp(r) | Z80_TEST_H; return r;
+        case 5: r = a ^ b; *pf = z80_test_szxyp(r); return r;
+        case 6: r = a | b; *pf = z80_test_szxyp(r); return r;
+        default:
+            // X and Y of the operand
+            z80_test_sub(a, b, 0, pf);
+            *pf = (*pf & ~Z80_TEST_XY) | (b & Z80_TEST_XY);
+            return a;
+    }
+}
+
+static uint8_t z80_test_daa(uint8_t a, uint8_t f, uint8_t *pf)
+{
+    uint8_t add = 0;
+    uint8_t c = f & Z80_TEST_C;
+    uint8_t h;
+    if ((f & Z80_TEST_H) || (a & 0x0f) > 9)
+        add = 0x06;
+    if (c || a > 0x99) {
+        add |= 0x60;
+        c = Z80_TEST_C;
+    }
+    if (f & Z80_TEST_N)
+        h = (f & Z80_TEST_H) && (a & 0x0f) < 6 ? Z80_TEST_H : 0;
+    else
+        h = (a & 0x0f) > 9 ? Z80_TEST_H : 0;
+    uint8_t r = f & Z80_TEST_N ? a - add : a + add;
+    *pf = z80_test_szxyp(r) | (f & Z80_TEST_N) | h | c;
+    return r;
+}
+
+// RLC, RRC, RL, RR, SLA, SRA, SLL and SRL by the bits 3-5 of the opcode
+static uint8_t z80_test_shift(uint8_t op, uint8_t v, uint8_t f, uint8_t *pf)
+{
+    int c = f & Z80_TEST_C;
+    uint8_t r;
+    switch (op) {
+        case 0: r = v << 1 | v >> 7; c = v >> 7; break;
+        case 1: r = v >> 1 | v << 7; c = v & 1; break;
+        case 2: r = v << 1 | c; c = v >> 7; break;
+        case 3: r = v >> 1 | c << 7; c = v & 1; break;
+        case 4: r = v << 1; c = v >> 7; break;
+        case 5: r = v >> 1 | (v & 0x80); c = v & 1; break;
+        case 6: r = v << 1 | 1; c = v >> 7; break;
+        default: r = v >> 1; c = v & 1; break;
+    }
+    *pf = z80_test_szxyp(r) | c;
+    return r;
+}
+
+// RLCA, RRCA, RLA, RRA, DAA, CPL, SCF and CCF by the bits 3-5 of the opcode
+static uint8_t z80_test_acc(uint8_t op, uint8_t a, uint8_t f, uint8_t *pf)
+{
+    uint8_t keep = f & (Z80_TEST_S | Z80_TEST_Z | Z80_TEST_P);
+    int c = f & Z80_TEST_C;
+    uint8_t r = a;
+    switch (op) {
+        case 0: r = a << 1 | a >> 7; c = a >> 7; break;
+        case 1: r = a >> 1 | a << 7; c = a & 1; break;
+        case 2: r = a << 1 | c; c = a >> 7; break;
+        case 3: r = a >> 1 | c << 7; c = a & 1; break;
+        case 4: return z80_test_daa(a, f, pf);
+        case 5:
+            r = ~a;
+            *pf = keep | (f & Z80_TEST_C) | (r & Z80_TEST_XY) | Z80_TEST_H | Z80_TEST_N;
+            return r;
+        case 6: c = 1; break;
+        default:
+            *pf = keep | (a & Z80_TEST_XY) | (c ? Z80_TEST_H : Z80_TEST_C);
+            return a;
+    }
+    *pf = keep | (r & Z80_TEST_XY) | c;
+    return r;
+}
+
+static uint16_t z80_test_add16(int op, uint16_t hl, uint16_t rr, uint8_t f, uint8_t *pf)
+{
+    int c = op ? f & Z80_TEST_C : 0;
+    int r = op == 2 ? hl - rr - c : hl + rr + c;
+    uint8_t hi = r >> 8;
+    uint8_t h = ((hl ^ rr ^ r) >> 8) & Z80_TEST_H;
+    uint8_t carry = r < 0 || r > 0xffff ? Z80_TEST_C : 0;
+    if (!op) {
+        *pf = (f & (Z80_TEST_S | Z80_TEST_Z | Z80_TEST_P)) | (hi & Z80_TEST_XY) | h | carry;
+        return r;
+    }
+    bool v = op == 1 ? (hl ^ ~rr) & (hl ^ r) & 0x8000 : (hl ^ rr) & (hl ^ r) & 0x8000;
+    *pf = (hi & (Z80_TEST_S | Z80_TEST_XY)) | ((uint16_t)r ? 0 : Z80_TEST_Z) | h | (v ? Z80_TEST_P : 0)
+        | (op == 2 ? Z80_TEST_N : 0) | carry;
+    return r;
+}
+
+typedef struct z80_test_sweep {
+    const char *name;
+    uint32_t runs;
+    uint32_t errors;
+} z80_test_sweep_t;
+
+// One instruction at 0x0000 from the given registers, PC and the rest of
+// the state are left from the previous run
+static void z80_test_step(cpu_t *cpu, const uint8_t *code, size_t size, const z80_test_regs_t *in, z80_test_regs_t *out)
+{
+    memcpy(cpu->memory, code, size);
+    z80_test_set(cpu, in);
+    cpu->pc = 0;
+    ESP_ERROR_CHECK(cpu_step(cpu));
+    z80_test_get(cpu, out);
+}
+
+static void z80_test_check(z80_test_sweep_t *sweep, const uint8_t *code, const z80_test_regs_t *in,
+        const z80_test_regs_t *out, const z80_test_regs_t *expected)
+{
+    ++sweep->runs;
+    if (!memcmp(out, expected, sizeof(z80_test_regs_t)))
+        return;
+    if (sweep->errors++ < Z80_TEST_SWEEP_LOG)
+        ESP_LOGE(TAG, "%s %02x %02x: AF %04x BC %04x HL %04x -> AF %04x BC %04x HL %04x, expected %04x %04x %04x",
+            sweep->name, code[0], code[1], in->af, in->bc, in->hl, out->af, out->bc, out->hl,
+            expected->af, expected->bc, expected->hl);
+}
+
+static size_t z80_test_sweep_done(z80_test_sweep_t *sweep)
+{
+    printf("%-14s %8u runs: %s\n", sweep->name, sweep->runs, sweep->errors ? "FAILED" : "OK");
+    return sweep->errors;
+}
+
+static const uint8_t z80_test_flags[] = { 0x00, 0xff };
+
+// <alu> A,B for all A, B and carry
+static size_t z80_test_sweep_alu(cpu_t *cpu)
+{
+    z80_test_sweep_t sweep = { name: "alu a,b" };
+    for (uint8_t op = 0; op < 8; ++op) {
+        uint8_t code[2] = { 0x80 | op << 3 };
+        for (size_t i = 0; i < sizeof(z80_test_flags); ++i) {
+            for (unsigned a = 0; a < 0x100; ++a) {
+                for (unsigned b = 0; b < 0x100; ++b) {
+                    z80_test_regs_t in = { af: a << 8 | z80_test_flags[i], bc: b << 8 };
+                    z80_test_regs_t out;
+                    z80_test_regs_t expected = in;
+                    uint8_t f;
+                    uint8_t r = z80_test_alu(op, a, b, z80_test_flags[i], &f);
+                    expected.af = r << 8 | f;
+                    z80_test_step(cpu, code, 1, &in, &out);
+                    z80_test_check(&sweep, code, &in, &out, &expected);
+                }
+            }
+        }
+    }
+    return z80_test_sweep_done(&sweep);
+}
+
+// INC B, DEC B and NEG for all values, the carry kept by INC and DEC
+static size_t z80_test_sweep_unary(cpu_t *cpu)
+{
+    z80_test_sweep_t sweep = { name: "inc dec neg" };
+    for (size_t i = 0; i < sizeof(z80_test_flags); ++i) {
+        uint8_t fin = z80_test_flags[i];
+        for (unsigned v = 0; v < 0x100; ++v) {
+            z80_test_regs_t in = { af: fin, bc: v << 8 };
+            z80_test_regs_t out;
+            z80_test_regs_t expected = in;
+            uint8_t f;
+            uint8_t r = z80_test_add(v, 1, 0, &f);
+            expected.af = (f & ~Z80_TEST_C) | (fin & Z80_TEST_C);
+            expected.bc = r << 8;
+            uint8_t inc[2] = { 0x04 };
+            z80_test_step(cpu, inc, 1, &in, &out);
+            z80_test_check(&sweep, inc, &in, &out, &expected);
+
+            r = z80_test_sub(v, 1, 0, &f);
+            expected.af = (f & ~Z80_TEST_C) | (fin & Z80_TEST_C);
+            expected.bc = r << 8;
+            uint8_t dec[2] = { 0x05 };
+            z80_test_step(cpu, dec, 1, &in, &out);
+            z80_test_check(&sweep, dec, &in, &out, &expected);
+
+            in.af = v << 8 | fin;
+            in.bc = 0;
+            expected.bc = 0;
+            r = z80_test_sub(0, v, 0, &f);
+            expected.af = r << 8 | f;
+            uint8_t neg[2] = { 0xed, 0x44 };
+            z80_test_step(cpu, neg, 2, &in, &out);
+            z80_test_check(&sweep, neg, &in, &out, &expected);
+        }
+    }
+    return z80_test_sweep_done(&sweep);
+}
+
+// RLCA, RRCA, RLA, RRA, DAA, CPL, SCF and CCF for all A and F
+static size_t z80_test_sweep_acc(cpu_t *cpu)
+{
+    z80_test_sweep_t sweep = { name: "acc" };
+    for (uint8_t op = 0; op < 8; ++op) {
+        uint8_t code[2] = { 0x07 | op << 3 };
+        for (unsigned af = 0; af < 0x10000; ++af) {
+            z80_test_regs_t in = { af: af };
+            z80_test_regs_t out;
+            z80_test_regs_t expected = in;
+            uint8_t f;
+            uint8_t r = z80_test_acc(op, af >> 8, af & 0xff, &f);
+            expected.af = r << 8 | f;
+            z80_test_step(cpu, code, 1, &in, &out);
+            z80_test_check(&sweep, code, &in, &out, &expected);
+        }
+    }
+    return z80_test_sweep_done(&sweep);
+}
+
+// CB shifts and BIT n of B for all values, X and Y of BIT from the operand
+static size_t z80_test_sweep_cb(cpu_t *cpu)
+{
+    z80_test_sweep_t sweep = { name: "cb shift bit" };
+    for (uint8_t op = 0; op < 16; ++op) {
+        uint8_t code[2] = { 0xcb, op < 8 ? op << 3 : 0x40 | (op - 8) << 3 };
+        for (size_t i = 0; i < sizeof(z80_test_flags); ++i) {
+            uint8_t fin = z80_test_flags[i];
+            for (unsigned v = 0; v < 0x100; ++v) {
+                z80_test_regs_t in = { af: fin, bc: v << 8 };
+                z80_test_regs_t out;
+                z80_test_regs_t expected = in;
+                uint8_t f;
+                if (op < 8) {
+                    expected.bc = z80_test_shift(op, v, fin, &f) << 8;
+                }
+                else {
+                    uint8_t bit = v & 1 << (op - 8);
+                    f = (bit & Z80_TEST_S) | (v & Z80_TEST_XY) | Z80_TEST_H | (fin & Z80_TEST_C);
+                    if (!bit)
+                        f |= Z80_TEST_Z | Z80_TEST_P;
+                }
+                expected.af = f;
+                z80_test_step(cpu, code, 2, &in, &out);
+                z80_test_check(&sweep, code, &in, &out, &expected);
+            }
+        }
+    }
+    return z80_test_sweep_done(&sweep);
+}
+
+// ADD HL,BC, ADC HL,BC and SBC HL,BC over the edge values and random pairs
+static size_t z80_test_sweep_add16(cpu_t *cpu)
+{
+    static const uint16_t edges[] = { 0x0000, 0x0001, 0x0fff, 0x1000, 0x7fff, 0x8000, 0x8001, 0xffff };
+    static const uint8_t codes[3][2] = { { 0x09 }, { 0xed, 0x4a }, { 0xed, 0x42 } };
+    z80_test_sweep_t sweep = { name: "add16" };
+    unsigned seed = 1;
+    for (int op = 0; op < 3; ++op) {
+        size_t size = op ? 2 : 1;
+        for (size_t n = 0; n < Z80_TEST_SWEEP_PAIRS + 64; ++n) {
+            uint16_t hl = n < 64 ? edges[n & 7] : rand_r(&seed);
+            uint16_t bc = n < 64 ? edges[n >> 3] : rand_r(&seed);
+            for (size_t i = 0; i < sizeof(z80_test_flags); ++i) {
+                z80_test_regs_t in = { af: 0x5a00 | z80_test_flags[i], bc: bc, hl: hl };
+                z80_test_regs_t out;
+                z80_test_regs_t expected = in;
+                uint8_t f;
+                expected.hl = z80_test_add16(op, hl, bc, z80_test_flags[i], &f);
+                expected.af = 0x5a00 | f;
+                z80_test_step(cpu, codes[op], size, &in, &out);
+                z80_test_check(&sweep, codes[op], &in, &out, &expected);
+            }
+        }
+    }
+    return z80_test_sweep_done(&sweep);
+}
+
+int main(int argc, char **argv)
+{
+    cpu_t *cpu;
+    ESP_ERROR_CHECK(cpu_create(&cpu));
+    cpu->type = CPU_TYPE_Z80;
+    cpu->reader = z80_test_reader;
+    cpu->writer = z80_test_writer;
+    cpu->memory = malloc(Z80_TEST_RAM_SIZE);
+    ESP_ERROR_CHECK(cpu->memory ? ESP_OK : ESP_ERR_NO_MEM);
+    ESP_ERROR_CHECK(cpu_init(cpu));
+
+    size_t errors = 0;
+    for (size_t i = 0; i < Z80_TEST_CASES; ++i)
+        errors += z80_test_run(cpu, &z80_test_cases[i]);
+    printf("%u cases: %s\n", (unsigned)Z80_TEST_CASES, errors ? "FAILED" : "OK");
+    errors += z80_test_sweep_alu(cpu);
+    errors += z80_test_sweep_unary(cpu);
+    errors += z80_test_sweep_acc(cpu);
+    errors += z80_test_sweep_cb(cpu);
+    errors += z80_test_sweep_add16(cpu);
+    free(cpu->memory);
+    ESP_ERROR_CHECK(cpu_done(cpu));
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * This file is part of the esp32-orion128 distribution
+ * (https://gitlab.romanchenko.su/esp/esp32/esp32-orion128.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "cpu.h"
+
+// Runs CP/M .COM programs on the Z80 core with a flat 64K memory and
+// the two BDOS console calls the instruction exercisers need:
+//   zex-runner zexdoc.com
+//   zex-runner zexall.com
+// The program starts at 0x0100, a jump to 0x0000 ends the run. The exit
+// status is 1 when the program printed ERROR, as the exercisers do on a
+// CRC mismatch.
+
+#define ZEX_TPA 0x0100
+#define ZEX_BDOS 0x0005
+// BDOS entry for the programs that take the stack top from 0x0006
+#define ZEX_BDOS_TOP 0xfe00
+#define ZEX_ERROR "ERROR"
+
+typedef struct zex_runner {
+    uint8_t ram[0x10000];
+    uint64_t steps;
+    // characters of ZEX_ERROR matched so far
+    size_t error_match;
+    uint32_t errors;
+} zex_runner_t;
+
+static const char __attribute__((unused)) *TAG = "zex-runner";
+
+static const uint8_t *zex_runner_reader(uint16_t addr, void *arg)
+{
+    return &((zex_runner_t *)arg)->ram[addr];
+}
+
+static uint8_t *zex_runner_writer(uint16_t addr, void *arg)
+{
+    return &((zex_runner_t *)arg)->ram[addr];
+}
+
+static void zex_runner_putchar(zex_runner_t *zex, char c)
+{
+    putchar(c);
+    if (c == ZEX_ERROR[zex->error_match]) {
+        if (!ZEX_ERROR[++zex->error_match]) {
+            ++zex->errors;
+            zex->error_match = 0;
+        }
+    }
+    else
+        zex->error_match = c == ZEX_ERROR[0] ? 1 : 0;
+}
+
+// C = 2: print E, C = 9: print the string at DE up to '$'
+static void zex_runner_bdos(zex_runner_t *zex, cpu_t *cpu)
+{
+    switch (cpu->reg_file[CPU_FILE_C]) {
+        case 2:
+            zex_runner_putchar(zex, cpu->reg_file[CPU_FILE_E]);
+            break;
+        case 9:
+            for (uint16_t addr = CPU_DE_VAL(cpu); zex->ram[addr] != '$'; ++addr)
+                zex_runner_putchar(zex, zex->ram[addr]);
+            break;
+        default:
+            ESP_LOGW(TAG, "BDOS function %d is not supported", cpu->reg_file[CPU_FILE_C]);
+            break;
+    }
+    fflush(stdout);
+    cpu->pc = zex->ram[cpu->sp] | (zex->ram[(uint16_t)(cpu->sp + 1)] << 8);
+    cpu->sp += 2;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s file.com\n", argv[0]);
+        return 1;
+    }
+    zex_runner_t *zex = (zex_runner_t *)calloc(1, sizeof(zex_runner_t));
+    ESP_ERROR_CHECK(zex ? ESP_OK : ESP_ERR_NO_MEM);
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) {
+        ESP_LOGE(TAG, "can't open %s", argv[1]);
+        return 1;
+    }
+    size_t size = fread(&zex->ram[ZEX_TPA], 1, ZEX_BDOS_TOP - ZEX_TPA, f);
+    fclose(f);
+    ESP_LOGI(TAG, "loaded %u bytes", (unsigned)size);
+
+    // JP to the BDOS, the call itself is handled on the host
+    zex->ram[ZEX_BDOS] = 0xc3;
+    zex->ram[ZEX_BDOS + 1] = ZEX_BDOS_TOP & 0xff;
+    zex->ram[ZEX_BDOS + 2] = ZEX_BDOS_TOP >> 8;
+    zex->ram[ZEX_BDOS_TOP] = 0xc9;
+
+    cpu_t *cpu;
+    ESP_ERROR_CHECK(cpu_create(&cpu));
+    cpu->type = CPU_TYPE_Z80;
+    cpu->reader = zex_runner_reader;
+    cpu->writer = zex_runner_writer;
+    cpu->memory = zex;
+    ESP_ERROR_CHECK(cpu_init(cpu));
+    cpu->pc = ZEX_TPA;
+    cpu->sp = ZEX_BDOS_TOP;
+
+    int64_t start = esp_timer_get_time();
+    while (cpu->pc != 0) {
+        if (cpu->pc == ZEX_BDOS)
+            zex_runner_bdos(zex, cpu);
+        ESP_ERROR_CHECK(cpu_step(cpu));
+        ++zex->steps;
+    }
+    double seconds = (esp_timer_get_time() - start) / 1e6;
+
+    printf("\n");
+    printf("host time:      %.3f s\n", seconds);
+    printf("cycles:         %llu, %.2f MHz\n", (unsigned long long)cpu->cycles, cpu->cycles / seconds / 1e6);
+    printf("instructions:   %llu, %.0f per second\n", (unsigned long long)zex->steps, zex->steps / seconds);
+    printf("errors:         %u\n", zex->errors);
+    int status = zex->errors ? 1 : 0;
+
+    ESP_ERROR_CHECK(cpu_done(cpu));
+    free(zex);
+    return status;
+}
@@ -18,7 +18,16 @@
 #include "sdkconfig.h"
 
 #include <string.h>
+#include <strings.h>
+#include <dirent.h>
 #include "esp_log.h"
+#include "esp_spiffs.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+#include "nvs_flash.h"
 #include "app.h"
 #include "parbus.h"
 #if defined(CONFIG_DISPLAY_TYPE_ILI9486)
@@ -30,20 +39,28 @@
 #endif
 #include "computer.h"
 #include "console.h"
+#include "roms.h"
 
 
-static const uint8_t app_ram[] asm("_binary_ramdisk1_rom_start");
-static const uint8_t app_ram_end[] asm("_binary_ramdisk1_rom_end");
-
-static const uint8_t app_rom[] asm("_binary_monitor2_rom_start");
-//static const uint8_t app_rom[] asm("_binary_ram_test_rom_start");
-static const uint8_t app_or_dos_rom[]  asm("_binary_romdisk2_rom_start");
-
 static const uint8_t app_font8x8[] asm("_binary_font8x8_fnt_start");
 //static const uint8_t app_xlat8x8[] asm("_binary_xlat8x8_bin_start");
 
 static const char __attribute__((unused)) *TAG = "app";
 
+#define APP_STORAGE_PATH "/spiffs"
+#define APP_STORAGE_PARTITION "storage"
+
+// boot menu items
+#define APP_MENU_MONITOR  0
+#define APP_MENU_ROM_DISK 1
+#define APP_MENU_RAM_DISK 2
+#define APP_MENU_START    3
+#define APP_MENU_REBOOT   4
+#define APP_MENU_ITEMS    5
+#define APP_MENU_LEFT     20
+#define APP_MENU_TOP      17
+#define APP_MENU_POLL_MS  20
+
 
 esp_err_t app_create(app_t **papp)
 {
@@ -107,6 +124,7 @@ static void app_display_init(app_t *app)
         flip_horizontally: true
     };
     ESP_ERROR_CHECK(app->lcd->init(app->lcd, &init));
+    ESP_ERROR_CHECK(display_palette_lut_init(app->lcd));
 }
 
 static void app_console_init(app_t *app)
@@ -127,20 +145,179 @@ static void app_console_init(app_t *app)
     ESP_ERROR_CHECK(console_init(cout, screen));
 }
 
-static void app_computer_init(app_t *app)
+static void app_storage_init(app_t *app)
+{
+    esp_vfs_spiffs_conf_t conf = {
+        base_path: APP_STORAGE_PATH,
+        partition_label: APP_STORAGE_PARTITION,
+        max_files: 4,
+        format_if_mount_failed: true
+    };
+    esp_err_t r = esp_vfs_spiffs_register(&conf);
+    if (r != ESP_OK)
+        ESP_LOGW(TAG, "storage is not available: %s", esp_err_to_name(r));
+    app->is_storage = (r == ESP_OK);
+}
+
+// .ord files in the storage replace the RAM disk files with the same name
+static void app_ram_disk_import(app_t *app)
 {
-    size_t size = app_ram_end - app_ram + 1;
-    if (size > MEMORY_RAM_PAGE1_SIZE)
-        size = MEMORY_RAM_PAGE1_SIZE;
+    DIR *dir = opendir(APP_STORAGE_PATH);
+    if (!dir)
+        return;
+    struct dirent *entry;
+    char path[300];
+    while ((entry = readdir(dir)) != NULL) {
+        const char *ext = strrchr(entry->d_name, '.');
+        if (!ext || strcasecmp(ext, ".ord"))
+            continue;
+        snprintf(path, sizeof(path), APP_STORAGE_PATH "/%s", entry->d_name);
+        FILE *f = fopen(path, "rb");
+        if (!f)
+            continue;
+        esp_err_t r = ordos_import(app->computer->mem->ram_disk, f, NULL);
+        if (r != ESP_OK)
+            ESP_LOGW(TAG, "can't import %s: %s", path, esp_err_to_name(r));
+        fclose(f);
+    }
+    closedir(dir);
+}
+
+// The ROM disk images of the flash partition come first, then the embedded ones.
+static size_t app_rom_disk_count(app_t *app)
+{
+    return app->computer->mem->rom_disk->dir_count + roms_count(ROMS_ROM_DISK);
+}
 
+static const char *app_rom_disk_name(app_t *app, size_t index)
+{
+    romdisk_t *rom_disk = app->computer->mem->rom_disk;
+    if (index < rom_disk->dir_count)
+        return romdisk_get_name(rom_disk, index);
+    return roms_get(ROMS_ROM_DISK, index - rom_disk->dir_count)->name;
+}
+
+static void app_select_roms(app_t *app)
+{
+    memory_t *mem = app->computer->mem;
+    mem->rom = roms_get(ROMS_MONITOR, app->monitor)->data;
+    if (app->rom_disk < mem->rom_disk->dir_count)
+        ESP_ERROR_CHECK(romdisk_select(mem->rom_disk, app->rom_disk));
+    else {
+        const roms_image_t *image = roms_get(ROMS_ROM_DISK, app->rom_disk - mem->rom_disk->dir_count);
+        ESP_ERROR_CHECK(romdisk_set_image(mem->rom_disk, image->data, roms_size(image)));
+    }
+}
+
+// the last RAM disk choice is an empty disk
+static void app_select_ram_disk(app_t *app)
+{
+    ordos_t *ram_disk = app->computer->mem->ram_disk;
+    const roms_image_t *image = roms_get(ROMS_RAM_DISK, app->ram_disk);
+    // ORDOS reads the disk only when it selects page 1
+    if (image)
+        ESP_ERROR_CHECK(ordos_mount(ram_disk, image->data, roms_size(image)));
+    else
+        ESP_ERROR_CHECK(ordos_format(ram_disk));
+}
+
+static void app_computer_init(app_t *app)
+{
     computer_t *computer = app->computer;
     computer->display = app->lcd;
     memory_t *mem = computer->mem;
-    memcpy(mem->ram_page1, app_ram, size);
-    mem->rom = app_rom;
-    mem->rom_disk = app_or_dos_rom;
+    // the ROM disk images are streamed from the flash partition when it is
+    // flashed, the embedded image is used otherwise
+    app->monitor = roms_find(ROMS_MONITOR, "monitor2");
+    if (romdisk_open_partition(mem->rom_disk, CONFIG_ORION_ROMDISK_PARTITION) == ESP_OK)
+        app->rom_disk = 0;
+    else
+        app->rom_disk = mem->rom_disk->dir_count + roms_find(ROMS_ROM_DISK, "romdisk2");
+    app->ram_disk = roms_find(ROMS_RAM_DISK, "ramdisk1");
+    app_select_roms(app);
+    app_select_ram_disk(app);
 
     computer_init(computer);
+    if (app->is_storage)
+        app_ram_disk_import(app);
+}
+
+
+static void app_wifi_event(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+    if (base == WIFI_EVENT && (id == WIFI_EVENT_STA_START || id == WIFI_EVENT_STA_DISCONNECTED))
+        esp_wifi_connect();
+    else if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP) {
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *)data;
+        ESP_LOGI(TAG, "server: http://" IPSTR ":%d/", IP2STR(&event->ip_info.ip), CONFIG_SERVER_PORT);
+    }
+}
+
+static bool app_network_init(app_t *app)
+{
+    if (!CONFIG_WIFI_SSID[0])
+        return false;
+    esp_err_t r = nvs_flash_init();
+    if (r == ESP_ERR_NVS_NO_FREE_PAGES || r == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        r = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(r);
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    esp_netif_create_default_wifi_sta();
+
+    wifi_init_config_t init = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&init));
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, app_wifi_event, app));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, app_wifi_event, app));
+
+    wifi_config_t config = {
+        sta: {
+            ssid: CONFIG_WIFI_SSID,
+            password: CONFIG_WIFI_PASSWORD
+        }
+    };
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &config));
+    ESP_ERROR_CHECK(esp_wifi_start());
+    return true;
+}
+
+// The partition is erased under the upload, the emulator takes the
+// embedded image until the boot menu reads the new directory
+static esp_err_t app_rom_disk_upload(void *arg, size_t size, server_hook_stage_t stage)
+{
+    app_t *app = (app_t *)arg;
+    computer_t *computer = app->computer;
+    romdisk_t *disk = computer->mem->rom_disk;
+    if (stage == SERVER_HOOK_BEGIN && !disk->data) {
+        const roms_image_t *image = roms_get(ROMS_ROM_DISK, roms_find(ROMS_ROM_DISK, "romdisk2"));
+        ESP_ERROR_CHECK(computer_pause(computer));
+        ESP_ERROR_CHECK(romdisk_set_image(disk, image->data, roms_size(image)));
+        ESP_ERROR_CHECK(computer_resume(computer));
+    }
+    app->is_rom_disk_changed = true;
+    return ESP_OK;
+}
+
+static void app_server_init(app_t *app)
+{
+    ESP_ERROR_CHECK(server_create(&app->server));
+    server_t *srv = app->server;
+    ESP_ERROR_CHECK(server_add_computer(srv, app->computer));
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+        ROMDISK_PARTITION_SUBTYPE, CONFIG_ORION_ROMDISK_PARTITION);
+    if (part)
+        ESP_ERROR_CHECK(server_add_partition(srv, "romdisk", part, app_rom_disk_upload, app));
+    if (app->is_storage) {
+        ESP_ERROR_CHECK(server_add_file(srv, "snapshot", CONFIG_SNAPSHOT_FILE));
+#ifdef CONFIG_ORION_TAPE
+        ESP_ERROR_CHECK(server_add_file(srv, "tape", CONFIG_TAPE_FILE));
+#endif
+        ESP_ERROR_CHECK(server_add_directory(srv, "files", APP_STORAGE_PATH));
+    }
+    ESP_ERROR_CHECK(server_start(srv, CONFIG_SERVER_PORT));
 }
 
 
@@ -152,7 +329,10 @@ esp_err_t app_init(app_t *app)
     app_bus_init(app);
     app_display_init(app);
     app_console_init(app);
+    app_storage_init(app);
     app_computer_init(app);
+    if (app_network_init(app))
+        app_server_init(app);
 
     return r;
 
@@ -162,6 +342,14 @@ esp_err_t app_done(app_t *app)
 {
     ESP_ERROR_CHECK(app ? ESP_OK : ESP_ERR_INVALID_ARG);
 
+    if (app->server)
+        ESP_ERROR_CHECK(server_done(app->server));
+#ifdef CONFIG_ORION_GDB_STUB
+    if (app->gdb)
+        ESP_ERROR_CHECK(gdb_done(app->gdb));
+#endif
+    if (app->is_storage)
+        ESP_ERROR_CHECK(esp_vfs_spiffs_unregister(APP_STORAGE_PARTITION));
     ESP_ERROR_CHECK(console_done(app->cout));
     ESP_ERROR_CHECK(screen_done(app->screen));
     ESP_ERROR_CHECK(font_done(app->font));
@@ -195,8 +383,336 @@ static screen_symbol_t __attribute__((unused)) draw_window_border(screen_t *scr,
     else return back;
 }
 
+static void app_snapshot(app_t *app, uint8_t command)
+{
+    if (!app->is_storage) {
+        ESP_LOGW(TAG, "no storage for snapshot");
+        return;
+    }
+    bool is_save = (command == KEYBOARD_COMMAND_SAVE);
+    FILE *f = fopen(CONFIG_SNAPSHOT_FILE, is_save ? "wb" : "rb");
+    if (!f) {
+        ESP_LOGW(TAG, "can't open %s", CONFIG_SNAPSHOT_FILE);
+        return;
+    }
+    esp_err_t r = is_save ? computer_save(app->computer, f) : computer_load(app->computer, f);
+    if (r != ESP_OK)
+        ESP_LOGW(TAG, "snapshot %s failed: %s", is_save ? "save" : "load", esp_err_to_name(r));
+    fclose(f);
+}
+
+#ifdef CONFIG_ORION_TAPE
+#ifdef CONFIG_ORION_TAPE_FAST
+#define APP_TAPE_FAST true
+#else
+#define APP_TAPE_FAST false
+#endif
+
+static void app_tape_file(app_t *app, bool is_save)
+{
+    tape_t *tape = app->computer->tape;
+    const char *path = is_save ? CONFIG_TAPE_RECORD_FILE : CONFIG_TAPE_FILE;
+    FILE *f = fopen(path, is_save ? "wb" : "rb");
+    if (!f) {
+        ESP_LOGW(TAG, "can't open %s", path);
+        return;
+    }
+    esp_err_t r;
+    if (is_save)
+        r = tape_save(tape, f);
+    else {
+        const char *ext = strrchr(path, '.');
+        r = tape_load(tape, f, ext && !strcasecmp(ext, ".ord"));
+        if (r == ESP_OK)
+            r = tape_play(tape, APP_TAPE_FAST, app->computer->cpu->cycles);
+    }
+    if (r != ESP_OK)
+        ESP_LOGW(TAG, "tape %s failed: %s", is_save ? "save" : "load", esp_err_to_name(r));
+    fclose(f);
+}
+
+// Insert plays the tape, Delete records it, any of them stops the tape,
+// the record is written when it stops
+static void app_tape(app_t *app, uint8_t command)
+{
+    if (!app->is_storage) {
+        ESP_LOGW(TAG, "no storage for tape");
+        return;
+    }
+    tape_t *tape = app->computer->tape;
+    tape_state_t state = tape->state;
+    ESP_ERROR_CHECK(tape_stop(tape));
+    if (state == TAPE_RECORDING)
+        app_tape_file(app, true);
+    else if (state == TAPE_STOPPED) {
+        if (command == KEYBOARD_COMMAND_TAPE_RECORD)
+            ESP_ERROR_CHECK(tape_record(tape, APP_TAPE_FAST));
+        else
+            app_tape_file(app, false);
+    }
+}
+#endif
+
+#ifdef CONFIG_ORION_INPUT_REPLAY
+// F7 records the keys, F8 replays them, any of them stops
+static void app_input(app_t *app, uint8_t command)
+{
+    keyboard_t *kbd = app->computer->kbd;
+    if (app->input_file) {
+        ESP_LOGI(TAG, "keys %s: %u", kbd->record ? "recorded" : "replayed", kbd->input_keys);
+        if (keyboard_input_stop(kbd) != ESP_OK)
+            ESP_LOGW(TAG, "can't write %s", CONFIG_INPUT_FILE);
+        fclose(app->input_file);
+        app->input_file = NULL;
+        return;
+    }
+    if (!app->is_storage) {
+        ESP_LOGW(TAG, "no storage for keys");
+        return;
+    }
+    bool is_record = (command == KEYBOARD_COMMAND_INPUT_RECORD);
+    app->input_file = fopen(CONFIG_INPUT_FILE, is_record ? "w" : "r");
+    if (!app->input_file) {
+        ESP_LOGW(TAG, "can't open %s", CONFIG_INPUT_FILE);
+        return;
+    }
+    uint64_t cycles = app->computer->cpu->cycles;
+    esp_err_t r = is_record ? keyboard_record(kbd, app->input_file, cycles) : keyboard_replay(kbd, app->input_file, cycles);
+    if (r != ESP_OK) {
+        ESP_LOGW(TAG, "keys %s failed: %s", is_record ? "record" : "replay", esp_err_to_name(r));
+        fclose(app->input_file);
+        app->input_file = NULL;
+    }
+}
+#endif
+
+#ifdef CONFIG_ORION_VIDEO_RECORDER
+// F9 starts and stops recording the screen
+static void app_video_record(app_t *app)
+{
+    recorder_t *rec = app->computer->recorder;
+    if (rec->is_recording) {
+        ESP_ERROR_CHECK(recorder_stop(rec));
+        fclose(app->video_file);
+        app->video_file = NULL;
+        return;
+    }
+    if (!app->is_storage) {
+        ESP_LOGW(TAG, "no storage for video");
+        return;
+    }
+    app->video_file = fopen(CONFIG_VIDEO_RECORD_FILE, "wb");
+    if (!app->video_file) {
+        ESP_LOGW(TAG, "can't open %s", CONFIG_VIDEO_RECORD_FILE);
+        return;
+    }
+    esp_err_t r = recorder_start(rec, app->video_file, app->computer->cpu->cycles);
+    if (r != ESP_OK) {
+        ESP_LOGW(TAG, "video record failed: %s", esp_err_to_name(r));
+        fclose(app->video_file);
+        app->video_file = NULL;
+    }
+}
+#endif
+
+#ifdef CONFIG_ORION_DEBUGGER
+#ifdef CONFIG_ORION_GDB_STUB
+// the serial console bytes come through the raw key ring
+static int app_gdb_read(void *arg)
+{
+    keyboard_t *kbd = (keyboard_t *)arg;
+    uint8_t ch;
+    if (ring_pop(kbd->ring, &ch, 1))
+        return ch;
+    return kbd->task ? GDB_READ_NONE : GDB_READ_CLOSED;
+}
+
+static esp_err_t app_gdb_write(void *arg, const void *data, size_t size)
+{
+    fwrite(data, 1, size, stdout);
+    fflush(stdout);
+    return ESP_OK;
+}
+
+// "gdb" in the debugger console: GDB owns the serial console until it
+// detaches. The machine is paused while stopped, running it is only
+// polled for Ctrl-C.
+static void app_gdb(app_t *app)
+{
+    computer_t *computer = app->computer;
+    debugger_t *dbg = computer->debugger;
+    keyboard_t *kbd = computer->kbd;
+    if (!app->gdb)
+        ESP_ERROR_CHECK(gdb_create(&app->gdb));
+    printf("quit the terminal and attach GDB to the serial port\n");
+    fflush(stdout);
+    ESP_ERROR_CHECK(keyboard_set_raw(kbd, true));
+    ESP_ERROR_CHECK(gdb_init(app->gdb, computer, app_gdb_read, app_gdb_write, kbd));
+    while (1) {
+        ESP_ERROR_CHECK(gdb_serve(app->gdb));
+        if (!app->gdb->is_attached)
+            break;
+        ESP_ERROR_CHECK(computer_resume(computer));
+        while (app->gdb->is_attached && dbg->stop == DEBUGGER_RUNNING) {
+            ESP_ERROR_CHECK(gdb_poll(app->gdb));
+            vTaskDelay(1);
+        }
+        ESP_ERROR_CHECK(computer_pause(computer));
+        if (!app->gdb->is_attached)
+            break;
+    }
+    ESP_ERROR_CHECK(keyboard_set_raw(kbd, false));
+}
+#endif
+
+// F5 or a breakpoint, the debugger reads the serial console until "c"
+static void app_debug(app_t *app)
+{
+    computer_t *computer = app->computer;
+    ESP_ERROR_CHECK(debugger_console(computer->debugger, computer, stdout));
+#ifdef CONFIG_ORION_GDB_STUB
+    if (computer->debugger->is_remote)
+        app_gdb(app);
+#endif
+}
+#endif
+
+static void app_menu_draw(app_t *app, size_t selected)
+{
+    static const char *labels[] = { "Monitor", "ROM disk", "RAM disk" };
+    size_t ram_disks = roms_count(ROMS_RAM_DISK);
+    const char *values[] = {
+        roms_get(ROMS_MONITOR, app->monitor)->name,
+        app_rom_disk_name(app, app->rom_disk),
+        app->ram_disk < ram_disks ? roms_get(ROMS_RAM_DISK, app->ram_disk)->name : "empty"
+    };
+    char line[48];
+    for (size_t i = 0; i < APP_MENU_ITEMS; ++i) {
+        // ESC Y x y moves the cursor, ESC Z back front sets the colours
+        int n = snprintf(line, sizeof(line), "\x1b\x59%c%c\x1b\x5a%s", 0x20 + APP_MENU_LEFT, 0x20 + APP_MENU_TOP + (int)i,
+            i == selected ? "\x2e\x21" : "\x21\x2e");
+        if (i < APP_MENU_START)
+            snprintf(line + n, sizeof(line) - n, " %-8s %-9.9s", labels[i], values[i]);
+        else
+            snprintf(line + n, sizeof(line) - n, " %-18s", i == APP_MENU_START ? "Start Orion 128" : "Reboot");
+        console_out_string(app->cout, line);
+    }
+}
+
+static void app_menu_change(app_t *app, size_t item, bool is_next)
+{
+    size_t *value;
+    size_t count;
+    switch (item) {
+        case APP_MENU_MONITOR:
+            value = &app->monitor;
+            count = roms_count(ROMS_MONITOR);
+            break;
+        case APP_MENU_ROM_DISK:
+            value = &app->rom_disk;
+            count = app_rom_disk_count(app);
+            break;
+        case APP_MENU_RAM_DISK:
+            value = &app->ram_disk;
+            count = roms_count(ROMS_RAM_DISK) + 1;
+            break;
+        default:
+            return;
+    }
+    *value = (*value + (is_next ? 1 : count - 1)) % count;
+}
+
+// The computer is paused, so the keys of the key ring are read here.
+// Returns true if the machine is to be started with the selected ROMs.
+static bool app_menu(app_t *app, uint32_t timeout_ms)
+{
+    screen_t *scr = app->screen;
+    screen_rect_t rw = {left: 18, top: 16, width: scr->width-1-36, height: scr->height-1-32};
+    keyboard_t *kbd = app->computer->kbd;
+    screen_draw_window(scr, &rw, draw_window_border);
+    size_t item = APP_MENU_START;
+    app_menu_draw(app, item);
+
+    uint32_t idle_ms = 0;
+    while (1) {
+        uint8_t key;
+        if (!ring_pop(kbd->ring, &key, 1)) {
+            vTaskDelay(pdMS_TO_TICKS(APP_MENU_POLL_MS));
+            idle_ms += APP_MENU_POLL_MS;
+            // the boot menu starts the machine unless a key is pressed
+            if (timeout_ms && idle_ms >= timeout_ms)
+                return true;
+            continue;
+        }
+        timeout_ms = 0;
+        switch (key) {
+            case KBD_KEY_UP:
+                item = (item + APP_MENU_ITEMS - 1) % APP_MENU_ITEMS;
+                break;
+            case KBD_KEY_DOWN:
+                item = (item + 1) % APP_MENU_ITEMS;
+                break;
+            case KBD_KEY_LEFT:
+            case KBD_KEY_RIGHT:
+                app_menu_change(app, item, key == KBD_KEY_RIGHT);
+                break;
+            case KBD_KEY_ENTER:
+                if (item == APP_MENU_REBOOT)
+                    esp_restart();
+                if (item == APP_MENU_START)
+                    return true;
+                break;
+            case KBD_KEY_ESC:
+                return false;
+        }
+        app_menu_draw(app, item);
+    }
+}
+
+// Picks the ROMs and resets the machine without a reboot, Esc keeps the
+// running machine as it is.
+static void app_boot_menu(app_t *app, uint32_t timeout_ms)
+{
+    computer_t *computer = app->computer;
+    // let the video task finish the pending updates, they would draw over the menu
+    while (ring_count(computer->video_ring))
+        vTaskDelay(1);
+    if (app->is_rom_disk_changed) {
+        app->is_rom_disk_changed = false;
+        romdisk_t *disk = computer->mem->rom_disk;
+        size_t count = disk->dir_count;
+        // the embedded images keep their place after the partition ones
+        if (romdisk_open_partition(disk, CONFIG_ORION_ROMDISK_PARTITION) != ESP_OK)
+            disk->dir_count = 0;
+        if (app->rom_disk < count)
+            app->rom_disk = 0;
+        else
+            app->rom_disk += disk->dir_count - count;
+        if (app->rom_disk >= app_rom_disk_count(app))
+            app->rom_disk = 0;
+        app_select_roms(app);
+    }
+    size_t monitor = app->monitor;
+    size_t rom_disk = app->rom_disk;
+    size_t ram_disk = app->ram_disk;
+    if (app_menu(app, timeout_ms)) {
+        int64_t start = esp_timer_get_time();
+        app_select_roms(app);
+        if (app->ram_disk != ram_disk)
+            app_select_ram_disk(app);
+        ESP_ERROR_CHECK(computer_reset(computer));
+        ESP_LOGI(TAG, "%s, %s: reset in %lld us", roms_get(ROMS_MONITOR, app->monitor)->name,
+            app_rom_disk_name(app, app->rom_disk), esp_timer_get_time() - start);
+    }
+    else {
+        app->monitor = monitor;
+        app->rom_disk = rom_disk;
+        app->ram_disk = ram_disk;
+    }
+    computer->mem->set_video_invalidate = true;
+}
+
 esp_err_t app_run(app_t *app) {
-    uint32_t count = 0;
 
     display_t *lcd = app->lcd;
     screen_t *scr = app->screen;
@@ -207,18 +723,63 @@ esp_err_t app_run(app_t *app) {
     screen_rect_t r = {left: 0, top: 0, width: scr->width, height: scr->height};
     screen_draw_window(scr, &r, draw_background);
 
-    screen_rect_t rw = {left: 18, top: 16, width: scr->width-1-36, height: scr->height-1-32};
-    screen_draw_window(scr, &rw, draw_window_border);
-
-    console_t *cout = app->cout;
-    console_out_string(cout, "\x1b\x59\x34\x32\x1b\x5a\x21\x2e Start Web server  ");
-    console_out_string(cout, "\x1b\x59\x34\x33\x1b\x5a\x2e\x21 Start Orion 128   ");
-    console_out_string(cout, "\x1b\x59\x34\x34\x1b\x5a\x21\x2e Start Radio 86 RK ");
-    console_out_string(cout, "\x1b\x59\x34\x35\x1b\x5a\x21\x2e Reboot            ");
-
+    computer_t *computer = app->computer;
+    keyboard_t *kbd = computer->kbd;
+    if (CONFIG_BOOT_MENU_TIMEOUT)
+        app_boot_menu(app, CONFIG_BOOT_MENU_TIMEOUT);
+    kbd->command = KEYBOARD_COMMAND_NONE;
+    ESP_ERROR_CHECK(computer_start(computer));
     while (1) {
-        computer_step(app->computer);
-        ++count;
+#ifdef CONFIG_ORION_DEBUGGER
+        // the emulation task stopped at a breakpoint or a watchpoint
+        if (computer->debugger->stop != DEBUGGER_RUNNING && !kbd->command)
+            kbd->command = KEYBOARD_COMMAND_DEBUG;
+#endif
+        if (kbd->command) {
+#ifdef CONFIG_ORION_PERF_COUNTERS
+            // the counters are printed while the machine runs
+            if (kbd->command == KEYBOARD_COMMAND_PERF) {
+                ESP_ERROR_CHECK(perf_print(computer->perf, stdout));
+                kbd->command = KEYBOARD_COMMAND_NONE;
+                continue;
+            }
+#endif
+            ESP_ERROR_CHECK(computer_pause(computer));
+            switch (kbd->command) {
+                case KEYBOARD_COMMAND_SAVE:
+                case KEYBOARD_COMMAND_LOAD:
+                    app_snapshot(app, kbd->command);
+                    break;
+#ifdef CONFIG_ORION_TAPE
+                case KEYBOARD_COMMAND_TAPE_PLAY:
+                case KEYBOARD_COMMAND_TAPE_RECORD:
+                    app_tape(app, kbd->command);
+                    break;
+#endif
+                case KEYBOARD_COMMAND_MENU:
+                    app_boot_menu(app, 0);
+                    break;
+#ifdef CONFIG_ORION_INPUT_REPLAY
+                case KEYBOARD_COMMAND_INPUT_RECORD:
+                case KEYBOARD_COMMAND_INPUT_REPLAY:
+                    app_input(app, kbd->command);
+                    break;
+#endif
+#ifdef CONFIG_ORION_VIDEO_RECORDER
+                case KEYBOARD_COMMAND_VIDEO_RECORD:
+                    app_video_record(app);
+                    break;
+#endif
+#ifdef CONFIG_ORION_DEBUGGER
+                case KEYBOARD_COMMAND_DEBUG:
+                    app_debug(app);
+                    break;
+#endif
+            }
+            kbd->command = KEYBOARD_COMMAND_NONE;
+            ESP_ERROR_CHECK(computer_resume(computer));
+        }
+        vTaskDelay(pdMS_TO_TICKS(100));
     }
     return ESP_OK;
 }
@@ -27,6 +27,10 @@
 #include "console.h"
 #include "font.h"
 #include "computer.h"
+#include "server.h"
+#ifdef CONFIG_ORION_GDB_STUB
+#include "gdb.h"
+#endif
 
 typedef struct app {
     bus_t *bus;
@@ -35,6 +39,24 @@ typedef struct app {
     font_t *font;
     console_t *cout;
     computer_t *computer;
+    bool is_storage;
+#ifdef CONFIG_ORION_INPUT_REPLAY
+    FILE *input_file;
+#endif
+#ifdef CONFIG_ORION_VIDEO_RECORDER
+    FILE *video_file;
+#endif
+    server_t *server;
+#ifdef CONFIG_ORION_GDB_STUB
+    // created by the first "gdb" of the debugger console
+    gdb_t *gdb;
+#endif
+    // the ROM disk partition was uploaded, the boot menu reopens it
+    volatile bool is_rom_disk_changed;
+    // selected ROMs, see roms.h
+    size_t monitor;
+    size_t rom_disk;
+    size_t ram_disk;
 } app_t;
 
 esp_err_t app_create(app_t **papp);
@@ -0,0 +1,75 @@
+/*
+ * This file is part of the esp32-orion128 distribution
+ * (https://gitlab.romanchenko.su/esp/esp32/esp32-orion128.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+
+#include "roms.h"
+
+#define ROMS_IMAGE(name) \
+    extern const uint8_t roms_##name##_start[] asm("_binary_" #name "_rom_start"); \
+    extern const uint8_t roms_##name##_end[] asm("_binary_" #name "_rom_end");
+#define ROMS_ENTRY(type, name) { #name, type, roms_##name##_start, roms_##name##_end }
+
+ROMS_IMAGE(monitor1)
+ROMS_IMAGE(monitor2)
+ROMS_IMAGE(monitor3)
+ROMS_IMAGE(ram_test)
+ROMS_IMAGE(romdisk1)
+ROMS_IMAGE(romdisk2)
+ROMS_IMAGE(ramdisk1)
+
+static const roms_image_t roms_images[] = {
+    ROMS_ENTRY(ROMS_MONITOR, monitor1),
+    ROMS_ENTRY(ROMS_MONITOR, monitor2),
+    ROMS_ENTRY(ROMS_MONITOR, monitor3),
+    ROMS_ENTRY(ROMS_MONITOR, ram_test),
+    ROMS_ENTRY(ROMS_ROM_DISK, romdisk1),
+    ROMS_ENTRY(ROMS_ROM_DISK, romdisk2),
+    ROMS_ENTRY(ROMS_RAM_DISK, ramdisk1),
+};
+
+#define ROMS_IMAGES (sizeof(roms_images) / sizeof(roms_images[0]))
+
+size_t roms_count(roms_type_t type)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < ROMS_IMAGES; ++i)
+        if (roms_images[i].type == type)
+            ++count;
+    return count;
+}
+
+const roms_image_t *roms_get(roms_type_t type, size_t index)
+{
+    for (size_t i = 0; i < ROMS_IMAGES; ++i)
+        if (roms_images[i].type == type && !index--)
+            return &roms_images[i];
+    return NULL;
+}
+
+size_t roms_find(roms_type_t type, const char *name)
+{
+    size_t index = 0;
+    for (size_t i = 0; i < ROMS_IMAGES; ++i) {
+        if (roms_images[i].type != type)
+            continue;
+        if (!strcmp(roms_images[i].name, name))
+            break;
+        ++index;
+    }
+    return index;
+}
@@ -0,0 +1,51 @@
+/*
+ * This file is part of the esp32-orion128 distribution
+ * (https://gitlab.romanchenko.su/esp/esp32/esp32-orion128.git).
+ * Copyright (c) 2022 Dmitry Romanchenko.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __ROMS_H__
+#define __ROMS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+
+typedef enum {
+    ROMS_MONITOR = 0,
+    ROMS_ROM_DISK,
+    ROMS_RAM_DISK,
+    ROMS_TYPES
+} roms_type_t;
+
+// ROM images embedded into the firmware, see components/core/component.mk
+typedef struct roms_image {
+    const char *name;
+    roms_type_t type;
+    const uint8_t *data;
+    const uint8_t *data_end;
+} roms_image_t;
+
+static inline size_t roms_size(const roms_image_t *image)
+{
+    return image->data_end - image->data;
+}
+
+size_t roms_count(roms_type_t type);
+const roms_image_t *roms_get(roms_type_t type, size_t index);
+// index of the image with the name, roms_count(type) if there is no such image
+size_t roms_find(roms_type_t type, const char *name);
+
+#endif // __ROMS_H__